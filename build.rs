@@ -36,6 +36,8 @@ fn main() {
         println!("cargo:rustc-link-lib=dylib=placebo");
         println!("cargo:rustc-link-lib=dylib=avformat");
         println!("cargo:rustc-link-lib=dylib=MoltenVk");
+        println!("cargo:rustc-link-lib=framework=CoreVideo");
+        println!("cargo:rustc-link-lib=framework=IOSurface");
         let bindings = bindgen::Builder::default()
             // The input header we would like to generate
             // bindings for.
@@ -1,12 +1,18 @@
 use std::{
+    borrow::Cow,
     collections::HashMap,
     error::Error,
-    path::Path,
-    sync::{Arc, Mutex},
+    fs,
+    hash::{Hash, Hasher},
+    path::{Path, PathBuf},
+    sync::{Arc, Mutex, OnceLock},
 };
 
 use anyhow::{bail, Result};
-use wasmtime::{Caller, Config, Engine, Extern, Instance, Linker, Module, Store, TypedFunc};
+use wasmtime::{
+    CacheStore, Caller, Config, Engine, Extern, Instance, InstancePre, Linker, Module, OptLevel,
+    Store, TypedFunc,
+};
 use wasmtime_wasi::WasiCtxBuilder;
 use wasmtime_wasi::{
     p1::{self, WasiP1Ctx},
@@ -16,26 +22,454 @@ use wasmtime_wasi::{
 use crate::{
     gfxinfo::{Asset, GfxEvent, GfxInfo},
     gfxruntime,
-    renderspec::RenderCalcErr,
+    renderspec::{MidiBinding, RenderCalcErr},
+    trace,
+    wirecodec::{WireDecoder, WireEncoder},
 };
 use crate::{gfxruntime::GfxData, renderspec::RenderSpec};
 
+// Compiled modules kept in memory, enough to flip between a few versions
+const MODULE_MEMORY_CACHE: usize = 4;
+
+// Bytes of compiled functions kept for incremental compilation, functions
+// not used by a recent compile go first once it's over
+const FUNCTION_CACHE_BYTES: usize = 256 << 20;
+
+/// Where the `send_specs` host call leaves what it decoded out of guest memory
+#[derive(Default)]
+struct SpecInbox {
+    decoder: WireDecoder,
+    specs: Vec<RenderSpec>,
+    error: Option<String>,
+}
+
+/// Per instance state the host calls reach through their `Caller`, so one
+/// linker serves every module that is loaded
+struct HostState {
+    wasi: WasiP1Ctx,
+    buf_ref: Arc<Mutex<Vec<u8>>>,
+    settings_ref: Arc<Mutex<Vec<u8>>>,
+    gfx_info_ref: Arc<Mutex<Vec<u8>>>,
+    reg_events_ref: Arc<Mutex<Vec<u8>>>,
+    spec_inbox_ref: Arc<Mutex<SpecInbox>>,
+    midi_bindings_ref: Arc<Mutex<Option<Vec<MidiBinding>>>>,
+}
+
+/// How the shared engine compiles modules
+#[derive(Clone, Debug)]
+pub struct WasmOptions {
+    pub opt_level: OptLevel,
+    pub parallel_compilation: bool,
+    /// Serialized modules are kept here between runs, memory only when None
+    pub cache_dir: Option<PathBuf>,
+}
+
+impl Default for WasmOptions {
+    fn default() -> Self {
+        Self {
+            opt_level: OptLevel::Speed,
+            parallel_compilation: true,
+            cache_dir: None,
+        }
+    }
+}
+
+impl WasmOptions {
+    /// Set the optimization from its command line name
+    pub fn opt_level_named(mut self, name: &str) -> Result<Self> {
+        self.opt_level = match name {
+            "none" => OptLevel::None,
+            "speed" => OptLevel::Speed,
+            "speed_and_size" => OptLevel::SpeedAndSize,
+            _ => bail!("Unknown wasm opt level {}", name),
+        };
+        Ok(self)
+    }
+}
+
+// Cranelift output per function, a reload only recompiles what changed
+#[derive(Debug, Default)]
+struct FunctionCache(Mutex<FunctionCacheEntries>);
+
+#[derive(Debug, Default)]
+struct FunctionCacheEntries {
+    // compiled function and the use it was last asked for on
+    entries: HashMap<Vec<u8>, (Vec<u8>, u64)>,
+    bytes: usize,
+    uses: u64,
+}
+
+impl FunctionCacheEntries {
+    // Drop least recently used functions until under FUNCTION_CACHE_BYTES
+    fn evict(&mut self) {
+        if self.bytes <= FUNCTION_CACHE_BYTES {
+            return;
+        }
+        let mut by_use = self
+            .entries
+            .iter()
+            .map(|(key, (value, used))| (*used, key.len() + value.len(), key.clone()))
+            .collect::<Vec<_>>();
+        by_use.sort();
+        for (_, bytes, key) in by_use {
+            if self.bytes <= FUNCTION_CACHE_BYTES {
+                break;
+            }
+            self.entries.remove(&key);
+            self.bytes -= bytes;
+        }
+    }
+}
+
+impl CacheStore for FunctionCache {
+    fn get(&self, key: &[u8]) -> Option<Cow<'_, [u8]>> {
+        let mut lock = self.0.lock().ok()?;
+        lock.uses += 1;
+        let uses = lock.uses;
+        let (value, used) = lock.entries.get_mut(key)?;
+        *used = uses;
+        Some(Cow::Owned(value.clone()))
+    }
+
+    fn insert(&self, key: &[u8], value: Vec<u8>) -> bool {
+        match self.0.lock() {
+            Ok(mut lock) => {
+                lock.uses += 1;
+                let uses = lock.uses;
+                lock.bytes += key.len() + value.len();
+                if let Some((old, _)) = lock.entries.insert(key.to_vec(), (value, uses)) {
+                    lock.bytes -= key.len() + old.len();
+                }
+                lock.evict();
+                true
+            }
+            Err(_) => false,
+        }
+    }
+}
+
+// FNV-1a, stable across builds unlike DefaultHasher, so the disk cache still
+// matches after hosts are rebuilt
+struct Fnv1a(u64);
+
+impl Default for Fnv1a {
+    fn default() -> Self {
+        Self(0xcbf29ce484222325)
+    }
+}
+
+impl Hasher for Fnv1a {
+    fn write(&mut self, bytes: &[u8]) {
+        for b in bytes {
+            self.0 ^= *b as u64;
+            self.0 = self.0.wrapping_mul(0x100000001b3);
+        }
+    }
+
+    fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+struct SharedEngine {
+    engine: Engine,
+    linker: Linker<HostState>,
+    cache_dir: Option<PathBuf>,
+    // most recently used last
+    modules: Mutex<Vec<(u64, InstancePre<HostState>)>>,
+}
+
+static SHARED_ENGINE: OnceLock<SharedEngine> = OnceLock::new();
+
+impl SharedEngine {
+    fn new(options: &WasmOptions) -> Result<Self> {
+        let mut config = Config::new();
+        config.cranelift_opt_level(options.opt_level.clone());
+        config.parallel_compilation(options.parallel_compilation);
+        config.enable_incremental_compilation(Arc::new(FunctionCache::default()))?;
+        let engine = Engine::new(&config)?;
+        let linker = host_linker(&engine)?;
+        if let Some(dir) = options.cache_dir.as_ref() {
+            fs::create_dir_all(dir)?;
+        }
+        Ok(Self {
+            engine,
+            linker,
+            cache_dir: options.cache_dir.clone(),
+            modules: Mutex::new(vec![]),
+        })
+    }
+
+    // Compiles a module once per engine and wasm contents, from the disk
+    // cache when an earlier run already did
+    fn instance_pre(&self, path: &Path) -> Result<InstancePre<HostState>> {
+        let _span = trace::span("wasm", format!("load {}", path.display()));
+        let bytes = fs::read(path)?;
+        let mut hasher = Fnv1a::default();
+        self.engine
+            .precompile_compatibility_hash()
+            .hash(&mut hasher);
+        hasher.write(&bytes);
+        let key = hasher.finish();
+
+        if let Ok(mut modules) = self.modules.lock() {
+            if let Some(pos) = modules.iter().position(|(k, _)| *k == key) {
+                let entry = modules.remove(pos);
+                let pre = entry.1.clone();
+                modules.push(entry);
+                return Ok(pre);
+            }
+        }
+
+        let cache_file = self
+            .cache_dir
+            .as_ref()
+            .map(|dir| dir.join(format!("{key:016x}-{}.cwasm", bytes.len())));
+        let cached = cache_file.as_ref().filter(|f| f.exists()).and_then(|f| {
+            // only this engine writes to the cache dir
+            match unsafe { Module::deserialize_file(&self.engine, f) } {
+                Ok(module) => Some(module),
+                Err(e) => {
+                    eprintln!("Ignoring cached module {:?}: {}", f, e);
+                    None
+                }
+            }
+        });
+        let module = match cached {
+            Some(module) => module,
+            None => {
+                let module = Module::new(&self.engine, &bytes)?;
+                if let Some(f) = cache_file.as_ref() {
+                    let written = module.serialize().and_then(|data| {
+                        // write then rename so a crash never leaves half a module
+                        let tmp = f.with_extension("tmp");
+                        fs::write(&tmp, data)?;
+                        fs::rename(&tmp, f)?;
+                        Ok(())
+                    });
+                    if let Err(e) = written {
+                        eprintln!("Could not cache module {:?}: {}", f, e);
+                    }
+                }
+                module
+            }
+        };
+        let pre = self.linker.instantiate_pre(&module)?;
+
+        if let Ok(mut modules) = self.modules.lock() {
+            if modules.len() >= MODULE_MEMORY_CACHE {
+                modules.remove(0);
+            }
+            modules.push((key, pre.clone()));
+        }
+        Ok(pre)
+    }
+}
+
+fn guest_memory(caller: &mut Caller<'_, HostState>) -> wasmtime::Memory {
+    match caller.get_export("memory") {
+        Some(Extern::Memory(mem)) => mem,
+        _ => panic!("failed to get memory"),
+    }
+}
+
+fn host_linker(engine: &Engine) -> Result<Linker<HostState>> {
+    let mut linker = Linker::new(engine);
+    p1::add_to_linker_sync(&mut linker, |s: &mut HostState| &mut s.wasi)?;
+
+    linker.func_wrap(
+        "host",
+        "send_bytes",
+        |mut caller: Caller<'_, HostState>, ptr: u32, len: u32| {
+            let mem = guest_memory(&mut caller);
+            let offset = ptr as usize;
+            let buf_ref = caller.data().buf_ref.clone();
+            let mut lock = buf_ref.lock();
+            let buf = lock.as_deref_mut().unwrap();
+
+            buf.resize(len as usize, Default::default());
+            mem.read(&caller, offset, buf.as_mut_slice()).unwrap();
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "send_specs",
+        |mut caller: Caller<'_, HostState>, ptr: u32, len: u32| {
+            let mem = guest_memory(&mut caller);
+            let inbox_ref = caller.data().spec_inbox_ref.clone();
+            let mut lock = inbox_ref.lock();
+            let inbox = lock.as_deref_mut().unwrap();
+            inbox.specs.clear();
+            inbox.error = None;
+
+            // decode in place, the specs never get copied out of the guest
+            let offset = ptr as usize;
+            let Some(bytes) = mem
+                .data(&caller)
+                .get(offset..offset.saturating_add(len as usize))
+            else {
+                inbox.error = Some(format!("Spec buffer {}+{} out of bounds", ptr, len));
+                return;
+            };
+            if let Err(e) = inbox.decoder.decode_specs(bytes, &mut inbox.specs) {
+                inbox.error = Some(format!("Could not decode specs: {}", e));
+            }
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "send_midi_bindings",
+        |mut caller: Caller<'_, HostState>, ptr: u32, len: u32| {
+            let mem = guest_memory(&mut caller);
+            let offset = ptr as usize;
+            let Some(bytes) = mem
+                .data(&caller)
+                .get(offset..offset.saturating_add(len as usize))
+            else {
+                eprintln!("Midi binding buffer {}+{} out of bounds", ptr, len);
+                return;
+            };
+            match serde_json::from_slice::<Vec<MidiBinding>>(bytes) {
+                Ok(bindings) => {
+                    caller
+                        .data()
+                        .midi_bindings_ref
+                        .lock()
+                        .unwrap()
+                        .replace(bindings);
+                }
+                Err(e) => eprintln!("Could not decode midi bindings: {}", e),
+            }
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "send_settings",
+        |mut caller: Caller<'_, HostState>, ptr: u32, len: u32| {
+            let mem = guest_memory(&mut caller);
+            let offset = ptr as usize;
+            let buf_ref = caller.data().settings_ref.clone();
+            let mut lock = buf_ref.lock();
+            let buf = lock.as_deref_mut().unwrap();
+
+            buf.resize(len as usize, Default::default());
+            mem.read(&caller, offset, buf.as_mut_slice()).unwrap();
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "recv_settings_size",
+        |caller: Caller<'_, HostState>| -> u64 {
+            let buf_ref = caller.data().settings_ref.clone();
+            let mut lock = buf_ref.lock();
+            let buf = lock.as_deref_mut().unwrap();
+            buf.len() as u64
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "recv_settings",
+        |mut caller: Caller<'_, HostState>, ptr: u32| {
+            let mem = guest_memory(&mut caller);
+            let offset = ptr as usize;
+            let buf_ref = caller.data().settings_ref.clone();
+            let mut lock = buf_ref.lock();
+            let buf = lock.as_deref_mut().unwrap();
+            mem.write(caller, offset, buf.as_mut_slice()).unwrap();
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "recv_gfx_info",
+        |mut caller: Caller<'_, HostState>, ptr: u32| {
+            let mem = guest_memory(&mut caller);
+            let offset = ptr as usize;
+            let buf_ref = caller.data().gfx_info_ref.clone();
+            let mut lock = buf_ref.lock();
+            let buf = lock.as_deref_mut().unwrap();
+
+            mem.write(caller, offset, buf.as_mut_slice()).unwrap();
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "gfx_info_serialized_size",
+        |caller: Caller<'_, HostState>| -> u32 {
+            caller.data().gfx_info_ref.lock().unwrap().len() as u32
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "recv_reg_events",
+        |mut caller: Caller<'_, HostState>, ptr: u32| {
+            let mem = guest_memory(&mut caller);
+            let offset = ptr as usize;
+            let buf_ref = caller.data().reg_events_ref.clone();
+            let mut lock = buf_ref.lock();
+            let buf = lock.as_deref_mut().unwrap();
+
+            mem.write(caller, offset, buf.as_mut_slice()).unwrap();
+        },
+    )?;
+
+    linker.func_wrap(
+        "host",
+        "reg_events_serialized_size",
+        |caller: Caller<'_, HostState>| -> u32 {
+            caller.data().reg_events_ref.lock().unwrap().len() as u32
+        },
+    )?;
+
+    Ok(linker)
+}
+
 pub struct AppRuntime {
     _engine: Engine,
-    _linker: Linker<WasiP1Ctx>,
     buf_ref: Arc<Mutex<Vec<u8>>>,
     reg_events_ref: Arc<Mutex<Vec<u8>>>,
     loaded_asset_info_ref: Arc<HashMap<Asset, GfxInfo>>,
     settings_ref: Arc<Mutex<Vec<u8>>>,
-    store: Arc<Mutex<Store<WasiP1Ctx>>>,
+    store: Arc<Mutex<Store<HostState>>>,
     _module: Module,
     _instance: Instance,
     calc_fn: TypedFunc<(u32, u32, i64, i64), u32>,
+    // binary transport, None for modules built before it existed
+    calc_bin_fn: Option<TypedFunc<(u32, u32, i64, i64), u32>>,
+    spec_inbox_ref: Arc<Mutex<SpecInbox>>,
+    midi_bindings_ref: Arc<Mutex<Option<Vec<MidiBinding>>>>,
+    event_encoder: Mutex<WireEncoder>,
     save_settings_fn: TypedFunc<(), ()>,
     restore_settings_fn: TypedFunc<(), ()>,
 }
 
 impl AppRuntime {
+    /// Set up the engine every later load shares. Only the first call has any
+    /// effect, loading without one uses the default options.
+    pub fn init_engine(options: &WasmOptions) -> Result<()> {
+        if SHARED_ENGINE.get().is_some() {
+            return Ok(());
+        }
+        let shared = SharedEngine::new(options)?;
+        SHARED_ENGINE.set(shared).ok();
+        Ok(())
+    }
+
+    fn shared_engine() -> Result<&'static SharedEngine> {
+        Self::init_engine(&WasmOptions::default())?;
+        match SHARED_ENGINE.get() {
+            Some(shared) => Ok(shared),
+            None => bail!("Wasm engine is not initialized"),
+        }
+    }
+
     pub fn load<P: AsRef<Path>>(
         path: P,
         preopen: P,
@@ -43,140 +477,15 @@ impl AppRuntime {
         frames_per_second: i64,
         dry_run: bool,
     ) -> Result<(Self, HashMap<String, GfxData>)> {
-        // Define the WASI functions globally on the `Config`.
-        let config = Config::new();
-        let engine = Engine::new(&config)?;
-        let mut linker = Linker::new(&engine);
-        p1::add_to_linker_sync(&mut linker, |s| s)?;
+        let shared = Self::shared_engine()?;
+        let instance_pre = shared.instance_pre(path.as_ref())?;
 
         let buf_ref: Arc<Mutex<Vec<u8>>> = Arc::new(Mutex::new(vec![]));
-        let guest_buf_ref = buf_ref.clone();
-
-        linker.func_wrap(
-            "host",
-            "send_bytes",
-            move |mut caller: Caller<'_, WasiP1Ctx>, ptr: u32, len: u32| {
-                let mem = match caller.get_export("memory") {
-                    Some(Extern::Memory(mem)) => mem,
-                    _ => panic!("failed to get memory"),
-                };
-                let offset = ptr as usize;
-                let buf_ref = guest_buf_ref.clone();
-                let mut lock = buf_ref.lock();
-                let buf = lock.as_deref_mut().unwrap();
-
-                buf.resize(len as usize, Default::default());
-                mem.read(&caller, offset, buf.as_mut_slice()).unwrap();
-            },
-        )?;
-
+        let spec_inbox_ref = Arc::new(Mutex::new(SpecInbox::default()));
         let settings_ref = Arc::new(Mutex::new(vec![]));
-        let guest_buf_ref = settings_ref.clone();
-
-        linker.func_wrap(
-            "host",
-            "send_settings",
-            move |mut caller: Caller<'_, WasiP1Ctx>, ptr: u32, len: u32| {
-                let mem = match caller.get_export("memory") {
-                    Some(Extern::Memory(mem)) => mem,
-                    _ => panic!("failed to get memory"),
-                };
-                let offset = ptr as usize;
-                let buf_ref = guest_buf_ref.clone();
-                let mut lock = buf_ref.lock();
-                let buf = lock.as_deref_mut().unwrap();
-
-                buf.resize(len as usize, Default::default());
-                mem.read(&caller, offset, buf.as_mut_slice()).unwrap();
-            },
-        )?;
-
-        let guest_buf_ref = settings_ref.clone();
-
-        linker.func_wrap(
-            "host",
-            "recv_settings_size",
-            move |_: Caller<'_, WasiP1Ctx>| -> u64 {
-                let buf_ref = guest_buf_ref.clone();
-                let mut lock = buf_ref.lock();
-                let buf = lock.as_deref_mut().unwrap();
-                buf.len() as u64
-            },
-        )?;
-
-        let guest_buf_ref = settings_ref.clone();
-        linker.func_wrap(
-            "host",
-            "recv_settings",
-            move |mut caller: Caller<'_, WasiP1Ctx>, ptr: u32| {
-                let mem = match caller.get_export("memory") {
-                    Some(Extern::Memory(mem)) => mem,
-                    _ => panic!("failed to get memory"),
-                };
-                let offset = ptr as usize;
-                let buf_ref = guest_buf_ref.clone();
-                let mut lock = buf_ref.lock();
-                let buf = lock.as_deref_mut().unwrap();
-                mem.write(caller, offset, buf.as_mut_slice()).unwrap();
-            },
-        )?;
-
         let gfx_info_ref = Arc::new(Mutex::new(Vec::<u8>::new()));
-        let guest_gfx_info_ref = gfx_info_ref.clone();
-
-        linker.func_wrap(
-            "host",
-            "recv_gfx_info",
-            move |mut caller: Caller<'_, WasiP1Ctx>, ptr: u32| {
-                let mem = match caller.get_export("memory") {
-                    Some(Extern::Memory(mem)) => mem,
-                    _ => panic!("failed to get memory"),
-                };
-                let offset = ptr as usize;
-                let buf_ref = guest_gfx_info_ref.clone();
-                let mut lock = buf_ref.lock();
-                let buf = lock.as_deref_mut().unwrap();
-
-                mem.write(caller, offset, buf.as_mut_slice()).unwrap();
-            },
-        )?;
-
-        let guest_gfx_info_ref = gfx_info_ref.clone();
-        linker.func_wrap(
-            "host",
-            "gfx_info_serialized_size",
-            move |_: Caller<'_, WasiP1Ctx>| -> u32 {
-                guest_gfx_info_ref.clone().lock().unwrap().len() as u32
-            },
-        )?;
-
         let reg_events_ref = Arc::new(Mutex::new(Vec::<u8>::new()));
-        let guest_reg_events_ref = reg_events_ref.clone();
-        linker.func_wrap(
-            "host",
-            "recv_reg_events",
-            move |mut caller: Caller<'_, WasiP1Ctx>, ptr: u32| {
-                let mem = match caller.get_export("memory") {
-                    Some(Extern::Memory(mem)) => mem,
-                    _ => panic!("failed to get memory"),
-                };
-                let offset = ptr as usize;
-                let buf_ref = guest_reg_events_ref.clone();
-                let mut lock = buf_ref.lock();
-                let buf = lock.as_deref_mut().unwrap();
-
-                mem.write(caller, offset, buf.as_mut_slice()).unwrap();
-            },
-        )?;
-
-        let guest_reg_events_ref = reg_events_ref.clone();
-        linker.func_wrap(
-            "host",
-            "reg_events_serialized_size",
-            move |_: Caller<'_, WasiP1Ctx>| -> u32 {
-                guest_reg_events_ref.clone().lock().unwrap().len() as u32
-            },
-        )?;
+        let midi_bindings_ref = Arc::new(Mutex::new(None));
 
         let wasi = WasiCtxBuilder::new()
             .inherit_stdio()
@@ -185,14 +494,30 @@ impl AppRuntime {
             .expect("Issue with preopening dir")
             .build_p1();
 
-        let mut store = Store::<WasiP1Ctx>::new(&engine, wasi);
+        let mut store = Store::new(
+            &shared.engine,
+            HostState {
+                wasi,
+                buf_ref: buf_ref.clone(),
+                settings_ref: settings_ref.clone(),
+                gfx_info_ref: gfx_info_ref.clone(),
+                reg_events_ref: reg_events_ref.clone(),
+                spec_inbox_ref: spec_inbox_ref.clone(),
+                midi_bindings_ref: midi_bindings_ref.clone(),
+            },
+        );
 
-        // Instantiate our module with the imports we've created, and run it.
-        let module = Module::from_file(&engine, path)?;
-        linker.module(&mut store, "", &module)?;
-        let instance = linker.instantiate(&mut store, &module)?;
+        // imports were resolved when the module was compiled, this only
+        // allocates the instance
+        let instance = instance_pre.instantiate(&mut store)?;
+        if let Ok(init) = instance.get_typed_func::<(), ()>(&mut store, "_initialize") {
+            init.call(&mut store, ())?;
+        }
         let calc_fn = instance
             .get_typed_func::<(u32, u32, i64, i64), u32>(&mut store, "calculate_internal")?;
+        let calc_bin_fn = instance
+            .get_typed_func::<(u32, u32, i64, i64), u32>(&mut store, "calculate_bin_internal")
+            .ok();
         let asset_list_fn =
             instance.get_typed_func::<(i64,), u32>(&mut store, "asset_list_internal")?;
 
@@ -253,16 +578,19 @@ impl AppRuntime {
 
         Ok((
             Self {
-                _engine: engine,
-                _linker: linker,
+                _engine: shared.engine.clone(),
                 buf_ref,
                 reg_events_ref,
                 settings_ref,
                 loaded_asset_info_ref: Arc::new(loaded_asset_info),
                 store: Arc::new(Mutex::new(store)),
-                _module: module,
+                _module: instance_pre.module().clone(),
                 _instance: instance,
                 calc_fn,
+                calc_bin_fn,
+                spec_inbox_ref,
+                midi_bindings_ref,
+                event_encoder: Mutex::new(WireEncoder::new()),
                 save_settings_fn,
                 restore_settings_fn,
             },
@@ -278,6 +606,11 @@ impl AppRuntime {
         fps: i64,
         reg_events: &[GfxEvent],
     ) -> Result<Vec<RenderSpec>, Box<dyn Error>> {
+        let _span = trace::span("calc", "AppRuntime::calc");
+        if let Some(calc_bin_fn) = self.calc_bin_fn.as_ref() {
+            return self.calc_bin(calc_bin_fn, canvas_w, canvas_h, frame, fps, reg_events);
+        }
+
         {
             {
                 let Ok(mut reg_lock) = self.reg_events_ref.lock() else {
@@ -307,6 +640,76 @@ impl AppRuntime {
         Ok(serde_json::from_slice(specs)?)
     }
 
+    fn calc_bin(
+        &self,
+        calc_bin_fn: &TypedFunc<(u32, u32, i64, i64), u32>,
+        canvas_w: u32,
+        canvas_h: u32,
+        frame: i64,
+        fps: i64,
+        reg_events: &[GfxEvent],
+    ) -> Result<Vec<RenderSpec>, Box<dyn Error>> {
+        let specs = self.exchange_bin(calc_bin_fn, canvas_w, canvas_h, frame, fps, reg_events);
+        if specs.is_err() {
+            // the guest may have stopped anywhere in either buffer, both name
+            // tables start over and the guest follows the new epoch
+            if let Ok(mut encoder) = self.event_encoder.lock() {
+                encoder.reset();
+            }
+            if let Ok(mut inbox) = self.spec_inbox_ref.lock() {
+                inbox.decoder.reset();
+            }
+        }
+        specs
+    }
+
+    fn exchange_bin(
+        &self,
+        calc_bin_fn: &TypedFunc<(u32, u32, i64, i64), u32>,
+        canvas_w: u32,
+        canvas_h: u32,
+        frame: i64,
+        fps: i64,
+        reg_events: &[GfxEvent],
+    ) -> Result<Vec<RenderSpec>, Box<dyn Error>> {
+        {
+            let Ok(mut reg_lock) = self.reg_events_ref.lock() else {
+                return Err("Reg events array is poisoned".into());
+            };
+            let Ok(mut encoder) = self.event_encoder.lock() else {
+                return Err("Event encoder is poisoned".into());
+            };
+            encoder.encode_events(reg_events, &mut reg_lock);
+        }
+
+        {
+            let mut lock = self.store.lock();
+            let store = lock.as_deref_mut().unwrap();
+
+            let err = RenderCalcErr::from(
+                calc_bin_fn.call(store, (canvas_w, canvas_h, frame, fps))? as u8,
+            );
+
+            match err {
+                RenderCalcErr::None => (),
+                _ => return Err("Got issue from wasm".into()),
+            }
+        }
+
+        let Ok(mut inbox) = self.spec_inbox_ref.lock() else {
+            return Err("Spec inbox is poisoned".into());
+        };
+        if let Some(e) = inbox.error.take() {
+            return Err(e.into());
+        }
+        Ok(std::mem::take(&mut inbox.specs))
+    }
+
+    /// Bindings the app registered since the last call, if it did
+    pub fn take_midi_bindings(&self) -> Option<Vec<MidiBinding>> {
+        self.midi_bindings_ref.lock().ok()?.take()
+    }
+
     pub fn loaded_asset_info(&self) -> Arc<HashMap<Asset, GfxInfo>> {
         self.loaded_asset_info_ref.clone()
     }
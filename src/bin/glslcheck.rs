@@ -1,12 +1,19 @@
 use clap::Parser;
 use ffmpeg_next::log::set_level;
 use sdlrig::gfxinfo::{VidMixer, VidMixerInfo};
-use sdlrig::vidruntime::{VidMixerData, VidMixerInput};
+use sdlrig::vidruntime::{PassStats, VidMixerData, VidMixerInput};
+use std::ffi::CString;
 use std::fs;
-use std::path::Path;
-use std::time::{SystemTime, UNIX_EPOCH};
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 
-use sdlrig::gfx_lowlevel::bindings::gfx_lowlevel_gpu_ctx_init;
+use sdlrig::gfx_lowlevel::bindings::{
+    gfx_lowlevel_gpu_ctx, gfx_lowlevel_gpu_ctx_destroy, gfx_lowlevel_gpu_ctx_fork,
+    gfx_lowlevel_gpu_ctx_init, gfx_lowlevel_gpu_ctx_init_headless, gfx_lowlevel_gpu_ctx_load_cache,
+    gfx_lowlevel_gpu_ctx_save_cache,
+};
 
 #[derive(Parser, Debug, Clone)]
 #[command(author = "VampireExec", version = "1", about = "visualization tool")]
@@ -22,15 +29,52 @@ struct Args {
     #[arg(long, default_value = "false")]
     shader_debug: bool,
     #[arg(long)]
-    shader_path: String,
+    shader_path: Option<String>,
     #[arg(long)]
     include_path: Vec<String>,
+    /// Compile every .glsl under this directory instead of one shader, and
+    /// print what each pass cost to compile
+    #[arg(long)]
+    shader_dir: Option<String>,
+    /// Pipeline cache to fill with --shader_dir, the same directory viz is
+    /// given as --shader_cache_dir. Shaders are built for as many inputs as
+    /// their highest src_texN and without a LUT, mixes set up differently
+    /// still compile live
+    #[arg(long)]
+    shader_cache_dir: Option<String>,
+    /// Shaders compiled at once with --shader_dir, 0 for one per core
+    #[arg(long, default_value = "0")]
+    jobs: usize,
+}
+
+// Forks are handed to one worker each and destroyed after it's joined
+struct WorkerCtx(*mut gfx_lowlevel_gpu_ctx);
+unsafe impl Send for WorkerCtx {}
+
+impl WorkerCtx {
+    // a closure using .0 would capture just the pointer, which isn't Send
+    fn ctx(&self) -> *mut gfx_lowlevel_gpu_ctx {
+        self.0
+    }
+}
+
+struct Report {
+    path: PathBuf,
+    time: Duration,
+    result: anyhow::Result<Vec<PassStats>>,
 }
 
 fn main() -> anyhow::Result<()> {
     set_level(ffmpeg_next::log::Level::Error);
     let args = Args::parse();
 
+    if let Some(shader_dir) = args.shader_dir.as_ref() {
+        return check_dir(&args, Path::new(shader_dir));
+    }
+    let Some(shader_path) = args.shader_path.as_ref() else {
+        anyhow::bail!("Give a --shader_path or a --shader_dir");
+    };
+
     let sdl_context = sdl2::init().unwrap();
     let video_subsystem = sdl_context.video().unwrap();
     // MAIN WINDOW
@@ -57,21 +101,7 @@ fn main() -> anyhow::Result<()> {
     let ns_per_frame = 1_000_000_000u128 / frames_per_sec as u128;
     let frame = (start_time.as_nanos() / ns_per_frame) as i64;
 
-    //file lookup in include paths
-    let lookup_includs = |name: &dyn AsRef<str>| -> Option<String> {
-        for include_path in &args.include_path {
-            let path = Path::new(include_path).join(name.as_ref());
-            if path.exists() {
-                if let Ok(content) = fs::read_to_string(path) {
-                    return Some(content);
-                }
-            }
-        }
-        None
-    };
-    //read the glsl
-    let f = fs::read_to_string(&args.shader_path)?;
-    let shader_source = sdlrig::shaderhelper::include_files(f, lookup_includs);
+    let shader_source = read_shader(&args, Path::new(shader_path))?;
 
     //make 10 dummy inputs -_-;
     let data = (0..10)
@@ -119,3 +149,183 @@ fn main() -> anyhow::Result<()> {
     eprintln!("all done.");
     return Ok(());
 }
+
+// The shader at path with its includes resolved against --include_path
+fn read_shader(args: &Args, path: &Path) -> anyhow::Result<String> {
+    //file lookup in include paths
+    let lookup_includs = |name: &dyn AsRef<str>| -> Option<String> {
+        for include_path in &args.include_path {
+            let path = Path::new(include_path).join(name.as_ref());
+            if path.exists() {
+                if let Ok(content) = fs::read_to_string(path) {
+                    return Some(content);
+                }
+            }
+        }
+        None
+    };
+    //read the glsl
+    let f = fs::read_to_string(path)?;
+    Ok(sdlrig::shaderhelper::include_files(f, lookup_includs))
+}
+
+fn find_shaders(dir: &Path, out: &mut Vec<PathBuf>) -> anyhow::Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        if path.is_dir() {
+            find_shaders(&path, out)?;
+        } else if path.extension().map_or(false, |ext| ext == "glsl") {
+            out.push(path);
+        }
+    }
+    Ok(())
+}
+
+// Warm every shader under dir up on a pool of forked contexts, which share
+// the pipeline cache that is saved at the end
+fn check_dir(args: &Args, dir: &Path) -> anyhow::Result<()> {
+    let mut paths = vec![];
+    find_shaders(dir, &mut paths)?;
+    paths.sort();
+    if paths.is_empty() {
+        anyhow::bail!("No .glsl files under {}", dir.display());
+    }
+
+    let _sdl_context = sdl2::init().unwrap();
+    let mut lowlevel_ctx = unsafe {
+        gfx_lowlevel_gpu_ctx_init_headless(args.width as i32, args.height as i32, std::ptr::null())
+    };
+    if lowlevel_ctx.is_null() {
+        panic!("Failed to initialize lowlevel_ctx");
+    }
+    if let Some(cache_dir) = args.shader_cache_dir.as_ref() {
+        fs::create_dir_all(cache_dir)?;
+        let c_dir = CString::new(cache_dir.as_str())?;
+        match unsafe { gfx_lowlevel_gpu_ctx_load_cache(lowlevel_ctx, c_dir.as_ptr()) } {
+            0 => (),
+            err => anyhow::bail!("Could not load shader cache {cache_dir}: {err}"),
+        }
+    }
+
+    let jobs = match args.jobs {
+        0 => thread::available_parallelism().map_or(1, |n| n.get()),
+        jobs => jobs,
+    }
+    .min(paths.len());
+    let workers = (0..jobs)
+        .map(|_| unsafe { gfx_lowlevel_gpu_ctx_fork(lowlevel_ctx) })
+        .filter(|fork| !fork.is_null())
+        .map(WorkerCtx)
+        .collect::<Vec<_>>();
+    if workers.is_empty() {
+        anyhow::bail!("Could not fork a gpu ctx to compile on");
+    }
+
+    let threads = workers.len();
+    let started = Instant::now();
+    let queue = Mutex::new(paths);
+    let mut reports = thread::scope(|scope| {
+        let handles = workers
+            .iter()
+            .map(|worker| {
+                let worker = WorkerCtx(worker.0);
+                let queue = &queue;
+                scope.spawn(move || {
+                    let mut reports = vec![];
+                    loop {
+                        let Some(path) = queue.lock().unwrap().pop() else {
+                            break;
+                        };
+                        let shader_started = Instant::now();
+                        let result = read_shader(args, &path).and_then(|shader| {
+                            let mixer = VidMixerData::new(VidMixerInfo::from(
+                                VidMixer::builder()
+                                    .name(path.display().to_string())
+                                    .width(args.width)
+                                    .height(args.height)
+                                    .shader(shader)
+                                    .build(),
+                            ));
+                            mixer.compile_stats(worker.ctx())
+                        });
+                        reports.push(Report {
+                            path,
+                            time: shader_started.elapsed(),
+                            result,
+                        });
+                    }
+                    reports
+                })
+            })
+            .collect::<Vec<_>>();
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().unwrap_or_default())
+            .collect::<Vec<_>>()
+    });
+    let elapsed = started.elapsed();
+
+    for mut worker in workers {
+        unsafe { gfx_lowlevel_gpu_ctx_destroy(&mut worker.0) };
+    }
+    if args.shader_cache_dir.is_some() {
+        match unsafe { gfx_lowlevel_gpu_ctx_save_cache(lowlevel_ctx) } {
+            0 => (),
+            err => eprintln!("Could not save shader cache: {err}"),
+        }
+    }
+    unsafe { gfx_lowlevel_gpu_ctx_destroy(&mut lowlevel_ctx) };
+
+    // most expensive first, that is what this report is for
+    reports.sort_by(|a, b| b.time.cmp(&a.time));
+    let mut failed = 0;
+    for report in &reports {
+        let passes = match &report.result {
+            Ok(passes) => passes,
+            Err(e) => {
+                failed += 1;
+                println!("FAILED {}: {}", report.path.display(), e);
+                continue;
+            }
+        };
+        println!(
+            "{:>9.3} ms  {}",
+            report.time.as_secs_f64() * 1000.0,
+            report.path.display()
+        );
+        for pass in passes {
+            let shader = &pass.shader;
+            let kind = if shader.compute_group_size[0] > 0 {
+                format!(
+                    " compute {}x{}",
+                    shader.compute_group_size[0], shader.compute_group_size[1]
+                )
+            } else {
+                String::new()
+            };
+            println!(
+                "{:>9.3} ms    pass {}..={}: {} statements, {} lines, {} descriptors, {} uniforms, {} constants{}",
+                pass.compile_time.as_secs_f64() * 1000.0,
+                pass.first,
+                pass.last,
+                shader.glsl_statements,
+                shader.glsl_lines,
+                shader.num_descriptors,
+                shader.num_variables,
+                shader.num_constants,
+                kind,
+            );
+        }
+    }
+    println!(
+        "{} shaders, {} failed, {:.3} s on {} threads",
+        reports.len(),
+        failed,
+        elapsed.as_secs_f64(),
+        threads
+    );
+    if failed > 0 {
+        anyhow::bail!("{} of {} shaders failed", failed, reports.len());
+    }
+    Ok(())
+}
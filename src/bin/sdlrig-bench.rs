@@ -0,0 +1,471 @@
+use clap::Parser;
+use ffmpeg_next::{format::Pixel, frame::Video, log::set_level};
+use sdlrig::appruntime::AppRuntime;
+use sdlrig::gfxinfo::{VidInfo, VidMixer, VidMixerInfo};
+use sdlrig::renderspec::{SendCmd, SendValue};
+use sdlrig::seekindex::SeekIndex;
+use sdlrig::vidruntime::{VidMixerData, VidMixerInput};
+use sdlrig::vidthread::{DecodeItem, DecodeThread};
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use sdlrig::gfx_lowlevel::bindings::{
+    gfx_lowlevel_frame_copy, gfx_lowlevel_frame_create_texture, gfx_lowlevel_frame_ctx,
+    gfx_lowlevel_frame_ctx_destroy, gfx_lowlevel_frame_ctx_init, gfx_lowlevel_gpu_config,
+    gfx_lowlevel_gpu_ctx, gfx_lowlevel_gpu_ctx_destroy, gfx_lowlevel_gpu_ctx_finish_frame,
+    gfx_lowlevel_gpu_ctx_init_headless, gfx_lowlevel_gpu_ctx_start_frame,
+    gfx_lowlevel_map_frame_ctx, gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_FIFO,
+    gfx_lowlevel_readback_next, gfx_lowlevel_reset_dispatch,
+};
+
+#[derive(Parser, Debug, Clone)]
+#[command(
+    author = "VampireExec",
+    version = "1",
+    about = "times the render hot paths offscreen"
+)]
+struct Args {
+    #[arg(long, default_value = "1920")]
+    width: u32,
+    #[arg(long, default_value = "1080")]
+    height: u32,
+    #[arg(long, default_value = "30")]
+    fps: i64,
+    /// Timed iterations per case
+    #[arg(long, default_value = "300")]
+    iterations: usize,
+    /// Untimed iterations first, so shaders are compiled and pools are full
+    #[arg(long, default_value = "30")]
+    warm_up: usize,
+    /// Inputs the render case mixes
+    #[arg(long, default_value = "4")]
+    inputs: usize,
+    /// Passes the render case runs
+    #[arg(long, default_value = "2")]
+    passes: usize,
+    /// Uniform updates per iteration in the update_values case
+    #[arg(long, default_value = "64")]
+    commands: usize,
+    /// Clip to decode up front and map in the map_clip case
+    #[arg(long)]
+    clip: Option<String>,
+    /// Decode the clip with VideoToolbox
+    #[arg(long, default_value = "false")]
+    hardware_decode: bool,
+    /// Frames of the clip to keep decoded
+    #[arg(long, default_value = "60")]
+    clip_frames: usize,
+    /// App to time calc on in the calc case
+    #[arg(long)]
+    wasm: Option<PathBuf>,
+    #[arg(long, default_value = "/tmp")]
+    preopen: PathBuf,
+    /// Cases to run, all of them when empty: map_sw, map_clip, render, copy,
+    /// update_values, calc
+    #[arg(long)]
+    only: Vec<String>,
+}
+
+// Per iteration timings of one case. op is the CPU time of the call being
+// measured, frame is start_frame to the GPU finishing it for cases that
+// render, and just op for the rest.
+struct Samples {
+    name: String,
+    op: Vec<Duration>,
+    frame: Vec<Duration>,
+}
+
+impl Samples {
+    fn new(name: &str, capacity: usize) -> Self {
+        Self {
+            name: name.to_string(),
+            op: Vec::with_capacity(capacity),
+            frame: Vec::with_capacity(capacity),
+        }
+    }
+
+    fn report(&mut self) {
+        if self.op.is_empty() {
+            return;
+        }
+        self.op.sort();
+        let total = self.frame.iter().sum::<Duration>();
+        let fps = if total.is_zero() {
+            0.0
+        } else {
+            self.frame.len() as f64 / total.as_secs_f64()
+        };
+        println!(
+            "{:<14} {:>6} {:>9.3} {:>9.3} {:>9.3} {:>9.3} {:>10.1}",
+            self.name,
+            self.op.len(),
+            ms(percentile(&self.op, 50.0)),
+            ms(percentile(&self.op, 90.0)),
+            ms(percentile(&self.op, 99.0)),
+            ms(self.op[self.op.len() - 1]),
+            fps,
+        );
+    }
+}
+
+fn percentile(sorted: &[Duration], pct: f64) -> Duration {
+    let rank = (pct / 100.0 * (sorted.len() - 1) as f64).round() as usize;
+    sorted[rank.min(sorted.len() - 1)]
+}
+
+fn ms(d: Duration) -> f64 {
+    d.as_secs_f64() * 1000.0
+}
+
+struct Bench {
+    args: Args,
+    ctx: *mut gfx_lowlevel_gpu_ctx,
+    readback: Vec<u8>,
+}
+
+impl Drop for Bench {
+    fn drop(&mut self) {
+        unsafe {
+            gfx_lowlevel_gpu_ctx_destroy(&mut self.ctx as _);
+        }
+    }
+}
+
+struct BenchFrame(*mut gfx_lowlevel_frame_ctx);
+impl Drop for BenchFrame {
+    fn drop(&mut self) {
+        unsafe {
+            gfx_lowlevel_frame_ctx_destroy(&mut self.0 as _);
+        }
+    }
+}
+
+impl Bench {
+    fn enabled(&self, name: &str) -> bool {
+        self.args.only.is_empty() || self.args.only.iter().any(|c| c == name)
+    }
+
+    fn frame_ctx(&self, texture: bool) -> anyhow::Result<BenchFrame> {
+        let frame = BenchFrame(unsafe { gfx_lowlevel_frame_ctx_init(self.ctx) });
+        if frame.0.is_null() {
+            anyhow::bail!("Could not create frame ctx");
+        }
+        if texture {
+            let (w, h) = (self.args.width as i32, self.args.height as i32);
+            match unsafe { gfx_lowlevel_frame_create_texture(self.ctx, frame.0, w, h) } {
+                0 => (),
+                err => anyhow::bail!("Could not create texture {}", err),
+            }
+        }
+        Ok(frame)
+    }
+
+    // Run op once per frame, timing it on its own and the whole frame up to
+    // the GPU finishing, which the readback wait stands in for
+    fn run_frames<F>(&mut self, name: &str, mut op: F) -> anyhow::Result<Samples>
+    where
+        F: FnMut(usize) -> anyhow::Result<()>,
+    {
+        let mut samples = Samples::new(name, self.args.iterations);
+        for i in 0..self.args.warm_up + self.args.iterations {
+            let frame_start = Instant::now();
+            unsafe {
+                if !gfx_lowlevel_gpu_ctx_start_frame(self.ctx) {
+                    anyhow::bail!("Could not start frame");
+                }
+                if gfx_lowlevel_reset_dispatch(self.ctx) != 0 {
+                    anyhow::bail!("Could not reset dispatch");
+                }
+            }
+            let op_start = Instant::now();
+            op(i)?;
+            let op_time = op_start.elapsed();
+            unsafe {
+                match gfx_lowlevel_gpu_ctx_finish_frame(self.ctx) {
+                    0 => (),
+                    err => anyhow::bail!("Could not finish frame {}", err),
+                }
+                let mut frame_id = 0u64;
+                match gfx_lowlevel_readback_next(
+                    self.ctx,
+                    self.readback.as_mut_ptr(),
+                    self.args.width as i32 * 4,
+                    u64::MAX,
+                    &mut frame_id,
+                ) {
+                    0 => (),
+                    err => anyhow::bail!("Could not read back frame {}", err),
+                }
+            }
+            if i >= self.args.warm_up {
+                samples.op.push(op_time);
+                samples.frame.push(frame_start.elapsed());
+            }
+        }
+        Ok(samples)
+    }
+
+    // For cases that don't touch the GPU, frame time is op time
+    fn run_cpu<F>(&self, name: &str, mut op: F) -> anyhow::Result<Samples>
+    where
+        F: FnMut(usize) -> anyhow::Result<()>,
+    {
+        let mut samples = Samples::new(name, self.args.iterations);
+        for i in 0..self.args.warm_up + self.args.iterations {
+            let start = Instant::now();
+            op(i)?;
+            let op_time = start.elapsed();
+            if i >= self.args.warm_up {
+                samples.op.push(op_time);
+                samples.frame.push(op_time);
+            }
+        }
+        Ok(samples)
+    }
+
+    fn map_frames(&mut self, name: &str, frames: &mut [Video]) -> anyhow::Result<Samples> {
+        let dst = self.frame_ctx(false)?;
+        let ctx = self.ctx;
+        self.run_frames(name, |i| {
+            let src = &mut frames[i % frames.len()];
+            match unsafe { gfx_lowlevel_map_frame_ctx(ctx, dst.0, src.as_mut_ptr()) } {
+                0 => Ok(()),
+                err => anyhow::bail!("Could not map frame {}", err),
+            }
+        })
+    }
+
+    // A few YUV420P frames with different content, so nothing upstream can
+    // get away with noticing the frame didn't change
+    fn map_sw(&mut self) -> anyhow::Result<Samples> {
+        let mut frames = (0..4)
+            .map(|n| {
+                let mut frame = Video::new(Pixel::YUV420P, self.args.width, self.args.height);
+                for plane in 0..3 {
+                    let stride = frame.stride(plane);
+                    for (y, row) in frame.data_mut(plane).chunks_mut(stride).enumerate() {
+                        for (x, px) in row.iter_mut().enumerate() {
+                            *px = ((x + y) * (plane + 1) + n * 32) as u8;
+                        }
+                    }
+                }
+                frame
+            })
+            .collect::<Vec<_>>();
+        self.map_frames("map_sw", &mut frames)
+    }
+
+    fn map_clip(&mut self, path: &str) -> anyhow::Result<Samples> {
+        let info = VidInfo {
+            name: String::from("bench"),
+            path: path.to_string(),
+            repeat: true,
+            hardware_decode: self.args.hardware_decode,
+            ..Default::default()
+        };
+        let decoder = DecodeThread::spawn(&info, 8, Arc::new(SeekIndex::default()))?;
+        let mut frames = vec![];
+        while frames.len() < self.args.clip_frames {
+            match decoder.next(true) {
+                Some(DecodeItem::Frame(frame)) => frames.push(frame),
+                Some(DecodeItem::Eof) | None => break,
+                Some(DecodeItem::Error(e)) => anyhow::bail!("Could not decode {}: {}", path, e),
+            }
+        }
+        if frames.is_empty() {
+            anyhow::bail!("No frames in {}", path);
+        }
+        let name = if self.args.hardware_decode {
+            "map_clip_hw"
+        } else {
+            "map_clip"
+        };
+        self.map_frames(name, &mut frames)
+    }
+
+    fn mixer(&self, name: String, shader: Option<String>) -> anyhow::Result<VidMixerData> {
+        let mut builder = VidMixer::builder()
+            .name(name)
+            .width(self.args.width)
+            .height(self.args.height);
+        if let Some(shader) = shader {
+            builder = builder.shader(shader);
+        }
+        let mixer = VidMixerData::new(VidMixerInfo::from(builder.build()));
+        mixer.prepare(self.ctx)?;
+        Ok(mixer)
+    }
+
+    // pass0 averages every input, later passes blend in the one before
+    fn render(&mut self) -> anyhow::Result<Samples> {
+        let inputs = (0..self.args.inputs.max(1))
+            .map(|i| self.mixer(format!("input{i}"), None))
+            .collect::<anyhow::Result<Vec<_>>>()?;
+        let mut shader = String::from("void pass0(out vec4 color) {\n  color = vec4(0.0);\n");
+        for i in 0..inputs.len() {
+            shader.push_str(&format!("  color += texture(src_tex{i}, src_uv);\n"));
+        }
+        shader.push_str(&format!("  color /= {}.0;\n}}\n", inputs.len()));
+        for p in 1..self.args.passes.max(1) {
+            shader.push_str(&format!(
+                "void pass{p}(out vec4 color) {{\n  \
+                 color = mix(texture(pass_tex{}, src_uv), texture(src_tex0, src_uv), 0.5);\n}}\n",
+                p - 1
+            ));
+        }
+        let mixer = self.mixer(String::from("bench"), Some(shader))?;
+        let inputs = inputs
+            .iter()
+            .map(VidMixerInput::Feedback)
+            .collect::<Vec<_>>();
+
+        let ctx = self.ctx;
+        let fps = self.args.fps;
+        self.run_frames("render", |i| {
+            mixer.mix(
+                fps,
+                1,
+                i as i64,
+                &inputs,
+                None,
+                ctx,
+                false,
+                true,
+                std::ptr::null_mut(),
+                false,
+            )
+        })
+    }
+
+    fn copy(&mut self) -> anyhow::Result<Samples> {
+        let src = self.frame_ctx(true)?;
+        let dst = self.frame_ctx(true)?;
+        let ctx = self.ctx;
+        self.run_frames("copy", |_| unsafe {
+            match gfx_lowlevel_frame_copy(ctx, &mut (*dst.0).pl_frame, &mut (*src.0).pl_frame) {
+                0 => Ok(()),
+                err => anyhow::bail!("Could not copy frame {}", err),
+            }
+        })
+    }
+
+    fn update_values(&mut self) -> anyhow::Result<Samples> {
+        let count = self.args.commands.max(1);
+        let mut shader = String::new();
+        for k in 0..count {
+            shader.push_str(&format!("//!VAR float u{k} 0.0\n"));
+        }
+        shader.push_str("void pass0(out vec4 color) {\n  color = vec4(0.0);\n");
+        for k in 0..count {
+            shader.push_str(&format!("  color.r += u{k};\n"));
+        }
+        shader.push_str("}\n");
+        let mixer = self.mixer(String::from("bench"), Some(shader))?;
+        let Some(mix_ctx) = mixer.mix_ctx() else {
+            anyhow::bail!("Mixer has no shader context");
+        };
+
+        let mut cmds = (0..count)
+            .map(|k| SendCmd {
+                mix: String::from("bench"),
+                name: format!("u{k}"),
+                value: SendValue::Float(0.0),
+            })
+            .collect::<Vec<_>>();
+        self.run_cpu("update_values", |i| {
+            for cmd in cmds.iter_mut() {
+                cmd.value = SendValue::Float(i as f32);
+                mixer.update_values(mix_ctx, cmd)?;
+            }
+            Ok(())
+        })
+    }
+
+    fn calc(&mut self, path: &PathBuf) -> anyhow::Result<Samples> {
+        let (app, _) = AppRuntime::load(
+            path.clone(),
+            self.args.preopen.clone(),
+            None,
+            self.args.fps,
+            true,
+        )?;
+        let (w, h, fps) = (self.args.width, self.args.height, self.args.fps);
+        self.run_cpu("calc", |i| match app.calc(w, h, i as i64, fps, &[]) {
+            Ok(_) => Ok(()),
+            Err(e) => anyhow::bail!("calc failed: {}", e),
+        })
+    }
+}
+
+fn main() -> anyhow::Result<()> {
+    set_level(ffmpeg_next::log::Level::Error);
+    let args = Args::parse();
+
+    let gpu_config = gfx_lowlevel_gpu_config {
+        queue_count: 4,
+        async_transfer: true,
+        async_compute: true,
+        present_mode: gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_FIFO,
+        frames_in_flight: 0,
+        vram_budget: 0,
+    };
+    let ctx = unsafe {
+        gfx_lowlevel_gpu_ctx_init_headless(args.width as i32, args.height as i32, &gpu_config)
+    };
+    if ctx.is_null() {
+        anyhow::bail!("Failed to initialize headless lowlevel_ctx");
+    }
+    let readback = vec![0u8; args.width as usize * args.height as usize * 4];
+    let mut bench = Bench {
+        args,
+        ctx,
+        readback,
+    };
+
+    println!(
+        "{}x{}, {} iterations after {} warm up",
+        bench.args.width, bench.args.height, bench.args.iterations, bench.args.warm_up
+    );
+    println!(
+        "{:<14} {:>6} {:>9} {:>9} {:>9} {:>9} {:>10}",
+        "case", "iters", "p50 ms", "p90 ms", "p99 ms", "max ms", "frames/s"
+    );
+
+    // printed as each case finishes, a full run takes a while
+    let mut failed = false;
+    let mut report = |result: anyhow::Result<Samples>| match result {
+        Ok(mut samples) => samples.report(),
+        Err(e) => {
+            eprintln!("{e:?}");
+            failed = true;
+        }
+    };
+    if bench.enabled("map_sw") {
+        report(bench.map_sw());
+    }
+    if let Some(clip) = bench.args.clip.clone() {
+        if bench.enabled("map_clip") {
+            report(bench.map_clip(&clip));
+        }
+    }
+    if bench.enabled("render") {
+        report(bench.render());
+    }
+    if bench.enabled("copy") {
+        report(bench.copy());
+    }
+    if bench.enabled("update_values") {
+        report(bench.update_values());
+    }
+    if let Some(wasm) = bench.args.wasm.clone() {
+        if bench.enabled("calc") {
+            report(bench.calc(&wasm));
+        }
+    }
+
+    if failed {
+        anyhow::bail!("Some cases failed");
+    }
+    Ok(())
+}
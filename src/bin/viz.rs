@@ -5,22 +5,36 @@ use lazy_static::lazy_static;
 use midir::{Ignore, MidiInput, MidiOutput};
 use sdl2::event::{Event, WindowEvent};
 use sdl2::keyboard::{Keycode, Mod};
-use sdlrig::appruntime::AppRuntime;
-use sdlrig::gfxinfo::{GfxEvent, KeyEvent, LogEvent, MidiEvent};
+use sdlrig::appruntime::{AppRuntime, WasmOptions};
+use sdlrig::encoder::{FrameEncoder, DEFAULT_RENDER_CODEC};
+use sdlrig::framepacer::{FramePacer, PacingProfile};
+use sdlrig::gfxinfo::{
+    AssetEvent, AssetState, GfxEvent, GpuMemoryEvent, KeyEvent, LogEvent, MidiEvent,
+};
 use sdlrig::gfxruntime::{GfxData, GfxRuntime};
+use sdlrig::midibind::{MidiStaging, MidiWriter};
+use sdlrig::mixgraph;
 use sdlrig::renderspec::RenderSpec;
+use sdlrig::trace;
 use std::collections::{HashMap, HashSet};
+use std::ffi::CString;
 use std::path::{Path, PathBuf};
 use std::sync::mpsc::channel;
 use std::sync::Arc;
 use std::thread::JoinHandle;
-use std::time::{Duration, SystemTime, UNIX_EPOCH};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 use std::{fs, thread};
 
 use sdlrig::gfx_lowlevel::bindings::{
-    gfx_lowlevel_gpu_ctx, gfx_lowlevel_gpu_ctx_destroy, gfx_lowlevel_gpu_ctx_finish_frame,
-    gfx_lowlevel_gpu_ctx_handle_resize, gfx_lowlevel_gpu_ctx_init,
-    gfx_lowlevel_gpu_ctx_start_frame,
+    gfx_lowlevel_gpu_config, gfx_lowlevel_gpu_ctx, gfx_lowlevel_gpu_ctx_destroy,
+    gfx_lowlevel_gpu_ctx_finish_frame, gfx_lowlevel_gpu_ctx_fork,
+    gfx_lowlevel_gpu_ctx_handle_resize, gfx_lowlevel_gpu_ctx_init_ex,
+    gfx_lowlevel_gpu_ctx_init_headless, gfx_lowlevel_gpu_ctx_load_cache,
+    gfx_lowlevel_gpu_ctx_save_cache, gfx_lowlevel_gpu_ctx_start_frame, gfx_lowlevel_present_mode,
+    gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_FIFO,
+    gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_FIFO_RELAXED,
+    gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_IMMEDIATE,
+    gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_MAILBOX, gfx_lowlevel_readback_next, GFX_EAGAIN,
 };
 
 #[derive(Parser, Debug, Clone)]
@@ -36,6 +50,7 @@ struct Args {
     fps: i64,
     #[arg(long, default_value = "false")]
     dry_run: bool,
+    /// Print rolling per mixer CPU/GPU times every few seconds
     #[arg(long, default_value = "false")]
     show_mix_time: bool,
     #[arg(long, default_value = "/tmp/viz")]
@@ -46,8 +61,73 @@ struct Args {
     midi_port: Vec<String>,
     #[arg(long)]
     midi_output: Vec<String>,
+    /// Directory to keep compiled shaders/pipelines in between runs
+    #[arg(long)]
+    shader_cache_dir: Option<String>,
+    /// Write a Chrome/Perfetto trace of frame timings to this file
+    #[arg(long)]
+    trace_file: Option<String>,
+    /// Render offscreen as fast as possible and encode to this file instead of
+    /// opening a window
+    #[arg(long)]
+    render_out: Option<String>,
+    /// Frames to render with --render_out, 0 renders until the app fails or quits
+    #[arg(long, default_value = "0")]
+    render_frames: u64,
+    /// ffmpeg encoder for --render_out, prores_videotoolbox works too
+    #[arg(long, default_value = DEFAULT_RENDER_CODEC)]
+    render_codec: String,
+    /// Vulkan queues to use per queue family
+    #[arg(long, default_value = "4")]
+    queue_count: i32,
+    /// Keep uploads on the graphics queue instead of a transfer queue
+    #[arg(long, default_value = "false")]
+    no_async_transfer: bool,
+    /// Directory to keep compiled wasm modules in between runs
+    #[arg(long)]
+    wasm_cache_dir: Option<String>,
+    /// Cranelift optimization for the wasm app: none, speed or speed_and_size
+    #[arg(long, default_value = "speed")]
+    wasm_opt_level: String,
+    /// Compile wasm functions on one thread
+    #[arg(long, default_value = "false")]
+    no_parallel_compile: bool,
+    /// Swapchain present mode: fifo, mailbox, immediate or fifo_relaxed. fifo
+    /// by default, mailbox with --low_latency
+    #[arg(long)]
+    present_mode: Option<String>,
+    /// Frames queued ahead of the display, 0 is libplacebo's default and 1 is
+    /// the default with --low_latency
+    #[arg(long)]
+    frames_in_flight: Option<i32>,
+    /// Live performance profile, mailbox with one frame in flight and every
+    /// frame started as late as its measured cost allows
+    #[arg(long, default_value = "false")]
+    low_latency: bool,
+    /// VRAM in MiB that mixer buffers, pooled textures and videos should stay
+    /// under, idle mixers lose their buffers past it. 0 doesn't limit them.
+    #[arg(long, default_value = "0")]
+    vram_budget_mb: u64,
 }
 
+fn present_mode_named(name: &str) -> anyhow::Result<gfx_lowlevel_present_mode> {
+    match name {
+        "fifo" => Ok(gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_FIFO),
+        "mailbox" => Ok(gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_MAILBOX),
+        "immediate" => Ok(gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_IMMEDIATE),
+        "fifo_relaxed" => Ok(gfx_lowlevel_present_mode_GFX_LOWLEVEL_PRESENT_FIFO_RELAXED),
+        _ => anyhow::bail!(
+            "Unknown present mode {name}, expected fifo, mailbox, immediate or fifo_relaxed"
+        ),
+    }
+}
+
+// How often the mixer stats table is printed with --show_mix_time
+const MIX_STATS_INTERVAL: Duration = Duration::from_secs(5);
+
+// How often VRAM residency is sent to the app and traced when it changed
+const GPU_MEMORY_INTERVAL: Duration = Duration::from_secs(1);
+
 // Adding a comment as a test
 pub fn main() -> anyhow::Result<()> {
     // Tee stderr so we can consume it programmatically.
@@ -59,25 +139,88 @@ pub fn main() -> anyhow::Result<()> {
     set_level(ffmpeg_next::log::Level::Error);
     let args = Args::parse();
 
+    if let Some(trace_file) = args.trace_file.as_ref() {
+        trace::start(trace_file)?;
+    }
+    if args.show_mix_time {
+        trace::enable_stats();
+    }
+    let mut last_stats_print = SystemTime::now();
+
     let sdl_context = sdl2::init().unwrap();
     let video_subsystem = sdl_context.video().unwrap();
+    let headless = args.render_out.is_some();
     // MAIN WINDOW
-    let mut window = video_subsystem
-        .window("Output", args.width, args.height)
-        .vulkan()
-        .position(0, 0)
-        .build()
-        .unwrap();
+    let mut window = if headless {
+        None
+    } else {
+        Some(
+            video_subsystem
+                .window("Output", args.width, args.height)
+                .vulkan()
+                .position(0, 0)
+                .build()
+                .unwrap(),
+        )
+    };
 
+    let gpu_config = gfx_lowlevel_gpu_config {
+        queue_count: args.queue_count,
+        async_transfer: !args.no_async_transfer,
+        async_compute: true,
+        present_mode: present_mode_named(
+            args.present_mode.as_deref().unwrap_or(if args.low_latency {
+                "mailbox"
+            } else {
+                "fifo"
+            }),
+        )?,
+        frames_in_flight: args
+            .frames_in_flight
+            .unwrap_or(if args.low_latency { 1 } else { 0 }),
+        vram_budget: args.vram_budget_mb << 20,
+    };
     let mut lowlevel_ctx = unsafe {
-        let raw_window = window.raw();
-        let ctx = gfx_lowlevel_gpu_ctx_init(raw_window as *mut _);
+        let ctx = match window.as_ref() {
+            Some(window) => gfx_lowlevel_gpu_ctx_init_ex(window.raw() as *mut _, &gpu_config),
+            None => gfx_lowlevel_gpu_ctx_init_headless(
+                args.width as i32,
+                args.height as i32,
+                &gpu_config,
+            ),
+        };
         if ctx.is_null() {
             panic!("Failed to initialize lowlevel_ctx");
         }
         ctx
     };
-    window.raise();
+    if let Some(window) = window.as_mut() {
+        window.raise();
+    }
+    let mut encoder = match args.render_out.as_ref() {
+        Some(path) => Some(FrameEncoder::start(
+            path,
+            &args.render_codec,
+            args.width,
+            args.height,
+            args.fps,
+        )?),
+        None => None,
+    };
+    let mut frames_rendered = 0u64;
+
+    if let Some(cache_dir) = args.shader_cache_dir.as_ref() {
+        fs::create_dir_all(cache_dir)?;
+        let c_dir = CString::new(cache_dir.as_str())?;
+        unsafe {
+            match gfx_lowlevel_gpu_ctx_load_cache(lowlevel_ctx, c_dir.as_ptr()) {
+                0 => (),
+                err => eprintln!("Shader cache disabled, could not load {cache_dir}: {err}"),
+            }
+        }
+    }
+    let mut last_gpu_memory = GpuMemoryEvent::default();
+    let mut last_gpu_memory_check = SystemTime::now();
 
     let mut midi_devices = HashMap::new();
     {
@@ -91,6 +234,8 @@ pub fn main() -> anyhow::Result<()> {
     }
 
     let (midi_tx, midi_rx) = channel();
+    // bound CCs go straight to their uniforms from the midir threads
+    let midi_staging = Arc::new(MidiStaging::default());
     let _conns = if !args.midi_port.is_empty() {
         let mut conns = Vec::new();
         for device in args.midi_port {
@@ -102,10 +247,12 @@ pub fn main() -> anyhow::Result<()> {
                 let port = ports.get(*p).ok_or(anyhow::anyhow!("Invalid midi port"))?;
                 println!("Opening midi port {}", midi_in.port_name(port)?);
                 let midi_tx = midi_tx.clone();
+                let mut midi_writer = MidiWriter::new(midi_staging.clone());
                 conns.push(midi_in.connect(
                     port,
                     "midir-read-input",
                     move |stamp, message, _| {
+                        midi_writer.write(&name, message);
                         let key = if message.len() >= 2 { message[1] } else { 0 };
                         let vel = if message.len() >= 3 { message[2] } else { 0 };
                         midi_tx
@@ -159,7 +306,10 @@ pub fn main() -> anyhow::Result<()> {
         }
     }
 
-    let (mut canvas_w, mut canvas_h) = window.size();
+    let (mut canvas_w, mut canvas_h) = match window.as_ref() {
+        Some(window) => window.size(),
+        None => (args.width, args.height),
+    };
 
     let mut event_pump = sdl_context.event_pump().unwrap();
     let start_time = SystemTime::now().duration_since(UNIX_EPOCH).unwrap();
@@ -167,13 +317,31 @@ pub fn main() -> anyhow::Result<()> {
     let frames_per_sec = args.fps;
     let ns_per_frame = 1_000_000_000u128 / frames_per_sec as u128;
 
-    let mut frame = (start_time.as_nanos() / ns_per_frame) as i64;
+    // offline renders start at zero so the output doesn't depend on the clock
+    let mut frame = if headless {
+        0
+    } else {
+        (start_time.as_nanos() / ns_per_frame) as i64
+    };
 
+    AppRuntime::init_engine(&WasmOptions {
+        parallel_compilation: !args.no_parallel_compile,
+        cache_dir: args.wasm_cache_dir.as_ref().map(PathBuf::from),
+        ..WasmOptions::default().opt_level_named(&args.wasm_opt_level)?
+    })?;
     let mut loader = RuntimeLoader::new();
 
     let gfx_runtime = GfxRuntime::new(frames_per_sec, frame - 1);
+    gfx_runtime.set_midi_staging(midi_staging.clone());
 
-    loader.start(&args.wasm, &args.preopen_dir, None, args.fps, args.dry_run);
+    loader.start(
+        &args.wasm,
+        &args.preopen_dir,
+        None,
+        args.fps,
+        args.dry_run,
+        lowlevel_ctx,
+    );
     #[allow(unused)]
     let (mut try_app, mut reloaded) = loader.try_finish(
         true,
@@ -190,10 +358,23 @@ pub fn main() -> anyhow::Result<()> {
     if args.dry_run {
         return Ok(());
     }
-    window.raise();
+    if let Some(window) = window.as_mut() {
+        window.raise();
+    }
     let mut reg_events = vec![];
+    let mut pacer = FramePacer::new(
+        frames_per_sec,
+        if args.low_latency {
+            PacingProfile::LowLatency
+        } else {
+            PacingProfile::Smooth
+        },
+    );
 
     'running: loop {
+        let frame_start = Instant::now();
+        // time blocked on image acquire and present, not what the frame cost
+        let mut swapchain_wait = Duration::ZERO;
         assert_eq!(unsafe { (*lowlevel_ctx).started }, false);
         (try_app, reloaded) = loader.try_finish(
             false,
@@ -206,6 +387,11 @@ pub fn main() -> anyhow::Result<()> {
             lowlevel_ctx,
         );
 
+        // a reloaded app that registers nothing drops the old bindings
+        let bindings = try_app.as_ref().and_then(|app| app.take_midi_bindings());
+        if bindings.is_some() || reloaded {
+            midi_staging.set_bindings(bindings.unwrap_or_default());
+        }
         for evt in midi_rx.try_iter() {
             reg_events.push(GfxEvent::MidiEvent(evt));
         }
@@ -213,6 +399,13 @@ pub fn main() -> anyhow::Result<()> {
         if reloaded {
             reg_events.push(GfxEvent::ReloadEvent());
         }
+        reg_events.extend(loader.asset_events.drain(..).map(GfxEvent::AssetEvent));
+        reg_events.extend(
+            gfx_runtime
+                .storage_events()
+                .into_iter()
+                .map(GfxEvent::StorageEvent),
+        );
 
         lazy_static! {
             static ref ACC: Mod = Mod::RSHIFTMOD | Mod::LSHIFTMOD;
@@ -317,6 +510,11 @@ pub fn main() -> anyhow::Result<()> {
             }));
         }
 
+        if headless && try_app.is_none() {
+            eprintln!("App failed, ending render after {} frames", frames_rendered);
+            break 'running;
+        }
+
         if let Some(app_runtime) = try_app.as_ref() {
             let mut specs = match app_runtime.calc(
                 canvas_w,
@@ -334,9 +532,13 @@ pub fn main() -> anyhow::Result<()> {
             };
 
             reg_events.clear();
+            mixgraph::schedule(&mut specs, |name| gfx_runtime.writes_storage(name));
 
             unsafe {
-                if !gfx_lowlevel_gpu_ctx_start_frame(lowlevel_ctx) {
+                let acquire_start = Instant::now();
+                let started = gfx_lowlevel_gpu_ctx_start_frame(lowlevel_ctx);
+                swapchain_wait += acquire_start.elapsed();
+                if !started {
                     eprintln!("Failed to start frame looping");
                     continue 'running;
                 }
@@ -407,22 +609,60 @@ pub fn main() -> anyhow::Result<()> {
 
         gfx_runtime.set_last_frame_rendered(frame);
         unsafe {
+            let _span = trace::span("present", "gfx_lowlevel_gpu_ctx_finish_frame");
+            let present_start = Instant::now();
             match gfx_lowlevel_gpu_ctx_finish_frame(lowlevel_ctx) {
                 0 => (),
                 err => panic!("Failed to finish frame {}", err),
             }
+            swapchain_wait += present_start.elapsed();
         }
-        // sync video
-        let current_time = SystemTime::now().duration_since(UNIX_EPOCH).unwrap();
-        let frames_elapsed = ((current_time.as_nanos() / ns_per_frame) as i64 - frame).max(1);
-        frame += frames_elapsed as i64;
-        let next_time = Duration::from_nanos(frame as u64 * ns_per_frame as u64);
-
-        if next_time.gt(&current_time) {
-            ::std::thread::sleep(next_time.checked_sub(current_time).unwrap());
+        if !headless {
+            pacer.presented(frame_start);
+        }
+        if let Some(pending) = encoder.as_ref() {
+            let _span = trace::span("present", "readback");
+            // only wait on the GPU when every readback buffer is in flight
+            if let Err(e) = unsafe { drain_readbacks(lowlevel_ctx, pending, false) } {
+                return Err(finish_encoder_after(encoder.take().unwrap(), e));
+            }
+            frames_rendered += 1;
+        }
+        // next frame's uploads run while the GPU is still on this one
+        gfx_runtime.prefetch_uploads(lowlevel_ctx, frame);
+        gfx_runtime.enforce_vram_budget(lowlevel_ctx, frame);
+        if last_gpu_memory_check.elapsed().unwrap_or_default() >= GPU_MEMORY_INTERVAL {
+            last_gpu_memory_check = SystemTime::now();
+            let gpu_memory = gfx_runtime.gpu_memory(lowlevel_ctx);
+            if gpu_memory != last_gpu_memory {
+                trace::gpu_memory(&gpu_memory);
+                reg_events.push(GfxEvent::GpuMemoryEvent(gpu_memory.clone()));
+                last_gpu_memory = gpu_memory;
+            }
+        }
+        if !headless {
+            // offline renders take as long as they take at full scale
+            gfx_runtime.update_render_scale(frame_start.elapsed().saturating_sub(swapchain_wait));
+        }
+        trace::flush();
+        if args.show_mix_time
+            && last_stats_print.elapsed().unwrap_or_default() >= MIX_STATS_INTERVAL
+        {
+            last_stats_print = SystemTime::now();
+            // stdout, stderr is fed back to the app as log events
+            print!("{}", trace::stats_table());
+        }
+        if headless {
+            if args.render_frames > 0 && frames_rendered >= args.render_frames {
+                break 'running;
+            }
+            frame += 1;
+        } else {
+            // sync video, frames the grid passed while we were late are skipped
+            frame += pacer.wait();
         }
 
-        if fs::metadata(&args.wasm).unwrap().modified().unwrap() > last_loaded_wasm {
+        if !headless && fs::metadata(&args.wasm).unwrap().modified().unwrap() > last_loaded_wasm {
             last_loaded_wasm = SystemTime::now();
             println!("Autoloading wasm at: {}", Local::now().to_rfc3339());
             loader.start(
@@ -431,28 +671,100 @@ pub fn main() -> anyhow::Result<()> {
                 try_app.as_ref().and_then(|app| Some(app.clone())),
                 args.fps,
                 args.dry_run,
+                lowlevel_ctx,
             );
         }
     }
 
     //cleanup
+    if let Some(encoder) = encoder.take() {
+        if let Err(e) = unsafe { drain_readbacks(lowlevel_ctx, &encoder, true) } {
+            return Err(finish_encoder_after(encoder, e));
+        }
+        encoder.finish()?;
+        println!(
+            "Rendered {} frames to {}",
+            frames_rendered,
+            args.render_out.as_deref().unwrap_or("")
+        );
+    }
     if let Some(app) = try_app.take() {
         drop(app);
     }
     drop(gfx_runtime);
+    // a load still running warms up on a fork and saves the shader cache, both
+    // have to be done before the ctx goes
+    if let Some(handle) = loader.handle.take() {
+        handle.join().ok();
+    }
     unsafe {
         gfx_lowlevel_gpu_ctx_destroy((&mut lowlevel_ctx) as *mut *mut gfx_lowlevel_gpu_ctx);
     }
     Ok(())
 }
 
+// Hand finished offscreen frames to the encoder. Blocks for the oldest frame
+// when the readback ring is full so the next finish_frame has a free buffer,
+// or for everything still in flight with `all`.
+unsafe fn drain_readbacks(
+    ctx: *mut gfx_lowlevel_gpu_ctx,
+    encoder: &FrameEncoder,
+    all: bool,
+) -> anyhow::Result<()> {
+    loop {
+        let pending = (*ctx).readback.count as usize;
+        if pending == 0 {
+            return Ok(());
+        }
+        let block = all || pending == (*ctx).readback.bufs.len();
+        let mut out = encoder.frame();
+        let stride = out.stride(0) as i32;
+        let mut frame_id = 0u64;
+        match gfx_lowlevel_readback_next(
+            ctx,
+            out.data_mut(0).as_mut_ptr(),
+            stride,
+            if block { u64::MAX } else { 0 },
+            &mut frame_id,
+        ) {
+            0 => encoder.submit(out)?,
+            err if err == GFX_EAGAIN as i32 && !block => return Ok(()),
+            err => anyhow::bail!("Failed to read back frame {}: {}", frame_id, err),
+        }
+    }
+}
+
+// A readback failed, still flush the encoder so the file gets its trailer and
+// keep the encode thread's own error, which is often why the readback failed
+fn finish_encoder_after(encoder: FrameEncoder, err: anyhow::Error) -> anyhow::Error {
+    match encoder.finish() {
+        Ok(()) => err,
+        Err(encode_err) => anyhow::anyhow!("{err}, and the encoder failed: {encode_err}"),
+    }
+}
+
+// Forked gpu ctx handed to the loader thread for warming up assets
+struct WarmUpCtx(*mut gfx_lowlevel_gpu_ctx);
+unsafe impl Send for WarmUpCtx {}
+impl Drop for WarmUpCtx {
+    fn drop(&mut self) {
+        unsafe {
+            gfx_lowlevel_gpu_ctx_destroy(&mut self.0 as _);
+        }
+    }
+}
+
 struct RuntimeLoader {
-    handle: Option<JoinHandle<(AppRuntime, HashMap<String, GfxData>)>>,
+    handle: Option<JoinHandle<(AppRuntime, HashMap<String, GfxData>, Vec<AssetEvent>)>>,
+    asset_events: Vec<AssetEvent>,
 }
 
 impl RuntimeLoader {
     fn new() -> Self {
-        Self { handle: None }
+        Self {
+            handle: None,
+            asset_events: vec![],
+        }
     }
 
     fn start<T: AsRef<Path>>(
@@ -462,6 +774,7 @@ impl RuntimeLoader {
         cached: Option<Arc<AppRuntime>>,
         frames_per_second: i64,
         dry_run: bool,
+        lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx,
     ) {
         if self.handle.is_some() {
             return;
@@ -469,6 +782,17 @@ impl RuntimeLoader {
 
         let path: PathBuf = PathBuf::from(path.as_ref());
         let preopen_dir: PathBuf = PathBuf::from(preopen_dir.as_ref());
+        let warm_up_ctx = if dry_run {
+            None
+        } else {
+            let fork = unsafe { gfx_lowlevel_gpu_ctx_fork(lowlevel_ctx) };
+            if fork.is_null() {
+                eprintln!("Could not fork gpu ctx, assets will be prepared on first use");
+                None
+            } else {
+                Some(WarmUpCtx(fork))
+            }
+        };
         self.handle = Some(thread::spawn(move || -> _ {
             let cached_assets = cached.as_ref().map(|ar| ar.loaded_asset_info().clone());
             match AppRuntime::load(
@@ -480,7 +804,30 @@ impl RuntimeLoader {
             ) {
                 Ok((app, loaded_gfx_data)) => {
                     println!("Built at: {}", Local::now().to_rfc3339());
-                    (app, loaded_gfx_data)
+                    let mut asset_events = vec![];
+                    if let Some(ctx) = warm_up_ctx.as_ref() {
+                        for (name, gfx_data) in loaded_gfx_data.iter() {
+                            let state = match gfx_data.warm_up(ctx.0) {
+                                Ok(()) => AssetState::Ready,
+                                Err(e) => {
+                                    eprintln!("Could not warm up {}: {}", name, e);
+                                    AssetState::Failed(e.to_string())
+                                }
+                            };
+                            asset_events.push(AssetEvent {
+                                name: name.clone(),
+                                state,
+                            });
+                        }
+                        eprintln!("Warm up complete at {}", Local::now().to_rfc3339());
+                        // saved here rather than from the render loop, which only
+                        // saves again at shutdown
+                        match unsafe { gfx_lowlevel_gpu_ctx_save_cache(ctx.0) } {
+                            0 => (),
+                            err => eprintln!("Could not save shader cache: {err}"),
+                        }
+                    }
+                    (app, loaded_gfx_data, asset_events)
                 }
                 Err(e) => panic!("{}", e),
             }
@@ -506,7 +853,7 @@ impl RuntimeLoader {
             return (try_app, false);
         }
 
-        let (app, mut loaded_gfx_data) = match self.handle.take().unwrap().join() {
+        let (app, mut loaded_gfx_data, asset_events) = match self.handle.take().unwrap().join() {
             Ok(result) => result,
             Err(e) => {
                 let msg = format!("Failed to finish loading: {:?}", e);
@@ -546,6 +893,7 @@ impl RuntimeLoader {
         for (_, gfx_data) in loaded_gfx_data.drain() {
             gfx_runtime.add(gfx_data.info(), gfx_data)
         }
+        self.asset_events.extend(asset_events);
 
         for k in to_remove {
             if let Err(e) = gfx_runtime.remove(&k) {
@@ -0,0 +1,265 @@
+use anyhow::{bail, Result};
+use ffmpeg_next::{
+    codec, encoder,
+    format::{self, context::Output, Pixel},
+    frame::Video,
+    software::scaling,
+    Packet, Rational,
+};
+use std::{
+    path::Path,
+    sync::mpsc::{channel, sync_channel, Receiver, Sender, SyncSender},
+    thread::{self, JoinHandle},
+};
+
+extern crate ffmpeg_next as ffmpeg;
+
+pub const DEFAULT_RENDER_CODEC: &str = "hevc_videotoolbox";
+
+// Frames that can wait for the encoder before submit blocks the renderer
+const ENCODE_QUEUE: usize = 8;
+
+/// Encodes RGBA frames to a file on its own thread. Frames handed to `submit`
+/// come back through `frame` once they're encoded so steady state rendering
+/// doesn't allocate.
+pub struct FrameEncoder {
+    frames: Option<SyncSender<Video>>,
+    recycled: Receiver<Video>,
+    handle: Option<JoinHandle<Result<()>>>,
+    width: u32,
+    height: u32,
+}
+
+impl FrameEncoder {
+    pub fn start<P: AsRef<Path>>(
+        path: P,
+        codec_name: &str,
+        width: u32,
+        height: u32,
+        fps: i64,
+    ) -> Result<FrameEncoder> {
+        let path = path.as_ref().to_path_buf();
+        let codec_name = codec_name.to_string();
+        let (frames_tx, frames_rx) = sync_channel::<Video>(ENCODE_QUEUE);
+        let (recycled_tx, recycled_rx) = channel();
+        let (init_tx, init_rx) = sync_channel(1);
+
+        let handle =
+            thread::Builder::new()
+                .name(String::from("encode"))
+                .spawn(move || -> Result<()> {
+                    let output = match open_output(&path, &codec_name, width, height, fps) {
+                        Ok(v) => v,
+                        Err(e) => {
+                            let msg = e.to_string();
+                            init_tx.send(Err(e)).ok();
+                            bail!("{}", msg);
+                        }
+                    };
+                    init_tx.send(Ok(())).ok();
+                    let (octx, encoder, scaler, pix) = output;
+                    encode(
+                        octx,
+                        encoder,
+                        scaler,
+                        pix,
+                        width,
+                        height,
+                        fps,
+                        frames_rx,
+                        recycled_tx,
+                    )
+                })?;
+
+        match init_rx.recv() {
+            Ok(Ok(())) => (),
+            Ok(Err(e)) => {
+                handle.join().ok();
+                return Err(e);
+            }
+            Err(_) => {
+                handle.join().ok();
+                bail!("Encode thread exited during startup");
+            }
+        }
+
+        Ok(FrameEncoder {
+            frames: Some(frames_tx),
+            recycled: recycled_rx,
+            handle: Some(handle),
+            width,
+            height,
+        })
+    }
+
+    /// An RGBA frame to render the next output into
+    pub fn frame(&self) -> Video {
+        match self.recycled.try_recv() {
+            Ok(frame) => frame,
+            Err(_) => Video::new(Pixel::RGBA, self.width, self.height),
+        }
+    }
+
+    pub fn submit(&self, frame: Video) -> Result<()> {
+        let Some(frames) = self.frames.as_ref() else {
+            bail!("Encoder already finished");
+        };
+        if frames.send(frame).is_err() {
+            bail!("Encode thread is gone");
+        }
+        Ok(())
+    }
+
+    /// Flush the encoder and write the trailer
+    pub fn finish(mut self) -> Result<()> {
+        self.frames.take();
+        match self.handle.take().map(|h| h.join()) {
+            Some(Ok(result)) => result,
+            Some(Err(_)) => bail!("Encode thread panicked"),
+            None => Ok(()),
+        }
+    }
+}
+
+impl Drop for FrameEncoder {
+    fn drop(&mut self) {
+        self.frames.take();
+        if let Some(handle) = self.handle.take() {
+            handle.join().ok();
+        }
+    }
+}
+
+fn open_output(
+    path: &Path,
+    codec_name: &str,
+    width: u32,
+    height: u32,
+    fps: i64,
+) -> Result<(
+    Output,
+    encoder::video::Encoder,
+    Option<scaling::Context>,
+    Pixel,
+)> {
+    let Some(codec) = encoder::find_by_name(codec_name) else {
+        bail!("No encoder named {}", codec_name);
+    };
+    let mut octx = match format::output(&path) {
+        Ok(octx) => octx,
+        Err(e) => bail!("Could not create {:?}: {}", path, e),
+    };
+    let global_header = octx.format().flags().contains(format::Flags::GLOBAL_HEADER);
+
+    // the first software format the encoder takes, VideoToolbox lists its
+    // hardware format too
+    let pix = codec
+        .video()?
+        .formats()
+        .and_then(|mut formats| formats.find(|f| *f != Pixel::VIDEOTOOLBOX && *f != Pixel::None))
+        .unwrap_or(Pixel::NV12);
+
+    let mut ost = octx.add_stream(codec)?;
+    let mut video = codec::context::Context::new_with_codec(codec)
+        .encoder()
+        .video()?;
+    video.set_width(width);
+    video.set_height(height);
+    video.set_format(pix);
+    video.set_time_base(Rational::new(1, fps as i32));
+    video.set_frame_rate(Some(Rational::new(fps as i32, 1)));
+    if global_header {
+        video.set_flags(codec::Flags::GLOBAL_HEADER);
+    }
+    let encoder = match video.open_as(codec) {
+        Ok(encoder) => encoder,
+        Err(e) => bail!("Could not open encoder {}: {}", codec_name, e),
+    };
+    ost.set_parameters(&encoder);
+    octx.write_header()?;
+
+    let scaler = if pix == Pixel::RGBA {
+        None
+    } else {
+        Some(scaling::Context::get(
+            Pixel::RGBA,
+            width,
+            height,
+            pix,
+            width,
+            height,
+            scaling::Flags::BILINEAR,
+        )?)
+    };
+
+    Ok((octx, encoder, scaler, pix))
+}
+
+fn encode(
+    mut octx: Output,
+    mut encoder: encoder::video::Encoder,
+    mut scaler: Option<scaling::Context>,
+    pix: Pixel,
+    width: u32,
+    height: u32,
+    fps: i64,
+    frames: Receiver<Video>,
+    recycled: Sender<Video>,
+) -> Result<()> {
+    let time_base = Rational::new(1, fps as i32);
+    let Some(stream_time_base) = octx.stream(0).map(|s| s.time_base()) else {
+        bail!("Output has no stream");
+    };
+    let mut converted = Video::new(pix, width, height);
+    let mut pts = 0;
+    for mut frame in frames.iter() {
+        let out = match scaler.as_mut() {
+            Some(scaler) => {
+                // the encoder may still hold a ref to the last one it was sent
+                if unsafe { ffmpeg::ffi::av_frame_make_writable(converted.as_mut_ptr()) } < 0 {
+                    bail!("Could not make the conversion frame writable");
+                }
+                scaler.run(&frame, &mut converted)?;
+                &mut converted
+            }
+            None => &mut frame,
+        };
+        out.set_pts(Some(pts));
+        pts += 1;
+        encoder.send_frame(out)?;
+        write_packets(&mut encoder, &mut octx, time_base, stream_time_base)?;
+        // only frames the encoder let go of are rendered into again, the
+        // rest are freed once it's done with them
+        if unsafe { ffmpeg::ffi::av_frame_is_writable(frame.as_mut_ptr()) } != 0 {
+            recycled.send(frame).ok();
+        }
+    }
+
+    encoder.send_eof()?;
+    write_packets(&mut encoder, &mut octx, time_base, stream_time_base)?;
+    octx.write_trailer()?;
+    Ok(())
+}
+
+fn write_packets(
+    encoder: &mut encoder::video::Encoder,
+    octx: &mut Output,
+    time_base: Rational,
+    stream_time_base: Rational,
+) -> Result<()> {
+    let mut packet = Packet::empty();
+    loop {
+        match encoder.receive_packet(&mut packet) {
+            Ok(()) => {
+                packet.set_stream(0);
+                packet.rescale_ts(time_base, stream_time_base);
+                packet.write_interleaved(octx)?;
+            }
+            Err(ffmpeg_next::Error::Other {
+                errno: ffmpeg_next::ffi::EAGAIN,
+            })
+            | Err(ffmpeg_next::Error::Eof) => return Ok(()),
+            Err(e) => bail!("Error encoding {}:{}: {e}", file!(), line!()),
+        }
+    }
+}
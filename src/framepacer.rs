@@ -0,0 +1,121 @@
+use std::{
+    thread,
+    time::{Duration, Instant},
+};
+
+// thread::sleep overshoots by up to a millisecond or so, the last stretch
+// before a deadline is spun instead
+const SPIN: Duration = Duration::from_micros(1500);
+
+// How quickly the frame cost estimate follows a slower frame, and a faster one.
+// Rising fast keeps one slow frame from being followed by a late one.
+const COST_RISE: f64 = 0.5;
+const COST_FALL: f64 = 0.05;
+
+/// How much slack a frame gets between starting and its present
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PacingProfile {
+    /// Half a period of headroom over the measured frame cost
+    Smooth,
+    /// Start as late as the measured frame cost allows, so MIDI and keys read
+    /// at the start of the frame are as fresh as possible when it's shown
+    LowLatency,
+}
+
+/// Schedules frame starts against a fixed grid of present times, one period
+/// apart from the first present, instead of wall clock sleeps. finish_frame
+/// blocks in the swapchain until the frame is queued, so when it returns is
+/// the closest thing to a present timestamp libplacebo gives us, that is
+/// what the frame cost is measured to.
+pub struct FramePacer {
+    period: Duration,
+    margin: Duration,
+    // when the next frame should be presented, always on the grid
+    target: Option<Instant>,
+    // grid points the target moved by at the last present, more than one
+    // when a late frame made it skip some
+    advanced: u32,
+    // frame start to present, including any time blocked in the swapchain
+    cost: Duration,
+}
+
+impl FramePacer {
+    pub fn new(fps: i64, profile: PacingProfile) -> Self {
+        let period = Duration::from_nanos(1_000_000_000 / fps.max(1) as u64);
+        let margin = match profile {
+            PacingProfile::Smooth => period / 2,
+            PacingProfile::LowLatency => (period / 8).max(Duration::from_millis(1)),
+        };
+        Self {
+            period,
+            margin,
+            target: None,
+            advanced: 1,
+            cost: Duration::ZERO,
+        }
+    }
+
+    /// Record a present, call right after finish_frame returns for the frame
+    /// that started at `start`
+    pub fn presented(&mut self, start: Instant) {
+        let now = Instant::now();
+        let cost = now.saturating_duration_since(start);
+        let weight = if cost > self.cost {
+            COST_RISE
+        } else {
+            COST_FALL
+        };
+        self.cost = self.cost.mul_f64(1.0 - weight) + cost.mul_f64(weight);
+
+        // the grid starts at the first present, after that presents landing
+        // early or late don't move it, only whole periods already passed
+        // are skipped
+        let Some(target) = self.target else {
+            self.target = Some(now + self.period);
+            self.advanced = 1;
+            return;
+        };
+        let mut next = target + self.period;
+        let mut advanced = 1;
+        if next <= now {
+            let behind = (now - next).as_nanos() / self.period.as_nanos().max(1) + 1;
+            next += self.period * behind as u32;
+            advanced += behind as u32;
+        }
+        self.target = Some(next);
+        self.advanced = advanced;
+    }
+
+    /// When the next frame should start to be presented on its grid point,
+    /// now if that's already passed
+    pub fn next_start(&self) -> Instant {
+        let now = Instant::now();
+        let Some(target) = self.target else {
+            return now;
+        };
+        let lead = self.cost + self.margin;
+        match target.checked_sub(lead) {
+            Some(start) if start > now => start,
+            _ => now,
+        }
+    }
+
+    /// Sleep until next_start, spinning the last stretch so the frame doesn't
+    /// inherit the scheduler's wake up jitter. Returns how many frames the
+    /// grid moved on since the last one, to advance the frame number by.
+    pub fn wait(&self) -> i64 {
+        let deadline = self.next_start();
+        loop {
+            let now = Instant::now();
+            if now >= deadline {
+                return self.advanced as i64;
+            }
+            let left = deadline - now;
+            if left > SPIN {
+                thread::sleep(left - SPIN);
+            } else {
+                thread::yield_now();
+            }
+        }
+    }
+}
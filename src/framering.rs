@@ -0,0 +1,93 @@
+use std::{
+    cell::UnsafeCell,
+    mem::MaybeUninit,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+/// Bounded single producer / single consumer queue.
+///
+/// `head` is only written by the consumer and `tail` only by the producer so
+/// neither side ever takes a lock. Pushing from more than one thread (or
+/// popping from more than one) at a time is not supported.
+pub struct FrameRing<T> {
+    slots: Box<[UnsafeCell<MaybeUninit<T>>]>,
+    head: AtomicUsize,
+    tail: AtomicUsize,
+}
+
+unsafe impl<T: Send> Send for FrameRing<T> {}
+unsafe impl<T: Send> Sync for FrameRing<T> {}
+
+impl<T> FrameRing<T> {
+    pub fn new(capacity: usize) -> Self {
+        assert!(capacity > 0, "ring needs at least one slot");
+        // one slot stays empty to tell full from empty
+        let slots = (0..capacity + 1)
+            .map(|_| UnsafeCell::new(MaybeUninit::uninit()))
+            .collect();
+        Self {
+            slots,
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.slots.len() - 1
+    }
+
+    pub fn len(&self) -> usize {
+        let head = self.head.load(Ordering::Acquire);
+        let tail = self.tail.load(Ordering::Acquire);
+        (tail + self.slots.len() - head) % self.slots.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    pub fn is_full(&self) -> bool {
+        self.len() == self.capacity()
+    }
+
+    /// Producer side, hands the value back if there is no room
+    pub fn push(&self, value: T) -> Result<(), T> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let next = (tail + 1) % self.slots.len();
+        if next == self.head.load(Ordering::Acquire) {
+            return Err(value);
+        }
+        unsafe {
+            (*self.slots[tail].get()).write(value);
+        }
+        self.tail.store(next, Ordering::Release);
+        Ok(())
+    }
+
+    /// Consumer side
+    pub fn pop(&self) -> Option<T> {
+        let head = self.head.load(Ordering::Relaxed);
+        if head == self.tail.load(Ordering::Acquire) {
+            return None;
+        }
+        let value = unsafe { (*self.slots[head].get()).assume_init_read() };
+        self.head
+            .store((head + 1) % self.slots.len(), Ordering::Release);
+        Some(value)
+    }
+
+    /// Consumer side, look at the next value without taking it
+    pub fn peek(&self) -> Option<&T> {
+        let head = self.head.load(Ordering::Relaxed);
+        if head == self.tail.load(Ordering::Acquire) {
+            return None;
+        }
+        Some(unsafe { (*self.slots[head].get()).assume_init_ref() })
+    }
+}
+
+impl<T> Drop for FrameRing<T> {
+    fn drop(&mut self) {
+        while self.pop().is_some() {}
+    }
+}
@@ -45,12 +45,23 @@ impl From<GfxInfo> for Asset {
                 opts: v.opts,
                 hardware_decode: v.hardware_decode,
                 software_filter: v.software_filter,
+                gpu_convert: v.gpu_convert,
+                decode_ahead: v.decode_ahead,
+                cue_points_ms: v.cue_points_ms,
+                image_sequence_fps: v.image_sequence_fps,
+                decode_threading: v.decode_threading,
+                decode_threads: v.decode_threads,
             }),
             GfxInfo::VidMixerInfo(v) => Asset::VidMixer(VidMixer {
                 name: v.name,
                 shader: v.shader,
                 width: v.width,
                 height: v.height,
+                render_scale_pct: v.render_scale_pct,
+                min_render_scale_pct: v.min_render_scale_pct,
+                scaler: v.scaler,
+                buffer_format: v.buffer_format,
+                pass_formats: v.pass_formats,
             }),
         }
     }
@@ -107,6 +118,18 @@ pub struct VidInfo {
     pub realtime: bool,
     pub hardware_decode: bool,
     pub software_filter: bool,
+    #[serde(default)]
+    pub gpu_convert: bool,
+    #[serde(default)]
+    pub decode_ahead: usize,
+    #[serde(default)]
+    pub cue_points_ms: Vec<u64>,
+    #[serde(default)]
+    pub image_sequence_fps: u32,
+    #[serde(default)]
+    pub decode_threading: DecodeThreading,
+    #[serde(default)]
+    pub decode_threads: u32,
 }
 
 impl VidInfo {
@@ -128,6 +151,35 @@ pub struct Vid {
     pub opts: Option<Vec<(String, String)>>,
     pub hardware_decode: bool,
     pub software_filter: bool,
+    /// Upload YUV planes as is and convert to RGBA on the GPU instead of with sws_scale
+    #[serde(default)]
+    pub gpu_convert: bool,
+    /// Frames decoded ahead of the mixer on the decode thread, 0 picks the default
+    #[serde(default)]
+    pub decode_ahead: usize,
+    /// Seek targets in milliseconds whose frames are decoded up front so SeekVid to them is instant
+    #[serde(default)]
+    pub cue_points_ms: Vec<u64>,
+    /// Load every image path matches as one frame each at this rate, 0 plays a single file
+    #[serde(default)]
+    pub image_sequence_fps: u32,
+    /// How a software decoder spreads over cores
+    #[serde(default)]
+    pub decode_threading: DecodeThreading,
+    /// Threads for software decoding and conversion, 0 takes an even share of the cores
+    #[serde(default)]
+    pub decode_threads: u32,
+}
+
+#[derive(Serialize, Deserialize, Clone, Copy, Default, Debug, PartialEq, Eq, Hash)]
+pub enum DecodeThreading {
+    /// Frames where the codec can, slices otherwise, and only slices for realtime inputs
+    #[default]
+    Auto,
+    /// Several frames in flight at once, as many frames of latency as threads
+    Frame,
+    /// Each frame split between threads, no added latency but needs a sliced stream
+    Slice,
 }
 
 impl Vid {
@@ -150,6 +202,12 @@ pub struct VidBuilder {
     pub realtime: bool,
     pub hardware_decode: bool,
     pub software_filter: bool,
+    pub gpu_convert: bool,
+    pub decode_ahead: usize,
+    pub cue_points_ms: Vec<u64>,
+    pub image_sequence_fps: u32,
+    pub decode_threading: DecodeThreading,
+    pub decode_threads: u32,
 }
 
 impl VidBuilder {
@@ -232,6 +290,36 @@ impl VidBuilder {
         self
     }
 
+    pub fn gpu_convert(mut self, gpu_convert: bool) -> Self {
+        self.gpu_convert = gpu_convert;
+        self
+    }
+
+    pub fn decode_ahead(mut self, decode_ahead: usize) -> Self {
+        self.decode_ahead = decode_ahead;
+        self
+    }
+
+    pub fn cue_points_ms(mut self, cue_points_ms: Vec<u64>) -> Self {
+        self.cue_points_ms = cue_points_ms;
+        self
+    }
+
+    pub fn image_sequence_fps(mut self, image_sequence_fps: u32) -> Self {
+        self.image_sequence_fps = image_sequence_fps;
+        self
+    }
+
+    pub fn decode_threading(mut self, decode_threading: DecodeThreading) -> Self {
+        self.decode_threading = decode_threading;
+        self
+    }
+
+    pub fn decode_threads(mut self, decode_threads: u32) -> Self {
+        self.decode_threads = decode_threads;
+        self
+    }
+
     pub fn build(self) -> Vid {
         Vid {
             name: self.name,
@@ -245,6 +333,12 @@ impl VidBuilder {
             realtime: self.realtime,
             hardware_decode: self.hardware_decode,
             software_filter: self.software_filter,
+            gpu_convert: self.gpu_convert,
+            decode_ahead: self.decode_ahead,
+            cue_points_ms: self.cue_points_ms,
+            image_sequence_fps: self.image_sequence_fps,
+            decode_threading: self.decode_threading,
+            decode_threads: self.decode_threads,
         }
     }
 }
@@ -265,6 +359,21 @@ pub struct VidMixer {
     pub shader: Option<String>,
     pub width: u32,
     pub height: u32,
+    /// Percent of width/height the passes render at, 0 renders at full size
+    #[serde(default)]
+    pub render_scale_pct: u32,
+    /// Lets the scale drop as low as this percent when frames go over budget, 0 keeps it fixed
+    #[serde(default)]
+    pub min_render_scale_pct: u32,
+    /// libplacebo filter the output is scaled to the window with, e.g. "ewa_lanczos", bilinear by default
+    #[serde(default)]
+    pub scaler: Option<String>,
+    /// Texture format of the pass buffers, e.g. "rgba16f" or "r11g11b10f", "rgba8" by default
+    #[serde(default)]
+    pub buffer_format: Option<String>,
+    /// Per pass overrides of buffer_format by pass index, empty strings keep the default
+    #[serde(default)]
+    pub pass_formats: Vec<String>,
 }
 
 impl VidMixer {
@@ -278,6 +387,11 @@ pub struct VidMixerBuilder {
     shader: Option<String>,
     width: Option<u32>,
     height: Option<u32>,
+    render_scale_pct: u32,
+    min_render_scale_pct: u32,
+    scaler: Option<String>,
+    buffer_format: Option<String>,
+    pass_formats: Vec<String>,
 }
 
 impl VidMixerBuilder {
@@ -287,6 +401,11 @@ impl VidMixerBuilder {
             shader: None,
             width: None,
             height: None,
+            render_scale_pct: 0,
+            min_render_scale_pct: 0,
+            scaler: None,
+            buffer_format: None,
+            pass_formats: vec![],
         }
     }
 
@@ -316,6 +435,43 @@ impl VidMixerBuilder {
         self
     }
 
+    pub fn render_scale_pct(mut self, render_scale_pct: u32) -> Self {
+        self.render_scale_pct = render_scale_pct;
+        self
+    }
+
+    pub fn min_render_scale_pct(mut self, min_render_scale_pct: u32) -> Self {
+        self.min_render_scale_pct = min_render_scale_pct;
+        self
+    }
+
+    pub fn scaler<T>(mut self, scaler: T) -> Self
+    where
+        T: AsRef<str>,
+    {
+        self.scaler = Some(scaler.as_ref().into());
+        self
+    }
+
+    pub fn buffer_format<T>(mut self, buffer_format: T) -> Self
+    where
+        T: AsRef<str>,
+    {
+        self.buffer_format = Some(buffer_format.as_ref().into());
+        self
+    }
+
+    pub fn pass_format<T>(mut self, pass: usize, format: T) -> Self
+    where
+        T: AsRef<str>,
+    {
+        if self.pass_formats.len() <= pass {
+            self.pass_formats.resize(pass + 1, String::new());
+        }
+        self.pass_formats[pass] = format.as_ref().into();
+        self
+    }
+
     pub fn build(self) -> VidMixer {
         VidMixer {
             name: self.name.unwrap(),
@@ -324,6 +480,11 @@ impl VidMixerBuilder {
             )),
             width: self.width.unwrap(),
             height: self.height.unwrap(),
+            render_scale_pct: self.render_scale_pct,
+            min_render_scale_pct: self.min_render_scale_pct,
+            scaler: self.scaler,
+            buffer_format: self.buffer_format,
+            pass_formats: self.pass_formats,
         }
     }
 }
@@ -334,6 +495,16 @@ pub struct VidMixerInfo {
     pub shader: Option<String>,
     pub width: u32,
     pub height: u32,
+    #[serde(default)]
+    pub render_scale_pct: u32,
+    #[serde(default)]
+    pub min_render_scale_pct: u32,
+    #[serde(default)]
+    pub scaler: Option<String>,
+    #[serde(default)]
+    pub buffer_format: Option<String>,
+    #[serde(default)]
+    pub pass_formats: Vec<String>,
 }
 
 impl From<VidMixer> for VidMixerInfo {
@@ -343,6 +514,11 @@ impl From<VidMixer> for VidMixerInfo {
             shader: value.shader,
             width: value.width,
             height: value.height,
+            render_scale_pct: value.render_scale_pct,
+            min_render_scale_pct: value.min_render_scale_pct,
+            scaler: value.scaler,
+            buffer_format: value.buffer_format,
+            pass_formats: value.pass_formats,
         }
     }
 }
@@ -892,6 +1068,46 @@ pub struct LogEvent {
     pub message: String,
 }
 
+#[derive(Clone, Debug, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub enum AssetState {
+    Ready,
+    Failed(String),
+}
+
+/// Sent once per newly loaded asset after it was warmed up in the background
+#[derive(Clone, Debug, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub struct AssetEvent {
+    pub name: String,
+    pub state: AssetState,
+}
+
+/// Contents of a mixer's `//!STORAGE` buffer after its `frame`th mix. They
+/// arrive a few frames after they were written.
+#[derive(Clone, Debug, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub struct StorageEvent {
+    pub mixer: String,
+    pub name: String,
+    pub frame: i64,
+    pub values: Vec<u32>,
+}
+
+/// What frame contexts hold in VRAM, sent about once a second while it changes
+#[derive(Clone, Debug, Default, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub struct GpuMemoryEvent {
+    /// 0 without a limit
+    pub budget_bytes: u64,
+    /// Pass buffers and scratch textures of loaded mixers
+    pub mixer_bytes: u64,
+    /// Released mixer textures kept for reuse
+    pub idle_bytes: u64,
+    /// Video textures, GPU conversion targets and upload buffers
+    pub video_bytes: u64,
+    /// Mixers holding buffers
+    pub resident_mixers: u32,
+    /// Idle mixers whose buffers were dropped to stay under the budget, ever
+    pub evicted_mixers: u64,
+}
+
 #[derive(Serialize, Deserialize, Clone, Debug, PartialEq, Eq, Hash)]
 pub enum GfxEvent {
     KeyEvent(KeyEvent),
@@ -899,4 +1115,7 @@ pub enum GfxEvent {
     FrameEvent(FrameEvent),
     ReloadEvent(),
     LogEvent(LogEvent),
+    AssetEvent(AssetEvent),
+    StorageEvent(StorageEvent),
+    GpuMemoryEvent(GpuMemoryEvent),
 }
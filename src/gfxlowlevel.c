@@ -14,31 +14,392 @@
 #pragma GCC diagnostic ignored "-Wswitch"
 #include <libplacebo/utils/libav.h>
 #pragma GCC diagnostic pop
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 #include <libavutil/pixfmt.h>
+#include <libavutil/time.h>
 #include <libplacebo/utils/upload.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __APPLE__
+#include <CoreVideo/CoreVideo.h>
+#include <IOSurface/IOSurface.h>
+#include <vulkan/vulkan_metal.h>
+
+// Number of distinct IOSurfaces kept imported per frame ctx, the decoder
+// recycles a small pool of pixel buffers so this rarely has to evict
+#define GFX_INTEROP_CACHE_SIZE 8
+// Most frames kept referenced so the decoder can't recycle a surface the GPU
+// may still be sampling, one per queued frame plus the one being recorded
+#define GFX_INTEROP_IN_FLIGHT (GFX_LOWLEVEL_MAX_FRAMES_IN_FLIGHT + 1)
+// Swapchain depth libplacebo picks when frames_in_flight is 0
+#define GFX_INTEROP_DEFAULT_DEPTH 3
+
+struct gfx_lowlevel_interop_entry {
+  IOSurfaceRef surface;
+  VkImage image;
+  VkDeviceMemory memory;
+  pl_tex tex;
+  uint64_t last_used;
+};
+
+struct gfx_lowlevel_interop {
+  struct gfx_lowlevel_interop_entry entries[GFX_INTEROP_CACHE_SIZE];
+  AVFrame* in_flight[GFX_INTEROP_IN_FLIGHT];
+  int in_flight_idx;
+  uint64_t counter;
+};
+#else
+struct gfx_lowlevel_interop {
+  int unused;
+};
+#endif
+
+static void gfx_lowlevel_interop_destroy(struct gfx_lowlevel_gpu_ctx* ctx,
+                                         struct gfx_lowlevel_interop** interop);
+
+// Descriptors start out empty and are laid out by the first render
+static void gfx_lowlevel_render_template_init(
+    struct gfx_lowlevel_render_template* tmpl, pl_gpu gpu) {
+  memset(tmpl, 0, sizeof(*tmpl));
+  tmpl->num_frames = -1;
+  tmpl->attrib = (struct pl_shader_va){
+      .attr =
+          {
+              .name = "src_uv",
+              .offset = 0,
+              .fmt = pl_find_vertex_fmt(gpu, PL_FMT_FLOAT, 2),
+          },
+      .data = {tmpl->verts, tmpl->verts + 2, tmpl->verts + 4,
+               tmpl->verts + 6},
+  };
+}
+
+static void gfx_lowlevel_render_template_free(
+    struct gfx_lowlevel_render_template* tmpl) {
+  for (int i = 0; i < tmpl->num_src_names; i++) {
+    free(tmpl->src_names[i]);
+  }
+  for (int i = 0; i < tmpl->num_pass_names; i++) {
+    free(tmpl->pass_names[i]);
+  }
+  free(tmpl->src_names);
+  free(tmpl->pass_names);
+  free(tmpl->descs);
+  memset(tmpl, 0, sizeof(*tmpl));
+}
+
+// Make sure names[0..count) exist, formatting the new ones from prefix
+static int gfx_lowlevel_render_template_names(char*** names, int* num_names,
+                                              int count, const char* prefix) {
+  if (count <= *num_names) {
+    return 0;
+  }
+  char** grown = realloc(*names, sizeof(char*) * count);
+  if (!grown) {
+    return ENOMEM;
+  }
+  *names = grown;
+  for (; *num_names < count; (*num_names)++) {
+    char* name = malloc(32);
+    if (!name) {
+      return ENOMEM;
+    }
+    snprintf(name, 32, "%s%d", prefix, *num_names);
+    grown[*num_names] = name;
+  }
+  return 0;
+}
+
+// Lay the descriptors out again if the numbers of frames, passes or storage
+// changed, then patch in this render's textures and src rect
+static int gfx_lowlevel_render_template_fill(
+    struct gfx_lowlevel_render_template* tmpl,
+    struct gfx_lowlevel_filter_params const* params,
+    struct pl_frame** src_frames, int num_frames, struct pl_frame** passes,
+    int num_passes) {
+  int num_storage = params->num_storage;
+  int total = num_frames + num_passes + num_storage;
+  if (total > tmpl->desc_capacity) {
+    int capacity = tmpl->desc_capacity ? tmpl->desc_capacity : 16;
+    while (capacity < total) {
+      capacity *= 2;
+    }
+    struct pl_shader_desc* descs =
+        realloc(tmpl->descs, sizeof(struct pl_shader_desc) * capacity);
+    if (!descs) {
+      fprintf(stderr, "gfx_ll> Failed to grow render descriptors to %d\n",
+              capacity);
+      return ENOMEM;
+    }
+    tmpl->descs = descs;
+    tmpl->desc_capacity = capacity;
+    tmpl->num_frames = -1;
+  }
+  if (gfx_lowlevel_render_template_names(&tmpl->src_names,
+                                         &tmpl->num_src_names, num_frames,
+                                         "src_tex") != 0 ||
+      gfx_lowlevel_render_template_names(&tmpl->pass_names,
+                                         &tmpl->num_pass_names, num_passes,
+                                         "pass_tex") != 0) {
+    fprintf(stderr, "gfx_ll> Failed to allocate render descriptor names\n");
+    return ENOMEM;
+  }
+
+  if (tmpl->num_frames != num_frames || tmpl->num_passes != num_passes ||
+      tmpl->num_storage != num_storage) {
+    for (int i = 0; i < num_frames + num_passes; i++) {
+      tmpl->descs[i] = (struct pl_shader_desc){
+          .desc = {.name = i < num_frames ? tmpl->src_names[i]
+                                          : tmpl->pass_names[i - num_frames],
+                   .type = PL_DESC_SAMPLED_TEX,
+                   .binding = i,
+                   .access = PL_DESC_ACCESS_READONLY},
+          .binding =
+              {
+                  .address_mode = PL_TEX_ADDRESS_REPEAT,
+                  .sample_mode = PL_TEX_SAMPLE_LINEAR,
+              },
+      };
+    }
+    tmpl->num_frames = num_frames;
+    tmpl->num_passes = num_passes;
+    tmpl->num_storage = num_storage;
+  }
+
+  for (int i = 0; i < num_frames; i++) {
+    tmpl->descs[i].binding.object = src_frames[i]->planes[0].texture;
+  }
+  for (int i = 0; i < num_passes; i++) {
+    tmpl->descs[num_frames + i].binding.object = passes[i]->planes[0].texture;
+  }
+  // storage can be a different set of buffers each render, and is few enough
+  // to just write out again
+  for (int i = 0; i < num_storage; i++) {
+    struct gfx_lowlevel_storage* storage = params->storage[i];
+    int slot = num_frames + num_passes + i;
+    tmpl->descs[slot] = (struct pl_shader_desc){
+        .desc = {.name = storage->block_name,
+                 .type = PL_DESC_BUF_STORAGE,
+                 .binding = slot,
+                 .access = PL_DESC_ACCESS_READWRITE},
+        .binding = {.object = storage->buf},
+        .buffer_vars = &storage->var,
+        .num_buffer_vars = 1,
+    };
+  }
+
+  tmpl->verts[0] = params->src.x0;
+  tmpl->verts[1] = params->src.y0;
+  tmpl->verts[2] = params->src.x1;
+  tmpl->verts[3] = params->src.y0;
+  tmpl->verts[4] = params->src.x0;
+  tmpl->verts[5] = params->src.y1;
+  tmpl->verts[6] = params->src.x1;
+  tmpl->verts[7] = params->src.y1;
+  return 0;
+}
+
+static uint64_t gfx_lowlevel_tex_params_bytes(const struct pl_tex_params* p) {
+  return (uint64_t)p->w * (p->h > 0 ? p->h : 1) * (p->d > 0 ? p->d : 1) *
+         p->format->texel_size;
+}
+
+static uint64_t gfx_lowlevel_tex_bytes(pl_tex tex) {
+  return tex ? gfx_lowlevel_tex_params_bytes(&tex->params) : 0;
+}
+
+static bool gfx_lowlevel_tex_params_match(const struct pl_tex_params* a,
+                                          const struct pl_tex_params* b) {
+  return a->w == b->w && a->h == b->h && a->d == b->d &&
+         a->format == b->format && a->sampleable == b->sampleable &&
+         a->renderable == b->renderable && a->storable == b->storable &&
+         a->blit_src == b->blit_src && a->blit_dst == b->blit_dst &&
+         a->host_writable == b->host_writable &&
+         a->host_readable == b->host_readable;
+}
+
+// Frames keep a backref to the root context, which owns the pool
+static struct gfx_lowlevel_tex_pool* gfx_lowlevel_tex_pool_of(
+    struct gfx_lowlevel_gpu_ctx* ctx) {
+  return ctx->parent ? &ctx->parent->tex_pool : &ctx->tex_pool;
+}
+
+static void gfx_lowlevel_tex_pool_init(struct gfx_lowlevel_tex_pool* pool,
+                                       uint64_t budget) {
+  pool->has_lock = pthread_mutex_init(&pool->lock, NULL) == 0;
+  pool->stats.budget = budget;
+}
+
+static void gfx_lowlevel_tex_pool_lock(struct gfx_lowlevel_tex_pool* pool) {
+  if (pool->has_lock) {
+    pthread_mutex_lock(&pool->lock);
+  }
+}
+
+static void gfx_lowlevel_tex_pool_unlock(struct gfx_lowlevel_tex_pool* pool) {
+  if (pool->has_lock) {
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static pl_tex gfx_lowlevel_tex_pool_remove(struct gfx_lowlevel_tex_pool* pool,
+                                           int i) {
+  pl_tex tex = pool->idle[i];
+  pool->stats.idle_bytes -= gfx_lowlevel_tex_bytes(tex);
+  pool->stats.idle_textures--;
+  memmove(&pool->idle[i], &pool->idle[i + 1],
+          (pool->num_idle - i - 1) * sizeof(pl_tex));
+  pool->num_idle--;
+  return tex;
+}
+
+static void gfx_lowlevel_tex_pool_drop(struct gfx_lowlevel_tex_pool* pool,
+                                       pl_gpu gpu, int i) {
+  pl_tex tex = gfx_lowlevel_tex_pool_remove(pool, i);
+  pl_tex_destroy(gpu, &tex);
+}
+
+// Destroy idle textures, oldest first, until extra more bytes fit the
+// budget. Called with the lock held.
+static void gfx_lowlevel_tex_pool_trim(struct gfx_lowlevel_tex_pool* pool,
+                                       pl_gpu gpu, uint64_t extra) {
+  struct gfx_lowlevel_residency* stats = &pool->stats;
+  while (pool->num_idle > 0 && stats->budget > 0 &&
+         stats->mixer_bytes + stats->idle_bytes + stats->video_bytes + extra >
+             stats->budget) {
+    gfx_lowlevel_tex_pool_drop(pool, gpu, 0);
+    stats->evicted++;
+  }
+}
+
+// An idle texture made with params, or a new one
+static pl_tex gfx_lowlevel_tex_pool_take(struct gfx_lowlevel_tex_pool* pool,
+                                         pl_gpu gpu,
+                                         const struct pl_tex_params* params) {
+  gfx_lowlevel_tex_pool_lock(pool);
+  pl_tex tex = NULL;
+  // newest first, it is the most likely to still be in the caches
+  for (int i = pool->num_idle - 1; i >= 0; i--) {
+    if (gfx_lowlevel_tex_params_match(&pool->idle[i]->params, params)) {
+      tex = gfx_lowlevel_tex_pool_remove(pool, i);
+      break;
+    }
+  }
+  if (!tex) {
+    gfx_lowlevel_tex_pool_trim(pool, gpu,
+                               gfx_lowlevel_tex_params_bytes(params));
+    tex = pl_tex_create(gpu, params);
+  }
+  if (tex) {
+    pool->stats.mixer_bytes += gfx_lowlevel_tex_bytes(tex);
+    pool->stats.mixer_textures++;
+  }
+  gfx_lowlevel_tex_pool_unlock(pool);
+  return tex;
+}
+
+static void gfx_lowlevel_tex_pool_put(struct gfx_lowlevel_tex_pool* pool,
+                                      pl_gpu gpu, pl_tex* tex) {
+  if (!*tex) {
+    return;
+  }
+  gfx_lowlevel_tex_pool_lock(pool);
+  uint64_t bytes = gfx_lowlevel_tex_bytes(*tex);
+  pool->stats.mixer_bytes -= bytes;
+  pool->stats.mixer_textures--;
+  if (pool->num_idle == GFX_LOWLEVEL_TEX_POOL_MAX) {
+    gfx_lowlevel_tex_pool_drop(pool, gpu, 0);
+  }
+  // libplacebo orders the next user's commands after the last ones, so it
+  // can go back right away even if the GPU still reads it
+  pool->idle[pool->num_idle++] = *tex;
+  pool->stats.idle_bytes += bytes;
+  pool->stats.idle_textures++;
+  *tex = NULL;
+  gfx_lowlevel_tex_pool_trim(pool, gpu, 0);
+  gfx_lowlevel_tex_pool_unlock(pool);
+}
+
+static void gfx_lowlevel_tex_pool_free(struct gfx_lowlevel_tex_pool* pool,
+                                       pl_gpu gpu) {
+  while (pool->num_idle > 0) {
+    gfx_lowlevel_tex_pool_drop(pool, gpu, pool->num_idle - 1);
+  }
+  if (pool->has_lock) {
+    pthread_mutex_destroy(&pool->lock);
+    pool->has_lock = false;
+  }
+}
+
+void gfx_lowlevel_gpu_ctx_set_vram_budget(struct gfx_lowlevel_gpu_ctx* ctx,
+                                          uint64_t bytes) {
+  if (!ctx || !ctx->vk) {
+    return;
+  }
+  struct gfx_lowlevel_tex_pool* pool = gfx_lowlevel_tex_pool_of(ctx);
+  gfx_lowlevel_tex_pool_lock(pool);
+  pool->stats.budget = bytes;
+  gfx_lowlevel_tex_pool_trim(pool, ctx->vk->gpu, 0);
+  gfx_lowlevel_tex_pool_unlock(pool);
+}
+
+void gfx_lowlevel_gpu_ctx_residency(struct gfx_lowlevel_gpu_ctx* ctx,
+                                    struct gfx_lowlevel_residency* out) {
+  if (!ctx || !out) {
+    return;
+  }
+  struct gfx_lowlevel_tex_pool* pool = gfx_lowlevel_tex_pool_of(ctx);
+  gfx_lowlevel_tex_pool_lock(pool);
+  *out = pool->stats;
+  gfx_lowlevel_tex_pool_unlock(pool);
+}
+
+void gfx_lowlevel_gpu_ctx_compute_limits(
+    struct gfx_lowlevel_gpu_ctx* ctx, struct gfx_lowlevel_compute_limits* out) {
+  if (!ctx || !out) {
+    return;
+  }
+  pl_gpu gpu = ctx->vk->gpu;
+  if (!gpu->glsl.compute) {
+    *out = (struct gfx_lowlevel_compute_limits){0};
+    return;
+  }
+  *out = (struct gfx_lowlevel_compute_limits){
+      .max_group_threads = gpu->limits.max_group_threads,
+      .max_group_size = {gpu->limits.max_group_size[0],
+                         gpu->limits.max_group_size[1]},
+      .max_shmem_size = gpu->limits.max_shmem_size,
+  };
+}
+
 void gfx_lowlevel_gpu_ctx_destroy(struct gfx_lowlevel_gpu_ctx** ctx) {
   if (ctx == NULL || *ctx == NULL) {
     return;
   }
 
-  // Clean up resource pool
-  if ((*ctx)->resource_pool.names) {
-    for (int i = 0; i < (*ctx)->resource_pool.max_names; i++) {
-      free((*ctx)->resource_pool.names[i]);
+  gfx_lowlevel_render_template_free(&(*ctx)->resource_pool);
+
+  // forks only own their dispatch and renderer
+  if ((*ctx)->parent != NULL) {
+    if ((*ctx)->dispatch != NULL) {
+      pl_dispatch_destroy(&((*ctx)->dispatch));
     }
-    free((*ctx)->resource_pool.names);
-  }
-  if ((*ctx)->resource_pool.vert_buffers) {
-    for (int i = 0; i < (*ctx)->resource_pool.max_names; i++) {
-      free((*ctx)->resource_pool.vert_buffers[i]);
+    if ((*ctx)->renderer != NULL) {
+      pl_renderer_destroy(&((*ctx)->renderer));
     }
-    free((*ctx)->resource_pool.vert_buffers);
+    free(*ctx);
+    *ctx = NULL;
+    return;
   }
-  free((*ctx)->resource_pool.descs);
-  free((*ctx)->resource_pool.attribs);
+
+  if ((*ctx)->cache != NULL) {
+    gfx_lowlevel_gpu_ctx_save_cache(*ctx);
+    pl_gpu_set_cache((*ctx)->vk->gpu, NULL);
+    pl_cache_destroy(&((*ctx)->cache));
+  }
+  free((*ctx)->cache_path);
 
   if ((*ctx)->dispatch != NULL) {
     pl_dispatch_destroy(&((*ctx)->dispatch));
@@ -46,6 +407,17 @@ void gfx_lowlevel_gpu_ctx_destroy(struct gfx_lowlevel_gpu_ctx** ctx) {
   if ((*ctx)->renderer != NULL) {
     pl_renderer_destroy(&((*ctx)->renderer));
   }
+  if ((*ctx)->vk != NULL) {
+    gfx_lowlevel_tex_pool_free(&(*ctx)->tex_pool, (*ctx)->vk->gpu);
+  }
+  for (int i = 0; i < GFX_LOWLEVEL_READBACK_RING; i++) {
+    if ((*ctx)->readback.bufs[i] != NULL) {
+      pl_buf_destroy((*ctx)->vk->gpu, &((*ctx)->readback.bufs[i]));
+    }
+  }
+  if ((*ctx)->offscreen != NULL) {
+    pl_tex_destroy((*ctx)->vk->gpu, &((*ctx)->offscreen));
+  }
   if ((*ctx)->swchain != NULL) {
     pl_swapchain_destroy(&((*ctx)->swchain));
   }
@@ -76,17 +448,151 @@ void gfx_lowlevel_swapwindow(struct gfx_lowlevel_gpu_ctx* ctx) {
   }
 }
 
-struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init(
-    struct SDL_Window* window) {
-  struct gfx_lowlevel_gpu_ctx* ctx =
-      malloc(sizeof(struct gfx_lowlevel_gpu_ctx));
+static int gfx_lowlevel_init_resource_pool(struct gfx_lowlevel_gpu_ctx* ctx) {
+  gfx_lowlevel_render_template_init(&ctx->resource_pool, ctx->vk->gpu);
+  return 0;
+}
+
+// Even without a cache dir the cache is kept in memory, that is what lets
+// forked contexts compile shaders ahead of time for the render loop
+static int gfx_lowlevel_create_cache(struct gfx_lowlevel_gpu_ctx* ctx) {
+  ctx->cache = pl_cache_create(&(struct pl_cache_params){
+      .log = ctx->log,
+      .max_total_size = 256 << 20,
+  });
+  if (!ctx->cache) {
+    fprintf(stderr, "gfx_ll> Failed to create shader cache\n");
+    return ENOMEM;
+  }
+  pl_gpu_set_cache(ctx->vk->gpu, ctx->cache);
+  return 0;
+}
+
+int gfx_lowlevel_gpu_ctx_load_cache(struct gfx_lowlevel_gpu_ctx* ctx,
+                                    const char* cache_dir) {
+  if (!ctx || !ctx->vk || !cache_dir) {
+    fprintf(stderr, "gfx_ll> Invalid context or cache dir\n");
+    return EINVAL;
+  }
+
+  if (ctx->parent) {
+    fprintf(stderr, "gfx_ll> The shader cache belongs to the parent context\n");
+    return EINVAL;
+  }
+  if (!ctx->cache && gfx_lowlevel_create_cache(ctx) != 0) {
+    return ENOMEM;
+  }
+
+  // Pipelines are only valid for the exact device + driver that made them,
+  // MoltenVK changes pipelineCacheUUID whenever its Metal output changes
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(ctx->vk->phys_device, &props);
+  char uuid[2 * VK_UUID_SIZE + 1];
+  for (int i = 0; i < VK_UUID_SIZE; i++) {
+    snprintf(uuid + 2 * i, 3, "%02x", props.pipelineCacheUUID[i]);
+  }
+
+  free(ctx->cache_path);
+  int len = snprintf(NULL, 0, "%s/sdlrig-%04x-%04x-%08x-%s-pl%d.cache",
+                     cache_dir, props.vendorID, props.deviceID,
+                     props.driverVersion, uuid, PL_API_VER);
+  ctx->cache_path = malloc(len + 1);
+  if (!ctx->cache_path) {
+    fprintf(stderr, "gfx_ll> Failed to allocate cache path\n");
+    return ENOMEM;
+  }
+  snprintf(ctx->cache_path, len + 1, "%s/sdlrig-%04x-%04x-%08x-%s-pl%d.cache",
+           cache_dir, props.vendorID, props.deviceID, props.driverVersion,
+           uuid, PL_API_VER);
+
+  // a missing file just means a cold start
+  if (pl_cache_load_file(ctx->cache, ctx->cache_path) < 0) {
+    fprintf(stderr, "gfx_ll> Could not read shader cache %s\n",
+            ctx->cache_path);
+  }
+  ctx->cache_sig = pl_cache_signature(ctx->cache);
+  return 0;
+}
+
+int gfx_lowlevel_gpu_ctx_save_cache(struct gfx_lowlevel_gpu_ctx* ctx) {
   if (!ctx) {
-    fprintf(stderr, "gfx_ll> Failed to allocate memory for gfx_ctx\n");
-    return NULL;
+    fprintf(stderr, "gfx_ll> Invalid context\n");
+    return EINVAL;
+  }
+  // forks share the parent's cache and write it to the parent's path
+  if (ctx->parent) {
+    ctx = ctx->parent;
+  }
+  if (!ctx->cache || !ctx->cache_path) {
+    return 0;
   }
-  memset(ctx, 0, sizeof(struct gfx_lowlevel_gpu_ctx));
 
-  ctx->shared_window = window;
+  uint64_t sig = pl_cache_signature(ctx->cache);
+  if (sig == ctx->cache_sig) {
+    return 0;
+  }
+
+  // write next to the real file and rename so a crash never leaves half a cache
+  int len = strlen(ctx->cache_path) + 5;
+  char* tmp_path = malloc(len);
+  if (!tmp_path) {
+    fprintf(stderr, "gfx_ll> Failed to allocate cache path\n");
+    return ENOMEM;
+  }
+  snprintf(tmp_path, len, "%s.tmp", ctx->cache_path);
+  if (pl_cache_save_file(ctx->cache, tmp_path) < 0 ||
+      rename(tmp_path, ctx->cache_path) != 0) {
+    fprintf(stderr, "gfx_ll> Failed to save shader cache %s\n",
+            ctx->cache_path);
+    remove(tmp_path);
+    free(tmp_path);
+    return EIO;
+  }
+  free(tmp_path);
+  ctx->cache_sig = sig;
+  return 0;
+}
+
+static const struct gfx_lowlevel_gpu_config gfx_lowlevel_default_config = {
+    .queue_count = GFX_LOWLEVEL_DEFAULT_QUEUE_COUNT,
+    .async_transfer = true,
+    .async_compute = true,
+    .present_mode = GFX_LOWLEVEL_PRESENT_FIFO,
+    .frames_in_flight = 0,
+    .vram_budget = 0,
+};
+
+static VkPresentModeKHR gfx_lowlevel_vk_present_mode(
+    enum gfx_lowlevel_present_mode mode) {
+  switch (mode) {
+    case GFX_LOWLEVEL_PRESENT_MAILBOX:
+      return VK_PRESENT_MODE_MAILBOX_KHR;
+    case GFX_LOWLEVEL_PRESENT_IMMEDIATE:
+      return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    case GFX_LOWLEVEL_PRESENT_FIFO_RELAXED:
+      return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    case GFX_LOWLEVEL_PRESENT_FIFO:
+    default:
+      return VK_PRESENT_MODE_FIFO_KHR;
+  }
+}
+
+// Log and Vulkan device, shared by windowed and headless contexts
+static int gfx_lowlevel_create_gpu(
+    struct gfx_lowlevel_gpu_ctx* ctx, const char** extensions,
+    unsigned int num_extensions, const struct gfx_lowlevel_gpu_config* config) {
+  ctx->config = config ? *config : gfx_lowlevel_default_config;
+  if (ctx->config.queue_count <= 0) {
+    ctx->config.queue_count = GFX_LOWLEVEL_DEFAULT_QUEUE_COUNT;
+  }
+  if (ctx->config.frames_in_flight < 0) {
+    ctx->config.frames_in_flight = 0;
+  }
+  if (ctx->config.frames_in_flight > GFX_LOWLEVEL_MAX_FRAMES_IN_FLIGHT) {
+    fprintf(stderr, "gfx_ll> frames_in_flight %d clamped to %d\n",
+            ctx->config.frames_in_flight, GFX_LOWLEVEL_MAX_FRAMES_IN_FLIGHT);
+    ctx->config.frames_in_flight = GFX_LOWLEVEL_MAX_FRAMES_IN_FLIGHT;
+  }
 
   struct pl_log_params log_params = {
       .log_cb = log_callback,
@@ -96,32 +602,105 @@ struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init(
   ctx->log = pl_log_create(PL_API_VER, &log_params);
   if (ctx->log == NULL) {
     fprintf(stderr, "gfx_ll> Failed to create libplacebo log\n");
-    gfx_lowlevel_gpu_ctx_destroy(&ctx);
-    return NULL;
+    return ENOMEM;
   }
 
-  const char* extensions[] = {
-      "VK_MVK_moltenvk",
-      "VK_MVK_macos_surface",
-      "VK_EXT_metal_surface",
+  // Device extensions that enable optional fast paths
+  const char* opt_extensions[] = {
+#ifdef __APPLE__
+      VK_EXT_METAL_OBJECTS_EXTENSION_NAME,
+#endif
+      NULL,
   };
-  unsigned int num_extensions = sizeof(extensions) / sizeof(extensions[0]);
+  unsigned int num_opt_extensions =
+      sizeof(opt_extensions) / sizeof(opt_extensions[0]) - 1;
 
   struct pl_vulkan_params vk_params = {
-      .async_transfer = 1,
-      .async_compute = 1,
-      .queue_count = 1,
+      .async_transfer = ctx->config.async_transfer,
+      .async_compute = ctx->config.async_compute,
+      .queue_count = ctx->config.queue_count,
       .instance_params =
           &(struct pl_vk_inst_params){
-              .extensions = (const char**)extensions,
+              .extensions = extensions,
               .num_extensions = num_extensions,
           },
+      .opt_extensions = (const char**)opt_extensions,
+      .num_opt_extensions = num_opt_extensions,
       .get_proc_addr = SDL_Vulkan_GetVkGetInstanceProcAddr(),
   };
 
   ctx->vk = pl_vulkan_create(ctx->log, &vk_params);
   if (ctx->vk == NULL) {
     fprintf(stderr, "gfx_ll> Failed to create libplacebo Vulkan context\n");
+    return EINVAL;
+  }
+  gfx_lowlevel_tex_pool_init(&ctx->tex_pool, ctx->config.vram_budget);
+
+#ifdef __APPLE__
+  for (int i = 0; i < ctx->vk->num_extensions; i++) {
+    if (strcmp(ctx->vk->extensions[i], VK_EXT_METAL_OBJECTS_EXTENSION_NAME) ==
+        0) {
+      ctx->has_iosurface_interop = true;
+    }
+  }
+#endif
+  if (!ctx->has_iosurface_interop) {
+    fprintf(stderr,
+            "gfx_ll> IOSurface import unavailable, hardware frames will be "
+            "copied\n");
+  }
+  return 0;
+}
+
+// Renderer, dispatch, shader cache and resource pool
+static int gfx_lowlevel_create_render_state(struct gfx_lowlevel_gpu_ctx* ctx) {
+  // Create a renderer
+  ctx->renderer = pl_renderer_create(ctx->log, ctx->vk->gpu);
+  if (ctx->renderer == NULL) {
+    fprintf(stderr, "gfx_ll> Failed to create libplacebo renderer\n");
+    return ENOMEM;
+  }
+
+  // Create a shared dispatch for shader caching
+  ctx->dispatch = pl_dispatch_create(ctx->log, ctx->vk->gpu);
+  if (ctx->dispatch == NULL) {
+    fprintf(stderr, "gfx_ll> Failed to create libplacebo dispatch\n");
+    return ENOMEM;
+  }
+
+  int err = gfx_lowlevel_create_cache(ctx);
+  if (err != 0) {
+    return err;
+  }
+
+  return gfx_lowlevel_init_resource_pool(ctx);
+}
+
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init(
+    struct SDL_Window* window) {
+  return gfx_lowlevel_gpu_ctx_init_ex(window, NULL);
+}
+
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init_ex(
+    struct SDL_Window* window, const struct gfx_lowlevel_gpu_config* config) {
+  struct gfx_lowlevel_gpu_ctx* ctx =
+      malloc(sizeof(struct gfx_lowlevel_gpu_ctx));
+  if (!ctx) {
+    fprintf(stderr, "gfx_ll> Failed to allocate memory for gfx_ctx\n");
+    return NULL;
+  }
+  memset(ctx, 0, sizeof(struct gfx_lowlevel_gpu_ctx));
+
+  ctx->shared_window = window;
+
+  const char* extensions[] = {
+      "VK_MVK_moltenvk",
+      "VK_MVK_macos_surface",
+      "VK_EXT_metal_surface",
+  };
+  unsigned int num_extensions = sizeof(extensions) / sizeof(extensions[0]);
+
+  if (gfx_lowlevel_create_gpu(ctx, extensions, num_extensions, config) != 0) {
     gfx_lowlevel_gpu_ctx_destroy(&ctx);
     return NULL;
   }
@@ -131,10 +710,11 @@ struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init(
     return NULL;
   }
 
-  // Create a swapchain
+  // Create a swapchain, libplacebo warns and uses FIFO if the mode is missing
   struct pl_vulkan_swapchain_params swapchain_params = {
       .surface = ctx->vk_surface,
-      .present_mode = VK_PRESENT_MODE_FIFO_KHR,
+      .present_mode = gfx_lowlevel_vk_present_mode(ctx->config.present_mode),
+      .swapchain_depth = ctx->config.frames_in_flight,
   };
 
   ctx->swchain = pl_vulkan_create_swapchain(ctx->vk, &swapchain_params);
@@ -153,64 +733,123 @@ struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init(
     return NULL;
   }
 
-  // Create a renderer
-  ctx->renderer = pl_renderer_create(ctx->log, ctx->vk->gpu);
-  if (ctx->renderer == NULL) {
-    fprintf(stderr, "gfx_ll> Failed to create libplacebo renderer\n");
+  if (gfx_lowlevel_create_render_state(ctx) != 0) {
     gfx_lowlevel_gpu_ctx_destroy(&ctx);
     return NULL;
   }
 
-  // Create a shared dispatch for shader caching
-  ctx->dispatch = pl_dispatch_create(ctx->log, ctx->vk->gpu);
-  if (ctx->dispatch == NULL) {
-    fprintf(stderr, "gfx_ll> Failed to create libplacebo dispatch\n");
-    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+  return ctx;
+}
+
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init_headless(
+    int width, int height, const struct gfx_lowlevel_gpu_config* config) {
+  if (width <= 0 || height <= 0) {
+    fprintf(stderr, "gfx_ll> Invalid headless size %dx%d\n", width, height);
+    return NULL;
+  }
+  struct gfx_lowlevel_gpu_ctx* ctx =
+      malloc(sizeof(struct gfx_lowlevel_gpu_ctx));
+  if (!ctx) {
+    fprintf(stderr, "gfx_ll> Failed to allocate memory for gfx_ctx\n");
     return NULL;
   }
+  memset(ctx, 0, sizeof(struct gfx_lowlevel_gpu_ctx));
+  ctx->headless = true;
 
-  // Initialize resource pool to avoid per-frame allocations
-  // Allocate for up to 16 frames + 16 passes (generous default)
-  ctx->resource_pool.max_resources = 128;
-  ctx->resource_pool.max_names = 256;  // (frames + passes + 1) * 2 + some extra
+  // without a Vulkan window nothing has loaded the Vulkan library for SDL yet
+  if (SDL_Vulkan_LoadLibrary(NULL) != 0) {
+    fprintf(stderr, "gfx_ll> Failed to load Vulkan: %s\n", SDL_GetError());
+    free(ctx);
+    return NULL;
+  }
 
-  ctx->resource_pool.descs =
-      calloc(ctx->resource_pool.max_resources, sizeof(struct pl_shader_desc));
-  ctx->resource_pool.attribs =
-      calloc(ctx->resource_pool.max_resources + 1, sizeof(struct pl_shader_va));
-  ctx->resource_pool.names =
-      calloc(ctx->resource_pool.max_names, sizeof(char*));
-  ctx->resource_pool.vert_buffers =
-      calloc(ctx->resource_pool.max_names, sizeof(float*));
+  if (gfx_lowlevel_create_gpu(ctx, NULL, 0, config) != 0) {
+    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+    return NULL;
+  }
 
-  if (!ctx->resource_pool.descs || !ctx->resource_pool.attribs ||
-      !ctx->resource_pool.names || !ctx->resource_pool.vert_buffers) {
-    fprintf(stderr, "gfx_ll> Failed to allocate resource pool\n");
+  pl_fmt fmt = pl_find_named_fmt(ctx->vk->gpu, "rgba8");
+  if (!fmt) {
+    fprintf(stderr, "gfx_ll> Failed to find format\n");
+    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+    return NULL;
+  }
+  ctx->offscreen = pl_tex_create(ctx->vk->gpu, &(struct pl_tex_params){
+                                                   .w = width,
+                                                   .h = height,
+                                                   .format = fmt,
+                                                   .sampleable = true,
+                                                   .renderable = true,
+                                                   .host_readable = true,
+                                                   .blit_dst = true,
+                                               });
+  if (!ctx->offscreen) {
+    fprintf(stderr, "gfx_ll> Failed to create offscreen texture\n");
     gfx_lowlevel_gpu_ctx_destroy(&ctx);
     return NULL;
   }
 
-  // Pre-allocate name strings and vertex buffers
-  for (int i = 0; i < ctx->resource_pool.max_names; i++) {
-    ctx->resource_pool.names[i] = malloc(32);
-    ctx->resource_pool.vert_buffers[i] = malloc(sizeof(float) * 8);
-    if (!ctx->resource_pool.names[i] || !ctx->resource_pool.vert_buffers[i]) {
-      fprintf(stderr, "gfx_ll> Failed to allocate resource pool buffers\n");
-      gfx_lowlevel_gpu_ctx_destroy(&ctx);
-      return NULL;
-    }
+  if (gfx_lowlevel_create_render_state(ctx) != 0) {
+    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+    return NULL;
   }
 
   return ctx;
 }
 
-int gfx_lowlevel_gpu_ctx_handle_resize(struct gfx_lowlevel_gpu_ctx* ctx,
-                                       int width, int height) {
-  if (!ctx || !ctx->swchain) {
-    fprintf(stderr, "gfx_ll> Invalid context or swapchain\n");
-    return -1;
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_fork(
+    struct gfx_lowlevel_gpu_ctx* parent) {
+  if (!parent || !parent->vk) {
+    fprintf(stderr, "gfx_ll> Invalid parent context\n");
+    return NULL;
   }
-
+  struct gfx_lowlevel_gpu_ctx* ctx =
+      malloc(sizeof(struct gfx_lowlevel_gpu_ctx));
+  if (!ctx) {
+    fprintf(stderr, "gfx_ll> Failed to allocate memory for gfx_ctx\n");
+    return NULL;
+  }
+  memset(ctx, 0, sizeof(struct gfx_lowlevel_gpu_ctx));
+
+  // pl_gpu and pl_cache are thread safe, the dispatch and renderer are not so
+  // every fork gets its own
+  ctx->parent = parent->parent ? parent->parent : parent;
+  ctx->shared_window = parent->shared_window;
+  ctx->vk = parent->vk;
+  ctx->log = parent->log;
+  ctx->cache = parent->cache;
+  ctx->config = parent->config;
+  ctx->has_iosurface_interop = parent->has_iosurface_interop;
+
+  ctx->renderer = pl_renderer_create(ctx->log, ctx->vk->gpu);
+  if (ctx->renderer == NULL) {
+    fprintf(stderr, "gfx_ll> Failed to create libplacebo renderer\n");
+    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+    return NULL;
+  }
+
+  ctx->dispatch = pl_dispatch_create(ctx->log, ctx->vk->gpu);
+  if (ctx->dispatch == NULL) {
+    fprintf(stderr, "gfx_ll> Failed to create libplacebo dispatch\n");
+    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+    return NULL;
+  }
+
+  if (gfx_lowlevel_init_resource_pool(ctx) != 0) {
+    gfx_lowlevel_gpu_ctx_destroy(&ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+int gfx_lowlevel_gpu_ctx_handle_resize(struct gfx_lowlevel_gpu_ctx* ctx,
+                                       int width, int height) {
+  if (!ctx || !ctx->swchain) {
+    fprintf(stderr, "gfx_ll> Invalid context or swapchain\n");
+    return -1;
+  }
+
   if (!pl_swapchain_resize(ctx->swchain, &width, &height)) {
     fprintf(stderr, "gfx_ll> Failed to resize swapchain\n");
     return -1;
@@ -219,12 +858,23 @@ int gfx_lowlevel_gpu_ctx_handle_resize(struct gfx_lowlevel_gpu_ctx* ctx,
   return 0;
 }
 
+static void gfx_lowlevel_frame_wrap_tex(struct pl_frame* f, pl_tex tex);
+
 // This may return and need to be rerun after window events are drained
 bool gfx_lowlevel_gpu_ctx_start_frame(struct gfx_lowlevel_gpu_ctx* ctx) {
   assert(ctx != NULL);
-  assert(ctx->swchain != NULL);
   assert(!ctx->started);
 
+  if (ctx->headless) {
+    ctx->started = true;
+    gfx_lowlevel_frame_wrap_tex(&ctx->window_frame, ctx->offscreen);
+    ctx->window_frame.repr = pl_color_repr_rgb;
+    ctx->window_frame.color = pl_color_space_srgb;
+    return true;
+  }
+
+  assert(ctx->swchain != NULL);
+
   if (pl_swapchain_start_frame(ctx->swchain, &ctx->swap_frame)) {
     ctx->started = true;
     pl_frame_from_swapchain(&ctx->window_frame, &ctx->swap_frame);
@@ -234,119 +884,697 @@ bool gfx_lowlevel_gpu_ctx_start_frame(struct gfx_lowlevel_gpu_ctx* ctx) {
   return false;
 }
 
-int gfx_lowlevel_map_frame_ctx(struct gfx_lowlevel_gpu_ctx* ctx,
-                               struct gfx_lowlevel_frame_ctx* dst,
-                               AVFrame* src) {
-  if (!ctx || !dst || !src) {
-    fprintf(stderr, "gfx_ll> Invalid context or frame\n");
+// Point a single plane frame at an RGBA(ish) texture
+static void gfx_lowlevel_frame_wrap_tex(struct pl_frame* f, pl_tex tex) {
+  pl_fmt fmt = tex->params.format;
+  struct pl_plane plane = {
+      .texture = tex,
+      .components = fmt->num_components,
+      .component_mapping = {fmt->sample_order[0], fmt->sample_order[1],
+                            fmt->sample_order[2], fmt->sample_order[3]},
+  };
+
+  *f = (struct pl_frame){0};
+  f->num_planes = 1;
+  f->planes[0] = plane;
+  f->repr = pl_color_repr_unknown;
+  f->color = pl_color_space_unknown;
+}
+
+// Convert a (possibly multi-plane YUV) frame into the RGBA convert_tex of
+// dst on the GPU. The color space is kept as is so the result matches what
+// sws_scale would have produced, only the YUV->RGB matrix is applied.
+static int gfx_lowlevel_convert_frame(struct gfx_lowlevel_gpu_ctx* ctx,
+                                      struct gfx_lowlevel_frame_ctx* dst,
+                                      const struct pl_frame* src, int width,
+                                      int height) {
+  pl_fmt fmt = pl_find_named_fmt(ctx->vk->gpu, "rgba8");
+  if (!fmt) {
+    fprintf(stderr, "gfx_ll> Failed to find format\n");
     return EINVAL;
   }
 
-  if (dst->to_rgba == NULL) {
-    enum AVPixelFormat src_format = src->format;
-    if (src_format == AV_PIX_FMT_VIDEOTOOLBOX) {
-      src_format = AV_PIX_FMT_NV12;
+  if (!pl_tex_recreate(ctx->vk->gpu, &dst->convert_tex,
+                       &(struct pl_tex_params){
+                           .w = width,
+                           .h = height,
+                           .format = fmt,
+                           .sampleable = true,
+                           .renderable = true,
+                           .blit_src = true,
+                       })) {
+    fprintf(stderr, "gfx_ll> Failed to create conversion texture\n");
+    return ENOMEM;
+  }
+
+  struct pl_frame target;
+  gfx_lowlevel_frame_wrap_tex(&target, dst->convert_tex);
+  target.repr = pl_color_repr_rgb;
+  target.color = src->color;
+
+  if (!pl_render_image(ctx->renderer, src, &target, &pl_render_fast_params)) {
+    fprintf(stderr, "gfx_ll> Failed to convert frame\n");
+    return EINVAL;
+  }
+
+  dst->pl_frame = target;
+  return 0;
+}
+
+#ifdef __APPLE__
+static VkFormat gfx_lowlevel_iosurface_format(OSType cv_format) {
+  switch (cv_format) {
+    case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
+    case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
+      return VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+    case kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange:
+    case kCVPixelFormatType_420YpCbCr10BiPlanarFullRange:
+      return VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16;
+    case kCVPixelFormatType_32BGRA:
+      return VK_FORMAT_B8G8R8A8_UNORM;
+    default:
+      return VK_FORMAT_UNDEFINED;
+  }
+}
+
+static void gfx_lowlevel_interop_entry_free(
+    struct gfx_lowlevel_gpu_ctx* ctx, struct gfx_lowlevel_interop_entry* e) {
+  if (e->tex) {
+    pl_tex_destroy(ctx->vk->gpu, &e->tex);
+  }
+  if (e->image) {
+    vkDestroyImage(ctx->vk->device, e->image, NULL);
+  }
+  if (e->memory) {
+    vkFreeMemory(ctx->vk->device, e->memory, NULL);
+  }
+  if (e->surface) {
+    CFRelease(e->surface);
+  }
+  *e = (struct gfx_lowlevel_interop_entry){0};
+}
+
+// Frames to keep referenced, the swapchain can have frames_in_flight frames
+// queued on top of the one being recorded
+static int gfx_lowlevel_interop_hold(struct gfx_lowlevel_gpu_ctx* ctx) {
+  int depth = ctx->config.frames_in_flight > 0 ? ctx->config.frames_in_flight
+                                               : GFX_INTEROP_DEFAULT_DEPTH;
+  return depth + 1;
+}
+
+// Wrap an IOSurface in a VkImage (MoltenVK aliases the surface memory, there
+// is no copy) and hand it to libplacebo
+static int gfx_lowlevel_interop_import(struct gfx_lowlevel_gpu_ctx* ctx,
+                                       struct gfx_lowlevel_interop_entry* e,
+                                       IOSurfaceRef surface, VkFormat format,
+                                       int width, int height) {
+  bool planar = format != VK_FORMAT_B8G8R8A8_UNORM;
+  VkImportMetalIOSurfaceInfoEXT import_info = {
+      .sType = VK_STRUCTURE_TYPE_IMPORT_METAL_IO_SURFACE_INFO_EXT,
+      .ioSurface = surface,
+  };
+  VkImageCreateInfo image_info = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .pNext = &import_info,
+      .flags = planar ? (VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT |
+                         VK_IMAGE_CREATE_EXTENDED_USAGE_BIT)
+                      : 0,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = format,
+      .extent = {width, height, 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_SAMPLED_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+
+  if (vkCreateImage(ctx->vk->device, &image_info, NULL, &e->image) !=
+      VK_SUCCESS) {
+    fprintf(stderr, "gfx_ll> Failed to create IOSurface image\n");
+    return EINVAL;
+  }
+
+  VkMemoryRequirements reqs;
+  vkGetImageMemoryRequirements(ctx->vk->device, e->image, &reqs);
+  VkPhysicalDeviceMemoryProperties props;
+  vkGetPhysicalDeviceMemoryProperties(ctx->vk->phys_device, &props);
+  uint32_t type_idx = UINT32_MAX;
+  for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+    if ((reqs.memoryTypeBits & (1u << i)) &&
+        (props.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+      type_idx = i;
+      break;
     }
-    struct SwsContext* sws_ctx = sws_getContext(
-        src->width, src->height, src_format, src->width, src->height,
-        AV_PIX_FMT_RGBA, SWS_BILINEAR, NULL, NULL, NULL);
-    if (!sws_ctx) {
-      fprintf(stderr, "gfx_ll> Failed to create sws context\n");
+  }
+  if (type_idx == UINT32_MAX) {
+    fprintf(stderr, "gfx_ll> No memory type for IOSurface image\n");
+    gfx_lowlevel_interop_entry_free(ctx, e);
+    return EINVAL;
+  }
+
+  VkMemoryAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = reqs.size,
+      .memoryTypeIndex = type_idx,
+  };
+  if (vkAllocateMemory(ctx->vk->device, &alloc_info, NULL, &e->memory) !=
+          VK_SUCCESS ||
+      vkBindImageMemory(ctx->vk->device, e->image, e->memory, 0) !=
+          VK_SUCCESS) {
+    fprintf(stderr, "gfx_ll> Failed to bind IOSurface image memory\n");
+    gfx_lowlevel_interop_entry_free(ctx, e);
+    return ENOMEM;
+  }
+
+  e->tex = pl_vulkan_wrap(ctx->vk->gpu, &(struct pl_vulkan_wrap_params){
+                                            .image = e->image,
+                                            .width = width,
+                                            .height = height,
+                                            .format = format,
+                                            .usage = image_info.usage,
+                                        });
+  if (!e->tex) {
+    fprintf(stderr, "gfx_ll> Failed to wrap IOSurface image\n");
+    gfx_lowlevel_interop_entry_free(ctx, e);
+    return EINVAL;
+  }
+
+  // wrapped images start out held by us, give them to libplacebo for good
+  pl_vulkan_release_ex(ctx->vk->gpu, &(struct pl_vulkan_release_params){
+                                         .tex = e->tex,
+                                         .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+                                         .qf = VK_QUEUE_FAMILY_IGNORED,
+                                     });
+
+  CFRetain(surface);
+  e->surface = surface;
+  return 0;
+}
+
+static pl_tex gfx_lowlevel_interop_lookup(struct gfx_lowlevel_gpu_ctx* ctx,
+                                          struct gfx_lowlevel_interop* interop,
+                                          IOSurfaceRef surface,
+                                          VkFormat format, int width,
+                                          int height) {
+  interop->counter++;
+  struct gfx_lowlevel_interop_entry* victim = &interop->entries[0];
+  for (int i = 0; i < GFX_INTEROP_CACHE_SIZE; i++) {
+    struct gfx_lowlevel_interop_entry* e = &interop->entries[i];
+    if (e->surface == surface && e->tex &&
+        e->tex->params.w == width && e->tex->params.h == height) {
+      e->last_used = interop->counter;
+      return e->tex;
+    }
+    if (e->last_used < victim->last_used) {
+      victim = e;
+    }
+  }
+
+  if (victim->tex) {
+    // rare, only when the decoder pool changes, make sure it's idle first
+    pl_gpu_finish(ctx->vk->gpu);
+    gfx_lowlevel_interop_entry_free(ctx, victim);
+  }
+
+  if (gfx_lowlevel_interop_import(ctx, victim, surface, format, width,
+                                  height) != 0) {
+    return NULL;
+  }
+  victim->last_used = interop->counter;
+  return victim->tex;
+}
+
+static int gfx_lowlevel_map_videotoolbox(struct gfx_lowlevel_gpu_ctx* ctx,
+                                         struct gfx_lowlevel_frame_ctx* dst,
+                                         AVFrame* src) {
+  CVPixelBufferRef pixbuf = (CVPixelBufferRef)src->data[3];
+  if (!pixbuf) {
+    return EINVAL;
+  }
+  IOSurfaceRef surface = CVPixelBufferGetIOSurface(pixbuf);
+  VkFormat format =
+      gfx_lowlevel_iosurface_format(CVPixelBufferGetPixelFormatType(pixbuf));
+  if (!surface || format == VK_FORMAT_UNDEFINED) {
+    return ENOTSUP;
+  }
+
+  if (!dst->interop) {
+    dst->interop = calloc(1, sizeof(struct gfx_lowlevel_interop));
+    if (!dst->interop) {
+      return ENOMEM;
+    }
+  }
+
+  pl_tex tex = gfx_lowlevel_interop_lookup(ctx, dst->interop, surface, format,
+                                           src->width, src->height);
+  if (!tex) {
+    return EINVAL;
+  }
+
+  struct pl_frame yuv;
+  pl_frame_from_avframe(&yuv, src);
+  if (tex->params.format->num_planes > 0) {
+    for (int i = 0; i < yuv.num_planes; i++) {
+      yuv.planes[i].texture = tex->planes[i];
+    }
+  } else {
+    yuv.planes[0].texture = tex;
+  }
+
+  int ret = gfx_lowlevel_convert_frame(ctx, dst, &yuv, src->width,
+                                       src->height);
+  if (ret != 0) {
+    return ret;
+  }
+
+  // hold on to the last few pixel buffers until the GPU is surely done
+  struct gfx_lowlevel_interop* interop = dst->interop;
+  av_frame_free(&interop->in_flight[interop->in_flight_idx]);
+  interop->in_flight[interop->in_flight_idx] = av_frame_clone(src);
+  interop->in_flight_idx =
+      (interop->in_flight_idx + 1) % gfx_lowlevel_interop_hold(ctx);
+  return 0;
+}
+#endif
+
+static void gfx_lowlevel_interop_destroy(
+    struct gfx_lowlevel_gpu_ctx* ctx, struct gfx_lowlevel_interop** interop) {
+  if (!interop || !*interop) {
+    return;
+  }
+#ifdef __APPLE__
+  pl_gpu_finish(ctx->vk->gpu);
+  for (int i = 0; i < GFX_INTEROP_CACHE_SIZE; i++) {
+    gfx_lowlevel_interop_entry_free(ctx, &(*interop)->entries[i]);
+  }
+  for (int i = 0; i < GFX_INTEROP_IN_FLIGHT; i++) {
+    av_frame_free(&(*interop)->in_flight[i]);
+  }
+#else
+  (void)ctx;
+#endif
+  free(*interop);
+  *interop = NULL;
+}
+
+// Point staging->frame at a buffer from its pool, the pool is rebuilt when
+// the size changes. The last buffer goes back to the pool here, so decoding
+// at a steady size allocates nothing.
+static int gfx_lowlevel_staging_get(struct gfx_lowlevel_staging* staging,
+                                    int width, int height,
+                                    enum AVPixelFormat format) {
+  if (!staging->frame) {
+    staging->frame = av_frame_alloc();
+    if (!staging->frame) {
+      fprintf(stderr, "gfx_ll> Failed to allocate staging AVFrame\n");
       return ENOMEM;
     }
-    dst->to_rgba = sws_ctx;
   }
+  av_frame_unref(staging->frame);
 
+  int size = av_image_get_buffer_size(format, width, height, 32);
+  if (size < 0) {
+    fprintf(stderr, "gfx_ll> Invalid staging frame size %d\n", size);
+    return size;
+  }
+  if (!staging->pool || staging->size != size) {
+    // buffers still out keep the old pool alive until they are returned
+    av_buffer_pool_uninit(&staging->pool);
+    staging->pool = av_buffer_pool_init(size, NULL);
+    staging->size = staging->pool ? size : 0;
+    if (!staging->pool) {
+      fprintf(stderr, "gfx_ll> Failed to create staging pool\n");
+      return ENOMEM;
+    }
+  }
+
+  AVBufferRef* buf = av_buffer_pool_get(staging->pool);
+  if (!buf) {
+    fprintf(stderr, "gfx_ll> Failed to get staging buffer\n");
+    return ENOMEM;
+  }
+  staging->frame->buf[0] = buf;
+  staging->frame->width = width;
+  staging->frame->height = height;
+  staging->frame->format = format;
+  int ret = av_image_fill_arrays(staging->frame->data, staging->frame->linesize,
+                                 buf->data, format, width, height, 32);
+  if (ret < 0) {
+    fprintf(stderr, "gfx_ll> Failed to lay out staging frame %d\n", ret);
+    av_frame_unref(staging->frame);
+    return ret;
+  }
+  return 0;
+}
+
+static void gfx_lowlevel_staging_free(struct gfx_lowlevel_staging* staging) {
+  av_frame_free(&staging->frame);
+  av_buffer_pool_uninit(&staging->pool);
+  staging->size = 0;
+}
+
+static void gfx_lowlevel_buffer_unowned(void* opaque, uint8_t* data) {}
+
+// Convert src to RGBA into data with pitch bytes per row. This goes through
+// sws_scale_frame because plain sws_scale never uses the slice threads.
+static int gfx_lowlevel_convert_rgba(struct gfx_lowlevel_frame_ctx* dst,
+                                     AVFrame* src, uint8_t* data,
+                                     size_t pitch) {
+  if (!dst->convert_out) {
+    dst->convert_out = av_frame_alloc();
+    if (!dst->convert_out) {
+      return ENOMEM;
+    }
+  }
+  AVFrame* out = dst->convert_out;
+  out->buf[0] = av_buffer_create(data, pitch * src->height,
+                                 gfx_lowlevel_buffer_unowned, NULL, 0);
+  if (!out->buf[0]) {
+    return ENOMEM;
+  }
+  out->data[0] = data;
+  out->linesize[0] = (int)pitch;
+  out->width = src->width;
+  out->height = src->height;
+  out->format = AV_PIX_FMT_RGBA;
+  int ret = sws_scale_frame(dst->to_rgba, out, src);
+  av_frame_unref(out);
+  return ret;
+}
+
+// Convert src into the next mapped upload buffer and upload tex[0] from it.
+// Returns ENOTSUP when the GPU can't map a buffer that large.
+static int gfx_lowlevel_upload_rgba(struct gfx_lowlevel_gpu_ctx* ctx,
+                                    struct gfx_lowlevel_frame_ctx* dst,
+                                    AVFrame* src) {
+  pl_gpu gpu = ctx->vk->gpu;
+  // the conversion wants aligned rows as much as the transfer does
+  size_t align = gpu->limits.align_tex_xfer_pitch > 64
+                     ? gpu->limits.align_tex_xfer_pitch
+                     : 64;
+  size_t pitch = ((size_t)src->width * 4 + align - 1) / align * align;
+  size_t size = pitch * src->height;
+  if (size > gpu->limits.max_mapped_size) {
+    return ENOTSUP;
+  }
+
+  pl_buf* buf = &dst->upload_bufs[dst->upload_next];
+  if (!pl_buf_recreate(gpu, buf,
+                       &(struct pl_buf_params){
+                           .size = size,
+                           .host_mapped = true,
+                       })) {
+    fprintf(stderr, "gfx_ll> Failed to create upload buffer\n");
+    return ENOMEM;
+  }
+  // the upload from this slot a couple of frames ago has to be done first
+  if (pl_buf_poll(gpu, *buf, UINT64_MAX)) {
+    fprintf(stderr, "gfx_ll> Upload buffer is still in use\n");
+    return EBUSY;
+  }
+
+  int ret = gfx_lowlevel_convert_rgba(dst, src, (*buf)->data, pitch);
+  if (ret < 0) {
+    fprintf(stderr, "gfx_ll> Failed to scale frame %d\n", ret);
+    return ret;
+  }
+
+  pl_fmt fmt = pl_find_named_fmt(gpu, "rgba8");
+  if (!fmt) {
+    fprintf(stderr, "gfx_ll> Failed to find format\n");
+    return EINVAL;
+  }
+  if (!pl_tex_recreate(gpu, &dst->tex[0],
+                       &(struct pl_tex_params){
+                           .w = src->width,
+                           .h = src->height,
+                           .format = fmt,
+                           .sampleable = true,
+                           .host_writable = true,
+                           .blit_src = true,
+                       })) {
+    fprintf(stderr, "gfx_ll> Failed to create upload texture\n");
+    return ENOMEM;
+  }
+  if (!pl_tex_upload(gpu, &(struct pl_tex_transfer_params){
+                              .tex = dst->tex[0],
+                              .buf = *buf,
+                              .row_pitch = pitch,
+                          })) {
+    fprintf(stderr, "gfx_ll> Failed to upload frame\n");
+    return EIO;
+  }
+
+  gfx_lowlevel_frame_wrap_tex(&dst->pl_frame, dst->tex[0]);
+  dst->pl_frame.repr = pl_color_repr_rgb;
+  dst->upload_next = (dst->upload_next + 1) % GFX_LOWLEVEL_UPLOAD_RING;
+  return 0;
+}
+
+static bool gfx_lowlevel_gpu_convertible(enum AVPixelFormat format) {
+  switch (format) {
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_P010:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Upload the planes of a YUV frame into dst->tex and render them to RGBA,
+// hardware frames are downloaded in their native format first
+static int gfx_lowlevel_map_yuv(struct gfx_lowlevel_gpu_ctx* ctx,
+                                struct gfx_lowlevel_frame_ctx* dst,
+                                AVFrame* src, enum AVPixelFormat sw_format) {
   if (dst->is_mapped) {
     pl_unmap_avframe(ctx->vk->gpu, &dst->pl_frame);
+    dst->is_mapped = false;
+  }
+  if (dst->yuv_mapped) {
+    pl_unmap_avframe(ctx->vk->gpu, &dst->yuv_frame);
+    dst->yuv_mapped = false;
   }
 
   int ret = 0;
-  AVFrame* tmp = NULL;
   if (src->format == AV_PIX_FMT_VIDEOTOOLBOX) {
-    tmp = av_frame_alloc();
-    if (!tmp) {
-      fprintf(stderr, "gfx_ll> Failed to allocate temporary AVFrame\n");
-      return ENOMEM;
+    ret = gfx_lowlevel_staging_get(&dst->hw_staging, src->width, src->height,
+                                   sw_format);
+    if (ret != 0) {
+      return ret;
     }
-    tmp->format = AV_PIX_FMT_NV12;
-    ret = av_hwframe_transfer_data(tmp, src, 0);
+    AVFrame* staged = dst->hw_staging.frame;
+    ret = av_hwframe_transfer_data(staged, src, 0);
     if (ret < 0) {
       fprintf(stderr, "gfx_ll> Failed to transfer data %d\n", ret);
-      exit(1);
-      av_frame_free(&tmp);
       return ret;
     }
-    src = tmp;
+    av_frame_copy_props(staged, src);
+    src = staged;
+  }
+
+  struct pl_avframe_params params = {.frame = src, .tex = dst->tex};
+  if (!pl_map_avframe_ex(ctx->vk->gpu, &dst->yuv_frame, &params)) {
+    fprintf(stderr, "gfx_ll> Failed to map YUV AVFrame to libplacebo frame\n");
+    return EINVAL;
+  }
+  dst->yuv_mapped = true;
+
+  return gfx_lowlevel_convert_frame(ctx, dst, &dst->yuv_frame, src->width,
+                                    src->height);
+}
+
+static int gfx_lowlevel_map_frame(struct gfx_lowlevel_gpu_ctx* ctx,
+                                  struct gfx_lowlevel_frame_ctx* dst,
+                                  AVFrame* src) {
+
+#ifdef __APPLE__
+  if (src->format == AV_PIX_FMT_VIDEOTOOLBOX && dst->hw_interop &&
+      ctx->has_iosurface_interop) {
+    if (dst->is_mapped) {
+      pl_unmap_avframe(ctx->vk->gpu, &dst->pl_frame);
+      dst->is_mapped = false;
+    }
+    if (dst->yuv_mapped) {
+      pl_unmap_avframe(ctx->vk->gpu, &dst->yuv_frame);
+      dst->yuv_mapped = false;
+    }
+    int ret = gfx_lowlevel_map_videotoolbox(ctx, dst, src);
+    if (ret == 0) {
+      return 0;
+    }
+    fprintf(stderr,
+            "gfx_ll> IOSurface import failed (%d), falling back to copy\n",
+            ret);
+    dst->hw_interop = false;
   }
+#endif
 
-  AVFrame *map_src, *rgba_frame = NULL;
-  if (dst->to_rgba != NULL) {
-    rgba_frame = av_frame_alloc();
-    if (!rgba_frame) {
-      fprintf(stderr, "gfx_ll> Failed to allocate temporary AVFrame\n");
-      av_frame_free(&tmp);
+  enum AVPixelFormat sw_format = src->format;
+  if (sw_format == AV_PIX_FMT_VIDEOTOOLBOX) {
+    sw_format = src->hw_frames_ctx
+                    ? ((AVHWFramesContext*)src->hw_frames_ctx->data)->sw_format
+                    : AV_PIX_FMT_NV12;
+  }
+  if (dst->gpu_convert && gfx_lowlevel_gpu_convertible(sw_format)) {
+    return gfx_lowlevel_map_yuv(ctx, dst, src, sw_format);
+  }
+
+  if (dst->to_rgba == NULL) {
+    enum AVPixelFormat src_format = src->format;
+    if (src_format == AV_PIX_FMT_VIDEOTOOLBOX) {
+      src_format = AV_PIX_FMT_NV12;
+    }
+    // same size in and out, so the cheapest filter only decides chroma
+    // upsampling for the formats without an unscaled converter
+    struct SwsContext* sws_ctx = sws_alloc_context();
+    if (!sws_ctx) {
+      fprintf(stderr, "gfx_ll> Failed to create sws context\n");
       return ENOMEM;
     }
+    av_opt_set_int(sws_ctx, "srcw", src->width, 0);
+    av_opt_set_int(sws_ctx, "srch", src->height, 0);
+    av_opt_set_int(sws_ctx, "src_format", src_format, 0);
+    av_opt_set_int(sws_ctx, "dstw", src->width, 0);
+    av_opt_set_int(sws_ctx, "dsth", src->height, 0);
+    av_opt_set_int(sws_ctx, "dst_format", AV_PIX_FMT_RGBA, 0);
+    av_opt_set_int(sws_ctx, "sws_flags", SWS_FAST_BILINEAR, 0);
+    av_opt_set_int(sws_ctx, "threads",
+                   dst->convert_threads > 1 ? dst->convert_threads : 1, 0);
+    if (sws_init_context(sws_ctx, NULL, NULL) < 0) {
+      fprintf(stderr, "gfx_ll> Failed to initialize sws context\n");
+      sws_freeContext(sws_ctx);
+      return EINVAL;
+    }
+    dst->to_rgba = sws_ctx;
+  }
 
-    rgba_frame->width = src->width;
-    rgba_frame->height = src->height;
-    rgba_frame->format = AV_PIX_FMT_RGBA;
-    ret = av_frame_get_buffer(rgba_frame, 32);
-    if (ret < 0) {
-      fprintf(stderr, "gfx_ll> Failed to allocate hw frame buffer %d\n", ret);
-      av_frame_free(&rgba_frame);
-      av_frame_free(&tmp);
+  if (dst->is_mapped) {
+    pl_unmap_avframe(ctx->vk->gpu, &dst->pl_frame);
+    dst->is_mapped = false;
+  }
+  if (dst->yuv_mapped) {
+    pl_unmap_avframe(ctx->vk->gpu, &dst->yuv_frame);
+    dst->yuv_mapped = false;
+  }
+
+  int ret = 0;
+  if (src->format == AV_PIX_FMT_VIDEOTOOLBOX) {
+    ret = gfx_lowlevel_staging_get(&dst->hw_staging, src->width, src->height,
+                                   AV_PIX_FMT_NV12);
+    if (ret != 0) {
       return ret;
     }
-
-    ret =
-        sws_scale(dst->to_rgba, (const uint8_t* const*)src->data, src->linesize,
-                  0, src->height, rgba_frame->data, rgba_frame->linesize);
+    ret = av_hwframe_transfer_data(dst->hw_staging.frame, src, 0);
     if (ret < 0) {
-      fprintf(stderr, "gfx_ll> Failed to scale frame %d\n", ret);
-      av_frame_free(&rgba_frame);
-      av_frame_free(&tmp);
-      return ret;
+      fprintf(stderr, "gfx_ll> Failed to transfer data %d\n", ret);
+      exit(1);
     }
-    map_src = rgba_frame;
-  } else {
-    map_src = src;
+    src = dst->hw_staging.frame;
   }
 
-  struct pl_avframe_params params = {.frame = map_src, .tex = dst->tex};
-  ret = pl_map_avframe_ex(ctx->vk->gpu, &dst->pl_frame, &params);
+  ret = gfx_lowlevel_upload_rgba(ctx, dst, src);
+  if (ret != ENOTSUP) {
+    return ret;
+  }
+
+  // too big to map, convert into pooled memory and let libplacebo upload it
+  ret = gfx_lowlevel_staging_get(&dst->rgba_staging, src->width, src->height,
+                                 AV_PIX_FMT_RGBA);
+  if (ret != 0) {
+    return ret;
+  }
+  AVFrame* rgba_frame = dst->rgba_staging.frame;
+  ret = sws_scale_frame(dst->to_rgba, rgba_frame, src);
   if (ret < 0) {
-    fprintf(stderr, "gfx_ll> Failed to map AVFrame to libplacebo frame\n");
+    fprintf(stderr, "gfx_ll> Failed to scale frame %d\n", ret);
     return ret;
   }
-  // pl_gpu_finish(ctx->vk->gpu);
-  dst->is_mapped = true;
 
-  if (tmp) {
-    av_frame_free(&tmp);
+  struct pl_avframe_params params = {.frame = rgba_frame, .tex = dst->tex};
+  if (!pl_map_avframe_ex(ctx->vk->gpu, &dst->pl_frame, &params)) {
+    fprintf(stderr, "gfx_ll> Failed to map AVFrame to libplacebo frame\n");
+    return EINVAL;
   }
+  dst->is_mapped = true;
+  return 0;
+}
 
-  if (rgba_frame) {
-    av_frame_free(&rgba_frame);
+// Recount what dst holds for its video after a map, textures are only
+// recreated when the frame size or format changes so this is mostly a no-op
+static void gfx_lowlevel_frame_account(struct gfx_lowlevel_frame_ctx* dst) {
+  uint64_t bytes = gfx_lowlevel_tex_bytes(dst->convert_tex);
+  for (int i = dst->tex_pooled ? 1 : 0; i < 4; i++) {
+    bytes += gfx_lowlevel_tex_bytes(dst->tex[i]);
+  }
+  for (int i = 0; i < GFX_LOWLEVEL_UPLOAD_RING; i++) {
+    if (dst->upload_bufs[i]) {
+      bytes += dst->upload_bufs[i]->params.size;
+    }
+  }
+  if (bytes == dst->video_bytes) {
+    return;
   }
+  struct gfx_lowlevel_tex_pool* pool =
+      gfx_lowlevel_tex_pool_of(dst->ctx_backref);
+  gfx_lowlevel_tex_pool_lock(pool);
+  pool->stats.video_bytes += bytes - dst->video_bytes;
+  gfx_lowlevel_tex_pool_unlock(pool);
+  dst->video_bytes = bytes;
+}
 
-  return 0;
+int gfx_lowlevel_map_frame_ctx(struct gfx_lowlevel_gpu_ctx* ctx,
+                               struct gfx_lowlevel_frame_ctx* dst,
+                               AVFrame* src) {
+  if (!ctx || !dst || !src) {
+    fprintf(stderr, "gfx_ll> Invalid context or frame\n");
+    return EINVAL;
+  }
+  int ret = gfx_lowlevel_map_frame(ctx, dst, src);
+  gfx_lowlevel_frame_account(dst);
+  return ret;
 }
 
 int gfx_lowlevel_frame_create_texture(struct gfx_lowlevel_gpu_ctx* ctx,
                                       struct gfx_lowlevel_frame_ctx* frame,
                                       int width, int height) {
-  if (!ctx || !frame) {
-    fprintf(stderr, "gfx_ll> Invalid context or frame\n");
+  return gfx_lowlevel_frame_create_texture_fmt(ctx, frame, width, height,
+                                               "rgba8", false);
+}
+
+int gfx_lowlevel_frame_create_texture_fmt(struct gfx_lowlevel_gpu_ctx* ctx,
+                                          struct gfx_lowlevel_frame_ctx* frame,
+                                          int width, int height,
+                                          const char* format, bool storable) {
+  if (!ctx || !frame || !format) {
+    fprintf(stderr, "gfx_ll> Invalid context, frame or format\n");
     return EINVAL;
   }
 
-  pl_fmt fmt = pl_find_named_fmt(ctx->vk->gpu, "rgba8");
+  // libplacebo names the packed float format by its channel order
+  if (!strcmp(format, "r11g11b10f")) {
+    format = "rg11b10f";
+  }
+  pl_fmt fmt = pl_find_named_fmt(ctx->vk->gpu, format);
   if (!fmt) {
-    fprintf(stderr, "gfx_ll> Failed to find format\n");
-    return EINVAL;
+    fprintf(stderr, "gfx_ll> Failed to find format %s\n", format);
+    return ENOTSUP;
+  }
+  enum pl_fmt_caps needed = PL_FMT_CAP_SAMPLEABLE | PL_FMT_CAP_RENDERABLE;
+  if (storable) {
+    needed |= PL_FMT_CAP_STORABLE;
+  }
+  if ((fmt->caps & needed) != needed) {
+    fprintf(stderr, "gfx_ll> Format %s can't be sampled and rendered to%s\n",
+            format, storable ? " or stored" : "");
+    return ENOTSUP;
   }
+  bool blittable = (fmt->caps & PL_FMT_CAP_BLITTABLE) != 0;
 
   struct pl_tex_params tex_params = {
       .w = width,
@@ -355,29 +1583,25 @@ int gfx_lowlevel_frame_create_texture(struct gfx_lowlevel_gpu_ctx* ctx,
       .format = fmt,
       .sampleable = true,
       .renderable = true,
-      .blit_src = true,
-      .blit_dst = true,
-  };
-
-  frame->tex[0] = pl_tex_create(ctx->vk->gpu, &tex_params);
-  if (!frame->tex[0]) {
-    fprintf(stderr, "gfx_ll> Failed to create texture\n");
-    return EINVAL;
-  }
-
-  struct pl_plane plane = {
-      .texture = frame->tex[0],
-      .components = fmt->num_components,
-      .component_mapping = {fmt->sample_order[0], fmt->sample_order[1],
-                            fmt->sample_order[2], fmt->sample_order[3]},
+      .storable = storable,
+      .blit_src = blittable,
+      .blit_dst = blittable,
   };
 
-  struct pl_frame* f = &frame->pl_frame;
-  f->num_planes = 1;
-  f->planes[0] = plane;
-  f->repr = pl_color_repr_unknown;
-  f->color = pl_color_space_unknown;
+  struct gfx_lowlevel_tex_pool* pool = gfx_lowlevel_tex_pool_of(ctx);
+  if (frame->tex_pooled) {
+    gfx_lowlevel_tex_pool_put(pool, ctx->vk->gpu, &frame->tex[0]);
+  } else if (frame->tex[0]) {
+    pl_tex_destroy(ctx->vk->gpu, &frame->tex[0]);
+  }
+  frame->tex[0] = gfx_lowlevel_tex_pool_take(pool, ctx->vk->gpu, &tex_params);
+  frame->tex_pooled = frame->tex[0] != NULL;
+  if (!frame->tex[0]) {
+    fprintf(stderr, "gfx_ll> Failed to create texture\n");
+    return EINVAL;
+  }
 
+  gfx_lowlevel_frame_wrap_tex(&frame->pl_frame, frame->tex[0]);
   return 0;
 }
 
@@ -395,27 +1619,53 @@ struct gfx_lowlevel_frame_ctx* gfx_lowlevel_frame_ctx_init(
     return NULL;
   }
   memset(frame, 0, sizeof(struct gfx_lowlevel_frame_ctx));
-  frame->ctx_backref = ctx;
+  // frames outlive the fork that made them
+  frame->ctx_backref = ctx->parent ? ctx->parent : ctx;
   return frame;
 }
 
 void gfx_lowlevel_frame_ctx_destroy(struct gfx_lowlevel_frame_ctx** frame) {
   if (frame && *frame && (*frame)->ctx_backref &&
-      (*frame)->ctx_backref->swchain && (*frame)->ctx_backref->vk->gpu) {
+      (*frame)->ctx_backref->vk && (*frame)->ctx_backref->vk->gpu) {
     if ((*frame)->is_mapped) {
       pl_unmap_avframe((*frame)->ctx_backref->vk->gpu, &(*frame)->pl_frame);
     }
+    if ((*frame)->yuv_mapped) {
+      pl_unmap_avframe((*frame)->ctx_backref->vk->gpu, &(*frame)->yuv_frame);
+    }
 
+    struct gfx_lowlevel_tex_pool* pool =
+        gfx_lowlevel_tex_pool_of((*frame)->ctx_backref);
+    if ((*frame)->tex_pooled) {
+      gfx_lowlevel_tex_pool_put(pool, (*frame)->ctx_backref->vk->gpu,
+                                &(*frame)->tex[0]);
+    }
     for (int i = 0; i < 4; i++) {
       if ((*frame)->tex[i]) {
         pl_tex_destroy((*frame)->ctx_backref->vk->gpu, &(*frame)->tex[i]);
       }
     }
+    if ((*frame)->video_bytes) {
+      gfx_lowlevel_tex_pool_lock(pool);
+      pool->stats.video_bytes -= (*frame)->video_bytes;
+      gfx_lowlevel_tex_pool_unlock(pool);
+    }
 
+    av_frame_free(&(*frame)->convert_out);
     if ((*frame)->to_rgba) {
       sws_freeContext((*frame)->to_rgba);
     }
 
+    if ((*frame)->convert_tex) {
+      pl_tex_destroy((*frame)->ctx_backref->vk->gpu, &(*frame)->convert_tex);
+    }
+    for (int i = 0; i < GFX_LOWLEVEL_UPLOAD_RING; i++) {
+      pl_buf_destroy((*frame)->ctx_backref->vk->gpu, &(*frame)->upload_bufs[i]);
+    }
+    gfx_lowlevel_staging_free(&(*frame)->hw_staging);
+    gfx_lowlevel_staging_free(&(*frame)->rgba_staging);
+    gfx_lowlevel_interop_destroy((*frame)->ctx_backref, &(*frame)->interop);
+
     (*frame)->is_mapped = false;
     (*frame)->ctx_backref = NULL;
     (*frame)->pl_frame = (struct pl_frame){0};
@@ -436,6 +1686,55 @@ int gfx_lowlevel_frame_clear(struct gfx_lowlevel_gpu_ctx* ctx,
   return 0;
 }
 
+static bool gfx_lowlevel_render_build(pl_shader sh,
+                                      const struct pl_custom_shader* sh_params,
+                                      struct gfx_lowlevel_lut* lut) {
+  if (!pl_shader_custom(sh, sh_params)) {
+    return false;
+  }
+  if (lut && lut->lut) {
+    pl_shader_custom_lut(sh, lut->lut, &lut->lut_state);
+  }
+  return true;
+}
+
+// Build a throwaway copy of the shader to read what it finalizes to, the one
+// that is dispatched can't be finalized beforehand
+static void gfx_lowlevel_render_stats(struct gfx_lowlevel_gpu_ctx* ctx,
+                                      const struct pl_custom_shader* sh_params,
+                                      struct gfx_lowlevel_lut* lut,
+                                      struct gfx_lowlevel_shader_stats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  int64_t started = av_gettime_relative();
+  pl_shader sh = pl_dispatch_begin(ctx->dispatch);
+  if (!sh) {
+    return;
+  }
+  const struct pl_shader_res* res = NULL;
+  if (gfx_lowlevel_render_build(sh, sh_params, lut)) {
+    res = pl_shader_finalize(sh);
+  }
+  if (res) {
+    stats->num_descriptors = res->num_descriptors;
+    stats->num_variables = res->num_variables;
+    stats->num_constants = res->num_constants;
+    stats->num_vertex_attribs = res->num_vertex_attribs;
+    for (const char* c = res->glsl; c && *c; c++) {
+      if (*c == '\n') {
+        stats->glsl_lines++;
+      } else if (*c == ';') {
+        stats->glsl_statements++;
+      }
+    }
+    if (sh_params->compute) {
+      stats->compute_group_size[0] = res->compute_group_size[0];
+      stats->compute_group_size[1] = res->compute_group_size[1];
+    }
+  }
+  pl_dispatch_abort(ctx->dispatch, &sh);
+  stats->build_us = av_gettime_relative() - started;
+}
+
 int gfx_lowlevel_gpu_ctx_render(struct gfx_lowlevel_gpu_ctx* ctx,
                                 // struct gfx_lowlevel_mix_ctx* mix_ctx,
                                 struct gfx_lowlevel_filter_params const* params,
@@ -448,6 +1747,18 @@ int gfx_lowlevel_gpu_ctx_render(struct gfx_lowlevel_gpu_ctx* ctx,
     return EINVAL;
   }
 
+  // Passes render straight into their own targets now, so the same texture
+  // must never be bound as both input and output of a dispatch
+  pl_tex dst_tex = dst_frame->planes[0].texture;
+  for (int i = 0; i < num_frames + num_passes; i++) {
+    struct pl_frame* f =
+        i < num_frames ? src_frames[i] : passes[i - num_frames];
+    if (f && f->planes[0].texture == dst_tex) {
+      fprintf(stderr, "gfx_ll> Render target is also bound as input %d\n", i);
+      return EINVAL;
+    }
+  }
+
   // Render the image and run shaders
   pl_shader sh = pl_dispatch_begin(ctx->dispatch);
   if (!sh) {
@@ -455,107 +1766,17 @@ int gfx_lowlevel_gpu_ctx_render(struct gfx_lowlevel_gpu_ctx* ctx,
     return EINVAL;
   }
 
-  // Use pre-allocated resources from pool instead of malloc
-  int total_resources = num_frames + num_passes;
-  if (total_resources > ctx->resource_pool.max_resources) {
-    fprintf(stderr,
-            "gfx_ll> Too many frames+passes (%d) exceeds pool size (%d)\n",
-            total_resources, ctx->resource_pool.max_resources);
-    return ENOMEM;
-  }
-
-  struct pl_shader_desc* descs = ctx->resource_pool.descs;
-  struct pl_shader_va* attribs = ctx->resource_pool.attribs;
-
-  // Clear the arrays (they're reused across frames)
-  memset(descs, 0, sizeof(struct pl_shader_desc) * total_resources);
-  memset(attribs, 0, sizeof(struct pl_shader_va) * (total_resources + 1));
-
-  int num_descs = 0;
-  int num_attribs = 0;
-  int name_idx = 0;  // Track which pre-allocated name/buffer we're using
-
-  // add a dummy vertex attrib for the src coords, since the shader expects one
-  {
-    if (name_idx >= ctx->resource_pool.max_names) {
-      fprintf(stderr, "gfx_ll> Exceeded max names in resource pool\n");
-      return ENOMEM;
-    }
-    char* name = ctx->resource_pool.names[name_idx];
-    float* verts = ctx->resource_pool.vert_buffers[name_idx];
-    name_idx++;
-
-    snprintf(name, 32, "src_uv");
-    verts[0] = params->src.x0;
-    verts[1] = params->src.y0;
-    verts[2] = params->src.x1;
-    verts[3] = params->src.y0;
-    verts[4] = params->src.x0;
-    verts[5] = params->src.y1;
-    verts[6] = params->src.x1;
-    verts[7] = params->src.y1;
-    attribs[num_attribs++] = (struct pl_shader_va){
-        .attr =
-            {
-                .name = name,
-                .offset = 0,
-                .fmt = pl_find_vertex_fmt(ctx->vk->gpu, PL_FMT_FLOAT, 2),
-            },
-        .data = {verts, (verts + 2), (verts + 4), (verts + 6)},
-    };
-  }
-
-  // Setup the source frames as inputs
-  for (int i = 0; i < num_frames; i++) {
-    // set up sampler
-    {
-      if (name_idx >= ctx->resource_pool.max_names) {
-        fprintf(stderr, "gfx_ll> Exceeded max names in resource pool\n");
-        return ENOMEM;
-      }
-      char* name = ctx->resource_pool.names[name_idx++];
-      snprintf(name, 32, "src_tex%d", i);
-      descs[num_descs] = (struct pl_shader_desc){
-          .desc = {.name = name,
-                   .type = PL_DESC_SAMPLED_TEX,
-                   .binding = num_descs,
-                   .access = PL_DESC_ACCESS_READONLY},
-          .binding =
-              {
-                  .object = src_frames[i]->planes[0].texture,
-                  .address_mode = PL_TEX_ADDRESS_REPEAT,
-                  .sample_mode = PL_TEX_SAMPLE_LINEAR,
-              },
-      };
-      num_descs++;
-    }
-  }
-
-  // Set up the previous passes as inputs, if applicable
-  for (int i = 0; i < num_passes; i++) {
-    // set up sampler for pass
-    {
-      if (name_idx >= ctx->resource_pool.max_names) {
-        fprintf(stderr, "gfx_ll> Exceeded max names in resource pool\n");
-        return ENOMEM;
-      }
-      char* name = ctx->resource_pool.names[name_idx++];
-      snprintf(name, 32, "pass_tex%d", i);
-      descs[num_descs] = (struct pl_shader_desc){
-          .desc = {.name = name,
-                   .type = PL_DESC_SAMPLED_TEX,
-                   .binding = num_descs,
-                   .access = PL_DESC_ACCESS_READONLY},
-          .binding =
-              {
-                  .object = passes[i]->planes[0].texture,
-                  .address_mode = PL_TEX_ADDRESS_REPEAT,
-                  .sample_mode = PL_TEX_SAMPLE_LINEAR,
-              },
-      };
-      num_descs++;
-    }
+  // a mixer keeps its own template, so its layout survives other mixers
+  // rendering in between
+  struct gfx_lowlevel_render_template* tmpl =
+      params->mix_ctx ? &params->mix_ctx->tmpl : &ctx->resource_pool;
+  int err = gfx_lowlevel_render_template_fill(tmpl, params, src_frames,
+                                              num_frames, passes, num_passes);
+  if (err != 0) {
+    pl_dispatch_abort(ctx->dispatch, &sh);
+    return err;
   }
+  int num_descs = num_frames + num_passes + params->num_storage;
 
   struct pl_custom_shader sh_params = {
       .description = "Return src tex",
@@ -564,25 +1785,26 @@ int gfx_lowlevel_gpu_ctx_render(struct gfx_lowlevel_gpu_ctx* ctx,
       .body = params->body,
       .input = PL_SHADER_SIG_NONE,
       .output = PL_SHADER_SIG_COLOR,
-      .descriptors = descs,
+      .descriptors = tmpl->descs,
       .num_descriptors = num_descs,
       .variables = params->vars,
       .num_variables = params->num_vars,
-      .vertex_attribs = attribs,
-      .num_vertex_attribs = num_attribs,
-      .constants = NULL,
-      .num_constants = 0,
-      .compute = false,
+      .vertex_attribs = &tmpl->attrib,
+      .num_vertex_attribs = 1,
+      .constants = params->constants,
+      .num_constants = params->num_constants,
+      .compute = params->compute,
+      .compute_shmem = params->compute_shmem,
+      .compute_group_size = {params->compute_size[0], params->compute_size[1]},
   };
 
-  if (!pl_shader_custom(sh, &sh_params)) {
+  if (!gfx_lowlevel_render_build(sh, &sh_params, lut)) {
     fprintf(stderr, "gfx_ll> Failed to create custom shader\n");
-    // Note: No need to free resources - they're from the pool
+    pl_dispatch_abort(ctx->dispatch, &sh);
     return EINVAL;
   }
-
-  if (lut && lut->lut) {
-    pl_shader_custom_lut(sh, lut->lut, &lut->lut_state);
+  if (params->stats) {
+    gfx_lowlevel_render_stats(ctx, &sh_params, lut, params->stats);
   }
 
   if (debug) {
@@ -626,6 +1848,7 @@ int gfx_lowlevel_gpu_ctx_render(struct gfx_lowlevel_gpu_ctx* ctx,
                         .y1 = params->dst.y1 *
                               dst_frame->planes[0].texture->params.h,
                     },
+                .timer = params->timer ? params->timer->timer : NULL,
             })) {
       fprintf(stderr, "gfx_ll> Failed to finish dispatch\n");
       return EINVAL;
@@ -639,16 +1862,237 @@ int gfx_lowlevel_gpu_ctx_render(struct gfx_lowlevel_gpu_ctx* ctx,
   return 0;
 }
 
+// Queue an async download of the offscreen texture into the next ring slot
+static int gfx_lowlevel_readback_start(struct gfx_lowlevel_gpu_ctx* ctx) {
+  if (ctx->readback.count == GFX_LOWLEVEL_READBACK_RING) {
+    fprintf(stderr, "gfx_ll> Readback ring is full, read frames back first\n");
+    return GFX_EAGAIN;
+  }
+  int slot = (ctx->readback.head + ctx->readback.count) %
+             GFX_LOWLEVEL_READBACK_RING;
+  pl_tex tex = ctx->offscreen;
+  size_t size = (size_t)tex->params.w * tex->params.h *
+                tex->params.format->texel_size;
+  if (!pl_buf_recreate(ctx->vk->gpu, &ctx->readback.bufs[slot],
+                       &(struct pl_buf_params){
+                           .size = size,
+                           .host_readable = true,
+                       })) {
+    fprintf(stderr, "gfx_ll> Failed to create readback buffer\n");
+    return ENOMEM;
+  }
+  if (!pl_tex_download(ctx->vk->gpu, &(struct pl_tex_transfer_params){
+                                         .tex = tex,
+                                         .buf = ctx->readback.bufs[slot],
+                                     })) {
+    fprintf(stderr, "gfx_ll> Failed to download frame\n");
+    return EIO;
+  }
+  // get the work going, it is only waited on when the frame is read back
+  pl_gpu_flush(ctx->vk->gpu);
+  ctx->readback.frame_ids[slot] = ctx->readback.next_id++;
+  ctx->readback.count++;
+  return 0;
+}
+
+int gfx_lowlevel_readback_next(struct gfx_lowlevel_gpu_ctx* ctx, uint8_t* dst,
+                               int dst_stride, uint64_t timeout_ns,
+                               uint64_t* frame_id) {
+  if (!ctx || !ctx->headless || !dst) {
+    fprintf(stderr, "gfx_ll> Invalid headless context or buffer\n");
+    return EINVAL;
+  }
+  if (ctx->readback.count == 0) {
+    return GFX_EAGAIN;
+  }
+  pl_buf buf = ctx->readback.bufs[ctx->readback.head];
+  if (pl_buf_poll(ctx->vk->gpu, buf, timeout_ns)) {
+    return GFX_EAGAIN;
+  }
+
+  pl_tex tex = ctx->offscreen;
+  size_t row = (size_t)tex->params.w * tex->params.format->texel_size;
+  if ((size_t)dst_stride == row) {
+    if (!pl_buf_read(ctx->vk->gpu, buf, 0, dst, row * tex->params.h)) {
+      fprintf(stderr, "gfx_ll> Failed to read back frame\n");
+      return EIO;
+    }
+  } else {
+    for (int y = 0; y < tex->params.h; y++) {
+      if (!pl_buf_read(ctx->vk->gpu, buf, y * row, dst + (size_t)y * dst_stride,
+                       row)) {
+        fprintf(stderr, "gfx_ll> Failed to read back frame\n");
+        return EIO;
+      }
+    }
+  }
+
+  if (frame_id) {
+    *frame_id = ctx->readback.frame_ids[ctx->readback.head];
+  }
+  ctx->readback.head = (ctx->readback.head + 1) % GFX_LOWLEVEL_READBACK_RING;
+  ctx->readback.count--;
+  return 0;
+}
+
+void gfx_lowlevel_gpu_ctx_flush(struct gfx_lowlevel_gpu_ctx* ctx) {
+  if (ctx && ctx->vk) {
+    pl_gpu_flush(ctx->vk->gpu);
+  }
+}
+
 int gfx_lowlevel_gpu_ctx_finish_frame(struct gfx_lowlevel_gpu_ctx* ctx) {
   assert(ctx != NULL);
-  assert(ctx->swchain != NULL);
   assert(ctx->started);
+  if (ctx->headless) {
+    ctx->started = false;
+    return gfx_lowlevel_readback_start(ctx);
+  }
+  assert(ctx->swchain != NULL);
   pl_swapchain_submit_frame(ctx->swchain);
   pl_swapchain_swap_buffers(ctx->swchain);
   ctx->started = false;
   return 0;
 }
 
+// Array uniforms get room for this many elements up front so SendCmds
+// changing their length don't have to reallocate
+#define GFX_LOWLEVEL_VAR_ARRAY_RESERVE 64
+
+static uint32_t gfx_lowlevel_hash_name(const char* name, size_t len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static int gfx_lowlevel_mix_ctx_build_index(
+    struct gfx_lowlevel_mix_ctx* mix_ctx) {
+  int size = 8;
+  while (size < mix_ctx->num_vars * 2) {
+    size *= 2;
+  }
+  mix_ctx->var_index = calloc(size, sizeof(int));
+  mix_ctx->var_capacity = calloc(mix_ctx->num_vars + 1, sizeof(size_t));
+  if (!mix_ctx->var_index || !mix_ctx->var_capacity) {
+    fprintf(stderr, "gfx_ll> Failed to allocate shader variable index\n");
+    return ENOMEM;
+  }
+  mix_ctx->var_index_size = size;
+
+  for (int i = 0; i < mix_ctx->num_vars; i++) {
+    struct pl_shader_var* var = &mix_ctx->vars[i];
+    size_t elem = sizeof(float) * var->var.dim_v * var->var.dim_m;
+    size_t bytes = elem * var->var.dim_a;
+    if (var->var.dim_a > 1 && var->var.dim_a < GFX_LOWLEVEL_VAR_ARRAY_RESERVE) {
+      size_t reserve = elem * GFX_LOWLEVEL_VAR_ARRAY_RESERVE;
+      void* data = realloc((void*)var->data, reserve);
+      if (data) {
+        var->data = data;
+        bytes = reserve;
+      }
+    }
+    mix_ctx->var_capacity[i] = bytes;
+
+    const char* name = var->var.name;
+    size_t len = strlen(name);
+    int pos = gfx_lowlevel_hash_name(name, len) & (size - 1);
+    while (mix_ctx->var_index[pos] != 0) {
+      pos = (pos + 1) & (size - 1);
+    }
+    mix_ctx->var_index[pos] = i + 1;
+  }
+  return 0;
+}
+
+int gfx_lowlevel_mix_ctx_find_var(struct gfx_lowlevel_mix_ctx* ctx,
+                                  const char* name, size_t name_len) {
+  if (!ctx || !ctx->var_index || !name) {
+    return -1;
+  }
+  int mask = ctx->var_index_size - 1;
+  int pos = gfx_lowlevel_hash_name(name, name_len) & mask;
+  while (ctx->var_index[pos] != 0) {
+    int slot = ctx->var_index[pos] - 1;
+    const char* var_name = ctx->vars[slot].var.name;
+    if (strncmp(var_name, name, name_len) == 0 && var_name[name_len] == '\0') {
+      return slot;
+    }
+    pos = (pos + 1) & mask;
+  }
+  return -1;
+}
+
+int gfx_lowlevel_mix_ctx_set_consts(struct gfx_lowlevel_mix_ctx* ctx,
+                                    int num_consts) {
+  if (!ctx || num_consts < 0 || num_consts > ctx->num_vars) {
+    fprintf(stderr, "gfx_ll> Invalid number of shader constants %d\n",
+            num_consts);
+    return EINVAL;
+  }
+  free(ctx->consts);
+  ctx->consts = NULL;
+  ctx->num_consts = 0;
+  if (num_consts == 0) {
+    return 0;
+  }
+  ctx->consts = calloc(num_consts, sizeof(struct pl_shader_const));
+  if (!ctx->consts) {
+    fprintf(stderr, "gfx_ll> Failed to allocate shader constants\n");
+    return ENOMEM;
+  }
+  int first = ctx->num_vars - num_consts;
+  for (int i = 0; i < num_consts; i++) {
+    struct pl_shader_var* var = &ctx->vars[first + i];
+    if (var->var.dim_v != 1 || var->var.dim_m != 1 || var->var.dim_a != 1) {
+      fprintf(stderr, "gfx_ll> Shader constant %s is not a scalar\n",
+              var->var.name);
+      free(ctx->consts);
+      ctx->consts = NULL;
+      return EINVAL;
+    }
+    // scalars never outgrow their data, so the alias stays valid.
+    // compile_time bakes the value into the GLSL, the dispatch's pass cache
+    // then keeps one compiled variant per value
+    ctx->consts[i] = (struct pl_shader_const){
+        .type = var->var.type,
+        .name = var->var.name,
+        .data = var->data,
+        .compile_time = true,
+    };
+  }
+  ctx->num_consts = num_consts;
+  return 0;
+}
+
+void* gfx_lowlevel_mix_ctx_reserve_var(struct gfx_lowlevel_mix_ctx* ctx,
+                                       int slot, size_t bytes) {
+  if (!ctx || slot < 0 || slot >= ctx->num_vars) {
+    fprintf(stderr, "gfx_ll> Invalid shader variable %d\n", slot);
+    return NULL;
+  }
+  struct pl_shader_var* var = &ctx->vars[slot];
+  if (bytes <= ctx->var_capacity[slot]) {
+    return (void*)var->data;
+  }
+  size_t capacity = ctx->var_capacity[slot] ? ctx->var_capacity[slot] : bytes;
+  while (capacity < bytes) {
+    capacity *= 2;
+  }
+  void* data = realloc((void*)var->data, capacity);
+  if (!data) {
+    fprintf(stderr, "gfx_ll> Failed to grow shader variable %s\n",
+            var->var.name);
+    return NULL;
+  }
+  var->data = data;
+  ctx->var_capacity[slot] = capacity;
+  return data;
+}
+
 struct gfx_lowlevel_mix_ctx* gfx_lowlevel_mix_ctx_init(
     struct gfx_lowlevel_gpu_ctx* ctx, const char* prelude, const char* header,
     const char* body, struct pl_shader_var* vars, int num_vars) {
@@ -664,7 +2108,8 @@ struct gfx_lowlevel_mix_ctx* gfx_lowlevel_mix_ctx_init(
     return NULL;
   }
   memset(mix_ctx, 0, sizeof(struct gfx_lowlevel_mix_ctx));
-  mix_ctx->ctx = ctx;
+  mix_ctx->ctx = ctx->parent ? ctx->parent : ctx;
+  gfx_lowlevel_render_template_init(&mix_ctx->tmpl, ctx->vk->gpu);
 
   if (prelude) {
     mix_ctx->prelude = malloc(strlen(prelude) + 1);
@@ -693,6 +2138,11 @@ struct gfx_lowlevel_mix_ctx* gfx_lowlevel_mix_ctx_init(
   mix_ctx->vars = var_copy;
   mix_ctx->num_vars = num_vars;
 
+  if (gfx_lowlevel_mix_ctx_build_index(mix_ctx) != 0) {
+    gfx_lowlevel_mix_ctx_destroy(&mix_ctx);
+    return NULL;
+  }
+
   return mix_ctx;
 }
 
@@ -706,6 +2156,10 @@ void gfx_lowlevel_mix_ctx_destroy(struct gfx_lowlevel_mix_ctx** mix_ctx) {
       free((void*)(*mix_ctx)->vars[i].data);
     }
     free((void*)(*mix_ctx)->vars);
+    free((void*)(*mix_ctx)->var_capacity);
+    free((void*)(*mix_ctx)->var_index);
+    free((void*)(*mix_ctx)->consts);
+    gfx_lowlevel_render_template_free(&(*mix_ctx)->tmpl);
 
     free((void*)(*mix_ctx));
     *mix_ctx = NULL;
@@ -767,10 +2221,75 @@ struct gfx_lowlevel_lut* gfx_lowlevel_init_lut(struct gfx_lowlevel_gpu_ctx* ctx,
   return lut;
 }
 
+static struct gfx_lowlevel_lut* gfx_lowlevel_lut_alloc(
+    const char* lut_filename) {
+  struct gfx_lowlevel_lut* lut = calloc(1, sizeof(struct gfx_lowlevel_lut));
+  if (!lut) {
+    fprintf(stderr, "gfx_ll> Failed to allocate memory for LUT\n");
+    return NULL;
+  }
+  lut->lut_filename = strdup(lut_filename);
+  if (!lut->lut_filename) {
+    fprintf(stderr, "gfx_ll> Failed to allocate memory for LUT filename\n");
+    free(lut);
+    return NULL;
+  }
+  return lut;
+}
+
+struct gfx_lowlevel_lut* gfx_lowlevel_parse_lut(const char* lut_filename,
+                                                const char* text, size_t len) {
+  if (!lut_filename || !text) {
+    fprintf(stderr, "gfx_ll> Invalid LUT filename or contents\n");
+    return NULL;
+  }
+  struct gfx_lowlevel_lut* lut = gfx_lowlevel_lut_alloc(lut_filename);
+  if (!lut) {
+    return NULL;
+  }
+  lut->lut = pl_lut_parse_cube(NULL, text, len);
+  if (!lut->lut) {
+    fprintf(stderr, "gfx_ll> Failed to parse LUT file %s\n", lut_filename);
+    gfx_lowlevel_destroy_lut(&lut);
+    return NULL;
+  }
+  return lut;
+}
+
+struct gfx_lowlevel_lut* gfx_lowlevel_lut_create(const char* lut_filename,
+                                                 uint64_t signature, int size_r,
+                                                 int size_g, int size_b) {
+  if (!lut_filename || size_r <= 0 || size_g < 0 || size_b < 0) {
+    fprintf(stderr, "gfx_ll> Invalid LUT filename or size\n");
+    return NULL;
+  }
+  struct gfx_lowlevel_lut* lut = gfx_lowlevel_lut_alloc(lut_filename);
+  if (!lut) {
+    return NULL;
+  }
+  size_t count = (size_t)size_r * (size_g ? size_g : 1) * (size_b ? size_b : 1);
+  lut->lut = calloc(1, sizeof(struct pl_custom_lut));
+  lut->owned_data = calloc(count * 3, sizeof(float));
+  if (!lut->lut || !lut->owned_data) {
+    fprintf(stderr, "gfx_ll> Failed to allocate memory for LUT data\n");
+    gfx_lowlevel_destroy_lut(&lut);
+    return NULL;
+  }
+  lut->lut->data = lut->owned_data;
+  lut->lut->signature = signature;
+  lut->lut->size[0] = size_r;
+  lut->lut->size[1] = size_g;
+  lut->lut->size[2] = size_b;
+  return lut;
+}
+
 int gfx_lowlevel_destroy_lut(struct gfx_lowlevel_lut** lut) {
   if (lut && *lut) {
     free((void*)(*lut)->lut_filename);
-    if ((*lut)->lut) {
+    if ((*lut)->owned_data) {
+      free((*lut)->owned_data);
+      free((*lut)->lut);
+    } else if ((*lut)->lut) {
       pl_lut_free(&(*lut)->lut);
     }
     if ((*lut)->lut_state) {
@@ -791,6 +2310,63 @@ int gfx_lowlevel_reset_dispatch(struct gfx_lowlevel_gpu_ctx* ctx) {
   return 0;
 }
 
+int gfx_lowlevel_frame_blit_scaled(struct gfx_lowlevel_gpu_ctx* ctx,
+                                   struct pl_frame* dst, struct pl_frame* src,
+                                   struct pl_rect2df src_rect,
+                                   struct pl_rect2df dst_rect,
+                                   const char* scaler) {
+  if (!ctx || !dst || !src || !src->planes[0].texture ||
+      !dst->planes[0].texture) {
+    fprintf(stderr, "gfx_ll> Invalid context or frame\n");
+    return EINVAL;
+  }
+
+  const struct pl_filter_config* upscaler = NULL;
+  const struct pl_filter_config* downscaler = NULL;
+  if (scaler) {
+    upscaler = pl_find_filter_config(scaler, PL_FILTER_UPSCALING);
+    downscaler = pl_find_filter_config(scaler, PL_FILTER_DOWNSCALING);
+    if (!upscaler) {
+      fprintf(stderr, "gfx_ll> Unknown scaler %s, using bilinear\n", scaler);
+    }
+  }
+
+  struct pl_frame image = *src;
+  struct pl_frame target = *dst;
+  // mixers already work in the output's colors, just resample
+  image.repr = pl_color_repr_rgb;
+  image.color = target.color;
+
+  float src_w = image.planes[0].texture->params.w;
+  float src_h = image.planes[0].texture->params.h;
+  float dst_w = target.planes[0].texture->params.w;
+  float dst_h = target.planes[0].texture->params.h;
+  image.crop = (struct pl_rect2df){
+      .x0 = src_rect.x0 * src_w,
+      .y0 = src_rect.y0 * src_h,
+      .x1 = src_rect.x1 * src_w,
+      .y1 = src_rect.y1 * src_h,
+  };
+  target.crop = (struct pl_rect2df){
+      .x0 = dst_rect.x0 * dst_w,
+      .y0 = dst_rect.y0 * dst_h,
+      .x1 = dst_rect.x1 * dst_w,
+      .y1 = dst_rect.y1 * dst_h,
+  };
+
+  struct pl_render_params params = pl_render_fast_params;
+  params.upscaler = upscaler ? upscaler : &pl_filter_bilinear;
+  params.downscaler = downscaler ? downscaler : &pl_filter_bilinear;
+  // several mixers can share the window, keep what they drew
+  params.border = PL_CLEAR_SKIP;
+
+  if (!pl_render_image(ctx->renderer, &image, &target, &params)) {
+    fprintf(stderr, "gfx_ll> Failed to scale frame\n");
+    return EINVAL;
+  }
+  return 0;
+}
+
 int gfx_lowlevel_frame_copy(struct gfx_lowlevel_gpu_ctx* ctx,
                             struct pl_frame* dst_frame,
                             struct pl_frame* src_frame) {
@@ -801,11 +2377,19 @@ int gfx_lowlevel_frame_copy(struct gfx_lowlevel_gpu_ctx* ctx,
 
   // For single-plane frames
   if (src_frame->num_planes == 1 && dst_frame->num_planes == 1) {
+    pl_tex src = src_frame->planes[0].texture;
+    pl_tex dst = dst_frame->planes[0].texture;
+    if (!src->params.blit_src || !dst->params.blit_dst) {
+      // float and packed formats aren't always blittable, draw it instead
+      struct pl_rect2df full = {.x0 = 0.0f, .y0 = 0.0f, .x1 = 1.0f, .y1 = 1.0f};
+      return gfx_lowlevel_frame_blit_scaled(ctx, dst_frame, src_frame, full,
+                                            full, NULL);
+    }
     pl_tex_blit(ctx->vk->gpu, &(struct pl_tex_blit_params){
-                                  .src = src_frame->planes[0].texture,
-                                  .dst = dst_frame->planes[0].texture,
+                                  .src = src,
+                                  .dst = dst,
                               });
-    pl_gpu_finish(ctx->vk->gpu);
+    // no finish here, libplacebo inserts the barriers for later reads
     return 0;
   } else {
     return EINVAL;  // Multi-plane frame copying not implemented
@@ -813,3 +2397,185 @@ int gfx_lowlevel_frame_copy(struct gfx_lowlevel_gpu_ctx* ctx,
 
   return 0;
 }
+
+struct gfx_lowlevel_timer* gfx_lowlevel_timer_create(
+    struct gfx_lowlevel_gpu_ctx* ctx) {
+  if (!ctx || !ctx->vk) {
+    fprintf(stderr, "gfx_ll> Invalid GPU context\n");
+    return NULL;
+  }
+  struct gfx_lowlevel_timer* timer = calloc(1, sizeof(*timer));
+  if (!timer) {
+    fprintf(stderr, "gfx_ll> Failed to allocate timer\n");
+    return NULL;
+  }
+  // the timer outlives forks used for warm up, keep it on the root context
+  timer->ctx_backref = ctx->parent ? ctx->parent : ctx;
+  timer->timer = pl_timer_create(ctx->vk->gpu);
+  if (!timer->timer) {
+    // not every GPU has timestamp queries, stay a no-op timer then
+    fprintf(stderr, "gfx_ll> GPU timers are not supported\n");
+  }
+  return timer;
+}
+
+uint64_t gfx_lowlevel_timer_poll(struct gfx_lowlevel_timer* timer) {
+  if (!timer || !timer->timer) {
+    return 0;
+  }
+  uint64_t ns, newest = 0;
+  while ((ns = pl_timer_query(timer->ctx_backref->vk->gpu, timer->timer))) {
+    newest = ns;
+  }
+  if (newest) {
+    timer->last_ns = newest;
+  }
+  return newest;
+}
+
+void gfx_lowlevel_timer_destroy(struct gfx_lowlevel_timer** timer) {
+  if (!timer || !*timer) {
+    return;
+  }
+  if ((*timer)->timer) {
+    pl_timer_destroy((*timer)->ctx_backref->vk->gpu, &(*timer)->timer);
+  }
+  free(*timer);
+  *timer = NULL;
+}
+
+struct gfx_lowlevel_storage* gfx_lowlevel_storage_create(
+    struct gfx_lowlevel_gpu_ctx* ctx, const char* name, int count) {
+  if (!ctx || !ctx->vk || !name || count <= 0) {
+    fprintf(stderr, "gfx_ll> Invalid context or storage size\n");
+    return NULL;
+  }
+  if (!ctx->vk->gpu->glsl.compute) {
+    fprintf(stderr, "gfx_ll> Storage buffers need compute shader support\n");
+    return NULL;
+  }
+  struct gfx_lowlevel_storage* storage = calloc(1, sizeof(*storage));
+  if (!storage) {
+    fprintf(stderr, "gfx_ll> Failed to allocate storage\n");
+    return NULL;
+  }
+  // same lifetime rules as timers, warm up forks don't own it
+  storage->ctx_backref = ctx->parent ? ctx->parent : ctx;
+  size_t len = strlen(name);
+  storage->block_name = malloc(len + sizeof("_buf"));
+  char* var_name = strdup(name);
+  storage->zeros = calloc(count, sizeof(uint32_t));
+  if (!storage->block_name || !var_name || !storage->zeros) {
+    fprintf(stderr, "gfx_ll> Failed to allocate storage\n");
+    free(var_name);
+    gfx_lowlevel_storage_destroy(&storage);
+    return NULL;
+  }
+  // the block needs a name of its own, shaders only see the array
+  snprintf(storage->block_name, len + sizeof("_buf"), "%s_buf", name);
+  struct pl_var var = {
+      .name = var_name,
+      .type = PL_VAR_UINT,
+      .dim_v = 1,
+      .dim_m = 1,
+      .dim_a = count,
+  };
+  storage->var = (struct pl_buffer_var){
+      .var = var,
+      .layout = pl_std430_layout(0, &var),
+  };
+
+  storage->buf = pl_buf_create(ctx->vk->gpu, &(struct pl_buf_params){
+                                                 .size = storage->var.layout.size,
+                                                 .storable = true,
+                                                 .host_writable = true,
+                                             });
+  if (!storage->buf) {
+    fprintf(stderr, "gfx_ll> Failed to create storage buffer %s\n", name);
+    gfx_lowlevel_storage_destroy(&storage);
+    return NULL;
+  }
+  return storage;
+}
+
+int gfx_lowlevel_storage_clear(struct gfx_lowlevel_storage* storage) {
+  if (!storage || !storage->buf) {
+    fprintf(stderr, "gfx_ll> Invalid storage\n");
+    return EINVAL;
+  }
+  pl_buf_write(storage->ctx_backref->vk->gpu, storage->buf, 0, storage->zeros,
+               storage->buf->params.size);
+  return 0;
+}
+
+int gfx_lowlevel_storage_read_start(struct gfx_lowlevel_storage* storage,
+                                    int64_t frame_id) {
+  if (!storage || !storage->buf) {
+    fprintf(stderr, "gfx_ll> Invalid storage\n");
+    return EINVAL;
+  }
+  if (storage->readback.count == GFX_LOWLEVEL_STORAGE_RING) {
+    return GFX_EAGAIN;
+  }
+  pl_gpu gpu = storage->ctx_backref->vk->gpu;
+  int slot = (storage->readback.head + storage->readback.count) %
+             GFX_LOWLEVEL_STORAGE_RING;
+  if (!pl_buf_recreate(gpu, &storage->readback.bufs[slot],
+                       &(struct pl_buf_params){
+                           .size = storage->buf->params.size,
+                           .host_readable = true,
+                       })) {
+    fprintf(stderr, "gfx_ll> Failed to create storage readback buffer\n");
+    return ENOMEM;
+  }
+  pl_buf_copy(gpu, storage->readback.bufs[slot], 0, storage->buf, 0,
+              storage->buf->params.size);
+  storage->readback.frame_ids[slot] = frame_id;
+  storage->readback.count++;
+  return 0;
+}
+
+int gfx_lowlevel_storage_read_next(struct gfx_lowlevel_storage* storage,
+                                   uint32_t* dst, int64_t* frame_id) {
+  if (!storage || !dst) {
+    fprintf(stderr, "gfx_ll> Invalid storage or buffer\n");
+    return EINVAL;
+  }
+  if (storage->readback.count == 0) {
+    return GFX_EAGAIN;
+  }
+  pl_gpu gpu = storage->ctx_backref->vk->gpu;
+  pl_buf buf = storage->readback.bufs[storage->readback.head];
+  if (pl_buf_poll(gpu, buf, 0)) {
+    return GFX_EAGAIN;
+  }
+  // std430 keeps uint arrays tightly packed
+  if (!pl_buf_read(gpu, buf, 0, dst,
+                   storage->var.var.dim_a * sizeof(uint32_t))) {
+    fprintf(stderr, "gfx_ll> Failed to read back storage\n");
+    return EIO;
+  }
+  if (frame_id) {
+    *frame_id = storage->readback.frame_ids[storage->readback.head];
+  }
+  storage->readback.head =
+      (storage->readback.head + 1) % GFX_LOWLEVEL_STORAGE_RING;
+  storage->readback.count--;
+  return 0;
+}
+
+void gfx_lowlevel_storage_destroy(struct gfx_lowlevel_storage** storage) {
+  if (!storage || !*storage) {
+    return;
+  }
+  pl_gpu gpu = (*storage)->ctx_backref->vk->gpu;
+  pl_buf_destroy(gpu, &(*storage)->buf);
+  for (int i = 0; i < GFX_LOWLEVEL_STORAGE_RING; i++) {
+    pl_buf_destroy(gpu, &(*storage)->readback.bufs[i]);
+  }
+  free((char*)(*storage)->var.var.name);
+  free((*storage)->block_name);
+  free((*storage)->zeros);
+  free(*storage);
+  *storage = NULL;
+}
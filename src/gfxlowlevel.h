@@ -5,6 +5,7 @@
 #include <SDL2/SDL_vulkan.h>
 #include <libavformat/avformat.h>
 #include <libavutil/pixfmt.h>
+#include <libplacebo/cache.h>
 #include <libplacebo/dispatch.h>
 #include <libplacebo/gpu.h>
 #include <libplacebo/renderer.h>
@@ -12,14 +13,136 @@
 #include <libplacebo/utils/upload.h>
 #include <libplacebo/vulkan.h>
 #include <libswscale/swscale.h>
+#include <pthread.h>
 #include <stdlib.h>
 
+// Opaque cache of hardware surfaces imported as textures
+struct gfx_lowlevel_interop;
+
+// Frames a headless context can have downloading at once
+#define GFX_LOWLEVEL_READBACK_RING 4
+
+// Most frames_in_flight a context takes, larger values are clamped
+#define GFX_LOWLEVEL_MAX_FRAMES_IN_FLIGHT 7
+
+// Queues requested per queue family when nothing else is configured,
+// libplacebo uses fewer if a family doesn't have that many
+#define GFX_LOWLEVEL_DEFAULT_QUEUE_COUNT 4
+
+// Swapchain present modes, ones the surface doesn't support fall back to FIFO
+enum gfx_lowlevel_present_mode {
+  GFX_LOWLEVEL_PRESENT_FIFO = 0,
+  GFX_LOWLEVEL_PRESENT_MAILBOX,
+  GFX_LOWLEVEL_PRESENT_IMMEDIATE,
+  GFX_LOWLEVEL_PRESENT_FIFO_RELAXED,
+};
+
+// Vulkan queue topology. With async_transfer uploads go to a transfer queue
+// when the device has one and overlap with rendering; libplacebo adds the
+// semaphores between queues.
+struct gfx_lowlevel_gpu_config {
+  int queue_count;  // per family, 0 for the default
+  bool async_transfer;
+  bool async_compute;
+  enum gfx_lowlevel_present_mode present_mode;
+  // Frames the CPU may queue ahead of the display, 0 for libplacebo's default,
+  // at most GFX_LOWLEVEL_MAX_FRAMES_IN_FLIGHT
+  int frames_in_flight;
+  // Bytes of VRAM the texture pool works to stay under, 0 for no limit
+  uint64_t vram_budget;
+};
+
+// Mapped upload buffers per frame, one can be written while the GPU still
+// reads the others
+#define GFX_LOWLEVEL_UPLOAD_RING 3
+
+// CPU side frame memory reused until the size or format changes
+struct gfx_lowlevel_staging {
+  AVBufferPool* pool;
+  int size;  // bytes per buffer in pool
+  AVFrame* frame;  // holds one buffer from pool at a time
+};
+
 struct gfx_lowlevel_frame_ctx {
   bool is_mapped;
   struct pl_frame pl_frame;
   pl_tex tex[4];
   struct gfx_lowlevel_gpu_ctx* ctx_backref;
   struct SwsContext* to_rgba;
+  // Slice threads to_rgba converts with, set before the first map. 0 or 1
+  // converts on the calling thread.
+  int convert_threads;
+  AVFrame* convert_out;  // wraps an upload buffer for sws_scale_frame
+  // Import hardware frames directly instead of copying them back to system
+  // memory, falls back to the copy path if the import is not possible
+  bool hw_interop;
+  pl_tex convert_tex;  // RGBA target for frames converted on the GPU
+  struct gfx_lowlevel_interop* interop;
+  // Map NV12/YUV420P/P010 planes into tex[] as is and convert to RGBA on the
+  // GPU instead of running sws_scale on every frame
+  bool gpu_convert;
+  struct pl_frame yuv_frame;  // mapped planes when gpu_convert is in use
+  bool yuv_mapped;
+  struct gfx_lowlevel_staging hw_staging;  // hardware frames copied back
+  struct gfx_lowlevel_staging rgba_staging;  // sws output without upload_bufs
+  // sws_scale writes RGBA straight into these and the texture is uploaded
+  // from them, so libplacebo makes no staging copy of its own
+  pl_buf upload_bufs[GFX_LOWLEVEL_UPLOAD_RING];
+  int upload_next;
+  bool tex_pooled;  // tex[0] came from the texture pool and goes back to it
+  uint64_t video_bytes;  // what mapping video into this frame holds
+};
+
+// Bytes of VRAM held by frame contexts as of the last change
+struct gfx_lowlevel_residency {
+  uint64_t budget;  // 0 without a limit
+  uint64_t mixer_bytes;  // pool textures frames are holding
+  int mixer_textures;
+  uint64_t idle_bytes;  // pool textures waiting to be reused
+  int idle_textures;
+  // video textures, GPU conversion targets and upload buffers
+  uint64_t video_bytes;
+  uint64_t evicted;  // idle textures destroyed to stay under the budget
+};
+
+// The largest compute workgroup the GPU runs, all 0 without compute shaders
+struct gfx_lowlevel_compute_limits {
+  int max_group_threads;  // invocations in one workgroup, w * h
+  int max_group_size[2];
+  size_t max_shmem_size;
+};
+
+// Idle textures the pool keeps at most, however much budget is left
+#define GFX_LOWLEVEL_TEX_POOL_MAX 64
+
+// Mixer textures released by their frames wait here until one of the same
+// size and format is asked for again. Idle ones are destroyed oldest first
+// when the total goes over the budget.
+struct gfx_lowlevel_tex_pool {
+  pthread_mutex_t lock;  // forks on other threads share the parent's pool
+  bool has_lock;
+  pl_tex idle[GFX_LOWLEVEL_TEX_POOL_MAX];  // oldest first
+  int num_idle;
+  struct gfx_lowlevel_residency stats;
+};
+
+// The descriptors and src_uv attrib a render binds. They are kept between
+// renders, so one with the same numbers of frames, passes and storage only
+// patches texture objects and the src rect. Grows as needed.
+struct gfx_lowlevel_render_template {
+  struct pl_shader_desc* descs;
+  int desc_capacity;
+  // "src_texN" and "pass_texN", formatted once when the counts first grow
+  char** src_names;
+  int num_src_names;
+  char** pass_names;
+  int num_pass_names;
+  struct pl_shader_va attrib;
+  float verts[8];
+  // layout descs were laid out for, num_frames is -1 before the first render
+  int num_frames;
+  int num_passes;
+  int num_storage;
 };
 
 struct gfx_lowlevel_gpu_ctx {
@@ -32,17 +155,73 @@ struct gfx_lowlevel_gpu_ctx {
   pl_renderer renderer;
   pl_log log;
   pl_dispatch dispatch;  // Shared dispatch for shader caching
+  struct gfx_lowlevel_gpu_config config;
   bool started;
-  
-  // Resource pool for render operations to avoid per-frame allocations
+  bool has_iosurface_interop;  // VK_EXT_metal_objects IOSurface import
+  pl_cache cache;  // Shader/pipeline cache, persisted to cache_path
+  char* cache_path;  // NULL when the cache is memory only
+  uint64_t cache_sig;  // Signature of the cache as of the last load/save
+  // Set on forked contexts, which borrow vk, log and cache from it
+  struct gfx_lowlevel_gpu_ctx* parent;
+  // Headless contexts render into offscreen instead of a swapchain and every
+  // finished frame is downloaded into the readback ring
+  bool headless;
+  pl_tex offscreen;
   struct {
-    struct pl_shader_desc* descs;
-    struct pl_shader_va* attribs;
-    char** names;  // Array of name strings
-    float** vert_buffers;  // Array of vertex buffers
-    int max_resources;  // Maximum number of frames + passes
-    int max_names;  // Maximum number of name strings
-  } resource_pool;
+    pl_buf bufs[GFX_LOWLEVEL_READBACK_RING];
+    uint64_t frame_ids[GFX_LOWLEVEL_READBACK_RING];
+    int head;  // oldest download still to be read
+    int count;  // downloads not read yet
+    uint64_t next_id;
+  } readback;
+
+  // for renders without a mix_ctx of their own
+  struct gfx_lowlevel_render_template resource_pool;
+  // unused on forks, they create and release through the parent's
+  struct gfx_lowlevel_tex_pool tex_pool;
+};
+
+// GPU time spent in the dispatches it was attached to. Results arrive a few
+// frames late, poll them before reusing the timer.
+struct gfx_lowlevel_timer {
+  struct gfx_lowlevel_gpu_ctx* ctx_backref;
+  pl_timer timer;
+  uint64_t last_ns;  // most recent result, 0 until one is ready
+};
+
+// Results of a storage buffer that are copied out this many frames deep
+#define GFX_LOWLEVEL_STORAGE_RING 3
+
+// A uint array shaders can write into with atomics, e.g. a histogram. It is
+// bound as `uint name[count]` and results are copied into a ring of host
+// buffers so reading them never waits on the frame that wrote them.
+struct gfx_lowlevel_storage {
+  struct gfx_lowlevel_gpu_ctx* ctx_backref;
+  char* block_name;
+  struct pl_buffer_var var;
+  pl_buf buf;
+  uint32_t* zeros;  // count zeros to clear buf with
+  struct {
+    pl_buf bufs[GFX_LOWLEVEL_STORAGE_RING];
+    int64_t frame_ids[GFX_LOWLEVEL_STORAGE_RING];
+    int head;
+    int count;
+  } readback;
+};
+
+// What a render's shader was compiled from, see filter_params.stats
+struct gfx_lowlevel_shader_stats {
+  int num_descriptors;
+  int num_variables;
+  int num_constants;
+  int num_vertex_attribs;
+  int glsl_lines;
+  // statements in the generated GLSL, a rough count of the instructions
+  int glsl_statements;
+  int compute_group_size[2];  // 0 unless it was dispatched as compute
+  // microseconds spent building this copy, to take out of timings of the
+  // render call
+  int64_t build_us;
 };
 
 struct gfx_lowlevel_filter_params {
@@ -54,6 +233,24 @@ struct gfx_lowlevel_filter_params {
   const char* body;
   struct pl_shader_var* vars;
   int num_vars;
+  const struct pl_shader_const* constants;  // optional
+  int num_constants;
+  struct gfx_lowlevel_timer* timer;  // optional
+  // Dispatch as a compute shader with compute_size[0] x compute_size[1]
+  // invocations per workgroup, the local size, and compute_shmem bytes of
+  // shared memory per workgroup. libplacebo works out how many workgroups
+  // cover the target, which has to be storable.
+  // gfx_lowlevel_gpu_ctx_compute_limits says how large a group may be.
+  bool compute;
+  int compute_size[2];
+  size_t compute_shmem;
+  struct gfx_lowlevel_storage** storage;  // optional
+  int num_storage;
+  // optional, renders through its template instead of the context's
+  struct gfx_lowlevel_mix_ctx* mix_ctx;
+  // optional, filled from the finalized shader. Builds the shader twice, so
+  // only for tools.
+  struct gfx_lowlevel_shader_stats* stats;
 };
 
 struct gfx_lowlevel_mix_ctx {
@@ -63,18 +260,71 @@ struct gfx_lowlevel_mix_ctx {
   char* body;
   struct pl_shader_var* vars;
   int num_vars;
+  // bytes allocated behind each vars[i].data, arrays can grow up to this
+  // without reallocating
+  size_t* var_capacity;
+  // open addressed name hash, slot + 1 per entry and 0 when empty
+  int* var_index;
+  int var_index_size;
+  // The last num_consts vars are compiled into the shader instead of bound
+  // as uniforms. consts[i].data aliases their vars[] data, so they are found
+  // and updated like any other var and a new value compiles a new variant.
+  struct pl_shader_const* consts;
+  int num_consts;
+  struct gfx_lowlevel_render_template tmpl;
 };
 
 struct gfx_lowlevel_lut {
   char* lut_filename;
   struct pl_custom_lut* lut;
   pl_shader_obj lut_state;
+  // Set when lut was made by gfx_lowlevel_lut_create instead of parsed. lut
+  // is then a plain malloc and this is the writable data it points at.
+  float* owned_data;
 };
 
 #define GFX_EAGAIN 35
 struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init(
     struct SDL_Window* window);
+// Same as gfx_lowlevel_gpu_ctx_init with an explicit queue topology, config
+// may be NULL for the defaults
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init_ex(
+    struct SDL_Window* window, const struct gfx_lowlevel_gpu_config* config);
 void gfx_lowlevel_gpu_ctx_destroy(struct gfx_lowlevel_gpu_ctx** ctx);
+// A context without a window that renders into an offscreen rgba8 texture,
+// finish_frame then starts downloading the frame instead of presenting it
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_init_headless(
+    int width, int height, const struct gfx_lowlevel_gpu_config* config);
+// Submit everything recorded so far without waiting, lets uploads start on
+// their own queue while the rest of the frame is still being built
+void gfx_lowlevel_gpu_ctx_flush(struct gfx_lowlevel_gpu_ctx* ctx);
+// Copy the oldest downloaded frame of a headless context into dst (rgba8,
+// dst_stride bytes per row). Waits up to timeout_ns for the download and
+// returns GFX_EAGAIN if it is not done yet or nothing is pending.
+int gfx_lowlevel_readback_next(struct gfx_lowlevel_gpu_ctx* ctx, uint8_t* dst,
+                               int dst_stride, uint64_t timeout_ns,
+                               uint64_t* frame_id);
+// A context for use on another thread, it shares the GPU and shader cache
+// with its parent but has its own dispatch and renderer. It can't present,
+// and must be destroyed before the parent.
+struct gfx_lowlevel_gpu_ctx* gfx_lowlevel_gpu_ctx_fork(
+    struct gfx_lowlevel_gpu_ctx* parent);
+// Load compiled shaders/pipelines from (and later save them to) a file in
+// cache_dir that is specific to this GPU, driver and libplacebo version
+int gfx_lowlevel_gpu_ctx_load_cache(struct gfx_lowlevel_gpu_ctx* ctx,
+                                    const char* cache_dir);
+// Write the cache back out if anything new was compiled since the last save.
+// A fork saves its parent's cache, so the save can be done off the render
+// thread; only one thread may save at a time.
+int gfx_lowlevel_gpu_ctx_save_cache(struct gfx_lowlevel_gpu_ctx* ctx);
+// Change the texture pool's budget, idle textures over it go right away
+void gfx_lowlevel_gpu_ctx_set_vram_budget(struct gfx_lowlevel_gpu_ctx* ctx,
+                                          uint64_t bytes);
+// Copy out what frame contexts hold on the GPU right now
+void gfx_lowlevel_gpu_ctx_residency(struct gfx_lowlevel_gpu_ctx* ctx,
+                                    struct gfx_lowlevel_residency* out);
+void gfx_lowlevel_gpu_ctx_compute_limits(
+    struct gfx_lowlevel_gpu_ctx* ctx, struct gfx_lowlevel_compute_limits* out);
 int gfx_lowlevel_gpu_ctx_handle_resize(struct gfx_lowlevel_gpu_ctx* ctx,
                                        int width, int height);
 bool gfx_lowlevel_gpu_ctx_start_frame(struct gfx_lowlevel_gpu_ctx* ctx);
@@ -105,10 +355,40 @@ struct gfx_lowlevel_mix_ctx* gfx_lowlevel_mix_ctx_init(
     const char* body, struct pl_shader_var* vars, int num_vars);
 
 void gfx_lowlevel_mix_ctx_destroy(struct gfx_lowlevel_mix_ctx** ctx);
+// Index into ctx->vars for the uniform called name (not null terminated), or
+// -1 if the shader has none
+int gfx_lowlevel_mix_ctx_find_var(struct gfx_lowlevel_mix_ctx* ctx,
+                                  const char* name, size_t name_len);
+// Compile the last num_consts vars in as constants, they have to be scalars.
+// Render them with vars/num_vars - num_consts and consts/num_consts.
+int gfx_lowlevel_mix_ctx_set_consts(struct gfx_lowlevel_mix_ctx* ctx,
+                                    int num_consts);
+// Make sure vars[slot].data holds at least bytes and return it, existing
+// contents are kept
+void* gfx_lowlevel_mix_ctx_reserve_var(struct gfx_lowlevel_mix_ctx* ctx,
+                                       int slot, size_t bytes);
 
+// An rgba8 texture for frame->tex[0], an idle one from the texture pool when
+// one matches. Destroying the frame hands it back to the pool.
 int gfx_lowlevel_frame_create_texture(struct gfx_lowlevel_gpu_ctx* ctx,
                                       struct gfx_lowlevel_frame_ctx* frame,
                                       int width, int height);
+// Same as gfx_lowlevel_frame_create_texture in a named libplacebo format such
+// as "rgba16f", "rg11b10f" or "r8". Returns ENOTSUP if the GPU can't both
+// sample and render to it, or store to it when storable is set.
+int gfx_lowlevel_frame_create_texture_fmt(struct gfx_lowlevel_gpu_ctx* ctx,
+                                          struct gfx_lowlevel_frame_ctx* frame,
+                                          int width, int height,
+                                          const char* format, bool storable);
+
+// Render src_rect of src into dst_rect of dst (both normalized) through the
+// libplacebo filter called scaler, e.g. "ewa_lanczos". NULL or an unknown
+// name uses bilinear. Nothing outside dst_rect is touched.
+int gfx_lowlevel_frame_blit_scaled(struct gfx_lowlevel_gpu_ctx* ctx,
+                                   struct pl_frame* dst, struct pl_frame* src,
+                                   struct pl_rect2df src_rect,
+                                   struct pl_rect2df dst_rect,
+                                   const char* scaler);
 
 int gfx_lowlevel_frame_copy(struct gfx_lowlevel_gpu_ctx* ctx,
                             struct pl_frame* dst_frame,
@@ -117,5 +397,36 @@ int gfx_lowlevel_frame_copy(struct gfx_lowlevel_gpu_ctx* ctx,
 struct gfx_lowlevel_lut* gfx_lowlevel_init_lut(struct gfx_lowlevel_gpu_ctx* ctx,
                                                const char* lut_filename);
 int gfx_lowlevel_destroy_lut(struct gfx_lowlevel_lut** lut);
+// Parse a .cube file already in memory. Needs no context, so it can run on
+// a loader thread, the GPU side is still only created on first render.
+struct gfx_lowlevel_lut* gfx_lowlevel_parse_lut(const char* lut_filename,
+                                                const char* text, size_t len);
+// An empty size_r x size_g x size_b LUT for the caller to fill owned_data
+// with rgb floats, red varying fastest. signature must change whenever the
+// contents do.
+struct gfx_lowlevel_lut* gfx_lowlevel_lut_create(const char* lut_filename,
+                                                 uint64_t signature, int size_r,
+                                                 int size_g, int size_b);
 int gfx_lowlevel_reset_dispatch(struct gfx_lowlevel_gpu_ctx* ctx);
+
+struct gfx_lowlevel_timer* gfx_lowlevel_timer_create(
+    struct gfx_lowlevel_gpu_ctx* ctx);
+// Collect finished results, returns the newest one in ns or 0 if nothing
+// finished since the last poll
+uint64_t gfx_lowlevel_timer_poll(struct gfx_lowlevel_timer* timer);
+void gfx_lowlevel_timer_destroy(struct gfx_lowlevel_timer** timer);
+
+struct gfx_lowlevel_storage* gfx_lowlevel_storage_create(
+    struct gfx_lowlevel_gpu_ctx* ctx, const char* name, int count);
+// Zero the buffer, call before the first dispatch writing to it each frame
+int gfx_lowlevel_storage_clear(struct gfx_lowlevel_storage* storage);
+// Queue a copy of the current contents tagged with frame_id, GFX_EAGAIN if
+// the ring is full because nothing was read in a while
+int gfx_lowlevel_storage_read_start(struct gfx_lowlevel_storage* storage,
+                                    int64_t frame_id);
+// Copy the oldest finished result into dst (count uint32s) without waiting,
+// GFX_EAGAIN if it is still in flight or nothing is pending
+int gfx_lowlevel_storage_read_next(struct gfx_lowlevel_storage* storage,
+                                   uint32_t* dst, int64_t* frame_id);
+void gfx_lowlevel_storage_destroy(struct gfx_lowlevel_storage** storage);
 #endif  // GFXLOWLEVEL_H
\ No newline at end of file
@@ -1,14 +1,21 @@
 use crate::gfx_lowlevel::bindings::{
-    gfx_lowlevel_destroy_lut, gfx_lowlevel_gpu_ctx, gfx_lowlevel_init_lut, gfx_lowlevel_lut,
+    gfx_lowlevel_gpu_ctx, gfx_lowlevel_gpu_ctx_flush, gfx_lowlevel_gpu_ctx_residency,
+    gfx_lowlevel_residency,
 };
-use crate::gfxinfo::FrameEvent;
+use crate::gfxinfo::{FrameEvent, GpuMemoryEvent, StorageEvent};
+use crate::lutcache::LutCache;
+use crate::midibind::{MidiReader, MidiStaging};
 use crate::renderspec::{Mix, MixInput, RenderSpec, Reset, SeekVid, SendCmd};
 use crate::vidruntime::VidMixerData;
 use anyhow::{anyhow, bail, Result};
 use ffmpeg_next::Rational;
 use sdl2::render::Texture;
-use std::ffi::CString;
-use std::{cell::RefCell, collections::HashMap};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use std::{
+    cell::{Cell, RefCell},
+    collections::HashMap,
+};
 
 extern crate ffmpeg_next as ffmpeg;
 
@@ -43,16 +50,21 @@ impl GfxData {
             GfxData::VidMixerData(vmd) => vmd.info().into(),
         }
     }
-}
 
-#[derive(Debug)]
-pub struct WrapLut(*mut gfx_lowlevel_lut);
-unsafe impl Send for WrapLut {}
-impl Drop for WrapLut {
-    fn drop(&mut self) {
-        unsafe {
-            gfx_lowlevel_destroy_lut(&mut self.0 as _);
+    /// Do the expensive part of the first mix ahead of time, on failure the
+    /// asset is reset so it gets prepared lazily again on the render thread
+    pub fn warm_up(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
+        let result = match self {
+            GfxData::VidData(vd) => vd.warm_up(lowlevel_ctx),
+            GfxData::VidMixerData(vmd) => vmd.warm_up(lowlevel_ctx),
+        };
+        if result.is_err() {
+            match self {
+                GfxData::VidData(vd) => vd.reset()?,
+                GfxData::VidMixerData(vmd) => vmd.reset()?,
+            }
         }
+        result
     }
 }
 
@@ -63,7 +75,71 @@ pub struct GfxRuntime {
     stream: RefCell<HashMap<String, VidInput>>,
     pub frames_per_sec: i64,
     pub last_frame_rendered: RefCell<i64>,
-    pub lut_cache: RefCell<HashMap<String, WrapLut>>,
+    pub lut_cache: RefCell<LutCache>,
+    render_scale: RefCell<ScaleController>,
+    midi: RefCell<Option<MidiReader>>,
+    evicted_mixers: Cell<u64>,
+}
+
+// Steps the render scale of dynamic mixers down when frames run over budget
+// and back up once there's plenty of headroom
+struct ScaleController {
+    avg_ms: f64,
+    pct: u32,
+    last_change: Instant,
+}
+
+// Percent the scale moves by, and how long it holds after a change so the
+// reallocated buffers have a chance to show up in the timings
+const RENDER_SCALE_STEP: u32 = 10;
+const RENDER_SCALE_HOLD: Duration = Duration::from_secs(1);
+
+// Mixers not mixed or read as feedback for this many frames are the ones
+// that lose their buffers while the GPU is over its VRAM budget
+const MIXER_IDLE_FRAMES: i64 = 48;
+
+fn residency(lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> gfx_lowlevel_residency {
+    unsafe {
+        let mut residency: gfx_lowlevel_residency = std::mem::zeroed();
+        gfx_lowlevel_gpu_ctx_residency(lowlevel_ctx, &mut residency);
+        residency
+    }
+}
+
+fn over_budget(residency: &gfx_lowlevel_residency) -> bool {
+    residency.budget > 0
+        && residency.mixer_bytes + residency.idle_bytes + residency.video_bytes > residency.budget
+}
+
+impl ScaleController {
+    // floor is the scale below which every dynamic mixer is already held at
+    // its min_render_scale_pct, going lower would change nothing on screen
+    fn update(&mut self, frame_ms: f64, budget_ms: f64, floor: u32) -> Option<u32> {
+        self.avg_ms = if self.avg_ms == 0.0 {
+            frame_ms
+        } else {
+            self.avg_ms * 0.9 + frame_ms * 0.1
+        };
+        if self.last_change.elapsed() < RENDER_SCALE_HOLD {
+            return None;
+        }
+        let pct = if self.avg_ms > budget_ms * 0.9 {
+            self.pct
+                .saturating_sub(RENDER_SCALE_STEP)
+                .max(floor)
+                .min(self.pct)
+        } else if self.avg_ms < budget_ms * 0.6 {
+            (self.pct + RENDER_SCALE_STEP).min(100)
+        } else {
+            self.pct
+        };
+        if pct == self.pct {
+            return None;
+        }
+        self.pct = pct;
+        self.last_change = Instant::now();
+        Some(pct)
+    }
 }
 
 pub fn load(asset: &Asset) -> Result<GfxData> {
@@ -89,7 +165,57 @@ impl GfxRuntime {
             stream: RefCell::new(HashMap::new()),
             frames_per_sec,
             last_frame_rendered: RefCell::new(frame),
-            lut_cache: RefCell::new(HashMap::new()),
+            lut_cache: RefCell::new(LutCache::new()),
+            render_scale: RefCell::new(ScaleController {
+                avg_ms: 0.0,
+                pct: 100,
+                last_change: Instant::now(),
+            }),
+            midi: RefCell::new(None),
+            evicted_mixers: Cell::new(0),
+        }
+    }
+
+    /// Apply the app's MIDI bindings from staging to mixers as they mix
+    pub fn set_midi_staging(&self, staging: Arc<MidiStaging>) {
+        self.midi.replace(Some(MidiReader::new(staging)));
+    }
+
+    /// Feed the CPU time the last frame took to build and submit, not
+    /// counting waits on the swapchain. That or the GPU time the mixers'
+    /// passes reported, whichever is more, is what is held to the frame
+    /// budget. Mixers with a min_render_scale_pct render smaller while it's
+    /// over.
+    pub fn update_render_scale(&self, cpu_time: Duration) {
+        let budget_ms = 1000.0 / self.frames_per_sec as f64;
+        let mut gpu_time = Duration::ZERO;
+        let mut floor = None;
+        for data in self.gfx_data.borrow().values() {
+            if let GfxData::VidMixerData(mixer) = data {
+                gpu_time += mixer.take_gpu_time();
+                if mixer.info.min_render_scale_pct > 0 {
+                    floor = Some(floor.unwrap_or(0).max(mixer.min_dynamic_scale()));
+                }
+            }
+        }
+        // nothing to scale
+        let Some(floor) = floor else {
+            return;
+        };
+        let frame_ms = cpu_time.max(gpu_time).as_secs_f64() * 1000.0;
+        let Some(pct) = self
+            .render_scale
+            .borrow_mut()
+            .update(frame_ms, budget_ms, floor)
+        else {
+            return;
+        };
+        for data in self.gfx_data.borrow().values() {
+            if let GfxData::VidMixerData(mixer) = data {
+                if mixer.info.min_render_scale_pct > 0 {
+                    mixer.set_dynamic_scale(pct);
+                }
+            }
         }
     }
 
@@ -122,6 +248,11 @@ impl GfxRuntime {
         let mut stream = self.stream.borrow_mut();
         stream.remove(add_info.name());
 
+        // counts as used so a mixer warmed up ahead of time isn't evicted
+        // before its first mix
+        if let GfxData::VidMixerData(mixer) = &add_data {
+            mixer.touch(*self.last_frame_rendered.borrow());
+        }
         data.insert(add_info.name().clone(), add_data);
         info.insert(add_info.name().clone(), add_info);
     }
@@ -149,6 +280,94 @@ impl GfxRuntime {
         self.gfx_info.borrow().clone()
     }
 
+    /// Start uploading the next frame of every video mixed in `frame`
+    pub fn prefetch_uploads(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx, frame: i64) {
+        let gfx_data = self.gfx_data.borrow();
+        for data in gfx_data.values() {
+            let GfxData::VidData(vid_data) = data else {
+                continue;
+            };
+            if vid_data.advanced_on.get() != Some(frame) {
+                continue;
+            }
+            if let Err(e) = vid_data.prefetch(lowlevel_ctx) {
+                eprintln!("Could not prefetch {}: {}", vid_data.info.name, e);
+            }
+        }
+        unsafe {
+            gfx_lowlevel_gpu_ctx_flush(lowlevel_ctx);
+        }
+    }
+
+    /// While the GPU is over its VRAM budget, hand the buffers of idle mixers
+    /// back to the texture pool, least recently used first. The pool destroys
+    /// what doesn't fit.
+    pub fn enforce_vram_budget(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx, frame: i64) {
+        let mut current = residency(lowlevel_ctx);
+        if !over_budget(&current) {
+            return;
+        }
+        let gfx_data = self.gfx_data.borrow();
+        let mut idle = gfx_data
+            .values()
+            .filter_map(|data| match data {
+                GfxData::VidMixerData(mixer)
+                    if mixer.has_buffers() && frame - mixer.last_used() >= MIXER_IDLE_FRAMES =>
+                {
+                    Some(mixer)
+                }
+                _ => None,
+            })
+            .collect::<Vec<_>>();
+        idle.sort_by_key(|mixer| mixer.last_used());
+        for mixer in idle {
+            if !over_budget(&current) {
+                break;
+            }
+            mixer.release_buffers();
+            self.evicted_mixers.set(self.evicted_mixers.get() + 1);
+            current = residency(lowlevel_ctx);
+        }
+    }
+
+    /// What mixers, the texture pool and videos hold in VRAM right now
+    pub fn gpu_memory(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> GpuMemoryEvent {
+        let current = residency(lowlevel_ctx);
+        let resident_mixers = self
+            .gfx_data
+            .borrow()
+            .values()
+            .filter(|data| matches!(data, GfxData::VidMixerData(mixer) if mixer.has_buffers()))
+            .count() as u32;
+        GpuMemoryEvent {
+            budget_bytes: current.budget,
+            mixer_bytes: current.mixer_bytes,
+            idle_bytes: current.idle_bytes,
+            video_bytes: current.video_bytes,
+            resident_mixers,
+            evicted_mixers: self.evicted_mixers.get(),
+        }
+    }
+
+    /// Whether the named mixer has a `//!STORAGE` buffer the app reads back
+    pub fn writes_storage(&self, name: &str) -> bool {
+        match self.gfx_data.borrow().get(name) {
+            Some(GfxData::VidMixerData(mixer)) => mixer.writes_storage(),
+            _ => false,
+        }
+    }
+
+    /// Storage buffer results every mixer got back since the last call
+    pub fn storage_events(&self) -> Vec<StorageEvent> {
+        let mut events = vec![];
+        for data in self.gfx_data.borrow().values() {
+            if let GfxData::VidMixerData(mixer) = data {
+                mixer.take_storage_events(&mut events);
+            }
+        }
+        events
+    }
+
     pub fn set_last_frame_rendered(&self, value: i64) {
         let mut last_frame = self.last_frame_rendered.borrow_mut();
         *last_frame = value;
@@ -165,7 +384,7 @@ impl GfxRuntime {
         let last_frame = self.last_frame_rendered.borrow();
         if let Err(e) = match &spec {
             RenderSpec::None => Ok(()),
-            RenderSpec::SendCmd(send_cmd) => self.send_cmd(lowlevel_ctx, send_cmd.clone()),
+            RenderSpec::SendCmd(send_cmd) => self.send_cmd(send_cmd.clone()),
             RenderSpec::HudText(_) => Ok(()),
             RenderSpec::Mix(mix) => self.mix(
                 lowlevel_ctx,
@@ -212,6 +431,7 @@ impl GfxRuntime {
             Some(GfxData::VidMixerData(vid_mixer)) => vid_mixer,
             _ => bail!("No data for mixer data for {}", mix.name),
         };
+        vid_mixer.touch(frames);
 
         let mut inputs = vec![];
         for name in &mix.inputs {
@@ -223,28 +443,26 @@ impl GfxRuntime {
                     });
                 }
                 MixInput::Mixed(name) => inputs.push(match gfx_data.get(name) {
-                    Some(GfxData::VidMixerData(vid_mixer_data)) => vid_mixer_data.into(),
+                    Some(GfxData::VidMixerData(vid_mixer_data)) => {
+                        vid_mixer_data.touch(frames);
+                        vid_mixer_data.into()
+                    }
                     _ => bail!("No mixer for feedback {}", name),
                 }),
             }
         }
 
+        // mixes without their LUT until it's loaded rather than stall the frame
         let lut_ptr = if let Some(lut) = mix.lut.as_ref() {
-            let mut lut_cache = self.lut_cache.borrow_mut();
-            if let Some(cached) = lut_cache.get(&lut.to_string()) {
-                cached.0
-            } else {
-                let lut_str = CString::new(lut.to_string())?;
-                unsafe {
-                    let lut_ptr = gfx_lowlevel_init_lut(lowlevel_ctx, lut_str.as_ptr());
-                    lut_cache.insert(lut.to_string(), WrapLut(lut_ptr));
-                    lut_ptr
-                }
-            }
+            self.lut_cache.borrow_mut().get(&lut.to_string())
         } else {
             std::ptr::null_mut()
         };
 
+        if let Some(midi) = self.midi.borrow_mut().as_mut() {
+            midi.stage(vid_mixer);
+        }
+
         match vid_mixer.mix(
             self.frames_per_sec,
             frames_to_mix,
@@ -266,14 +484,13 @@ impl GfxRuntime {
         Ok(())
     }
 
-    fn send_cmd(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx, send_cmd: SendCmd) -> Result<()> {
+    fn send_cmd(&self, send_cmd: SendCmd) -> Result<()> {
         let gfx_data = self.gfx_data.borrow();
         let Some(GfxData::VidMixerData(mix)) = gfx_data.get(&send_cmd.mix) else {
             bail!("No such VidMixer for command {:?}", send_cmd);
         };
 
-        mix.do_cmd(lowlevel_ctx, &send_cmd)?;
-        Ok(())
+        mix.do_cmd(send_cmd)
     }
 
     pub fn get_present_time_for_mix(&self, mix_name: &str) -> Result<Rational> {
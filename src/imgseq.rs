@@ -0,0 +1,507 @@
+use crate::{
+    framering::FrameRing,
+    gfxinfo::VidInfo,
+    glob::glob,
+    mapfile::MappedFile,
+    vidthread::{DecodeCmd, DecodeItem, Decoded, IDLE_PARK},
+};
+use anyhow::{bail, Result};
+use ffmpeg_next::{codec, codec::packet::Borrow, decoder, format::Pixel, frame::Video, Codec};
+use std::{
+    collections::HashMap,
+    ffi::c_void,
+    path::Path,
+    sync::{
+        atomic::{AtomicBool, AtomicU64, Ordering},
+        mpsc::{channel, Receiver, Sender},
+        Arc, Mutex,
+    },
+    thread::{self, JoinHandle, Thread},
+};
+
+extern crate ffmpeg_next as ffmpeg;
+
+// Images decoding at once per sequence, PNG and EXR are slow enough to want a few
+const SEQUENCE_WORKERS: usize = 4;
+
+/// Every file pattern matches, in name order
+pub fn sequence_paths(pattern: &str) -> Vec<String> {
+    let mut paths = glob(pattern).unwrap_or_default();
+    paths.sort();
+    paths
+}
+
+/// Width and height of one image of a sequence
+pub fn probe(path: &str, codec_name: Option<&str>) -> Result<(u32, u32)> {
+    let frame = load_image(path, codec_name, &mut HashMap::new())?;
+    Ok((frame.width(), frame.height()))
+}
+
+// Where the pixels of an uncompressed image sit in its file
+struct RawLayout {
+    format: Pixel,
+    width: u32,
+    height: u32,
+    offset: usize,
+    stride: usize,
+}
+
+// Binary PGM/PPM
+fn ppm_layout(bytes: &[u8]) -> Option<RawLayout> {
+    let channels = match bytes.get(0..2)? {
+        b"P5" => 1,
+        b"P6" => 3,
+        _ => return None,
+    };
+    let mut pos = 2;
+    let mut fields = [0usize; 3];
+    for field in fields.iter_mut() {
+        // whitespace and comments between fields
+        loop {
+            match *bytes.get(pos)? {
+                b'#' => {
+                    while *bytes.get(pos)? != b'\n' {
+                        pos += 1;
+                    }
+                }
+                c if c.is_ascii_whitespace() => pos += 1,
+                _ => break,
+            }
+        }
+        let start = pos;
+        while bytes.get(pos)?.is_ascii_digit() {
+            pos += 1;
+        }
+        *field = std::str::from_utf8(&bytes[start..pos]).ok()?.parse().ok()?;
+    }
+    // a single whitespace byte before the pixels
+    pos += 1;
+
+    let [width, height, maxval] = fields;
+    let (format, bytes_per_pixel) = match (channels, maxval) {
+        (1, 1..=255) => (Pixel::GRAY8, 1),
+        (1, 256..=65535) => (Pixel::GRAY16BE, 2),
+        (3, 1..=255) => (Pixel::RGB24, 3),
+        (3, 256..=65535) => (Pixel::RGB48BE, 6),
+        _ => return None,
+    };
+    let stride = width.checked_mul(bytes_per_pixel)?;
+    raw_layout(bytes, format, width, height, pos, stride)
+}
+
+// 8 and 16 bit RGB(A) DPX, 10 and 12 bit need unpacking so ffmpeg decodes those
+fn dpx_layout(bytes: &[u8]) -> Option<RawLayout> {
+    let big_endian = match bytes.get(0..4)? {
+        b"SDPX" => true,
+        b"XPDS" => false,
+        _ => return None,
+    };
+    let u32_at = |at: usize| -> Option<u32> {
+        let b: [u8; 4] = bytes.get(at..at + 4)?.try_into().ok()?;
+        Some(if big_endian {
+            u32::from_be_bytes(b)
+        } else {
+            u32::from_le_bytes(b)
+        })
+    };
+    let u16_at = |at: usize| -> Option<u16> {
+        let b: [u8; 2] = bytes.get(at..at + 2)?.try_into().ok()?;
+        Some(if big_endian {
+            u16::from_be_bytes(b)
+        } else {
+            u16::from_le_bytes(b)
+        })
+    };
+
+    let offset = u32_at(4)? as usize;
+    if u16_at(770)? != 1 {
+        return None;
+    }
+    let width = u32_at(772)?;
+    let height = u32_at(776)?;
+    let descriptor = *bytes.get(800)?;
+    let bits = *bytes.get(803)?;
+    let packing = u16_at(804)?;
+    let encoding = u16_at(806)?;
+    if encoding != 0 {
+        return None;
+    }
+    let eol_padding = match u32_at(812)? {
+        u32::MAX => 0,
+        padding => padding as usize,
+    };
+    let (format, bytes_per_pixel) = match (descriptor, bits, big_endian) {
+        (50, 8, _) => (Pixel::RGB24, 3),
+        (51, 8, _) => (Pixel::RGBA, 4),
+        (50, 16, true) => (Pixel::RGB48BE, 6),
+        (50, 16, false) => (Pixel::RGB48LE, 6),
+        (51, 16, true) => (Pixel::RGBA64BE, 8),
+        (51, 16, false) => (Pixel::RGBA64LE, 8),
+        _ => return None,
+    };
+    let row = (width as usize).checked_mul(bytes_per_pixel)?;
+    // filled packing pads every line out to a whole 32 bit word
+    let row = if packing != 0 {
+        row.checked_add(3)? / 4 * 4
+    } else {
+        row
+    };
+    let stride = row.checked_add(eol_padding)?;
+    raw_layout(
+        bytes,
+        format,
+        width as usize,
+        height as usize,
+        offset,
+        stride,
+    )
+}
+
+// The header's values come straight from the file, anything that overflows
+// or reaches past the mapping is a broken image
+fn raw_layout(
+    bytes: &[u8],
+    format: Pixel,
+    width: usize,
+    height: usize,
+    offset: usize,
+    stride: usize,
+) -> Option<RawLayout> {
+    if width == 0 || height == 0 {
+        return None;
+    }
+    let end = stride.checked_mul(height)?.checked_add(offset)?;
+    if end > bytes.len() || i32::try_from(stride).is_err() {
+        return None;
+    }
+    Some(RawLayout {
+        format,
+        width: width.try_into().ok()?,
+        height: height.try_into().ok()?,
+        offset,
+        stride,
+    })
+}
+
+unsafe extern "C" fn release_mapping(opaque: *mut c_void, _data: *mut u8) {
+    drop(Arc::from_raw(opaque as *const MappedFile));
+}
+
+// A frame whose single plane is the pixels in the mapping, nothing is copied
+// until the upload reads them
+fn wrap_mapping(map: &Arc<MappedFile>, layout: &RawLayout) -> Result<Video> {
+    let mut frame = Video::empty();
+    frame.set_format(layout.format);
+    frame.set_width(layout.width);
+    frame.set_height(layout.height);
+    unsafe {
+        let opaque = Arc::into_raw(map.clone()) as *mut c_void;
+        let buf = ffmpeg::ffi::av_buffer_create(
+            (map.bytes().as_ptr() as *mut u8).add(layout.offset),
+            (layout.stride * layout.height as usize) as _,
+            Some(release_mapping),
+            opaque,
+            ffmpeg::ffi::AV_BUFFER_FLAG_READONLY as i32,
+        );
+        if buf.is_null() {
+            release_mapping(opaque, std::ptr::null_mut());
+            bail!("Could not wrap mapped image");
+        }
+        let ptr = frame.as_mut_ptr();
+        (*ptr).buf[0] = buf;
+        (*ptr).data[0] = (*buf).data;
+        (*ptr).linesize[0] = layout.stride as i32;
+    }
+    Ok(frame)
+}
+
+fn codec_for(path: &str, codec_name: Option<&str>) -> Result<Codec> {
+    if let Some(name) = codec_name {
+        let Some(codec) = decoder::find_by_name(name) else {
+            bail!("No decoder named {}", name);
+        };
+        return Ok(codec);
+    }
+    let ext = Path::new(path)
+        .extension()
+        .and_then(|e| e.to_str())
+        .unwrap_or_default()
+        .to_ascii_lowercase();
+    let id = match ext.as_str() {
+        "png" => codec::Id::PNG,
+        "jpg" | "jpeg" => codec::Id::MJPEG,
+        "exr" => codec::Id::EXR,
+        "dpx" => codec::Id::DPX,
+        "tif" | "tiff" => codec::Id::TIFF,
+        "bmp" => codec::Id::BMP,
+        "tga" => codec::Id::TARGA,
+        "webp" => codec::Id::WEBP,
+        "ppm" | "pnm" => codec::Id::PPM,
+        "pgm" => codec::Id::PGM,
+        _ => bail!("No decoder for .{} images", ext),
+    };
+    match decoder::find(id) {
+        Some(codec) => Ok(codec),
+        None => bail!("ffmpeg was built without a decoder for .{}", ext),
+    }
+}
+
+// One image from its mapping, decoders are kept per codec for the next one
+fn load_image(
+    path: &str,
+    codec_name: Option<&str>,
+    decoders: &mut HashMap<String, decoder::Video>,
+) -> Result<Video> {
+    let map = Arc::new(MappedFile::open(path)?);
+    if let Some(layout) = ppm_layout(map.bytes()).or_else(|| dpx_layout(map.bytes())) {
+        return wrap_mapping(&map, &layout);
+    }
+
+    let codec = codec_for(path, codec_name)?;
+    let key = codec.name().to_string();
+    if !decoders.contains_key(&key) {
+        let context = codec::context::Context::new_with_codec(codec);
+        decoders.insert(key.clone(), context.decoder().video()?);
+    }
+    let decoder = decoders.get_mut(&key).unwrap();
+
+    decoder.send_packet(&Borrow::new(map.bytes()))?;
+    let mut frame = Video::empty();
+    match decoder.receive_frame(&mut frame) {
+        Ok(()) => Ok(frame),
+        Err(ffmpeg::Error::Other {
+            errno: ffmpeg::ffi::EAGAIN,
+        }) => {
+            // a decoder holding the frame back gives it up at end of stream
+            decoder.send_eof()?;
+            let received = decoder.receive_frame(&mut frame);
+            decoder.flush();
+            received?;
+            Ok(frame)
+        }
+        Err(e) => bail!("Could not decode {}: {}", path, e),
+    }
+}
+
+struct Job {
+    generation: u64,
+    // position in play order, repeats keep counting up
+    position: usize,
+}
+
+struct Done {
+    generation: u64,
+    position: usize,
+    item: DecodeItem,
+}
+
+/// Feeds a DecodeThread ring from an image sequence. Workers decode ahead
+/// in parallel and this puts their frames back in order, so seeking is just
+/// starting over at another index.
+pub(crate) struct SequenceProducer {
+    info: VidInfo,
+    paths: Arc<Vec<String>>,
+    ring: Arc<FrameRing<Decoded>>,
+    stop: Arc<AtomicBool>,
+    cmds: Receiver<(u64, DecodeCmd)>,
+    consumer: Arc<Mutex<Thread>>,
+}
+
+impl SequenceProducer {
+    pub(crate) fn new(
+        info: &VidInfo,
+        ring: Arc<FrameRing<Decoded>>,
+        stop: Arc<AtomicBool>,
+        cmds: Receiver<(u64, DecodeCmd)>,
+        consumer: Arc<Mutex<Thread>>,
+    ) -> Result<Self> {
+        let paths = sequence_paths(&info.path);
+        if paths.is_empty() {
+            bail!("No images match {}", info.path);
+        }
+        Ok(Self {
+            info: info.clone(),
+            paths: Arc::new(paths),
+            ring,
+            stop,
+            cmds,
+            consumer,
+        })
+    }
+
+    fn spawn_worker(
+        &self,
+        i: usize,
+        jobs: Arc<Mutex<Receiver<Job>>>,
+        done: Sender<Done>,
+        current: Arc<AtomicU64>,
+    ) -> Result<JoinHandle<()>> {
+        let paths = self.paths.clone();
+        let codec_name = self.info.codec.clone();
+        let producer = thread::current();
+        Ok(thread::Builder::new()
+            .name(format!("sequence-{}-{}", self.info.name, i))
+            .spawn(move || {
+                let mut decoders = HashMap::new();
+                loop {
+                    let job = match jobs.lock() {
+                        Ok(jobs) => jobs.recv(),
+                        Err(_) => return,
+                    };
+                    let Ok(job) = job else {
+                        return;
+                    };
+                    // queued before a seek, nobody wants it any more
+                    if job.generation != current.load(Ordering::Acquire) {
+                        continue;
+                    }
+                    let index = job.position % paths.len();
+                    let path = &paths[index];
+                    let item = match load_image(path, codec_name.as_deref(), &mut decoders) {
+                        Ok(mut frame) => {
+                            frame.set_pts(Some(index as i64));
+                            unsafe { (*frame.as_mut_ptr()).duration = 1 };
+                            DecodeItem::Frame(frame)
+                        }
+                        Err(e) => DecodeItem::Error(format!("{}: {}", path, e)),
+                    };
+                    let finished = Done {
+                        generation: job.generation,
+                        position: job.position,
+                        item,
+                    };
+                    if done.send(finished).is_err() {
+                        return;
+                    }
+                    producer.unpark();
+                }
+            })?)
+    }
+
+    pub(crate) fn run(self) {
+        let (jobs_tx, jobs_rx) = channel();
+        let jobs_rx = Arc::new(Mutex::new(jobs_rx));
+        let (done_tx, done_rx) = channel();
+        let current = Arc::new(AtomicU64::new(0));
+        let workers = (0..SEQUENCE_WORKERS)
+            .filter_map(|i| {
+                match self.spawn_worker(i, jobs_rx.clone(), done_tx.clone(), current.clone()) {
+                    Ok(handle) => Some(handle),
+                    Err(e) => {
+                        eprintln!("Could not start decoder for {}: {}", self.info.name, e);
+                        None
+                    }
+                }
+            })
+            .collect::<Vec<_>>();
+        drop(done_tx);
+
+        let count = self.paths.len();
+        let lookahead = self.ring.capacity() + workers.len().max(1);
+        let mut generation = 0;
+        let mut next_issue = 0;
+        let mut next_push = 0;
+        let mut pending: HashMap<usize, DecodeItem> = HashMap::new();
+        let mut eof_queued = false;
+        // images in a row that failed to decode
+        let mut failed = 0;
+        let mut done = workers.is_empty();
+        if done {
+            self.ring
+                .push(Decoded {
+                    generation,
+                    item: DecodeItem::Error(String::from("No sequence decoders")),
+                })
+                .ok();
+        }
+
+        while !self.stop.load(Ordering::Acquire) {
+            while let Ok((seek_generation, cmd)) = self.cmds.try_recv() {
+                match cmd {
+                    DecodeCmd::Seek { ts, .. } => {
+                        // every image is a key frame, start right at the target
+                        generation = seek_generation;
+                        current.store(generation, Ordering::Release);
+                        // past the end of a sequence that doesn't repeat is
+                        // its last image
+                        next_issue = if self.info.repeat {
+                            ts.max(0) as usize % count
+                        } else {
+                            (ts.max(0) as usize).min(count - 1)
+                        };
+                        next_push = next_issue;
+                        pending.clear();
+                        eof_queued = false;
+                        failed = 0;
+                        done = workers.is_empty();
+                    }
+                }
+            }
+
+            while !done
+                && next_issue < next_push + lookahead
+                && (self.info.repeat || next_issue < count)
+            {
+                let job = Job {
+                    generation,
+                    position: next_issue,
+                };
+                if jobs_tx.send(job).is_err() {
+                    break;
+                }
+                next_issue += 1;
+            }
+            if !self.info.repeat && next_issue == count && !eof_queued {
+                pending.insert(count, DecodeItem::Eof);
+                eof_queued = true;
+            }
+
+            while let Ok(finished) = done_rx.try_recv() {
+                if finished.generation == generation && finished.position >= next_push {
+                    pending.insert(finished.position, finished.item);
+                }
+            }
+
+            // in order, whatever the workers finished first
+            while !done {
+                let Some(item) = pending.remove(&next_push) else {
+                    break;
+                };
+                // a bad image is skipped, the sequence only fails once a
+                // whole pass over it decoded nothing
+                match &item {
+                    DecodeItem::Frame(_) => failed = 0,
+                    DecodeItem::Error(e) if failed + 1 < count => {
+                        failed += 1;
+                        eprintln!("Skipping image of {}: {}", self.info.name, e);
+                        next_push += 1;
+                        continue;
+                    }
+                    _ => (),
+                }
+                let last = !matches!(item, DecodeItem::Frame(_));
+                match self.ring.push(Decoded { generation, item }) {
+                    Ok(()) => {
+                        next_push += 1;
+                        done = last;
+                        if let Ok(consumer) = self.consumer.try_lock() {
+                            consumer.unpark();
+                        }
+                    }
+                    Err(decoded) => {
+                        pending.insert(next_push, decoded.item);
+                        break;
+                    }
+                }
+            }
+
+            // woken by workers finishing and by the consumer taking frames
+            thread::park_timeout(IDLE_PARK);
+        }
+
+        drop(jobs_tx);
+        for worker in workers {
+            worker.join().ok();
+        }
+    }
+}
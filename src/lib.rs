@@ -1,18 +1,40 @@
 #[cfg(not(target_family = "wasm"))]
 pub mod appruntime;
 #[cfg(not(target_family = "wasm"))]
+pub mod encoder;
+#[cfg(not(target_family = "wasm"))]
 pub mod fonts;
+#[cfg(not(target_family = "wasm"))]
+pub mod framepacer;
+#[cfg(not(target_family = "wasm"))]
+pub mod framering;
 pub mod gfxinfo;
 #[cfg(not(target_family = "wasm"))]
 pub mod gfxruntime;
 #[cfg(not(target_family = "wasm"))]
 pub mod glob;
+#[cfg(not(target_family = "wasm"))]
+pub mod imgseq;
+#[cfg(not(target_family = "wasm"))]
+pub mod lutcache;
+#[cfg(not(target_family = "wasm"))]
+pub mod mapfile;
+#[cfg(not(target_family = "wasm"))]
+pub mod midibind;
+pub mod mixgraph;
 pub mod renderspec;
+#[cfg(not(target_family = "wasm"))]
+pub mod seekindex;
 #[cfg(target_family = "wasm")]
 pub mod spec_engine;
 #[cfg(not(target_family = "wasm"))]
 pub mod vidruntime;
+#[cfg(not(target_family = "wasm"))]
+pub mod vidthread;
 pub use adjustable::Adjustable;
 #[cfg(not(target_family = "wasm"))]
 pub mod gfx_lowlevel;
 pub mod shaderhelper;
+#[cfg(not(target_family = "wasm"))]
+pub mod trace;
+pub mod wirecodec;
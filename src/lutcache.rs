@@ -0,0 +1,380 @@
+use crate::{
+    gfx_lowlevel::bindings::{
+        gfx_lowlevel_destroy_lut, gfx_lowlevel_lut, gfx_lowlevel_lut_create, gfx_lowlevel_parse_lut,
+    },
+    mapfile::MappedFile,
+};
+use anyhow::{bail, Result};
+use std::{
+    collections::HashMap,
+    ffi::CString,
+    fs,
+    io::Write,
+    sync::mpsc::{channel, Receiver, Sender},
+    thread::{self, JoinHandle},
+    time::{Duration, Instant},
+};
+
+/// Default for how much the loaded LUTs may hold before unused ones go
+pub const DEFAULT_LUT_BUDGET: usize = 256 << 20;
+
+// LUTs used this recently are never evicted, their textures may still be in
+// flight on the GPU
+const EVICT_GRACE: Duration = Duration::from_secs(2);
+
+// A LUT that failed to load is asked for again after this, so fixing the
+// .cube on disk doesn't need a restart
+const FAILED_RETRY: Duration = Duration::from_secs(5);
+
+// <lut>.sdlrig-lut next to the source, a header then rgb float16s
+const CACHE_EXT: &str = "sdlrig-lut";
+const CACHE_MAGIC: &[u8; 4] = b"SLUT";
+const CACHE_VERSION: u32 = 1;
+const CACHE_HEADER: usize = 4 + 4 + 8 + 3 * 4;
+
+#[derive(Debug)]
+pub struct WrapLut(*mut gfx_lowlevel_lut);
+unsafe impl Send for WrapLut {}
+impl Drop for WrapLut {
+    fn drop(&mut self) {
+        unsafe {
+            gfx_lowlevel_destroy_lut(&mut self.0 as _);
+        }
+    }
+}
+
+impl WrapLut {
+    fn size(&self) -> [i32; 3] {
+        unsafe { (*(*self.0).lut).size }
+    }
+
+    fn values(&self) -> usize {
+        self.size()
+            .iter()
+            .map(|s| (*s).max(1) as usize)
+            .product::<usize>()
+            * 3
+    }
+
+    fn data(&self) -> &[f32] {
+        unsafe { std::slice::from_raw_parts((*(*self.0).lut).data, self.values()) }
+    }
+
+    // the float copy plus about as much again for its texture
+    fn bytes(&self) -> usize {
+        self.values() * size_of::<f32>() * 2
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum LutStatus {
+    /// Never asked for, or evicted since
+    Unknown,
+    /// Loading on the worker, mixes render without it meanwhile
+    Pending,
+    Ready,
+    Failed,
+}
+
+enum Slot {
+    Pending,
+    Ready(WrapLut),
+    Failed(Instant),
+}
+
+struct Entry {
+    slot: Slot,
+    last_used: Instant,
+}
+
+/// Loads .cube LUTs on a worker thread so a mix never waits on one. Parsed
+/// LUTs are written back next to the source as a float16 cache keyed by a
+/// hash of the .cube, later runs map that instead of parsing again.
+pub struct LutCache {
+    entries: HashMap<String, Entry>,
+    requests: Option<Sender<String>>,
+    loaded: Receiver<(String, Result<WrapLut>)>,
+    worker: Option<JoinHandle<()>>,
+    budget: usize,
+}
+
+impl LutCache {
+    pub fn new() -> Self {
+        let (requests, pending) = channel::<String>();
+        let (done, loaded) = channel();
+        let worker = thread::Builder::new()
+            .name(String::from("lut-loader"))
+            .spawn(move || {
+                for path in pending {
+                    let lut = load(&path);
+                    if done.send((path, lut)).is_err() {
+                        return;
+                    }
+                }
+            })
+            .map_err(|e| eprintln!("Could not start LUT loader: {}", e))
+            .ok();
+        Self {
+            entries: HashMap::new(),
+            requests: Some(requests),
+            loaded,
+            worker,
+            budget: DEFAULT_LUT_BUDGET,
+        }
+    }
+
+    /// Bytes the loaded LUTs may hold before ones not used lately are dropped
+    pub fn set_budget(&mut self, bytes: usize) {
+        self.budget = bytes;
+        self.evict();
+    }
+
+    pub fn status(&self, path: &str) -> LutStatus {
+        match self.entries.get(path).map(|e| &e.slot) {
+            None => LutStatus::Unknown,
+            Some(Slot::Pending) => LutStatus::Pending,
+            Some(Slot::Ready(_)) => LutStatus::Ready,
+            Some(Slot::Failed(_)) => LutStatus::Failed,
+        }
+    }
+
+    /// The LUT at path if it's loaded, null while it's loading or if it
+    /// failed. The first call starts it loading.
+    pub fn get(&mut self, path: &str) -> *mut gfx_lowlevel_lut {
+        self.collect();
+        let now = Instant::now();
+        if let Some(Slot::Failed(at)) = self.entries.get(path).map(|e| &e.slot) {
+            if now.duration_since(*at) > FAILED_RETRY {
+                self.entries.remove(path);
+            }
+        }
+        if let Some(entry) = self.entries.get_mut(path) {
+            entry.last_used = now;
+            return match &entry.slot {
+                Slot::Ready(lut) => lut.0,
+                _ => std::ptr::null_mut(),
+            };
+        }
+
+        let slot = match self.requests.as_ref().map(|r| r.send(path.to_string())) {
+            Some(Ok(())) => Slot::Pending,
+            _ => {
+                // no worker, load it here rather than not at all
+                match load(path) {
+                    Ok(lut) => Slot::Ready(lut),
+                    Err(e) => {
+                        eprintln!("Could not load LUT {}: {}", path, e);
+                        Slot::Failed(now)
+                    }
+                }
+            }
+        };
+        let lut = match &slot {
+            Slot::Ready(lut) => lut.0,
+            _ => std::ptr::null_mut(),
+        };
+        let entry = Entry {
+            slot,
+            last_used: now,
+        };
+        self.entries.insert(path.to_string(), entry);
+        self.evict();
+        lut
+    }
+
+    // Take whatever the worker finished since the last call
+    fn collect(&mut self) {
+        let mut any = false;
+        while let Ok((path, lut)) = self.loaded.try_recv() {
+            let Some(entry) = self.entries.get_mut(&path) else {
+                continue;
+            };
+            entry.slot = match lut {
+                Ok(lut) => Slot::Ready(lut),
+                Err(e) => {
+                    eprintln!("Could not load LUT {}: {}", path, e);
+                    Slot::Failed(Instant::now())
+                }
+            };
+            any = true;
+        }
+        if any {
+            self.evict();
+        }
+    }
+
+    // Drop least recently used LUTs until under budget
+    fn evict(&mut self) {
+        let mut used = self
+            .entries
+            .values()
+            .map(|e| match &e.slot {
+                Slot::Ready(lut) => lut.bytes(),
+                _ => 0,
+            })
+            .sum::<usize>();
+        if used <= self.budget {
+            return;
+        }
+        let mut candidates = self
+            .entries
+            .iter()
+            .filter_map(|(path, e)| match &e.slot {
+                Slot::Ready(lut) if e.last_used.elapsed() > EVICT_GRACE => {
+                    Some((e.last_used, lut.bytes(), path.clone()))
+                }
+                _ => None,
+            })
+            .collect::<Vec<_>>();
+        candidates.sort();
+        for (_, bytes, path) in candidates {
+            if used <= self.budget {
+                break;
+            }
+            self.entries.remove(&path);
+            used -= bytes;
+        }
+    }
+}
+
+impl Drop for LutCache {
+    fn drop(&mut self) {
+        self.requests.take();
+        if let Some(worker) = self.worker.take() {
+            worker.join().ok();
+        }
+    }
+}
+
+// FNV-1a, stable across builds unlike DefaultHasher
+fn hash(bytes: &[u8]) -> u64 {
+    let mut hash = 0xcbf29ce484222325u64;
+    for b in bytes {
+        hash ^= *b as u64;
+        hash = hash.wrapping_mul(0x100000001b3);
+    }
+    hash
+}
+
+fn load(path: &str) -> Result<WrapLut> {
+    let source = MappedFile::open(path)?;
+    let signature = hash(source.bytes());
+    let cache_path = format!("{}.{}", path, CACHE_EXT);
+    if let Some(lut) = load_cache(path, &cache_path, signature) {
+        return Ok(lut);
+    }
+
+    let c_path = CString::new(path)?;
+    let lut = unsafe {
+        gfx_lowlevel_parse_lut(
+            c_path.as_ptr(),
+            source.bytes().as_ptr() as *const _,
+            source.bytes().len(),
+        )
+    };
+    if lut.is_null() {
+        bail!("Could not parse {}", path);
+    }
+    let lut = WrapLut(lut);
+    if let Err(e) = write_cache(&cache_path, signature, &lut) {
+        eprintln!("Could not write LUT cache {}: {}", cache_path, e);
+    }
+    Ok(lut)
+}
+
+// A cache written for this exact .cube, or None to parse it again
+fn load_cache(path: &str, cache_path: &str, signature: u64) -> Option<WrapLut> {
+    let cache = MappedFile::open(cache_path).ok()?;
+    let bytes = cache.bytes();
+    let u32_at = |at: usize| u32::from_le_bytes(bytes[at..at + 4].try_into().unwrap());
+    if bytes.len() < CACHE_HEADER
+        || &bytes[0..4] != CACHE_MAGIC
+        || u32_at(4) != CACHE_VERSION
+        || u64::from_le_bytes(bytes[8..16].try_into().unwrap()) != signature
+    {
+        return None;
+    }
+    let size = [u32_at(16) as i32, u32_at(20) as i32, u32_at(24) as i32];
+    let values = size.iter().map(|s| (*s).max(1) as usize).product::<usize>() * 3;
+    let halfs = &bytes[CACHE_HEADER..];
+    if size[0] <= 0 || halfs.len() != values * 2 {
+        return None;
+    }
+
+    let c_path = CString::new(path).ok()?;
+    let lut =
+        unsafe { gfx_lowlevel_lut_create(c_path.as_ptr(), signature, size[0], size[1], size[2]) };
+    if lut.is_null() {
+        return None;
+    }
+    let lut = WrapLut(lut);
+    let data = unsafe { std::slice::from_raw_parts_mut((*lut.0).owned_data, values) };
+    for (value, half) in data.iter_mut().zip(halfs.chunks_exact(2)) {
+        *value = f16_to_f32(u16::from_le_bytes([half[0], half[1]]));
+    }
+    Some(lut)
+}
+
+fn write_cache(cache_path: &str, signature: u64, lut: &WrapLut) -> Result<()> {
+    let data = lut.data();
+    let mut out = Vec::with_capacity(CACHE_HEADER + data.len() * 2);
+    out.extend_from_slice(CACHE_MAGIC);
+    out.extend_from_slice(&CACHE_VERSION.to_le_bytes());
+    out.extend_from_slice(&signature.to_le_bytes());
+    for s in lut.size() {
+        out.extend_from_slice(&(s as u32).to_le_bytes());
+    }
+    for value in data {
+        out.extend_from_slice(&f32_to_f16(*value).to_le_bytes());
+    }
+    // written aside and renamed so a reader never maps half a cache
+    let partial = format!("{}.partial", cache_path);
+    fs::File::create(&partial)?.write_all(&out)?;
+    fs::rename(&partial, cache_path)?;
+    Ok(())
+}
+
+// Round to nearest even, out of range values become infinities
+fn f32_to_f16(value: f32) -> u16 {
+    let bits = value.to_bits();
+    let sign = ((bits >> 16) & 0x8000) as u16;
+    let exp = ((bits >> 23) & 0xff) as i32;
+    let mant = bits & 0x7f_ffff;
+    if exp == 0xff {
+        return sign | 0x7c00 | if mant != 0 { 0x200 } else { 0 };
+    }
+    let exp = exp - 127 + 15;
+    if exp >= 0x1f {
+        return sign | 0x7c00;
+    }
+    let (half, rem, mid) = if exp <= 0 {
+        if exp < -10 {
+            return sign;
+        }
+        let mant = mant | 0x80_0000;
+        let shift = (14 - exp) as u32;
+        (mant >> shift, mant & ((1 << shift) - 1), 1 << (shift - 1))
+    } else {
+        (((exp as u32) << 10) | (mant >> 13), mant & 0x1fff, 0x1000)
+    };
+    // a carry out of the mantissa bumps the exponent, which is what we want
+    let round = (rem > mid || (rem == mid && half & 1 == 1)) as u32;
+    sign | (half + round) as u16
+}
+
+fn f16_to_f32(half: u16) -> f32 {
+    let sign = ((half & 0x8000) as u32) << 16;
+    let exp = ((half >> 10) & 0x1f) as u32;
+    let mant = (half & 0x3ff) as u32;
+    let bits = match (exp, mant) {
+        (0, 0) => sign,
+        (0, _) => {
+            // subnormal, normalize it
+            let shift = mant.leading_zeros() - 21;
+            sign | ((113 - shift) << 23) | (((mant << shift) & 0x3ff) << 13)
+        }
+        (0x1f, _) => sign | 0x7f80_0000 | (mant << 13),
+        _ => sign | ((exp + 112) << 23) | (mant << 13),
+    };
+    f32::from_bits(bits)
+}
@@ -0,0 +1,53 @@
+use anyhow::{bail, Result};
+use std::{ffi::c_void, fs::File, os::fd::AsRawFd};
+
+/// A file mapped read only, unmapped on drop
+pub struct MappedFile {
+    ptr: *mut u8,
+    len: usize,
+}
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl MappedFile {
+    pub fn open(path: &str) -> Result<Self> {
+        let file = File::open(path)?;
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            bail!("{} is empty", path);
+        }
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            bail!(
+                "Could not map {}: {}",
+                path,
+                std::io::Error::last_os_error()
+            );
+        }
+        Ok(Self {
+            ptr: ptr as *mut u8,
+            len,
+        })
+    }
+
+    pub fn bytes(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr, self.len) }
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut c_void, self.len);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+use crate::{
+    gfxinfo::MIDI_CONTROL_CHANGE,
+    renderspec::{MidiBinding, SendCmd, SendValue},
+    vidruntime::VidMixerData,
+};
+use std::{
+    collections::HashMap,
+    sync::{
+        atomic::{AtomicU32, AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+};
+
+/// MIDI CC bindings the app registered, shared between the midir callback
+/// threads and the render thread. Callbacks store mapped values straight into
+/// per binding atomics and mixers pick up the latest values when they mix, so a
+/// knob never waits on calculate. The table is only locked to swap in a new
+/// one, both sides keep their own Arc and notice a swap by its generation.
+#[derive(Default)]
+pub struct MidiStaging {
+    generation: AtomicU64,
+    table: Mutex<Arc<BindingTable>>,
+}
+
+#[derive(Default)]
+struct BindingTable {
+    generation: u64,
+    slots: Vec<BindingSlot>,
+    by_cc: HashMap<u8, Vec<usize>>,
+    by_mixer: HashMap<String, Vec<usize>>,
+}
+
+struct BindingSlot {
+    binding: MidiBinding,
+    // f32 bits of the mapped value
+    value: AtomicU32,
+    // bumped by every write, 0 until the knob first moves
+    written: AtomicU64,
+}
+
+impl MidiStaging {
+    /// Replace the bindings, values start out unset until a knob moves
+    pub fn set_bindings(&self, bindings: Vec<MidiBinding>) {
+        let Ok(mut table) = self.table.lock() else {
+            return;
+        };
+        let generation = table.generation + 1;
+        let mut next = BindingTable {
+            generation,
+            ..Default::default()
+        };
+        for (i, binding) in bindings.into_iter().enumerate() {
+            next.by_cc.entry(binding.cc).or_default().push(i);
+            next.by_mixer
+                .entry(binding.mixer.clone())
+                .or_default()
+                .push(i);
+            next.slots.push(BindingSlot {
+                binding,
+                value: AtomicU32::new(0),
+                written: AtomicU64::new(0),
+            });
+        }
+        *table = Arc::new(next);
+        self.generation.store(generation, Ordering::Release);
+    }
+
+    // Swap in the current table if `cached` is out of date, only locks when
+    // the bindings actually changed
+    fn refresh(&self, cached: &mut Arc<BindingTable>) {
+        if cached.generation == self.generation.load(Ordering::Acquire) {
+            return;
+        }
+        if let Ok(table) = self.table.lock() {
+            *cached = table.clone();
+        }
+    }
+}
+
+/// One per midir connection, lives in its callback
+pub struct MidiWriter {
+    staging: Arc<MidiStaging>,
+    table: Arc<BindingTable>,
+}
+
+impl MidiWriter {
+    pub fn new(staging: Arc<MidiStaging>) -> Self {
+        Self {
+            staging,
+            table: Arc::default(),
+        }
+    }
+
+    /// Stage a raw message from device, true if a binding took it
+    pub fn write(&mut self, device: &str, message: &[u8]) -> bool {
+        if message.len() < 3 || message[0] & 0xF0 != MIDI_CONTROL_CHANGE {
+            return false;
+        }
+        self.staging.refresh(&mut self.table);
+        let (channel, cc, value) = (message[0] & 0x0F, message[1], message[2]);
+        let Some(indices) = self.table.by_cc.get(&cc) else {
+            return false;
+        };
+        let mut matched = false;
+        for slot in indices.iter().map(|i| &self.table.slots[*i]) {
+            if slot.binding.matches(device, channel, cc) {
+                let mapped = slot.binding.map(value);
+                slot.value.store(mapped.to_bits(), Ordering::Relaxed);
+                slot.written.fetch_add(1, Ordering::Release);
+                matched = true;
+            }
+        }
+        matched
+    }
+}
+
+/// The render thread's side, sets bound values on their mixers
+pub struct MidiReader {
+    staging: Arc<MidiStaging>,
+    table: Arc<BindingTable>,
+}
+
+impl MidiReader {
+    pub fn new(staging: Arc<MidiStaging>) -> Self {
+        Self {
+            staging,
+            table: Arc::default(),
+        }
+    }
+
+    /// Set every binding of mixer whose knob has moved to its latest value.
+    /// They go in after the app's own SendCmds on every mix, so a bound knob
+    /// keeps winning over whatever the app sends for the same var.
+    pub fn stage(&mut self, mixer: &VidMixerData) {
+        self.staging.refresh(&mut self.table);
+        let Some(indices) = self.table.by_mixer.get(&mixer.info.name) else {
+            return;
+        };
+        for slot in indices.iter().map(|i| &self.table.slots[*i]) {
+            if slot.written.load(Ordering::Acquire) == 0 {
+                continue;
+            }
+            let send_cmd = SendCmd {
+                mix: slot.binding.mixer.clone(),
+                name: slot.binding.var.clone(),
+                value: SendValue::Float(f32::from_bits(slot.value.load(Ordering::Relaxed))),
+            };
+            if let Err(e) = mixer.do_cmd(send_cmd) {
+                eprintln!("Could not apply midi control {}: {}", slot.binding.var, e);
+            }
+        }
+    }
+}
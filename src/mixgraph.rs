@@ -0,0 +1,99 @@
+use crate::renderspec::{Mix, MixInput, RenderSpec};
+use std::collections::{HashMap, HashSet};
+
+/// Order one frame's specs so every mix runs after the mixes it reads and drop
+/// mixes nobody sees. A mix is kept if it is displayed, if `keep` says so (a
+/// mixer whose `//!STORAGE` the app reads back) or if a kept mix reads it
+/// through `MixInput::Mixed`. Only runs of consecutive mixes are reordered,
+/// so seeks, resets and commands still land between the same mixes. Reading a
+/// mix from a later run is left alone, that's last frame's output on purpose.
+/// Returns how many mixes were dropped.
+pub fn schedule(specs: &mut Vec<RenderSpec>, keep: impl Fn(&str) -> bool) -> usize {
+    let mut producers: HashMap<&str, Vec<usize>> = HashMap::new();
+    for (i, spec) in specs.iter().enumerate() {
+        if let RenderSpec::Mix(mix) = spec {
+            producers.entry(mix.name.as_str()).or_default().push(i);
+        }
+    }
+    if producers.is_empty() {
+        return 0;
+    }
+
+    let mut live = HashSet::new();
+    let mut pending = specs
+        .iter()
+        .filter_map(|spec| match spec {
+            RenderSpec::Mix(mix) if !mix.no_display || keep(&mix.name) => Some(mix.name.as_str()),
+            _ => None,
+        })
+        .collect::<Vec<_>>();
+    while let Some(name) = pending.pop() {
+        if !live.insert(name) {
+            continue;
+        }
+        let Some(indices) = producers.get(name) else {
+            continue;
+        };
+        for i in indices {
+            let RenderSpec::Mix(mix) = &specs[*i] else {
+                continue;
+            };
+            pending.extend(mixed_inputs(mix).filter(|input| !live.contains(input)));
+        }
+    }
+
+    let mut order = Vec::with_capacity(specs.len());
+    let mut culled = 0;
+    let mut run = vec![];
+    for (i, spec) in specs.iter().enumerate() {
+        match spec {
+            RenderSpec::Mix(mix) => {
+                if live.contains(mix.name.as_str()) {
+                    run.push(i);
+                } else {
+                    culled += 1;
+                }
+            }
+            _ => {
+                sort_run(specs, &mut run, &mut order);
+                order.push(i);
+            }
+        }
+    }
+    sort_run(specs, &mut run, &mut order);
+
+    if culled == 0 && order.iter().enumerate().all(|(pos, i)| pos == *i) {
+        return 0;
+    }
+    let mut taken = specs.drain(..).map(Some).collect::<Vec<_>>();
+    specs.extend(order.into_iter().filter_map(|i| taken[i].take()));
+    culled
+}
+
+fn mixed_inputs(mix: &Mix) -> impl Iterator<Item = &str> {
+    mix.inputs.iter().filter_map(|input| match input {
+        MixInput::Mixed(name) => Some(name.as_str()),
+        MixInput::Video(_) => None,
+    })
+}
+
+// Topological sort of one run of mixes. Ties and cycles fall back to the
+// order the app sent them in, which also keeps feedback loops as they were.
+fn sort_run(specs: &[RenderSpec], run: &mut Vec<usize>, order: &mut Vec<usize>) {
+    while !run.is_empty() {
+        let names = run
+            .iter()
+            .filter_map(|i| match &specs[*i] {
+                RenderSpec::Mix(mix) => Some(mix.name.as_str()),
+                _ => None,
+            })
+            .collect::<HashSet<_>>();
+        let ready = run.iter().position(|i| {
+            let RenderSpec::Mix(mix) = &specs[*i] else {
+                return true;
+            };
+            mixed_inputs(mix).all(|input| input == mix.name || !names.contains(input))
+        });
+        order.push(run.remove(ready.unwrap_or(0)));
+    }
+}
@@ -174,6 +174,128 @@ impl SendCmdBuilder {
     }
 }
 
+/// How a CC value of 0..=127 maps onto a binding's min..max
+#[derive(Clone, Copy, Debug, Default, Serialize, Deserialize, PartialEq)]
+pub enum MidiCurve {
+    #[default]
+    Linear,
+    /// x^exponent, above 1 gives finer control at the low end
+    Power(f32),
+    /// min below 64, max from 64 up
+    Toggle,
+}
+
+/// Drives a float uniform of a mixer straight from a MIDI CC on the host,
+/// without going through calculate. Registered with
+/// `spec_engine::register_midi_bindings`.
+#[derive(Clone, Debug, Default, Serialize, Deserialize, PartialEq)]
+pub struct MidiBinding {
+    /// midir port name, empty matches every device
+    pub device: String,
+    /// None matches every channel
+    pub channel: Option<u8>,
+    pub cc: u8,
+    pub mixer: String,
+    /// A `//!VAR float` of the mixer's shader
+    pub var: String,
+    pub min: f32,
+    pub max: f32,
+    pub curve: MidiCurve,
+}
+
+impl MidiBinding {
+    pub fn builder() -> MidiBindingBuilder {
+        MidiBindingBuilder::new()
+    }
+
+    pub fn matches(&self, device: &str, channel: u8, cc: u8) -> bool {
+        self.cc == cc
+            && self.channel.map_or(true, |c| c == channel)
+            && (self.device.is_empty() || self.device == device)
+    }
+
+    /// The uniform value for a CC value
+    pub fn map(&self, value: u8) -> f32 {
+        let x = value.min(127) as f32 / 127.0;
+        let y = match self.curve {
+            MidiCurve::Linear => x,
+            MidiCurve::Power(exponent) => x.powf(exponent),
+            MidiCurve::Toggle => {
+                if value >= 64 {
+                    1.0
+                } else {
+                    0.0
+                }
+            }
+        };
+        self.min + (self.max - self.min) * y
+    }
+}
+
+pub struct MidiBindingBuilder {
+    obj: MidiBinding,
+}
+
+impl MidiBindingBuilder {
+    pub fn new() -> Self {
+        Self {
+            obj: MidiBinding {
+                max: 1.0,
+                ..Default::default()
+            },
+        }
+    }
+
+    pub fn device<T>(mut self, device: T) -> Self
+    where
+        T: ToString,
+    {
+        self.obj.device = device.to_string();
+        self
+    }
+
+    pub fn channel(mut self, channel: u8) -> Self {
+        self.obj.channel = Some(channel);
+        self
+    }
+
+    pub fn cc(mut self, cc: u8) -> Self {
+        self.obj.cc = cc;
+        self
+    }
+
+    pub fn mixer<T>(mut self, mixer: T) -> Self
+    where
+        T: ToString,
+    {
+        self.obj.mixer = mixer.to_string();
+        self
+    }
+
+    pub fn var<T>(mut self, var: T) -> Self
+    where
+        T: ToString,
+    {
+        self.obj.var = var.to_string();
+        self
+    }
+
+    pub fn range(mut self, min: f32, max: f32) -> Self {
+        self.obj.min = min;
+        self.obj.max = max;
+        self
+    }
+
+    pub fn curve(mut self, curve: MidiCurve) -> Self {
+        self.obj.curve = curve;
+        self
+    }
+
+    pub fn build(self) -> MidiBinding {
+        self.obj
+    }
+}
+
 #[derive(Clone, Debug, Default, Serialize, Deserialize)]
 #[repr(C)]
 pub struct HudText {
@@ -0,0 +1,272 @@
+use crate::{
+    gfxinfo::VidInfo,
+    vidthread::{open_input, return_input},
+};
+use anyhow::{bail, Result};
+use ffmpeg_next::{codec::packet::Packet, decoder, format::context::Input, frame::Video, Rational};
+use std::{
+    fmt::Debug,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex, Weak,
+    },
+    thread,
+};
+
+extern crate ffmpeg_next as ffmpeg;
+
+// Cue frames kept decoded per file, cue points past this are found by a
+// normal seek
+const MAX_CUE_FRAMES: usize = 8;
+
+/// A cue point decoded ahead of time
+pub struct CueFrame {
+    /// The seek target it was decoded for in stream time base units
+    pub target: i64,
+    pub frame: Video,
+}
+
+/// Key frame positions and cue frames for one file. Filled in on a background
+/// thread once the file has cue points or is first seeked; until then every
+/// lookup just misses.
+#[derive(Default)]
+pub struct SeekIndex {
+    started: AtomicBool,
+    keyframes: Mutex<Option<Vec<i64>>>,
+    cues: Mutex<Vec<CueFrame>>,
+}
+
+impl Debug for SeekIndex {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "keyframes: {:?}, cues: {:?}",
+            self.keyframes
+                .lock()
+                .ok()
+                .and_then(|k| k.as_ref().map(|k| k.len())),
+            self.cues.lock().map(|c| c.len()).unwrap_or(0),
+        )
+    }
+}
+
+impl SeekIndex {
+    /// Index `info` in the background, only the first call does anything.
+    /// The thread only holds a weak reference and gives up as soon as the
+    /// owning VidData is dropped.
+    pub fn start(self: &Arc<Self>, info: &VidInfo) {
+        // same rule as VidData::seek_vid, nothing else ever seeks
+        if info.realtime || !info.repeat {
+            return;
+        }
+        // every image of a sequence is a key frame, seeks go straight there
+        if info.image_sequence_fps > 0 {
+            return;
+        }
+        if self.started.swap(true, Ordering::Relaxed) {
+            return;
+        }
+        let weak = Arc::downgrade(self);
+        let info = info.clone();
+        let spawned = thread::Builder::new()
+            .name(format!("index-{}", info.name))
+            .spawn(move || {
+                if let Err(e) = build_index(&info, &weak) {
+                    eprintln!("Could not index {}: {}", info.name, e);
+                }
+            });
+        if let Err(e) = spawned {
+            eprintln!("Could not start indexing {}: {}", info.name, e);
+        }
+    }
+
+    /// The last key frame at or before `pts`, None until the index is built
+    pub fn keyframe_before(&self, pts: i64) -> Option<i64> {
+        let lock = self.keyframes.lock().ok()?;
+        let keyframes = lock.as_ref()?;
+        match keyframes.binary_search(&pts) {
+            Ok(i) => Some(keyframes[i]),
+            Err(0) => None,
+            Err(i) => Some(keyframes[i - 1]),
+        }
+    }
+
+    /// A new reference to the frame cached for a seek to within `slack` of `target`
+    pub fn cue_frame(&self, target: i64, slack: i64) -> Option<Video> {
+        let cues = self.cues.lock().ok()?;
+        let cue = cues.iter().find(|c| (c.target - target).abs() <= slack)?;
+        unsafe {
+            let frame = ffmpeg_next::ffi::av_frame_clone(cue.frame.as_ptr());
+            if frame.is_null() {
+                return None;
+            }
+            Some(Video::wrap(frame))
+        }
+    }
+}
+
+fn build_index(info: &VidInfo, weak: &Weak<SeekIndex>) -> Result<()> {
+    // a background job, it shouldn't take cores from the decks playing
+    let (mut ictx, mut decoder, params) = open_input(info, 1)?;
+    let video_stream_index = params.video_stream_index;
+
+    // most containers come with an index, only scan packets when there's none
+    let mut keyframes = container_keyframes(&ictx, video_stream_index);
+    if keyframes.is_empty() {
+        keyframes = scan_keyframes(&mut ictx, video_stream_index, weak)?;
+    }
+    keyframes.sort_unstable();
+    keyframes.dedup();
+    let Some(index) = weak.upgrade() else {
+        return Ok(());
+    };
+    index.keyframes.lock().unwrap().replace(keyframes);
+    drop(index);
+
+    let time_base: Rational = info.timebase_q.into();
+    if time_base <= Rational::new(0, 1) {
+        return Ok(());
+    }
+    // same tolerance seek_vid uses for landing near the target
+    let slack = f64::from(time_base.invert() * Rational::new(1, 20)) as i64;
+    if info.cue_points_ms.len() > MAX_CUE_FRAMES {
+        eprintln!(
+            "{} has {} cue points, only the first {} are decoded ahead",
+            info.name,
+            info.cue_points_ms.len(),
+            MAX_CUE_FRAMES
+        );
+    }
+    for ms in info.cue_points_ms.iter().take(MAX_CUE_FRAMES) {
+        let target = (*ms as f64 / 1000.0 / f64::from(time_base)) as i64;
+        let frame = decode_at(
+            &mut ictx,
+            &mut decoder,
+            video_stream_index,
+            target,
+            target - slack,
+        )?;
+        let Some(index) = weak.upgrade() else {
+            return Ok(());
+        };
+        if let Some(frame) = frame.and_then(to_software) {
+            index.cues.lock().unwrap().push(CueFrame { target, frame });
+        }
+    }
+    // the decode thread usually opens the same file next
+    return_input(info, 1, ictx, decoder, params);
+    Ok(())
+}
+
+// A cue is kept for the life of the input, so a hardware frame is copied out
+// rather than holding on to one of the decoder's surfaces
+fn to_software(frame: Video) -> Option<Video> {
+    unsafe {
+        if (*frame.as_ptr()).hw_frames_ctx.is_null() {
+            return Some(frame);
+        }
+        let mut sw = Video::empty();
+        if ffmpeg_next::ffi::av_hwframe_transfer_data(sw.as_mut_ptr(), frame.as_ptr(), 0) < 0
+            || ffmpeg_next::ffi::av_frame_copy_props(sw.as_mut_ptr(), frame.as_ptr()) < 0
+        {
+            return None;
+        }
+        Some(sw)
+    }
+}
+
+fn container_keyframes(ictx: &Input, video_stream_index: usize) -> Vec<i64> {
+    let mut keyframes = vec![];
+    let Some(stream) = ictx.stream(video_stream_index) else {
+        return keyframes;
+    };
+    unsafe {
+        let stream = stream.as_ptr() as *mut ffmpeg_next::ffi::AVStream;
+        let count = ffmpeg_next::ffi::avformat_index_get_entries_count(stream);
+        for i in 0..count {
+            let entry = ffmpeg_next::ffi::avformat_index_get_entry(stream, i);
+            if entry.is_null() {
+                continue;
+            }
+            if (*entry).flags() & ffmpeg_next::ffi::AVINDEX_KEYFRAME as i32 != 0 {
+                keyframes.push((*entry).timestamp);
+            }
+        }
+    }
+    keyframes
+}
+
+fn scan_keyframes(
+    ictx: &mut Input,
+    video_stream_index: usize,
+    weak: &Weak<SeekIndex>,
+) -> Result<Vec<i64>> {
+    let mut keyframes = vec![];
+    let mut count = 0usize;
+    loop {
+        let mut packet = Packet::empty();
+        match packet.read(ictx) {
+            Ok(()) => (),
+            Err(ffmpeg_next::Error::Eof) => break,
+            Err(e) => bail!("error reading packet {}:{}: {e}", file!(), line!()),
+        }
+        if packet.stream() == video_stream_index && packet.is_key() {
+            if let Some(pts) = packet.pts().or(packet.dts()) {
+                keyframes.push(pts);
+            }
+        }
+        count += 1;
+        if count % 1024 == 0 && weak.strong_count() == 0 {
+            break;
+        }
+    }
+    Ok(keyframes)
+}
+
+/// Decode the first frame at or after `min_pts`, or the last one in the file
+fn decode_at(
+    ictx: &mut Input,
+    decoder: &mut decoder::Video,
+    video_stream_index: usize,
+    target: i64,
+    min_pts: i64,
+) -> Result<Option<Video>> {
+    if let Err(e) = ictx.seek_stream(video_stream_index as i32, target, 0..target) {
+        bail!("Error seeking {}:{}: {e}", file!(), line!());
+    }
+    decoder.flush();
+    let mut last = None;
+    loop {
+        let mut frame = Video::empty();
+        match decoder.receive_frame(&mut frame) {
+            Ok(()) => {
+                if frame.pts().map_or(true, |pts| pts >= min_pts) {
+                    return Ok(Some(frame));
+                }
+                last = Some(frame);
+                continue;
+            }
+            Err(ffmpeg_next::Error::Other {
+                errno: ffmpeg_next::ffi::EAGAIN,
+            }) => (),
+            Err(ffmpeg_next::Error::Eof) => return Ok(last),
+            Err(e) => bail!("Error receiving frame {}:{}: {e}", file!(), line!()),
+        }
+
+        let mut packet = Packet::empty();
+        match packet.read(ictx) {
+            Ok(()) => {
+                if packet.stream() != video_stream_index {
+                    continue;
+                }
+                if let Err(e) = decoder.send_packet(&packet) {
+                    bail!("error sending packet {}:{}: {e}", file!(), line!());
+                }
+            }
+            Err(ffmpeg_next::Error::Eof) => {
+                decoder.send_eof().ok();
+            }
+            Err(e) => bail!("error reading packet {}:{}: {e}", file!(), line!()),
+        }
+    }
+}
@@ -7,7 +7,8 @@ use std::{
 
 use crate::{
     gfxinfo::{Asset, GfxEvent, GfxInfo},
-    renderspec::{RenderCalcErr, RenderSpec},
+    renderspec::{MidiBinding, RenderCalcErr, RenderSpec},
+    wirecodec::{WireDecoder, WireEncoder},
 };
 use serde_json;
 
@@ -21,6 +22,8 @@ unsafe extern "C" {
     fn gfx_info_serialized_size() -> u32;
     fn recv_reg_events(ptr: u32);
     fn reg_events_serialized_size() -> u32;
+    fn send_specs(ptr: u32, len: u32);
+    fn send_midi_bindings(ptr: u32, len: u32);
 }
 
 extern "Rust" {
@@ -40,6 +43,18 @@ extern "Rust" {
 static INITIALIZE: Once = Once::new();
 static GFX_INFO: Mutex<Option<HashMap<String, GfxInfo>>> = Mutex::new(None);
 
+/// State for the binary transport, kept across frames so the name tables stay
+/// in sync with the host and the buffers are reused
+struct Wire {
+    decoder: WireDecoder,
+    encoder: WireEncoder,
+    events_buf: Vec<u8>,
+    events: Vec<GfxEvent>,
+    specs_buf: Vec<u8>,
+}
+
+static WIRE: Mutex<Option<Wire>> = Mutex::new(None);
+
 #[no_mangle]
 pub extern "C" fn asset_list_internal(fps: i64) -> u32 {
     let asset_list = unsafe { asset_list(fps) };
@@ -100,6 +115,81 @@ pub extern "C" fn calculate_internal(canvas_w: u32, canvas_h: u32, frame: i64, f
     }
 }
 
+/// Same as `calculate_internal` but events come in and specs go out in the
+/// `wirecodec` binary format, the host prefers this one when it is exported
+#[no_mangle]
+pub extern "C" fn calculate_bin_internal(
+    canvas_w: u32,
+    canvas_h: u32,
+    frame: i64,
+    fps: i64,
+) -> u32 {
+    INITIALIZE.call_once(|| {
+        init_gfx_info();
+    });
+
+    let mut lock = WIRE.lock().unwrap();
+    let wire = lock.get_or_insert_with(|| Wire {
+        decoder: WireDecoder::new(),
+        encoder: WireEncoder::new(),
+        events_buf: vec![],
+        events: vec![],
+        specs_buf: vec![],
+    });
+
+    let sz = unsafe { reg_events_serialized_size() } as usize;
+    wire.events_buf.resize(sz, 0u8);
+    unsafe { recv_reg_events(wire.events_buf.as_mut_ptr() as u32) }
+    wire.events.clear();
+    if let Err(e) = wire
+        .decoder
+        .decode_events(wire.events_buf.as_slice(), &mut wire.events)
+    {
+        eprintln!("Error decoding reg events: {}", e);
+        return RenderCalcErr::Unknown as u32;
+    }
+    // the host starts a new epoch when anything went wrong on either side,
+    // the specs going back start over with it
+    if wire.decoder.take_new_epoch() {
+        wire.encoder.reset();
+    }
+
+    match unsafe {
+        calculate(
+            canvas_w,
+            canvas_h,
+            frame,
+            fps,
+            GFX_INFO.lock().unwrap().as_ref().unwrap(),
+            &wire.events,
+        )
+    } {
+        Ok(specs) => {
+            wire.encoder.encode_specs(&specs, &mut wire.specs_buf);
+            unsafe { send_specs(wire.specs_buf.as_ptr() as u32, wire.specs_buf.len() as u32) };
+            RenderCalcErr::None as u32
+        }
+        Err(e) => {
+            eprintln!(
+                "Error calculating {} {} {}: {}",
+                canvas_w, canvas_h, frame, e
+            );
+            RenderCalcErr::Unknown as u32
+        }
+    }
+}
+
+/// Hand the host a table of MIDI CC to uniform bindings, replacing any earlier
+/// one. Bound CCs move their uniforms on the host as soon as they arrive, so
+/// register once (asset_list is a good place) instead of turning CCs into
+/// SendCmds in calculate. The events still show up in reg_events.
+pub fn register_midi_bindings(bindings: &[MidiBinding]) {
+    match serde_json::to_vec(bindings) {
+        Ok(v) => unsafe { send_midi_bindings(v.as_ptr() as u32, v.len() as u32) },
+        Err(e) => eprintln!("Err serializing midi bindings {:?}", e),
+    }
+}
+
 fn init_gfx_info() {
     let mut lock = GFX_INFO.lock().unwrap();
     let sz = unsafe { gfx_info_serialized_size() } as usize;
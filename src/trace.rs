@@ -0,0 +1,262 @@
+use std::{
+    cell::Cell,
+    collections::{HashMap, VecDeque},
+    fmt::Write as _,
+    fs::File,
+    io::{BufWriter, Write},
+    path::Path,
+    sync::{
+        atomic::{AtomicBool, AtomicU64, Ordering},
+        Mutex,
+    },
+    time::Instant,
+};
+
+use anyhow::{Context, Result};
+use lazy_static::lazy_static;
+
+use crate::gfxinfo::GpuMemoryEvent;
+
+/// Frames the per mixer stats roll over
+const STATS_WINDOW: usize = 120;
+
+lazy_static! {
+    static ref TRACE_FILE: Mutex<Option<BufWriter<File>>> = Mutex::new(None);
+    static ref STATS: Mutex<HashMap<String, MixStats>> = Mutex::new(HashMap::new());
+    static ref EPOCH: Instant = Instant::now();
+}
+
+static TRACING: AtomicBool = AtomicBool::new(false);
+static STATS_ON: AtomicBool = AtomicBool::new(false);
+static NEXT_TID: AtomicU64 = AtomicU64::new(1);
+
+thread_local! {
+    static TID: Cell<u64> = const { Cell::new(0) };
+}
+
+/// Record spans and GPU pass times to `path` in the Chrome trace event format,
+/// which chrome://tracing and ui.perfetto.dev both open
+pub fn start<P: AsRef<Path>>(path: P) -> Result<()> {
+    let file = File::create(path.as_ref())
+        .with_context(|| format!("Could not create trace file {:?}", path.as_ref()))?;
+    let mut out = BufWriter::new(file);
+    // the closing bracket is optional in this format, so a crash still leaves
+    // a readable trace
+    out.write_all(b"[\n")?;
+    TRACE_FILE.lock().unwrap().replace(out);
+    TRACING.store(true, Ordering::Release);
+    Ok(())
+}
+
+/// Keep the rolling per mixer stats behind `stats_table`
+pub fn enable_stats() {
+    STATS_ON.store(true, Ordering::Release);
+}
+
+/// Whether anything is collected at all, nothing should be measured otherwise
+pub fn enabled() -> bool {
+    TRACING.load(Ordering::Acquire) || STATS_ON.load(Ordering::Acquire)
+}
+
+pub fn flush() {
+    if !TRACING.load(Ordering::Acquire) {
+        return;
+    }
+    if let Some(out) = TRACE_FILE.lock().unwrap().as_mut() {
+        out.flush().ok();
+    }
+}
+
+/// Measures the CPU time until it is dropped
+pub struct Span {
+    start: Option<(Instant, String)>,
+    cat: &'static str,
+    mix_stats: bool,
+}
+
+impl Drop for Span {
+    fn drop(&mut self) {
+        let Some((start, name)) = self.start.take() else {
+            return;
+        };
+        let dur = start.elapsed();
+        if self.mix_stats && STATS_ON.load(Ordering::Acquire) {
+            let mut stats = STATS.lock().unwrap();
+            let entry = stats.entry(name.clone()).or_default();
+            entry.cpu.push(dur.as_secs_f64() * 1000.0);
+        }
+        if TRACING.load(Ordering::Acquire) {
+            let ts = start.duration_since(*EPOCH).as_secs_f64() * 1e6;
+            write_event(&format!(
+                r#"{{"ph":"X","cat":"{}","name":{},"ts":{:.3},"dur":{:.3},"pid":1,"tid":{}}}"#,
+                self.cat,
+                quote(&name),
+                ts,
+                dur.as_secs_f64() * 1e6,
+                tid(),
+            ));
+        }
+    }
+}
+
+pub fn span<S: AsRef<str>>(cat: &'static str, name: S) -> Span {
+    Span {
+        start: if TRACING.load(Ordering::Acquire) {
+            Some((Instant::now(), name.as_ref().to_string()))
+        } else {
+            None
+        },
+        cat,
+        mix_stats: false,
+    }
+}
+
+/// Span around one mixer's work for a frame, also feeds the stats table
+pub fn mix_span<S: AsRef<str>>(mixer: S) -> Span {
+    Span {
+        start: if enabled() {
+            Some((Instant::now(), mixer.as_ref().to_string()))
+        } else {
+            None
+        },
+        cat: "mix",
+        mix_stats: true,
+    }
+}
+
+/// A GPU timer result for one dispatch, run `run` of a mixer covering passes
+/// first..=last when pointwise passes were fused into it. These arrive a few
+/// frames after the dispatch, so they are traced as a counter per mixer
+/// rather than a span.
+pub fn gpu_pass(mixer: &str, run: usize, first: usize, last: usize, ns: u64) {
+    let ms = ns as f64 / 1e6;
+    let label = if first == last {
+        format!("pass{}", first)
+    } else {
+        format!("pass{}-{}", first, last)
+    };
+    if STATS_ON.load(Ordering::Acquire) {
+        let mut stats = STATS.lock().unwrap();
+        let entry = stats.entry(mixer.to_string()).or_default();
+        if entry.gpu.len() <= run {
+            entry.gpu.resize_with(run + 1, Default::default);
+        }
+        entry.gpu[run].0 = label.clone();
+        entry.gpu[run].1.push(ms);
+    }
+    if TRACING.load(Ordering::Acquire) {
+        let ts = EPOCH.elapsed().as_secs_f64() * 1e6;
+        write_event(&format!(
+            r#"{{"ph":"C","cat":"gpu","name":{},"ts":{:.3},"pid":1,"args":{{{}:{:.3}}}}}"#,
+            quote(&format!("gpu {}", mixer)),
+            ts,
+            quote(&label),
+            ms,
+        ));
+    }
+}
+
+/// VRAM held by mixers, the texture pool and videos, as a MiB counter
+pub fn gpu_memory(memory: &GpuMemoryEvent) {
+    if !TRACING.load(Ordering::Acquire) {
+        return;
+    }
+    let mib = |bytes: u64| bytes as f64 / (1 << 20) as f64;
+    let ts = EPOCH.elapsed().as_secs_f64() * 1e6;
+    write_event(&format!(
+        r#"{{"ph":"C","cat":"gpu","name":"vram","ts":{:.3},"pid":1,"args":{{"mixers":{:.1},"idle":{:.1},"videos":{:.1}}}}}"#,
+        ts,
+        mib(memory.mixer_bytes),
+        mib(memory.idle_bytes),
+        mib(memory.video_bytes),
+    ));
+}
+
+/// CPU and per pass GPU times in ms over the last `STATS_WINDOW` frames
+pub fn stats_table() -> String {
+    let stats = STATS.lock().unwrap();
+    let mut names = stats.keys().collect::<Vec<_>>();
+    names.sort();
+    let mut table = String::new();
+    writeln!(
+        &mut table,
+        "{:<24} {:>9} {:>9}  gpu avg/max per dispatch",
+        "mixer", "cpu avg", "cpu max"
+    )
+    .ok();
+    for name in names {
+        let entry = &stats[name];
+        write!(
+            &mut table,
+            "{:<24} {:>9.3} {:>9.3} ",
+            name,
+            entry.cpu.avg(),
+            entry.cpu.max()
+        )
+        .ok();
+        for (label, run) in entry.gpu.iter() {
+            write!(&mut table, " {}={:.3}/{:.3}", label, run.avg(), run.max()).ok();
+        }
+        table.push('\n');
+    }
+    table
+}
+
+#[derive(Default)]
+struct MixStats {
+    cpu: Rolling,
+    // per dispatch, labelled with the passes it ran
+    gpu: Vec<(String, Rolling)>,
+}
+
+#[derive(Default)]
+struct Rolling {
+    samples: VecDeque<f64>,
+}
+
+impl Rolling {
+    fn push(&mut self, v: f64) {
+        if self.samples.len() == STATS_WINDOW {
+            self.samples.pop_front();
+        }
+        self.samples.push_back(v);
+    }
+
+    fn avg(&self) -> f64 {
+        if self.samples.is_empty() {
+            return 0.0;
+        }
+        self.samples.iter().sum::<f64>() / self.samples.len() as f64
+    }
+
+    fn max(&self) -> f64 {
+        self.samples.iter().cloned().fold(0.0, f64::max)
+    }
+}
+
+fn quote(s: &str) -> String {
+    serde_json::to_string(s).unwrap_or_else(|_| String::from("\"?\""))
+}
+
+fn tid() -> u64 {
+    TID.with(|tid| {
+        if tid.get() == 0 {
+            tid.set(NEXT_TID.fetch_add(1, Ordering::Relaxed));
+            let current = std::thread::current();
+            let name = current.name().unwrap_or("unnamed");
+            write_event(&format!(
+                r#"{{"ph":"M","name":"thread_name","pid":1,"tid":{},"args":{{"name":{}}}}}"#,
+                tid.get(),
+                quote(name),
+            ));
+        }
+        tid.get()
+    })
+}
+
+fn write_event(event: &str) {
+    if let Some(out) = TRACE_FILE.lock().unwrap().as_mut() {
+        out.write_all(event.as_bytes()).ok();
+        out.write_all(b",\n").ok();
+    }
+}
@@ -1,44 +1,62 @@
 use crate::{
     gfx_lowlevel::bindings::{
-        gfx_lowlevel_filter_params, gfx_lowlevel_frame_clear, gfx_lowlevel_frame_copy,
-        gfx_lowlevel_frame_create_texture, gfx_lowlevel_frame_ctx, gfx_lowlevel_frame_ctx_destroy,
-        gfx_lowlevel_frame_ctx_init, gfx_lowlevel_gpu_ctx, gfx_lowlevel_gpu_ctx_render,
-        gfx_lowlevel_lut, gfx_lowlevel_map_frame_ctx, gfx_lowlevel_mix_ctx,
-        gfx_lowlevel_mix_ctx_destroy, gfx_lowlevel_mix_ctx_init, gfx_lowlevel_reset_dispatch,
-        pl_frame, pl_rect2df, pl_shader_var, pl_var, pl_var_type_PL_VAR_FLOAT,
-        pl_var_type_PL_VAR_SINT, pl_var_type_PL_VAR_UINT,
+        gfx_lowlevel_compute_limits, gfx_lowlevel_filter_params, gfx_lowlevel_frame_blit_scaled,
+        gfx_lowlevel_frame_clear, gfx_lowlevel_frame_create_texture_fmt, gfx_lowlevel_frame_ctx,
+        gfx_lowlevel_frame_ctx_destroy, gfx_lowlevel_frame_ctx_init, gfx_lowlevel_gpu_ctx,
+        gfx_lowlevel_gpu_ctx_compute_limits, gfx_lowlevel_gpu_ctx_render, gfx_lowlevel_lut,
+        gfx_lowlevel_map_frame_ctx, gfx_lowlevel_mix_ctx, gfx_lowlevel_mix_ctx_destroy,
+        gfx_lowlevel_mix_ctx_find_var, gfx_lowlevel_mix_ctx_init, gfx_lowlevel_mix_ctx_reserve_var,
+        gfx_lowlevel_mix_ctx_set_consts, gfx_lowlevel_reset_dispatch, gfx_lowlevel_shader_stats,
+        gfx_lowlevel_storage, gfx_lowlevel_storage_clear, gfx_lowlevel_storage_create,
+        gfx_lowlevel_storage_destroy, gfx_lowlevel_storage_read_next,
+        gfx_lowlevel_storage_read_start, gfx_lowlevel_timer, gfx_lowlevel_timer_create,
+        gfx_lowlevel_timer_destroy, gfx_lowlevel_timer_poll, pl_frame, pl_rect2df, pl_shader_var,
+        pl_var, pl_var_type_PL_VAR_FLOAT, pl_var_type_PL_VAR_SINT, pl_var_type_PL_VAR_UINT,
+        GFX_EAGAIN,
     },
-    gfxinfo::{Vid, VidInfo, VidMixerInfo},
+    gfxinfo::{StorageEvent, Vid, VidInfo, VidMixerInfo},
     glob::glob,
+    imgseq::{probe, sequence_paths},
     renderspec::{CopyEx, SendCmd, SendValue},
+    seekindex::SeekIndex,
+    trace,
+    vidthread::{DecodeItem, DecodeThread, LoadedDeck},
 };
 use anyhow::{bail, Context as AnyhowContext, Error, Result};
 use ffmpeg_next::ffi::{AVCodecContext, AVPixelFormat};
 use ffmpeg_next::{
-    decoder,
-    format::{context::Input, input_with_decoder_format},
-    frame::Video,
-    media::Type,
-    Rational,
+    decoder, format::input_with_decoder_format, frame::Video, media::Type, Rational,
 };
 
 use std::{
-    cell::RefCell,
+    cell::{Cell, RefCell},
+    collections::{HashMap, HashSet},
     ffi::{CStr, CString},
-    fmt::Debug,
+    fmt::{Debug, Write as _},
     i32,
     iter::repeat_with,
     sync::Arc,
+    time::{Duration, Instant},
     usize,
 };
 
 use regex;
 extern crate ffmpeg_next as ffmpeg;
 
+// Distinct values a //!CONST may take before it's reported as driven by
+// something continuous, every one of them is another compiled shader
+const CONST_VARIANTS_WARN: usize = 16;
+
 #[derive(Debug)]
 pub struct VidData {
     pub info: VidInfo,
     pub vid_input: RefCell<Option<VidInput>>,
+    pub seek_index: Arc<SeekIndex>,
+    /// Frame number a mixer last advanced this video for, other mixers reading
+    /// it in the same frame reuse that frame instead of decoding again
+    pub advanced_on: Cell<Option<i64>>,
+    // counts this video towards the decks sharing the cores while loaded
+    _deck: LoadedDeck,
 }
 
 #[derive(Debug)]
@@ -69,27 +87,86 @@ impl Drop for WrapMixCtx {
     }
 }
 
+#[derive(Debug)]
+pub struct WrapTimer(*mut gfx_lowlevel_timer);
+unsafe impl Send for WrapTimer {}
+impl Drop for WrapTimer {
+    fn drop(&mut self) {
+        unsafe {
+            gfx_lowlevel_timer_destroy(&mut self.0 as _);
+        }
+    }
+}
+
+pub struct WrapStorage {
+    pub name: String,
+    pub count: usize,
+    storage: *mut gfx_lowlevel_storage,
+}
+unsafe impl Send for WrapStorage {}
+impl Drop for WrapStorage {
+    fn drop(&mut self) {
+        unsafe {
+            gfx_lowlevel_storage_destroy(&mut self.storage as _);
+        }
+    }
+}
+
 pub struct VidInput {
-    pub ictx: Input,
+    pub decode_thread: DecodeThread,
     pub video_stream_index: usize,
-    pub decoder: decoder::Video,
     pub time_base: Rational,
     pub duration_tbu: Rational,
-    pub last_frame: Arc<WrapFrame>, //todo add a double buffer here to try and remove the need for the gpu sync in the lowlevel code
+    pub last_frame: Arc<WrapFrame>,
+    /// Holds the upload of `prefetched` until decode_frame swaps it in
+    pub prefetch_frame: Option<Arc<WrapFrame>>,
+    pub prefetched: Option<DecodeItem>,
     pub last_frame_pts: i64,
     pub last_frame_duration: i64,
     pub last_real_pts: Option<Rational>,
     pub continuous_pts: Rational,
     pub fps: Rational,
+    pub eof: bool,
+    /// A cue frame is showing while the decode thread pre-rolls to the frame
+    /// after it, decode_frame keeps it up instead of waiting on the ring
+    pub holding_cue: bool,
+}
+
+impl VidInput {
+    /// Move the clocks on to `frame` and hand it to the GPU, `uploaded` frames
+    /// are already in prefetch_frame
+    fn advance(
+        &mut self,
+        frame: &mut Video,
+        last_real_pts: Rational,
+        delta: Rational,
+        uploaded: bool,
+        lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx,
+    ) {
+        self.last_real_pts = Some(last_real_pts);
+        self.continuous_pts = self.continuous_pts + delta;
+        self.last_frame_pts = frame.pts().unwrap();
+        self.last_frame_duration = frame.packet().duration;
+        if uploaded {
+            if let Some(prefetch_frame) = self.prefetch_frame.as_mut() {
+                std::mem::swap(&mut self.last_frame, prefetch_frame);
+                return;
+            }
+        }
+        let _span = trace::span("map_frame", "gfx_lowlevel_map_frame_ctx");
+        unsafe {
+            gfx_lowlevel_map_frame_ctx(lowlevel_ctx, self.last_frame.0, frame.as_mut_ptr() as _);
+        }
+    }
 }
 
 impl Debug for VidInput {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
         write!(
             f,
-            "idx: {:?}, decoder: {:?}, time_base {:?}, duration: {:?}, last_frame.is_empty: {}",
+            "idx: {:?}, buffered: {:?}, time_base {:?}, duration: {:?}, last_frame.is_empty: {}",
             self.video_stream_index,
-            self.decoder.id(),
+            self.decode_thread.buffered(),
             self.time_base,
             self.duration_tbu,
             self.last_frame.0 as u64,
@@ -97,7 +174,7 @@ impl Debug for VidInput {
     }
 }
 
-unsafe extern "C" fn get_hw_format(
+pub(crate) unsafe extern "C" fn get_hw_format(
     _ctx: *mut AVCodecContext,
     mut pix_fmts: *const AVPixelFormat,
 ) -> AVPixelFormat {
@@ -113,6 +190,10 @@ unsafe extern "C" fn get_hw_format(
 
 impl VidData {
     pub fn load(spec: &Vid) -> Result<VidData> {
+        if spec.image_sequence_fps > 0 {
+            return Self::load_sequence(spec);
+        }
+
         let mut paths = vec![];
 
         paths.extend(glob(&spec.path).unwrap_or_else(|| {
@@ -187,23 +268,77 @@ impl VidData {
             spec
         );
 
-        Ok(VidData {
-            info: VidInfo {
-                name: spec.name.clone(),
-                path,
-                repeat: spec.repeat,
-                codec: spec.codec.clone(),
-                format: spec.format.clone(),
-                opts: spec.opts.clone(),
-                size: (decoder.width(), decoder.height()),
-                duration_tbu_q,
-                timebase_q,
-                realtime: spec.realtime,
-                hardware_decode: spec.hardware_decode,
-                software_filter: spec.software_filter,
-            },
+        Ok(Self::loaded(
+            spec,
+            path,
+            (decoder.width(), decoder.height()),
+            duration_tbu_q,
+            timebase_q,
+        ))
+    }
+
+    // Every file the glob matches is one frame, the path stays the glob so the
+    // decode thread can list them again
+    fn load_sequence(spec: &Vid) -> Result<VidData> {
+        if spec.realtime {
+            bail!("Image sequence {} can't be realtime", spec.name);
+        }
+        let paths = sequence_paths(&spec.path);
+        let Some(first) = paths.first() else {
+            bail!("Nothing loaded for {}", spec.name);
+        };
+        let size = match probe(first, spec.codec.as_deref()) {
+            Ok(size) => size,
+            Err(e) => bail!("Could not open {} of {}: {}", first, spec.name, e),
+        };
+        Ok(Self::loaded(
+            spec,
+            spec.path.clone(),
+            size,
+            (paths.len() as i32, 1),
+            (1, spec.image_sequence_fps as i32),
+        ))
+    }
+
+    fn loaded(
+        spec: &Vid,
+        path: String,
+        size: (u32, u32),
+        duration_tbu_q: (i32, i32),
+        timebase_q: (i32, i32),
+    ) -> VidData {
+        let info = VidInfo {
+            name: spec.name.clone(),
+            path,
+            repeat: spec.repeat,
+            codec: spec.codec.clone(),
+            format: spec.format.clone(),
+            opts: spec.opts.clone(),
+            size,
+            duration_tbu_q,
+            timebase_q,
+            realtime: spec.realtime,
+            hardware_decode: spec.hardware_decode,
+            software_filter: spec.software_filter,
+            gpu_convert: spec.gpu_convert,
+            decode_ahead: spec.decode_ahead,
+            cue_points_ms: spec.cue_points_ms.clone(),
+            image_sequence_fps: spec.image_sequence_fps,
+            decode_threading: spec.decode_threading,
+            decode_threads: spec.decode_threads,
+        };
+        let vid_data = VidData {
+            _deck: LoadedDeck::new(&info),
+            info,
             vid_input: RefCell::new(None),
-        })
+            seek_index: Arc::new(SeekIndex::default()),
+            advanced_on: Cell::new(None),
+        };
+        // cues are decoded ahead, anything else is indexed on its first seek
+        if !vid_data.info.cue_points_ms.is_empty() {
+            vid_data.seek_index.start(&vid_data.info);
+        }
+        vid_data
     }
 
     pub fn prepare(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
@@ -213,91 +348,49 @@ impl VidData {
             return Ok(());
         }
 
-        let path = self.info.path.clone();
-        let decoder_name = self.info.codec.as_ref().map(|s| s.as_str());
-        let format_name = self.info.format.as_ref().map(|s| s.as_str());
-        let ictx = match input_with_decoder_format(
-            &path,
-            decoder_name,
-            format_name,
-            self.info.opts.as_ref().map(|v| v.as_slice()),
-        ) {
-            Ok(ictx) => ictx,
-            Err(e) => bail!(
-                "Could not preload {} with decoder {:?} and fmt {:?}: {}",
-                path,
-                decoder_name,
-                format_name,
-                e
-            ),
-        };
-
-        let input = ictx
-            .streams()
-            .best(Type::Video)
-            .ok_or(ffmpeg::Error::StreamNotFound)?;
-
-        let video_stream_index = input.index();
-
-        let mut context_decoder = get_codec_context(decoder_name, input.parameters())?;
-        if self.info.hardware_decode {
-            unsafe {
-                let mut hw_device_ctx: *mut ffmpeg_next::ffi::AVBufferRef = std::ptr::null_mut();
-
-                // Set the hw_device_ctx
-                if ffmpeg_next::ffi::av_hwdevice_ctx_create(
-                    &mut hw_device_ctx as *mut *mut ffmpeg_next::ffi::AVBufferRef,
-                    ffmpeg_next::ffi::AVHWDeviceType::AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
-                    std::ptr::null_mut(),
-                    std::ptr::null_mut(),
-                    0,
-                ) < 0
-                {
-                    bail!("Could not create hwdevice context")
-                }
-
-                (*context_decoder.as_mut_ptr()).hw_device_ctx =
-                    ffmpeg_next::ffi::av_buffer_ref(hw_device_ctx);
-                (*context_decoder.as_mut_ptr()).get_format = Some(get_hw_format);
-            }
-        }
-        let decoder = context_decoder.decoder().video()?;
-
-        let Some(stream) = ictx.stream(video_stream_index) else {
-            bail!("Could not find video stream");
-        };
+        // demux and decode happen on the decode thread, only mapping stays here
+        let decode_thread =
+            DecodeThread::spawn(&self.info, self.info.decode_ahead, self.seek_index.clone())
+                .with_context(|| format!("error starting decoder for {}", self.info.name))?;
+        let video_stream_index = decode_thread.params.video_stream_index;
+        let fps = decode_thread.params.fps;
 
         let duration: Rational = self.info.duration_tbu_q.into();
         let time_base: Rational = self.info.timebase_q.into();
-        let fps = if stream.rate() > Rational::new(0, 1) {
-            stream.rate()
-        } else if stream.avg_frame_rate() > Rational::new(0, 1) {
-            stream.avg_frame_rate()
-        } else {
-            panic!(
-                "Unable to get fps for {} {}",
-                self.info.name, self.info.path
-            )
-        };
+
+        let last_frame = WrapFrame::new(lowlevel_ctx);
+        if last_frame.0.is_null() {
+            bail!("Failed to allocate frame for {}", self.info.name);
+        }
+        // hardware frames are imported straight from their IOSurface when possible
+        unsafe {
+            (*last_frame.0).hw_interop = self.info.hardware_decode;
+            (*last_frame.0).gpu_convert = self.info.gpu_convert;
+            (*last_frame.0).convert_threads = decode_thread.threads() as i32;
+        }
 
         vid_input.replace(VidInput {
-            ictx,
+            decode_thread,
             video_stream_index,
-            decoder,
             duration_tbu: duration,
             time_base,
-            last_frame: Arc::new(WrapFrame::new(lowlevel_ctx)),
+            last_frame: Arc::new(last_frame),
+            prefetch_frame: None,
+            prefetched: None,
             last_frame_pts: 0,
             last_frame_duration: 0,
             last_real_pts: None,
             continuous_pts: Rational::new(0, 1),
             fps,
+            eof: false,
+            holding_cue: false,
         });
 
         Ok(())
     }
 
     pub fn decode_frame(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
+        let _span = trace::span("decode", &self.info.name);
         self.prepare(lowlevel_ctx)
             .with_context(|| format!("error preparing {}:{}", file!(), line!()))?;
         let mut borrowed = self.vid_input.borrow_mut();
@@ -305,82 +398,68 @@ impl VidData {
             bail!("Stream not set after prepre {:?}", self);
         };
 
-        //read from stream
-        let mut error_counter = 0;
-        loop {
-            for (stream, packet) in vid_input.ictx.packets() {
-                if stream.index() == vid_input.video_stream_index {
-                    vid_input
-                        .decoder
-                        .send_packet(&packet)
-                        .with_context(|| format!("error sending packet {}:{}", file!(), line!()))?;
-                    let mut next_decoded = Video::empty();
-                    let last_real_pts;
-                    match vid_input.decoder.receive_frame(&mut next_decoded) {
-                        Ok(()) => {
-                            let delta = if self.info.realtime {
-                                // go off of timestamps on frames
-                                if vid_input.last_frame_duration > 0 {
-                                    let delta =
-                                        next_decoded.pts().unwrap() - vid_input.last_frame_pts;
-                                    unsafe { (*next_decoded.as_mut_ptr()).duration = delta };
-                                    last_real_pts = vid_input.continuous_pts;
-                                    next_decoded
-                                        .set_pts(Some(f64::from(vid_input.continuous_pts) as i64));
-                                    Rational::new(delta as i32, 1)
-                                } else {
-                                    eprintln!("Skip a frame to get a duration....");
-                                    vid_input.last_frame_pts = next_decoded.pts().unwrap();
-                                    vid_input.last_frame_duration = next_decoded.packet().duration;
-                                    continue;
-                                }
-                            } else {
-                                last_real_pts = if let Some(pts) = next_decoded.pts() {
-                                    Rational::new(pts as i32, 1)
-                                } else {
-                                    vid_input.continuous_pts
-                                };
-                                next_decoded
-                                    .set_pts(Some(f64::from(vid_input.continuous_pts) as i64));
-                                Rational::new(next_decoded.packet().duration as i32, 1)
-                            };
-                            vid_input.last_real_pts = Some(last_real_pts);
-                            vid_input.continuous_pts = vid_input.continuous_pts + delta;
-                            vid_input.last_frame_pts = next_decoded.pts().unwrap();
-                            vid_input.last_frame_duration = next_decoded.packet().duration;
-                            unsafe {
-                                gfx_lowlevel_map_frame_ctx(
-                                    lowlevel_ctx,
-                                    vid_input.last_frame.0,
-                                    next_decoded.as_mut_ptr() as _,
-                                );
-                            }
-                            return Ok(());
-                        }
-                        Err(ffmpeg_next::Error::Other {
-                            errno: ffmpeg_next::ffi::EAGAIN,
-                        }) => (), //resource temporarily unavailable
-                        Err(e) => {
-                            eprintln!("Error receiving frame {}:{}: {}", file!(), line!(), e);
-                            error_counter += 1;
-                            if error_counter > 2 {
-                                return Err(e.into());
-                            }
-                        }
-                    }
+        // realtime inputs just keep showing the last frame when the decoder is behind,
+        // everything else has to wait so timing stays right
+        let block =
+            (!self.info.realtime || vid_input.last_frame_duration == 0) && !vid_input.holding_cue;
+        while !vid_input.eof {
+            let pulled = if self.info.realtime {
+                vid_input
+                    .decode_thread
+                    .next_latest(block && vid_input.prefetched.is_none())
+            } else if vid_input.prefetched.is_none() {
+                vid_input.decode_thread.next(block)
+            } else {
+                None
+            };
+            // a live input may already have a newer frame than the one
+            // uploaded ahead, that one is dropped then
+            let (item, uploaded) = match (pulled, vid_input.prefetched.take()) {
+                (Some(item), _) => (item, false),
+                (None, Some(item)) => (item, true),
+                (None, None) => return Ok(()),
+            };
+            vid_input.holding_cue = false;
+            let mut next_decoded = match item {
+                DecodeItem::Frame(frame) => frame,
+                DecodeItem::Eof => {
+                    vid_input.eof = true;
+                    break;
                 }
-            }
-
-            // check to see if we can rewind otherwise break
-            if !self.info.repeat || vid_input.duration_tbu <= Rational::new(0, 1) {
-                break;
-            }
-
-            vid_input
-                .ictx
-                .seek(0, ..)
-                .with_context(|| format!("error seeking {}:{}", file!(), line!()))?;
-            vid_input.decoder.flush();
+                DecodeItem::Error(e) => bail!("Error decoding {}: {}", self.info.name, e),
+            };
+            let last_real_pts;
+            let delta = if self.info.realtime {
+                // go off of timestamps on frames
+                if vid_input.last_frame_duration > 0 {
+                    let delta = next_decoded.pts().unwrap() - vid_input.last_frame_pts;
+                    unsafe { (*next_decoded.as_mut_ptr()).duration = delta };
+                    last_real_pts = vid_input.continuous_pts;
+                    next_decoded.set_pts(Some(f64::from(vid_input.continuous_pts) as i64));
+                    Rational::new(delta as i32, 1)
+                } else {
+                    eprintln!("Skip a frame to get a duration....");
+                    vid_input.last_frame_pts = next_decoded.pts().unwrap();
+                    vid_input.last_frame_duration = next_decoded.packet().duration;
+                    continue;
+                }
+            } else {
+                last_real_pts = if let Some(pts) = next_decoded.pts() {
+                    Rational::new(pts as i32, 1)
+                } else {
+                    vid_input.continuous_pts
+                };
+                next_decoded.set_pts(Some(f64::from(vid_input.continuous_pts) as i64));
+                Rational::new(next_decoded.packet().duration as i32, 1)
+            };
+            vid_input.advance(
+                &mut next_decoded,
+                last_real_pts,
+                delta,
+                uploaded,
+                lowlevel_ctx,
+            );
+            return Ok(());
         }
 
         // We're not looping so just send the last fame forever
@@ -431,16 +510,6 @@ impl VidData {
         Ok(self.vid_input.borrow().as_ref().unwrap().time_base.clone())
     }
 
-    fn duration_tbu(&self) -> Result<Rational> {
-        Ok(self
-            .vid_input
-            .borrow()
-            .as_ref()
-            .unwrap()
-            .duration_tbu
-            .clone())
-    }
-
     pub fn seek_vid(
         &self,
         sec: f64,
@@ -453,6 +522,7 @@ impl VidData {
         if let Err(e) = self.prepare(lowlevel_ctx) {
             return Err(e);
         }
+        self.seek_index.start(&self.info);
 
         let delta_tbu = Rational::from(sec) / self.time_base()?;
         let last_pts = if let Some(last_pts) = self.last_real_pts()? {
@@ -468,6 +538,8 @@ impl VidData {
         };
 
         if let Some(stream) = self.vid_input.borrow_mut().as_mut() {
+            // anything uploaded ahead is from before the seek
+            stream.prefetched.take();
             let mut circuit_breaker = 100;
             while seek_tbu < Rational::new(0, 1) {
                 seek_tbu = seek_tbu + stream.duration_tbu;
@@ -492,60 +564,106 @@ impl VidData {
                     )
                 }
             }
+            // We might hop to a key frame so let the decode thread search for our PTS
+            let slack = stream.time_base.invert() * Rational::new(1, 20);
+            let pts_min = seek_tbu - slack;
+            let pts_min = if pts_min < Rational::new(0, 1) {
+                Rational::new(0, 1)
+            } else if pts_min >= stream.duration_tbu {
+                eprintln!("Min somehow beyond duration, just scan the whole thing");
+                Rational::new(0, 1)
+            } else {
+                pts_min
+            };
             let ts = f64::from(seek_tbu) as i64;
-            if let Err(e) = stream
-                .ictx
-                .seek_stream(stream.video_stream_index as i32, ts, 0..ts)
-            {
+
+            // a cue decoded ahead of time goes up right away, the decode thread
+            // picks up from the frame after it and the cue stays up until that
+            // one is ready
+            if let Some(mut cue) = self.seek_index.cue_frame(ts, f64::from(slack) as i64) {
+                let cue_pts = cue.pts().unwrap_or(ts);
+                if let Err(e) = stream.decode_thread.seek(ts, cue_pts + 1) {
+                    bail!("Error seeking {}:{}: {e}", file!(), line!());
+                }
+                stream.eof = false;
+                stream.holding_cue = true;
+                let last_real_pts = Rational::new(cue_pts as i32, 1);
+                cue.set_pts(Some(f64::from(stream.continuous_pts) as i64));
+                let delta = Rational::new(cue.packet().duration as i32, 1);
+                stream.advance(&mut cue, last_real_pts, delta, false, lowlevel_ctx);
+                return Ok(());
+            }
+
+            if let Err(e) = stream.decode_thread.seek(ts, f64::from(pts_min) as i64) {
                 bail!("Error seeking {}:{}: {e}", file!(), line!());
             }
-            stream.decoder.flush();
+            stream.eof = false;
+            stream.holding_cue = false;
         }
 
-        // We might have hopped to a key frame so let's search for out PTS
-        let pts_min = seek_tbu - self.time_base()?.invert() * Rational::new(1, 20);
-        let pts_min = if pts_min < Rational::new(0, 0) {
-            Rational::new(0, 0)
-        } else if pts_min >= self.duration_tbu()? {
-            eprintln!("Min somehow beyond duration, just scan the whole thing");
-            Rational::new(0, 0)
+        // frames before the target never leave the decode thread, so this is
+        // the only one that gets mapped
+        self.decode_frame(lowlevel_ctx)
+    }
+
+    /// Take the next decoded frame, if it's ready, and start uploading it so
+    /// the transfer overlaps with the GPU still working on this frame.
+    /// decode_frame swaps it in instead of uploading when it gets there.
+    pub fn prefetch(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
+        let mut borrowed = self.vid_input.borrow_mut();
+        let Some(vid_input) = borrowed.as_mut() else {
+            return Ok(());
+        };
+        if vid_input.eof || vid_input.prefetched.is_some() {
+            return Ok(());
+        }
+        let item = if self.info.realtime {
+            vid_input.decode_thread.next_latest(false)
         } else {
-            pts_min
+            vid_input.decode_thread.next(false)
         };
-        let mut circuit_breaker = 1000;
-        let mut last_last_pts = None;
-        loop {
-            circuit_breaker -= 1;
-            self.decode_frame(lowlevel_ctx)?;
-            let last_pts = self.last_real_pts()?.unwrap();
-            if last_pts >= pts_min {
-                break;
-            }
-            if let Some(last_last_pts) = last_last_pts {
-                if last_pts < last_last_pts {
-                    break;
+        let Some(item) = item else {
+            return Ok(());
+        };
+        if let DecodeItem::Frame(frame) = &item {
+            if vid_input.prefetch_frame.is_none() {
+                let prefetch_frame = WrapFrame::new(lowlevel_ctx);
+                if prefetch_frame.0.is_null() {
+                    bail!("Failed to allocate prefetch frame for {}", self.info.name);
                 }
-            } else {
-                last_last_pts.replace(last_pts);
+                unsafe {
+                    (*prefetch_frame.0).hw_interop = self.info.hardware_decode;
+                    (*prefetch_frame.0).gpu_convert = self.info.gpu_convert;
+                    (*prefetch_frame.0).convert_threads = vid_input.decode_thread.threads() as i32;
+                }
+                vid_input.prefetch_frame = Some(Arc::new(prefetch_frame));
             }
-            if circuit_breaker <= 0 {
-                eprintln!(
-                    "CIRCUIT BREAKER seek_tbu={seek_tbu:?} min={pts_min:?} duration_tbu={:?}",
-                    self.duration_tbu()
+            let _span = trace::span("map_frame", "prefetch");
+            unsafe {
+                gfx_lowlevel_map_frame_ctx(
+                    lowlevel_ctx,
+                    vid_input.prefetch_frame.as_ref().unwrap().0,
+                    frame.as_ptr() as _,
                 );
-                break;
             }
         }
+        // end of stream and errors are kept for decode_frame to handle
+        vid_input.prefetched = Some(item);
         Ok(())
     }
 
+    /// Open the decoder and take the first frame off the render thread
+    pub fn warm_up(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
+        self.decode_frame(lowlevel_ctx)
+    }
+
     pub fn reset(&self) -> Result<()> {
         self.vid_input.borrow_mut().take();
         Ok(())
     }
 }
 
-fn get_codec_context(
+pub(crate) fn get_codec_context(
     name: Option<&str>,
     params: ffmpeg::codec::Parameters,
 ) -> Result<ffmpeg::codec::Context> {
@@ -574,6 +692,19 @@ fn get_codec_context(
 pub struct VidMixerData {
     pub info: VidMixerInfo,
     stream: RefCell<VidMixerStream>,
+    // sent before the mix ctx existed, by var name so only the last one stays
+    pending_cmds: RefCell<HashMap<String, SendCmd>>,
+    dynamic_scale_pct: Cell<u32>,
+    storage_events: RefCell<Vec<StorageEvent>>,
+    // frame this mixer was last mixed or read as feedback on
+    last_used: Cell<i64>,
+    // GPU time of the pass timers that came back since take_gpu_time
+    gpu_ns: Cell<u64>,
+    // values each //!CONST was set to, until there are too many to count
+    const_values: RefCell<HashMap<String, HashSet<u32>>>,
+    // has a //!STORAGE buffer, so its StorageEvents are read even if no one
+    // looks at its output
+    writes_storage: bool,
 }
 
 impl Debug for VidMixerData {
@@ -590,12 +721,50 @@ pub struct VidMixerStream {
     pub next_time: Option<Rational>,
     pub last_input_times: Vec<(VidInfo, Rational)>,
     pub pass_buffers: Vec<Arc<WrapFrame>>,
+    // passes render into these and then swap with pass_buffers, so reading last
+    // frame's output of a pass never aliases the texture being written
+    pub pass_back_buffers: Vec<Arc<WrapFrame>>,
     pub pass_count: usize,
     pub scratch_frame: Option<Arc<WrapFrame>>,
     pub last_frame_time: Option<Rational>,
     pub frame_count: i64,
     pub mix_ctx: Option<WrapMixCtx>,
     pub has_been_rendered: bool,
+    // size pass_buffers and scratch_frame were allocated at
+    pub render_size: (u32, u32),
+    // one per pass run, only while tracing or keeping stats
+    pub pass_timers: Vec<WrapTimer>,
+    // workgroup size and shared memory of passes that run as compute shaders
+    pub compute_passes: Vec<Option<ComputePass>>,
+    pub storage: Vec<WrapStorage>,
+    // what each dispatch runs, pointwise passes are folded into the one before
+    pub pass_runs: Vec<PassRun>,
+}
+
+/// Passes first..=last dispatched as one shader into last's target
+#[derive(Clone, Debug)]
+pub struct PassRun {
+    pub first: usize,
+    pub last: usize,
+    pub body: CString,
+}
+
+/// How one dispatch of a mixer compiled, for finding expensive shaders
+#[derive(Clone, Copy, Debug)]
+pub struct PassStats {
+    pub first: usize,
+    pub last: usize,
+    /// Building and dispatching it once, mostly pipeline compilation unless
+    /// the pipeline cache already had it. The copy built for `shader` isn't
+    /// counted.
+    pub compile_time: Duration,
+    pub shader: gfx_lowlevel_shader_stats,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ComputePass {
+    pub size: [i32; 2],
+    pub shmem: usize,
 }
 
 pub enum VidMixerInput<'a> {
@@ -615,11 +784,78 @@ impl<'a> From<&'a VidMixerData> for VidMixerInput<'a> {
     }
 }
 
+// The uniform called `name` in a mix ctx, None if the shader doesn't use it
+unsafe fn find_var(ctx: *mut gfx_lowlevel_mix_ctx, name: &str) -> Option<*mut pl_shader_var> {
+    let slot = gfx_lowlevel_mix_ctx_find_var(ctx, name.as_ptr() as _, name.len());
+    if slot < 0 {
+        return None;
+    }
+    Some((*ctx).vars.offset(slot as isize))
+}
+
+unsafe fn set_scalar<T>(ctx: *mut gfx_lowlevel_mix_ctx, name: &str, value: T) {
+    if let Some(var) = find_var(ctx, name) {
+        *((*var).data as *mut T) = value;
+    }
+}
+
+// Vectors and arrays. Arrays are at least two long so they stay arrays in
+// the generated GLSL, and the storage only grows.
+unsafe fn set_array<T: Copy + Default>(
+    ctx: *mut gfx_lowlevel_mix_ctx,
+    name: &str,
+    values: &[T],
+) -> Result<()> {
+    let slot = gfx_lowlevel_mix_ctx_find_var(ctx, name.as_ptr() as _, name.len());
+    if slot < 0 {
+        return Ok(());
+    }
+    let var = (*ctx).vars.offset(slot as isize);
+    let elem_size = ((*var).var.dim_v * (*var).var.dim_m) as usize;
+    let curr_count = (*var).var.dim_a as usize;
+
+    let len = if curr_count == 1 && elem_size > 1 {
+        values.len().max(elem_size)
+    } else {
+        values.len().max(elem_size * 2)
+    };
+    if len % elem_size != 0 {
+        bail!(
+            "Invalid size for vector {}: expected multiple of {}",
+            name,
+            elem_size
+        );
+    }
+
+    let data = gfx_lowlevel_mix_ctx_reserve_var(ctx, slot, len * size_of::<T>()) as *mut T;
+    if data.is_null() {
+        bail!("Could not allocate {} values for {}", len, name);
+    }
+    std::ptr::copy_nonoverlapping(values.as_ptr(), data, values.len());
+    for j in values.len()..len {
+        *data.add(j) = T::default();
+    }
+    (*var).var.dim_a = (len / elem_size) as i32;
+    Ok(())
+}
+
 impl VidMixerData {
     pub fn new(info: VidMixerInfo) -> Self {
+        let writes_storage = info.shader.as_ref().map_or(false, |shader| {
+            shader
+                .lines()
+                .any(|line| line.trim_start().starts_with("//!STORAGE"))
+        });
         Self {
             info,
             stream: RefCell::new(VidMixerStream::default()),
+            pending_cmds: RefCell::new(HashMap::new()),
+            dynamic_scale_pct: Cell::new(100),
+            storage_events: RefCell::new(vec![]),
+            last_used: Cell::new(0),
+            gpu_ns: Cell::new(0),
+            const_values: RefCell::new(HashMap::new()),
+            writes_storage,
         }
     }
 
@@ -627,6 +863,159 @@ impl VidMixerData {
         self.info.clone()
     }
 
+    /// The compiled shader context once prepared, what update_values writes to
+    pub fn mix_ctx(&self) -> Option<*mut gfx_lowlevel_mix_ctx> {
+        self.stream.borrow().mix_ctx.as_ref().map(|ctx| ctx.0)
+    }
+
+    // `//!COMPUTE <pass> <w> <h> [shmem]` runs pass<pass> as a compute shader
+    // with w x h invocations per workgroup, its local size, and shmem bytes of
+    // shared memory per workgroup. libplacebo dispatches as many groups as
+    // cover the target. prepare checks the size against the GPU's limits.
+    // `//!STORAGE <name> <count>` binds a `uint name[count]` every pass can
+    // write to, its contents come back as StorageEvents
+    fn extract_compute(txt: &str) -> (Vec<(usize, ComputePass)>, Vec<(String, usize)>) {
+        let mut passes = vec![];
+        let mut storage = vec![];
+        for line in txt.lines() {
+            let parts = line.split_whitespace().collect::<Vec<_>>();
+            match parts.as_slice() {
+                ["//!COMPUTE", pass, w, h, rest @ ..] if rest.len() <= 1 => {
+                    let pass = pass.strip_prefix("pass").unwrap_or(*pass);
+                    let (Ok(pass), Ok(w), Ok(h)) =
+                        (pass.parse::<usize>(), w.parse::<i32>(), h.parse::<i32>())
+                    else {
+                        eprintln!("Invalid compute pass: {}", line);
+                        continue;
+                    };
+                    let shmem = rest.first().and_then(|s| s.parse().ok()).unwrap_or(0);
+                    if w <= 0 || h <= 0 {
+                        eprintln!("Invalid workgroup size for pass{}: {}", pass, line);
+                        continue;
+                    }
+                    passes.push((
+                        pass,
+                        ComputePass {
+                            size: [w, h],
+                            shmem,
+                        },
+                    ));
+                }
+                ["//!STORAGE", name, count] => match count.parse::<usize>() {
+                    Ok(count) if count > 0 => storage.push((name.to_string(), count)),
+                    _ => eprintln!("Invalid storage size: {}", line),
+                },
+                [directive, ..] if *directive == "//!COMPUTE" || *directive == "//!STORAGE" => {
+                    eprintln!("Invalid number of parts: {}", line)
+                }
+                _ => (),
+            }
+        }
+        (passes, storage)
+    }
+
+    // `//!CONST <name>...` compiles the named scalar `//!VAR`s into the shader
+    // instead of binding them as uniforms, so branches on them fold away.
+    // Changing one through a SendCmd compiles another variant of the shader,
+    // so they are for switches that take a handful of values. A CONST bound
+    // to a knob or animated stalls on a compile for every new value, one
+    // that goes past CONST_VARIANTS_WARN values is reported.
+    fn extract_consts(txt: &str) -> Vec<String> {
+        let mut consts = vec![];
+        for line in txt.lines() {
+            let parts = line.split_whitespace().collect::<Vec<_>>();
+            match parts.as_slice() {
+                ["//!CONST", names @ ..] if !names.is_empty() => {
+                    consts.extend(names.iter().map(|name| name.to_string()))
+                }
+                ["//!CONST"] => eprintln!("Invalid number of parts: {}", line),
+                _ => (),
+            }
+        }
+        consts
+    }
+
+    // `//!POINTWISE <pass>...` declares passes that only look at the previous
+    // pass at their own pixel, and take it as `inout vec4 color` instead of
+    // sampling pass_tex. They run in the same dispatch as the pass before
+    // whenever nothing else samples that pass's texture.
+    fn extract_pointwise(txt: &str) -> Vec<usize> {
+        let mut passes = vec![];
+        for line in txt.lines() {
+            let parts = line.split_whitespace().collect::<Vec<_>>();
+            match parts.as_slice() {
+                ["//!POINTWISE", names @ ..] if !names.is_empty() => {
+                    for name in names {
+                        match name.strip_prefix("pass").unwrap_or(name).parse::<usize>() {
+                            Ok(pass) => passes.push(pass),
+                            Err(_) => eprintln!("Invalid pointwise pass: {}", line),
+                        }
+                    }
+                }
+                ["//!POINTWISE"] => eprintln!("Invalid number of parts: {}", line),
+                _ => (),
+            }
+        }
+        passes
+    }
+
+    // Group passes into dispatches. A pointwise pass joins the run before it
+    // unless that run is compute or its output is sampled anywhere, which
+    // includes feedback from later passes or frames. On its own it gets the
+    // previous pass's output sampled into color for it.
+    fn pass_runs(
+        code: &str,
+        pass_count: usize,
+        pointwise: &[usize],
+        compute: &[Option<ComputePass>],
+    ) -> Vec<PassRun> {
+        let sampled = |pass: usize| {
+            regex::Regex::new(&format!(r"\bpass_tex{}\b", pass))
+                .map(|re| re.is_match(code))
+                .unwrap_or(true)
+        };
+        let mut runs: Vec<(usize, usize, String)> = vec![];
+        for i in 0..pass_count {
+            let is_compute = compute.get(i).copied().flatten().is_some();
+            if i == 0 || is_compute || !pointwise.contains(&i) {
+                runs.push((i, i, format!("pass{}(color);", i)));
+                continue;
+            }
+            match runs.last_mut() {
+                Some(run) if compute.get(run.1).copied().flatten().is_none() && !sampled(i - 1) => {
+                    run.1 = i;
+                    run.2.push_str(&format!(" pass{}(color);", i));
+                }
+                _ => runs.push((
+                    i,
+                    i,
+                    format!(
+                        "color = texture(pass_tex{}, src_uv); pass{}(color);",
+                        i - 1,
+                        i
+                    ),
+                )),
+            }
+        }
+        runs.into_iter()
+            .map(|(first, last, body)| PassRun {
+                first,
+                last,
+                body: CString::new(body).unwrap_or_default(),
+            })
+            .collect()
+    }
+
+    /// Whether the shader declares a `//!STORAGE` buffer
+    pub fn writes_storage(&self) -> bool {
+        self.writes_storage
+    }
+
+    /// Storage buffer contents that came back since the last call
+    pub fn take_storage_events(&self, out: &mut Vec<StorageEvent>) {
+        out.append(&mut self.storage_events.borrow_mut());
+    }
+
     fn extract_vars(txt: &str, _addendum: &mut String) -> Result<Vec<pl_shader_var>> {
         let mut vars = vec![];
         let mut lines = vec![];
@@ -1175,17 +1564,12 @@ impl VidMixerData {
             let re_comments = regex::Regex::new(r"(?m)//.*\n").unwrap();
             let re_c_comments = regex::Regex::new(r"(?s)/\*.*?\*/").unwrap();
             let re_pass = regex::Regex::new(r"(?m)(^|\W)pass\d+(\W|$)").unwrap();
-            stream.pass_count = if let Some(shader) = self.info.shader.as_ref() {
-                re_pass
-                    .find_iter(
-                        re_comments
-                            .replace_all(&re_c_comments.replace_all(shader, "").as_ref(), "")
-                            .as_ref(),
-                    )
-                    .count()
-            } else {
-                0
-            };
+            let code = self.info.shader.as_ref().map_or(String::new(), |shader| {
+                re_comments
+                    .replace_all(&re_c_comments.replace_all(shader, "").as_ref(), "")
+                    .into_owned()
+            });
+            stream.pass_count = re_pass.find_iter(&code).count();
             let body = Some(CString::new("pass0(color);").unwrap());
 
             //add some internally used variables
@@ -1211,6 +1595,27 @@ impl VidMixerData {
                 dynamic: false,
             });
 
+            // constants go last, mix_ctx binds everything before them as uniforms
+            let const_names = self
+                .info
+                .shader
+                .as_ref()
+                .map(|shader| Self::extract_consts(shader))
+                .unwrap_or_default();
+            let (mut vars, consts): (Vec<_>, Vec<_>) = vars.into_iter().partition(|var| {
+                let name = unsafe { CStr::from_ptr(var.var.name) }.to_string_lossy();
+                if !const_names.iter().any(|c| *c == name) {
+                    return true;
+                }
+                let scalar = var.var.dim_v == 1 && var.var.dim_m == 1 && var.var.dim_a == 1;
+                if !scalar {
+                    eprintln!("{} can't be a constant, only scalars can", name);
+                }
+                !scalar
+            });
+            let num_consts = consts.len();
+            vars.extend(consts);
+
             let mix_ctx = unsafe {
                 gfx_lowlevel_mix_ctx_init(
                     lowlevel_ctx,
@@ -1225,47 +1630,246 @@ impl VidMixerData {
                 bail!("Error creating mix ctx for {}", self.info.name);
             }
             stream.mix_ctx.replace(WrapMixCtx(mix_ctx));
+            match unsafe { gfx_lowlevel_mix_ctx_set_consts(mix_ctx, num_consts as i32) } {
+                0 => (),
+                err => {
+                    stream.mix_ctx.take();
+                    bail!("Error compiling constants for {}: {}", self.info.name, err);
+                }
+            }
             stream.last_frame_time.replace(Rational::new(0, 1));
 
-            stream.pass_buffers.clear();
-            for _ in 0..stream.pass_count {
-                unsafe {
-                    #[allow(unused_mut)]
-                    let mut pass_buffer = Arc::new(WrapFrame::new(lowlevel_ctx));
-                    match gfx_lowlevel_frame_create_texture(
-                        lowlevel_ctx,
-                        pass_buffer.0,
-                        self.info.width as i32,
-                        self.info.height as i32,
-                    ) {
-                        0 => (),
-                        err => bail!("Could not create pass buffer texture {}", err),
+            let (compute, storage) = self
+                .info
+                .shader
+                .as_ref()
+                .map(|shader| Self::extract_compute(shader))
+                .unwrap_or_default();
+            stream.compute_passes = vec![None; stream.pass_count];
+            let limits = if compute.is_empty() {
+                None
+            } else {
+                let mut limits: gfx_lowlevel_compute_limits = unsafe { std::mem::zeroed() };
+                unsafe { gfx_lowlevel_gpu_ctx_compute_limits(lowlevel_ctx, &mut limits) };
+                Some(limits)
+            };
+            for (pass, compute_pass) in compute {
+                if let Some(limits) = limits.as_ref() {
+                    let [w, h] = compute_pass.size;
+                    if w as i64 * h as i64 > limits.max_group_threads as i64
+                        || w > limits.max_group_size[0]
+                        || h > limits.max_group_size[1]
+                        || compute_pass.shmem > limits.max_shmem_size
+                    {
+                        stream.mix_ctx.take();
+                        bail!(
+                            "{} pass{} workgroup {}x{} with {} bytes shared is over the GPU's {}x{}, {} invocations and {} bytes",
+                            self.info.name,
+                            pass,
+                            w,
+                            h,
+                            compute_pass.shmem,
+                            limits.max_group_size[0],
+                            limits.max_group_size[1],
+                            limits.max_group_threads,
+                            limits.max_shmem_size
+                        );
                     }
+                }
+                match stream.compute_passes.get_mut(pass) {
+                    Some(slot) => *slot = Some(compute_pass),
+                    None => eprintln!("{} has no pass{} to run as compute", self.info.name, pass),
+                }
+            }
+            let pointwise = self
+                .info
+                .shader
+                .as_ref()
+                .map(|shader| Self::extract_pointwise(shader))
+                .unwrap_or_default();
+            stream.pass_runs =
+                Self::pass_runs(&code, stream.pass_count, &pointwise, &stream.compute_passes);
+            stream.storage.clear();
+            for (name, count) in storage {
+                let c_name = CString::new(name.as_str())?;
+                let storage = unsafe {
+                    gfx_lowlevel_storage_create(lowlevel_ctx, c_name.as_ptr(), count as i32)
+                };
+                if storage.is_null() {
+                    bail!("Could not create storage {} for {}", name, self.info.name);
+                }
+                stream.storage.push(WrapStorage {
+                    name,
+                    count,
+                    storage,
+                });
+            }
 
-                    gfx_lowlevel_frame_clear(
-                        lowlevel_ctx,
-                        &mut (*pass_buffer.0).pl_frame as _,
-                        0.0,
-                        0.0,
-                        0.0,
-                        1.0,
-                    );
+            // one per dispatch, a fused run is timed as a whole. The render
+            // scale needs them as much as the trace does
+            stream.pass_timers.clear();
+            if trace::enabled() || self.info.min_render_scale_pct > 0 {
+                for _ in 0..stream.pass_runs.len() {
+                    let timer = unsafe { gfx_lowlevel_timer_create(lowlevel_ctx) };
+                    if !timer.is_null() {
+                        stream.pass_timers.push(WrapTimer(timer));
+                    }
+                }
+            }
+
+            self.alloc_buffers(&mut stream, lowlevel_ctx)?;
+        } else if stream.render_size != self.render_size() {
+            self.alloc_buffers(&mut stream, lowlevel_ctx)?;
+        }
+        Ok(())
+    }
 
+    /// Width and height the passes render at
+    pub fn render_size(&self) -> (u32, u32) {
+        let pct = match self.info.render_scale_pct {
+            0 => 100,
+            pct => pct.min(100),
+        };
+        let pct = if self.info.min_render_scale_pct > 0 {
+            (pct * self.dynamic_scale_pct.get() / 100).max(self.info.min_render_scale_pct.min(pct))
+        } else {
+            pct
+        };
+        (
+            (self.info.width * pct / 100).max(1),
+            (self.info.height * pct / 100).max(1),
+        )
+    }
+
+    /// Scale the render size of mixers with a min_render_scale_pct by `pct`,
+    /// the buffers are reallocated on the next mix
+    pub fn set_dynamic_scale(&self, pct: u32) {
+        self.dynamic_scale_pct.set(pct.clamp(1, 100));
+    }
+
+    /// Lowest set_dynamic_scale that still shrinks this mixer, below it the
+    /// render size is held at min_render_scale_pct. 100 for fixed mixers.
+    pub fn min_dynamic_scale(&self) -> u32 {
+        let pct = match self.info.render_scale_pct {
+            0 => 100,
+            pct => pct.min(100),
+        };
+        match self.info.min_render_scale_pct {
+            0 => 100,
+            min => ((min.min(pct) * 100 + pct - 1) / pct).min(100),
+        }
+    }
+
+    /// GPU time the pass timers reported since the last call. Results come
+    /// back a few frames late, so this is about one earlier frame's worth.
+    pub fn take_gpu_time(&self) -> Duration {
+        Duration::from_nanos(self.gpu_ns.take())
+    }
+
+    fn pass_format(&self, pass: usize) -> &str {
+        match self.info.pass_formats.get(pass) {
+            Some(format) if !format.is_empty() => format,
+            _ => self.info.buffer_format.as_deref().unwrap_or("rgba8"),
+        }
+    }
+
+    // Falls back to rgba8 when the GPU can't render to the format asked for
+    unsafe fn create_buffer(
+        &self,
+        lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx,
+        frame: *mut gfx_lowlevel_frame_ctx,
+        width: u32,
+        height: u32,
+        format: &str,
+        storable: bool,
+    ) -> Result<()> {
+        let c_format = CString::new(format)?;
+        match gfx_lowlevel_frame_create_texture_fmt(
+            lowlevel_ctx,
+            frame,
+            width as i32,
+            height as i32,
+            c_format.as_ptr(),
+            storable,
+        ) {
+            0 => return Ok(()),
+            err if format == "rgba8" => bail!("Could not create pass buffer texture {}", err),
+            err => eprintln!(
+                "{} can't use buffer format {}: {}, using rgba8",
+                self.info.name, format, err
+            ),
+        }
+        let c_format = CString::new("rgba8")?;
+        match gfx_lowlevel_frame_create_texture_fmt(
+            lowlevel_ctx,
+            frame,
+            width as i32,
+            height as i32,
+            c_format.as_ptr(),
+            storable,
+        ) {
+            0 => Ok(()),
+            err => bail!("Could not create pass buffer texture {}", err),
+        }
+    }
+
+    fn alloc_buffers(
+        &self,
+        stream: &mut VidMixerStream,
+        lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx,
+    ) -> Result<()> {
+        let (width, height) = self.render_size();
+        stream.render_size = (width, height);
+        stream.pass_buffers.clear();
+        stream.pass_back_buffers.clear();
+        for i in 0..stream.pass_count * 2 {
+            let pass = i % stream.pass_count;
+            unsafe {
+                #[allow(unused_mut)]
+                let mut pass_buffer = Arc::new(WrapFrame::new(lowlevel_ctx));
+                self.create_buffer(
+                    lowlevel_ctx,
+                    pass_buffer.0,
+                    width,
+                    height,
+                    self.pass_format(pass),
+                    stream
+                        .compute_passes
+                        .get(pass)
+                        .map_or(false, |c| c.is_some()),
+                )?;
+
+                gfx_lowlevel_frame_clear(
+                    lowlevel_ctx,
+                    &mut (*pass_buffer.0).pl_frame as _,
+                    0.0,
+                    0.0,
+                    0.0,
+                    1.0,
+                );
+
+                if stream.pass_buffers.len() < stream.pass_count {
                     stream.pass_buffers.push(pass_buffer);
+                } else {
+                    stream.pass_back_buffers.push(pass_buffer);
                 }
             }
+        }
 
+        // the output of the last pass doubles as the mixed frame
+        if let Some(last_pass) = stream.pass_buffers.last() {
+            stream.scratch_frame = Some(last_pass.clone());
+        } else {
             stream.scratch_frame = Some(Arc::new(WrapFrame::new(lowlevel_ctx)));
             unsafe {
-                match gfx_lowlevel_frame_create_texture(
+                self.create_buffer(
                     lowlevel_ctx,
                     stream.scratch_frame.as_ref().unwrap().0,
-                    self.info.width as i32,
-                    self.info.height as i32,
-                ) {
-                    0 => (),
-                    err => bail!("Could not create blank frame texture {}", err),
-                }
+                    width,
+                    height,
+                    self.pass_format(0),
+                    false,
+                )?;
 
                 gfx_lowlevel_frame_clear(
                     lowlevel_ctx,
@@ -1280,9 +1884,35 @@ impl VidMixerData {
         Ok(())
     }
 
+    /// Note that frame mixes this or reads it as feedback
+    pub fn touch(&self, frame: i64) {
+        self.last_used.set(frame);
+    }
+
+    /// Frame this was last mixed or read on
+    pub fn last_used(&self) -> i64 {
+        self.last_used.get()
+    }
+
+    /// Whether the pass buffers are allocated
+    pub fn has_buffers(&self) -> bool {
+        self.stream.borrow().scratch_frame.is_some()
+    }
+
+    /// Hand the pass buffers back to the texture pool. The next mix allocates
+    /// them again, cleared, so feedback starts over.
+    pub fn release_buffers(&self) {
+        let mut stream = self.stream.borrow_mut();
+        stream.pass_buffers.clear();
+        stream.pass_back_buffers.clear();
+        stream.scratch_frame.take();
+        stream.render_size = (0, 0);
+    }
+
     pub fn unload(&self) -> Result<()> {
         let mut stream = self.stream.borrow_mut();
         stream.mix_ctx.take();
+        self.pending_cmds.borrow_mut().clear();
         Ok(())
     }
 
@@ -1300,9 +1930,18 @@ impl VidMixerData {
         shader_debug: bool,
     ) -> Result<()> {
         assert!(frames_to_mix > 0);
+        let _span = trace::mix_span(&self.info.name);
         self.prepare(lowlevel_ctx)?;
         let mut mix = self.stream.borrow_mut();
 
+        // whatever was sent before the mix ctx existed goes in now
+        let ctx = mix.mix_ctx.as_ref().unwrap().0;
+        for (_, send_cmd) in self.pending_cmds.borrow_mut().drain() {
+            if let Err(e) = self.update_values(ctx, &send_cmd) {
+                eprintln!("Could not apply {:?}: {}", send_cmd, e);
+            }
+        }
+
         // save the current next time and increment one frame for the object state
         let present_time_secs = mix.next_time.or_else(|| Some(Rational::new(0, 1))).unwrap()
             + Rational::new((frames_to_mix - 1) as i32, fps as i32);
@@ -1323,6 +1962,18 @@ impl VidMixerData {
             for i in 0..inputs.len() {
                 match inputs[i] {
                     VidMixerInput::Video(vid_data) => {
+                        if vid_data.advanced_on.get() == Some(frames) {
+                            // keep our clock on the shared frame so we pick up
+                            // from here if the other mixer stops reading it
+                            let (last_info, last_time) = mix.last_input_times.get_mut(i).unwrap();
+                            if last_info != &vid_data.info {
+                                *last_info = vid_data.info.clone();
+                            }
+                            *last_time = present_time_secs;
+                            decoded_frames[i] = unsafe { vid_data.last_frame()? };
+                            continue;
+                        }
+                        vid_data.advanced_on.set(Some(frames));
                         if vid_data.info.realtime {
                             // just display the next frame you get and forget it
                             // if the input frame rate is slower than the app fps
@@ -1443,92 +2094,58 @@ impl VidMixerData {
 
             let num_frames = raw_frames.len() as i32;
 
-            let mut previous_passes = unsafe {
-                (0..mix.pass_buffers.len())
-                    .map(|i| &mut (*mix.pass_buffers[i].0).pl_frame as *mut _)
-                    .collect::<Vec<_>>()
-            };
-
             // update how many frames we have seen
             mix.frame_count += 1;
 
             // update standard vars if requested by the shader
 
-            let target = self.info.name.clone();
-            let mut std_vars = vec![
-                SendCmd::builder()
-                    .name("iFrame")
-                    .mix(target.clone())
-                    .value(SendValue::Float(mix.frame_count as f32))
-                    .build(),
-                SendCmd::builder()
-                    .name("iResolution")
-                    .mix(target.clone())
-                    .value(SendValue::Vector(vec![
-                        self.info.width as f32,
-                        self.info.height as f32,
-                        1.0,
-                    ]))
-                    .build(),
-                SendCmd::builder()
-                    .name("iTime")
-                    .mix(target.clone())
-                    .value(SendValue::Float(mix.frame_count as f32 / fps as f32))
-                    .build(),
-                SendCmd::builder()
-                    .name("iTimeDelta")
-                    .mix(target.clone())
-                    .value(SendValue::Float(f64::from(one_frame_time_secs) as f32))
-                    .build(),
-                SendCmd::builder()
-                    .name("iSampleRate")
-                    .mix(target.clone())
-                    .value(SendValue::Float(fps as f32))
-                    .build(),
-            ];
-
-            let mut inp_idx = 0;
-            for inp in inputs {
-                match inp {
-                    &VidMixerInput::Video(vid_data) => std_vars.push(
-                        SendCmd::builder()
-                            .name(format!("iResolution{inp_idx}"))
-                            .value(SendValue::Vector(vec![
-                                vid_data.info.size.0 as f32,
-                                vid_data.info.size.1 as f32,
-                            ]))
-                            .mix(target.clone())
-                            .build(),
-                    ),
-                    &VidMixerInput::Feedback(mix_data) => std_vars.push(
-                        SendCmd::builder()
-                            .name(format!("iResolution{inp_idx}"))
-                            .value(SendValue::Vector(vec![
-                                mix_data.info.width as f32,
-                                mix_data.info.height as f32,
-                            ]))
-                            .mix(target.clone())
-                            .build(),
-                    ),
+            let ctx = mix.mix_ctx.as_ref().unwrap().0;
+            unsafe {
+                set_scalar(ctx, "iFrame", mix.frame_count as f32);
+                set_array(
+                    ctx,
+                    "iResolution",
+                    &[mix.render_size.0 as f32, mix.render_size.1 as f32, 1.0],
+                )?;
+                set_scalar(ctx, "iTime", mix.frame_count as f32 / fps as f32);
+                set_scalar(ctx, "iTimeDelta", f64::from(one_frame_time_secs) as f32);
+                set_scalar(ctx, "iSampleRate", fps as f32);
+
+                let mut name = String::new();
+                for (inp_idx, inp) in inputs.iter().enumerate() {
+                    let size = match inp {
+                        &VidMixerInput::Video(vid_data) => {
+                            [vid_data.info.size.0 as f32, vid_data.info.size.1 as f32]
+                        }
+                        &VidMixerInput::Feedback(mix_data) => {
+                            let (w, h) = mix_data.render_size();
+                            [w as f32, h as f32]
+                        }
+                    };
+                    name.clear();
+                    write!(&mut name, "iResolution{inp_idx}").ok();
+                    set_array(ctx, &name, &size)?;
                 }
-                inp_idx += 1;
-            }
 
-            std_vars.push(
-                SendCmd::builder()
-                    .name("frame")
-                    .value(SendValue::Float((frames % (1 << 24)) as f32))
-                    .mix(target.clone())
-                    .build(),
-            );
+                set_scalar(ctx, "frame", (frames % (1 << 24)) as f32);
+            }
 
-            let ctx = mix.mix_ctx.as_ref().unwrap().0;
-            for c in std_vars {
-                self.update_values(ctx, &c)?;
+            // storage is zeroed once per mix, passes accumulate into it
+            let mut storage = mix.storage.iter().map(|s| s.storage).collect::<Vec<_>>();
+            for s in &storage {
+                unsafe {
+                    match gfx_lowlevel_storage_clear(*s) {
+                        0 => (),
+                        err => bail!("Could not clear storage {}", err),
+                    }
+                }
             }
 
-            for i in 0..mix.pass_count {
-                let body = CString::new(format!("pass{}(color);", i))?;
+            for run in 0..mix.pass_runs.len() {
+                // the run renders into its last pass's target
+                let i = mix.pass_runs[run].last;
+                let body = mix.pass_runs[run].body.clone();
+                let compute = mix.compute_passes.get(i).copied().flatten();
 
                 let params = gfx_lowlevel_filter_params {
                     src: pl_rect2df {
@@ -1548,7 +2165,41 @@ impl VidMixerData {
                     header: unsafe { (*mix.mix_ctx.as_ref().unwrap().0).header },
                     body: body.as_ptr(),
                     vars: unsafe { (*mix.mix_ctx.as_ref().unwrap().0).vars },
-                    num_vars: unsafe { (*mix.mix_ctx.as_ref().unwrap().0).num_vars },
+                    num_vars: unsafe {
+                        (*mix.mix_ctx.as_ref().unwrap().0).num_vars
+                            - (*mix.mix_ctx.as_ref().unwrap().0).num_consts
+                    },
+                    constants: unsafe { (*mix.mix_ctx.as_ref().unwrap().0).consts },
+                    num_constants: unsafe { (*mix.mix_ctx.as_ref().unwrap().0).num_consts },
+                    timer: mix
+                        .pass_timers
+                        .get(run)
+                        .map_or(std::ptr::null_mut(), |t| t.0),
+                    compute: compute.is_some(),
+                    compute_size: compute.map_or([0, 0], |c| c.size),
+                    compute_shmem: compute.map_or(0, |c| c.shmem),
+                    storage: storage.as_mut_ptr(),
+                    num_storage: storage.len() as i32,
+                    mix_ctx: mix.mix_ctx.as_ref().unwrap().0,
+                    stats: std::ptr::null_mut(),
+                };
+                // results for earlier frames come back before the timer is reused
+                if let Some(timer) = mix.pass_timers.get(run) {
+                    match unsafe { gfx_lowlevel_timer_poll(timer.0) } {
+                        0 => (),
+                        ns => {
+                            let first = mix.pass_runs[run].first;
+                            trace::gpu_pass(&self.info.name, run, first, i, ns);
+                            self.gpu_ns.set(self.gpu_ns.get() + ns);
+                        }
+                    }
+                }
+                // earlier passes were already swapped to this frame's output, later
+                // ones (and this one) still hold the previous frame for feedback
+                let mut previous_passes = unsafe {
+                    (0..mix.pass_buffers.len())
+                        .map(|i| &mut (*mix.pass_buffers[i].0).pl_frame as *mut _)
+                        .collect::<Vec<_>>()
                 };
                 unsafe {
                     let one_lut_only = if i == mix.pass_count - 1 {
@@ -1560,7 +2211,7 @@ impl VidMixerData {
                         lowlevel_ctx,
                         //mix.mix_ctx.as_ref().unwrap().0,
                         &params as _,
-                        &mut (*mix.scratch_frame.as_ref().unwrap().0).pl_frame as _, //dst frame
+                        &mut (*mix.pass_back_buffers[i].0).pl_frame as _, //dst frame
                         raw_frames.as_mut_ptr(),
                         num_frames,
                         previous_passes.as_mut_ptr() as _,
@@ -1571,56 +2222,42 @@ impl VidMixerData {
                         0 => (),
                         err => bail!("Could not render frame {}", err),
                     }
-
-                    // copy the scratch frame to the pass buffer for feedback and potential display
-                    match gfx_lowlevel_frame_copy(
-                        lowlevel_ctx,
-                        &mut (*mix.pass_buffers[i].0).pl_frame as _,
-                        &mut (*mix.scratch_frame.as_ref().unwrap().0).pl_frame as _,
-                    ) {
-                        0 => (),
-                        err => bail!("Could not copy frame {}", err),
-                    }
                 }
+                let stream = &mut *mix;
+                std::mem::swap(
+                    &mut stream.pass_buffers[i],
+                    &mut stream.pass_back_buffers[i],
+                );
             }
+
+            if let Some(last_pass) = mix.pass_buffers.last() {
+                mix.scratch_frame = Some(last_pass.clone());
+            }
+
+            self.read_storage(&mix)?;
         }
 
         if dry_run || no_display {
             return Ok(());
         }
 
-        // basic copy params - just sample the mixed frame into the fbo
-        let body = CString::new("color = texture(src_tex0, src_uv);")?;
-        let mut params = gfx_lowlevel_filter_params {
-            src: pl_rect2df {
-                x0: 0.0,
-                y0: 0.0,
-                x1: 1.0,
-                y1: 1.0,
-            },
-            dst: pl_rect2df {
-                x0: 0.0,
-                y0: 0.0,
-                x1: 1.0,
-                y1: 1.0,
-            },
-            rotation: 0.0,
-            prelude: std::ptr::null() as _,
-            header: std::ptr::null() as _,
-            body: body.as_ptr(),
-            vars: std::ptr::null_mut(),
-            num_vars: 0,
-        };
-
-        let mut raw_frame = unsafe {
-            vec![&mut (*mix.scratch_frame.as_mut().unwrap().0).pl_frame as *mut pl_frame]
+        // scale the mixed frame into the window with the mixer's filter
+        let mut src_rect = pl_rect2df {
+            x0: 0.0,
+            y0: 0.0,
+            x1: 1.0,
+            y1: 1.0,
         };
+        let mut dst_rect = src_rect;
+        let scratch =
+            unsafe { &mut (*mix.scratch_frame.as_mut().unwrap().0).pl_frame as *mut pl_frame };
 
         if let Some(target) = target.as_ref() {
             if let Some(src) = target.src {
-                let w = unsafe { (*(*raw_frame[0]).planes[0].texture).params.w as f32 };
-                let h = unsafe { (*(*raw_frame[0]).planes[0].texture).params.h as f32 };
-                params.src = pl_rect2df {
+                // src is in mixer pixels, whatever size the passes render at
+                let w = self.info.width as f32;
+                let h = self.info.height as f32;
+                src_rect = pl_rect2df {
                     x0: src.0 as f32 / w,
                     y0: src.1 as f32 / h,
                     x1: (src.0 + src.2 as i32) as f32 / w,
@@ -1632,7 +2269,7 @@ impl VidMixerData {
                     unsafe { (*(*lowlevel_ctx).window_frame.planes[0].texture).params.w as f32 };
                 let h =
                     unsafe { (*(*lowlevel_ctx).window_frame.planes[0].texture).params.h as f32 };
-                params.dst = pl_rect2df {
+                dst_rect = pl_rect2df {
                     x0: dst.0 as f32 / w,
                     y0: dst.1 as f32 / h,
                     x1: (dst.0 + dst.2 as i32) as f32 / w,
@@ -1641,18 +2278,19 @@ impl VidMixerData {
             }
         };
 
+        let scaler = self
+            .info
+            .scaler
+            .as_ref()
+            .and_then(|s| CString::new(s.as_str()).ok());
         unsafe {
-            match gfx_lowlevel_gpu_ctx_render(
+            match gfx_lowlevel_frame_blit_scaled(
                 lowlevel_ctx,
-                // mix.mix_ctx.as_ref().unwrap().0,
-                &params as _,
                 &mut (*lowlevel_ctx).window_frame as _,
-                raw_frame.as_mut_ptr(),
-                raw_frame.len() as i32,
-                std::ptr::null_mut(),
-                0,
-                std::ptr::null_mut(),
-                false,
+                scratch,
+                src_rect,
+                dst_rect,
+                scaler.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
             ) {
                 0 => (),
                 err => bail!("Could not render frame {}", err),
@@ -1662,6 +2300,169 @@ impl VidMixerData {
         return Ok(());
     }
 
+    // Collect finished copies of the storage buffers and queue one of this
+    // frame's contents, nothing here waits on the GPU
+    fn read_storage(&self, mix: &VidMixerStream) -> Result<()> {
+        for s in &mix.storage {
+            loop {
+                let mut values = vec![0u32; s.count];
+                let mut frame = 0;
+                match unsafe {
+                    gfx_lowlevel_storage_read_next(s.storage, values.as_mut_ptr(), &mut frame)
+                } {
+                    0 => self.storage_events.borrow_mut().push(StorageEvent {
+                        mixer: self.info.name.clone(),
+                        name: s.name.clone(),
+                        frame,
+                        values,
+                    }),
+                    err if err == GFX_EAGAIN as i32 => break,
+                    err => bail!("Could not read storage {}: {}", s.name, err),
+                }
+            }
+            match unsafe { gfx_lowlevel_storage_read_start(s.storage, mix.frame_count) } {
+                0 => (),
+                // the oldest copy is still in flight, skip this frame's
+                err if err == GFX_EAGAIN as i32 => (),
+                err => bail!("Could not copy storage {}: {}", s.name, err),
+            }
+        }
+        Ok(())
+    }
+
+    /// Prepare and dispatch every pass once against blank inputs so the shaders
+    /// are compiled (and in the shared shader cache) before the first real mix.
+    /// The input count is guessed from the highest src_texN and no LUT is
+    /// applied, a mix with other inputs or a LUT still compiles its own
+    /// variant. Meant to run with a forked ctx off the render thread.
+    pub fn warm_up(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
+        self.warm_up_passes(lowlevel_ctx, None)
+    }
+
+    /// Warm up and report how each dispatch compiled, one entry per pass run
+    pub fn compile_stats(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<Vec<PassStats>> {
+        let mut stats = vec![];
+        self.warm_up_passes(lowlevel_ctx, Some(&mut stats))?;
+        Ok(stats)
+    }
+
+    fn warm_up_passes(
+        &self,
+        lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx,
+        mut stats: Option<&mut Vec<PassStats>>,
+    ) -> Result<()> {
+        self.prepare(lowlevel_ctx)?;
+        let mix = self.stream.borrow();
+        let (Some(mix_ctx), Some(scratch)) = (mix.mix_ctx.as_ref(), mix.scratch_frame.as_ref())
+        else {
+            return Ok(());
+        };
+
+        // the shader is specialized on the number of inputs, so guess it the same
+        // way pass_count is found
+        let re_src = regex::Regex::new(r"src_tex(\d+)").unwrap();
+        let num_inputs = self.info.shader.as_ref().map_or(0, |shader| {
+            re_src
+                .captures_iter(shader)
+                .filter_map(|c| c[1].parse::<usize>().ok())
+                .map(|i| i + 1)
+                .max()
+                .unwrap_or(0)
+        });
+        let mut raw_frames = unsafe {
+            (0..num_inputs)
+                .map(|_| &mut (*scratch.0).pl_frame as *mut pl_frame)
+                .collect::<Vec<_>>()
+        };
+        let mut previous_passes = unsafe {
+            mix.pass_buffers
+                .iter()
+                .map(|p| &mut (*p.0).pl_frame as *mut pl_frame)
+                .collect::<Vec<_>>()
+        };
+
+        let mut storage = mix.storage.iter().map(|s| s.storage).collect::<Vec<_>>();
+        for run in &mix.pass_runs {
+            let i = run.last;
+            let body = &run.body;
+            let compute = mix.compute_passes.get(i).copied().flatten();
+            let mut shader_stats: gfx_lowlevel_shader_stats = unsafe { std::mem::zeroed() };
+            let params = gfx_lowlevel_filter_params {
+                src: pl_rect2df {
+                    x0: 0.0,
+                    y0: 0.0,
+                    x1: 1.0,
+                    y1: 1.0,
+                },
+                dst: pl_rect2df {
+                    x0: 0.0,
+                    y0: 0.0,
+                    x1: 1.0,
+                    y1: 1.0,
+                },
+                rotation: 0.0,
+                prelude: unsafe { (*mix_ctx.0).prelude },
+                header: unsafe { (*mix_ctx.0).header },
+                body: body.as_ptr(),
+                vars: unsafe { (*mix_ctx.0).vars },
+                num_vars: unsafe { (*mix_ctx.0).num_vars - (*mix_ctx.0).num_consts },
+                constants: unsafe { (*mix_ctx.0).consts },
+                num_constants: unsafe { (*mix_ctx.0).num_consts },
+                timer: std::ptr::null_mut(),
+                compute: compute.is_some(),
+                compute_size: compute.map_or([0, 0], |c| c.size),
+                compute_shmem: compute.map_or(0, |c| c.shmem),
+                storage: storage.as_mut_ptr(),
+                num_storage: storage.len() as i32,
+                mix_ctx: mix_ctx.0,
+                stats: if stats.is_some() {
+                    &mut shader_stats
+                } else {
+                    std::ptr::null_mut()
+                },
+            };
+            let started = Instant::now();
+            unsafe {
+                match gfx_lowlevel_gpu_ctx_render(
+                    lowlevel_ctx,
+                    &params as _,
+                    &mut (*mix.pass_back_buffers[i].0).pl_frame as _,
+                    raw_frames.as_mut_ptr(),
+                    raw_frames.len() as i32,
+                    previous_passes.as_mut_ptr() as _,
+                    previous_passes.len() as i32,
+                    std::ptr::null_mut(),
+                    false,
+                ) {
+                    0 => (),
+                    err => bail!(
+                        "Could not warm up pass {} of {}: {}",
+                        i,
+                        self.info.name,
+                        err
+                    ),
+                }
+            }
+            if let Some(stats) = stats.as_mut() {
+                stats.push(PassStats {
+                    first: run.first,
+                    last: run.last,
+                    compile_time: started
+                        .elapsed()
+                        .saturating_sub(Duration::from_micros(shader_stats.build_us.max(0) as u64)),
+                    shader: shader_stats,
+                });
+            }
+        }
+
+        unsafe {
+            if gfx_lowlevel_reset_dispatch(lowlevel_ctx) != 0 {
+                bail!("Failed to reset warm up dispatch for {}", self.info.name);
+            }
+        }
+        Ok(())
+    }
+
     pub fn get_present_time(&self) -> Result<Rational> {
         let mix = self.stream.borrow();
         let zero = Rational::new(0, 1);
@@ -1675,19 +2476,22 @@ impl VidMixerData {
 
     pub fn reset(&self) -> std::result::Result<(), Error> {
         self.stream.replace(VidMixerStream::default());
+        self.pending_cmds.borrow_mut().clear();
         Ok(())
     }
 
-    pub fn do_cmd(
-        &self,
-        lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx,
-        send_cmd: &crate::renderspec::SendCmd,
-    ) -> Result<()> {
-        self.prepare(lowlevel_ctx)?;
-        let stream = self.stream.borrow_mut();
-        let ctx = stream.mix_ctx.as_ref().unwrap().0;
-        self.update_values(ctx, send_cmd)?;
-        Ok(())
+    /// Set a uniform for the next mix. Before the mixer is prepared the value
+    /// is held until it is, the last one sent per var winning.
+    pub fn do_cmd(&self, send_cmd: SendCmd) -> Result<()> {
+        match self.mix_ctx() {
+            Some(ctx) => self.update_values(ctx, &send_cmd),
+            None => {
+                self.pending_cmds
+                    .borrow_mut()
+                    .insert(send_cmd.name.clone(), send_cmd);
+                Ok(())
+            }
+        }
     }
 
     pub fn update_values(
@@ -1695,118 +2499,56 @@ impl VidMixerData {
         ctx: *mut gfx_lowlevel_mix_ctx,
         send_cmd: &crate::renderspec::SendCmd,
     ) -> Result<()> {
-        let name = CString::new(send_cmd.name.as_bytes()).unwrap();
-        let num_vars = unsafe { (*ctx).num_vars } as isize;
-        for i in 0..num_vars {
-            let var = unsafe { (*ctx).vars.offset(i) };
-            let var_name = unsafe { CStr::from_ptr((*var).var.name as *mut i8) };
-            if var_name == name.as_c_str() {
-                match send_cmd.value {
-                    SendValue::Float(f) => unsafe {
-                        *((*var).data as *mut libc::c_float) = f;
-                        return Ok(());
-                    },
-                    SendValue::Integer(i) => unsafe {
-                        *((*var).data as *mut libc::c_int) = i;
-                        return Ok(());
-                    },
-                    SendValue::Unsigned(u) => unsafe {
-                        *((*var).data as *mut libc::c_uint) = u;
-                        return Ok(());
-                    },
-                    SendValue::Vector(ref v) => unsafe {
-                        let elem_size = ((*var).var.dim_v * (*var).var.dim_m) as usize;
-                        let curr_count = (*var).var.dim_a as usize;
-
-                        let len = if curr_count == 1 && elem_size > 1 {
-                            v.len().clamp(elem_size, usize::MAX)
-                        } else {
-                            v.len().clamp(elem_size * 2, usize::MAX)
-                        };
-
-                        if len % elem_size != 0 {
-                            bail!(
-                                "Invalid size for vector {}: expected multiple of {}",
-                                send_cmd.name,
-                                elem_size
-                            );
-                        }
-                        libc::free((*var).data as *mut libc::c_void);
-                        (*var).data =
-                            libc::malloc(len * size_of::<libc::c_float>()) as *mut libc::c_void;
-                        for j in 0..v.len() {
-                            *(((*var).data as *mut libc::c_float).offset(j as isize)) =
-                                v[j as usize];
-                        }
-                        for _ in v.len()..len {
-                            *(((*var).data as *mut libc::c_float).offset(v.len() as isize)) = 0.0;
-                        }
-                        (*var).var.dim_a = (len / elem_size) as i32;
-                        return Ok(());
-                    },
-                    SendValue::IVector(ref v) => unsafe {
-                        let elem_size = ((*var).var.dim_v * (*var).var.dim_m) as usize;
-                        let curr_count = (*var).var.dim_a as usize;
-
-                        let len = if curr_count == 1 && elem_size > 1 {
-                            v.len().clamp(elem_size, usize::MAX)
-                        } else {
-                            v.len().clamp(elem_size * 2, usize::MAX)
-                        };
-
-                        if len % elem_size != 0 {
-                            bail!(
-                                "Invalid size for vector {}: expected multiple of {}",
-                                send_cmd.name,
-                                elem_size
-                            );
-                        }
-                        libc::free((*var).data as *mut libc::c_void);
-                        (*var).data =
-                            libc::malloc(len * size_of::<libc::c_int>()) as *mut libc::c_void;
-                        for j in 0..v.len() {
-                            *(((*var).data as *mut libc::c_int).offset(j as isize)) = v[j as usize];
-                        }
-                        for _ in v.len()..len {
-                            *(((*var).data as *mut libc::c_int).offset(v.len() as isize)) = 0;
-                        }
-                        (*var).var.dim_a = (len / elem_size) as i32;
-                        return Ok(());
-                    },
-                    SendValue::UVector(ref v) => unsafe {
-                        let elem_size = ((*var).var.dim_v * (*var).var.dim_m) as usize;
-                        let curr_count = (*var).var.dim_a as usize;
-                        let len = if curr_count == 1 && elem_size > 1 {
-                            v.len().clamp(elem_size * 2, usize::MAX)
-                        } else {
-                            v.len().clamp(elem_size, usize::MAX)
-                        };
-                        if len % elem_size != 0 {
-                            bail!(
-                                "Invalid size for vector {}: expected multiple of {}",
-                                send_cmd.name,
-                                elem_size
-                            );
-                        }
-                        libc::free((*var).data as *mut libc::c_void);
-                        (*var).data =
-                            libc::malloc(len * size_of::<libc::c_uint>()) as *mut libc::c_void;
-                        for j in 0..v.len() {
-                            *(((*var).data as *mut libc::c_uint).offset(j as isize)) =
-                                v[j as usize];
-                        }
-                        for _ in v.len()..len {
-                            *(((*var).data as *mut libc::c_uint).offset(v.len() as isize)) = 0;
-                        }
-                        (*var).var.dim_a = (len / elem_size) as i32;
-                        return Ok(());
-                    },
-                }
+        let name = send_cmd.name.as_str();
+        let bits = match send_cmd.value {
+            SendValue::Float(f) => Some(f.to_bits()),
+            SendValue::Integer(i) => Some(i as u32),
+            SendValue::Unsigned(u) => Some(u),
+            _ => None,
+        };
+        if let Some(bits) = bits {
+            self.note_const_value(ctx, name, bits);
+        }
+        unsafe {
+            match send_cmd.value {
+                SendValue::Float(f) => set_scalar(ctx, name, f),
+                SendValue::Integer(i) => set_scalar(ctx, name, i),
+                SendValue::Unsigned(u) => set_scalar(ctx, name, u),
+                SendValue::Vector(ref v) => set_array(ctx, name, v)?,
+                SendValue::IVector(ref v) => set_array(ctx, name, v)?,
+                SendValue::UVector(ref v) => set_array(ctx, name, v)?,
             }
         }
         Ok(())
     }
 
+    // Count the values a //!CONST is set to, and warn once it has taken more
+    // than makes sense for something compiled in
+    fn note_const_value(&self, ctx: *mut gfx_lowlevel_mix_ctx, name: &str, bits: u32) {
+        let slot = unsafe { gfx_lowlevel_mix_ctx_find_var(ctx, name.as_ptr() as _, name.len()) };
+        if slot < 0 || slot < unsafe { (*ctx).num_vars - (*ctx).num_consts } {
+            return;
+        }
+        let mut const_values = self.const_values.borrow_mut();
+        if !const_values.contains_key(name) {
+            const_values.insert(name.to_string(), HashSet::new());
+        }
+        let Some(values) = const_values.get_mut(name) else {
+            return;
+        };
+        if values.len() > CONST_VARIANTS_WARN || !values.insert(bits) {
+            return;
+        }
+        if values.len() > CONST_VARIANTS_WARN {
+            eprintln!(
+                "{}: //!CONST {} has taken {} values, each one compiles another shader. Make it a //!VAR if it follows a continuous control.",
+                self.info.name,
+                name,
+                values.len()
+            );
+        }
+    }
+
     pub fn reset_mix_dispatch(&self, lowlevel_ctx: *mut gfx_lowlevel_gpu_ctx) -> Result<()> {
         let mix = self.stream.borrow();
         if mix.mix_ctx.is_some() {
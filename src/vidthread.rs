@@ -0,0 +1,726 @@
+use crate::{
+    framering::FrameRing,
+    gfxinfo::{DecodeThreading, VidInfo},
+    imgseq::SequenceProducer,
+    seekindex::SeekIndex,
+    vidruntime::{get_codec_context, get_hw_format},
+};
+use anyhow::{bail, Result};
+use ffmpeg_next::{
+    codec::packet::Packet, decoder, format::context::Input, format::input_with_decoder_format,
+    frame::Video, media::Type, Rational,
+};
+use std::{
+    collections::VecDeque,
+    sync::{
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        mpsc::{channel, sync_channel, Receiver, Sender},
+        Arc, Mutex,
+    },
+    thread::{self, JoinHandle, Thread},
+    time::Duration,
+};
+
+extern crate ffmpeg_next as ffmpeg;
+
+pub const DEFAULT_DECODE_AHEAD: usize = 4;
+
+// How long an idle producer sleeps before checking for commands again
+pub(crate) const IDLE_PARK: Duration = Duration::from_millis(5);
+
+// Opened inputs kept for reuse after their video is reset or reloaded, sets
+// tend to come back to the same few dozen clips
+const INPUT_POOL_SIZE: usize = 32;
+
+pub enum DecodeItem {
+    Frame(Video),
+    Eof,
+    Error(String),
+}
+
+pub enum DecodeCmd {
+    /// Seek to `ts` and skip anything decoded before `min_pts`
+    Seek { ts: i64, min_pts: i64 },
+}
+
+/// A decoded item tagged with the seek generation it was produced for, so the
+/// consumer can drop anything decoded before the latest seek
+pub struct Decoded {
+    pub generation: u64,
+    pub item: DecodeItem,
+}
+
+/// Stream parameters worked out by the producer when it opens the input
+#[derive(Clone, Copy)]
+pub struct StreamParams {
+    pub video_stream_index: usize,
+    pub fps: Rational,
+}
+
+/// Demuxes and decodes one video on its own thread, ahead of the render
+/// thread, into a bounded ring
+pub struct DecodeThread {
+    ring: Arc<FrameRing<Decoded>>,
+    cmds: Sender<(u64, DecodeCmd)>,
+    stop: Arc<AtomicBool>,
+    handle: Option<JoinHandle<()>>,
+    consumer: Arc<Mutex<Thread>>,
+    generation: u64,
+    cores: CoreShare,
+    pub params: StreamParams,
+}
+
+// Decoding decks running and the threads they hold between them
+static DECKS: AtomicUsize = AtomicUsize::new(0);
+static CORES_IN_USE: AtomicUsize = AtomicUsize::new(0);
+// Software decoded videos loaded, whether or not they decode yet
+static LOADED_DECKS: AtomicUsize = AtomicUsize::new(0);
+
+/// Held by every loaded video that will take a share of the cores, so the
+/// first deck to start decoding already knows how many will follow
+#[derive(Debug)]
+pub(crate) struct LoadedDeck {
+    counted: bool,
+}
+
+impl LoadedDeck {
+    pub(crate) fn new(info: &VidInfo) -> Self {
+        let counted = !info.hardware_decode && info.image_sequence_fps == 0;
+        if counted {
+            LOADED_DECKS.fetch_add(1, Ordering::AcqRel);
+        }
+        Self { counted }
+    }
+}
+
+impl Drop for LoadedDeck {
+    fn drop(&mut self) {
+        if self.counted {
+            LOADED_DECKS.fetch_sub(1, Ordering::AcqRel);
+        }
+    }
+}
+
+/// The decode and conversion threads one deck was given. Automatic counts
+/// are an even share of the cores between the decks loaded or running, and
+/// never more than what other decks left over, so several decks don't
+/// oversubscribe.
+pub(crate) struct CoreShare {
+    threads: usize,
+    counted: bool,
+}
+
+impl CoreShare {
+    fn acquire(info: &VidInfo) -> Self {
+        // hardware decoders don't want CPU threads and sequences have a pool
+        if info.hardware_decode || info.image_sequence_fps > 0 {
+            return Self {
+                threads: 1,
+                counted: false,
+            };
+        }
+        let cores = thread::available_parallelism().map_or(1, |n| n.get());
+        let decks =
+            (DECKS.fetch_add(1, Ordering::AcqRel) + 1).max(LOADED_DECKS.load(Ordering::Acquire));
+        let threads = if info.decode_threads > 0 {
+            (info.decode_threads as usize).min(cores)
+        } else {
+            let left = cores.saturating_sub(CORES_IN_USE.load(Ordering::Acquire));
+            (cores / decks).min(left).max(1)
+        };
+        CORES_IN_USE.fetch_add(threads, Ordering::AcqRel);
+        Self {
+            threads,
+            counted: true,
+        }
+    }
+}
+
+impl Drop for CoreShare {
+    fn drop(&mut self) {
+        if self.counted {
+            DECKS.fetch_sub(1, Ordering::AcqRel);
+            CORES_IN_USE.fetch_sub(self.threads, Ordering::AcqRel);
+        }
+    }
+}
+
+impl DecodeThread {
+    pub fn spawn(info: &VidInfo, ring_size: usize, index: Arc<SeekIndex>) -> Result<DecodeThread> {
+        let ring_size = if ring_size == 0 {
+            DEFAULT_DECODE_AHEAD
+        } else {
+            ring_size
+        };
+        let ring = Arc::new(FrameRing::new(ring_size));
+        let stop = Arc::new(AtomicBool::new(false));
+        let (cmd_tx, cmd_rx) = channel();
+        let (init_tx, init_rx) = sync_channel(1);
+        let consumer = Arc::new(Mutex::new(thread::current()));
+        let cores = CoreShare::acquire(info);
+        let threads = cores.threads;
+
+        if info.image_sequence_fps > 0 {
+            let producer =
+                SequenceProducer::new(info, ring.clone(), stop.clone(), cmd_rx, consumer.clone())?;
+            let handle = thread::Builder::new()
+                .name(format!("sequence-{}", info.name))
+                .spawn(move || producer.run())?;
+            return Ok(DecodeThread {
+                ring,
+                cmds: cmd_tx,
+                stop,
+                handle: Some(handle),
+                consumer,
+                generation: 0,
+                cores,
+                params: StreamParams {
+                    video_stream_index: 0,
+                    fps: Rational::new(info.image_sequence_fps as i32, 1),
+                },
+            });
+        }
+
+        let mut producer = Producer {
+            info: info.clone(),
+            ring: ring.clone(),
+            stop: stop.clone(),
+            cmds: cmd_rx,
+            consumer: consumer.clone(),
+            generation: 0,
+            index,
+            last_pts: None,
+            preroll: None,
+            held: None,
+            failed: false,
+        };
+        let handle = thread::Builder::new()
+            .name(format!("decode-{}", info.name))
+            .spawn(move || {
+                let (ictx, decoder, params) = match open_input(&producer.info, threads) {
+                    Ok(v) => v,
+                    Err(e) => {
+                        init_tx.send(Err(e)).ok();
+                        return;
+                    }
+                };
+                let video_stream_index = params.video_stream_index;
+                if init_tx.send(Ok(params)).is_err() {
+                    return_input(&producer.info, threads, ictx, decoder, params);
+                    return;
+                }
+                if let Some((ictx, decoder)) = producer.run(ictx, decoder, video_stream_index) {
+                    return_input(&producer.info, threads, ictx, decoder, params);
+                }
+            })?;
+
+        let params = match init_rx.recv() {
+            Ok(Ok(params)) => params,
+            Ok(Err(e)) => {
+                handle.join().ok();
+                return Err(e);
+            }
+            Err(_) => {
+                handle.join().ok();
+                bail!("Decode thread for {} exited during startup", info.name);
+            }
+        };
+
+        Ok(DecodeThread {
+            ring,
+            cmds: cmd_tx,
+            stop,
+            handle: Some(handle),
+            consumer,
+            generation: 0,
+            cores,
+            params,
+        })
+    }
+
+    /// Threads this deck may use, for converting its frames as well
+    pub fn threads(&self) -> usize {
+        self.cores.threads
+    }
+
+    fn wake(&self) {
+        if let Some(handle) = self.handle.as_ref() {
+            handle.thread().unpark();
+        }
+    }
+
+    /// Ask the producer to seek, anything already in the ring is stale after this.
+    /// Frames before `min_pts` are decoded on the producer and dropped there so
+    /// the first thing handed out is the one we were after.
+    pub fn seek(&mut self, ts: i64, min_pts: i64) -> Result<()> {
+        self.generation += 1;
+        if self
+            .cmds
+            .send((self.generation, DecodeCmd::Seek { ts, min_pts }))
+            .is_err()
+        {
+            bail!("Decode thread is gone");
+        }
+        self.wake();
+        Ok(())
+    }
+
+    /// Next item for the current generation. With `block` set this waits for the
+    /// producer, otherwise it returns None when nothing is ready yet.
+    pub fn next(&self, block: bool) -> Option<DecodeItem> {
+        loop {
+            match self.ring.pop() {
+                Some(decoded) => {
+                    self.wake();
+                    if decoded.generation == self.generation {
+                        return Some(decoded.item);
+                    }
+                }
+                None => {
+                    if !block {
+                        return None;
+                    }
+                    if self.handle.as_ref().map_or(true, |h| h.is_finished()) {
+                        return Some(DecodeItem::Error(String::from("Decode thread exited")));
+                    }
+                    // whoever waits gets woken, the input may be warmed up on
+                    // another thread than the one that renders it
+                    if let Ok(mut consumer) = self.consumer.lock() {
+                        if consumer.id() != thread::current().id() {
+                            *consumer = thread::current();
+                        }
+                    }
+                    self.wake();
+                    thread::park_timeout(IDLE_PARK);
+                }
+            }
+        }
+    }
+
+    /// next for live inputs. Frames with a newer one already behind them in
+    /// the ring are dropped, so a consumer that fell behind shows what the
+    /// source has now instead of working through stale frames in order.
+    pub fn next_latest(&self, block: bool) -> Option<DecodeItem> {
+        let mut item = self.next(block)?;
+        while let DecodeItem::Frame(_) = item {
+            match self.next(false) {
+                Some(newer) => item = newer,
+                None => break,
+            }
+        }
+        Some(item)
+    }
+
+    pub fn buffered(&self) -> usize {
+        self.ring.len()
+    }
+}
+
+impl Drop for DecodeThread {
+    fn drop(&mut self) {
+        self.stop.store(true, Ordering::Release);
+        if let Some(handle) = self.handle.take() {
+            handle.thread().unpark();
+            handle.join().ok();
+        }
+    }
+}
+
+struct HwDevice(*mut ffmpeg_next::ffi::AVBufferRef);
+unsafe impl Send for HwDevice {}
+
+static HW_DEVICE: Mutex<HwDevice> = Mutex::new(HwDevice(std::ptr::null_mut()));
+
+/// A new reference to the VideoToolbox device every hardware decoder shares,
+/// created on first use and kept for the life of the process
+fn shared_hw_device() -> Result<*mut ffmpeg_next::ffi::AVBufferRef> {
+    let Ok(mut device) = HW_DEVICE.lock() else {
+        bail!("Hardware device lock poisoned");
+    };
+    unsafe {
+        if device.0.is_null()
+            && ffmpeg_next::ffi::av_hwdevice_ctx_create(
+                &mut device.0 as *mut *mut ffmpeg_next::ffi::AVBufferRef,
+                ffmpeg_next::ffi::AVHWDeviceType::AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
+                std::ptr::null_mut(),
+                std::ptr::null_mut(),
+                0,
+            ) < 0
+        {
+            device.0 = std::ptr::null_mut();
+            bail!("Could not create hwdevice context")
+        }
+        let device_ref = ffmpeg_next::ffi::av_buffer_ref(device.0);
+        if device_ref.is_null() {
+            bail!("Could not reference hwdevice context")
+        }
+        Ok(device_ref)
+    }
+}
+
+// Everything about a VidInfo that changes how its input and decoder are
+// opened, with the thread count the decoder was actually opened with
+#[derive(PartialEq, Eq)]
+struct InputKey {
+    path: String,
+    codec: Option<String>,
+    format: Option<String>,
+    opts: Option<Vec<(String, String)>>,
+    hardware_decode: bool,
+    decode_threading: DecodeThreading,
+    threads: usize,
+}
+
+impl InputKey {
+    fn new(info: &VidInfo, threads: usize) -> Self {
+        Self {
+            path: info.path.clone(),
+            codec: info.codec.clone(),
+            format: info.format.clone(),
+            opts: info.opts.clone(),
+            hardware_decode: info.hardware_decode,
+            decode_threading: info.decode_threading,
+            threads,
+        }
+    }
+}
+
+struct PooledInput {
+    key: InputKey,
+    ictx: Input,
+    decoder: decoder::Video,
+    params: StreamParams,
+}
+
+static INPUT_POOL: Mutex<VecDeque<PooledInput>> = Mutex::new(VecDeque::new());
+
+/// Hand an input back for the next open of the same video with as many
+/// threads. Realtime inputs can't be rewound and are just closed.
+pub(crate) fn return_input(
+    info: &VidInfo,
+    threads: usize,
+    ictx: Input,
+    mut decoder: decoder::Video,
+    params: StreamParams,
+) {
+    if info.realtime {
+        return;
+    }
+    // let go of buffered frames and the surfaces they hold
+    decoder.flush();
+    let Ok(mut pool) = INPUT_POOL.lock() else {
+        return;
+    };
+    if pool.len() >= INPUT_POOL_SIZE {
+        pool.pop_front();
+    }
+    pool.push_back(PooledInput {
+        key: InputKey::new(info, threads),
+        ictx,
+        decoder,
+        params,
+    });
+}
+
+fn take_pooled_input(
+    info: &VidInfo,
+    threads: usize,
+) -> Option<(Input, decoder::Video, StreamParams)> {
+    if info.realtime {
+        return None;
+    }
+    let key = InputKey::new(info, threads);
+    let mut pooled = {
+        let mut pool = INPUT_POOL.lock().ok()?;
+        let pos = pool.iter().rposition(|p| p.key == key)?;
+        pool.remove(pos)?
+    };
+    // the last user left it anywhere, start over from the top
+    if let Err(e) = pooled.ictx.seek(0, ..) {
+        eprintln!("Could not rewind pooled input {}: {}", info.path, e);
+        return None;
+    }
+    pooled.decoder.flush();
+    Some((pooled.ictx, pooled.decoder, pooled.params))
+}
+
+/// Open the input and its decoder the way every decode thread wants them,
+/// reusing one a reset or reload handed back if there is one
+pub(crate) fn open_input(
+    info: &VidInfo,
+    threads: usize,
+) -> Result<(Input, decoder::Video, StreamParams)> {
+    if let Some(pooled) = take_pooled_input(info, threads) {
+        return Ok(pooled);
+    }
+    let path = info.path.clone();
+    let decoder_name = info.codec.as_ref().map(|s| s.as_str());
+    let format_name = info.format.as_ref().map(|s| s.as_str());
+    let ictx = match input_with_decoder_format(
+        &path,
+        decoder_name,
+        format_name,
+        info.opts.as_ref().map(|v| v.as_slice()),
+    ) {
+        Ok(ictx) => ictx,
+        Err(e) => bail!(
+            "Could not preload {} with decoder {:?} and fmt {:?}: {}",
+            path,
+            decoder_name,
+            format_name,
+            e
+        ),
+    };
+
+    let input = ictx
+        .streams()
+        .best(Type::Video)
+        .ok_or(ffmpeg::Error::StreamNotFound)?;
+
+    let video_stream_index = input.index();
+
+    let mut context_decoder = get_codec_context(decoder_name, input.parameters())?;
+    if !info.hardware_decode && threads > 1 {
+        let thread_type = match info.decode_threading {
+            // frame threading holds frames back, a live input can't afford that
+            DecodeThreading::Auto if info.realtime => ffmpeg::ffi::FF_THREAD_SLICE,
+            // ffmpeg takes frames when the codec has them and slices otherwise
+            DecodeThreading::Auto => ffmpeg::ffi::FF_THREAD_FRAME | ffmpeg::ffi::FF_THREAD_SLICE,
+            DecodeThreading::Frame => ffmpeg::ffi::FF_THREAD_FRAME,
+            DecodeThreading::Slice => ffmpeg::ffi::FF_THREAD_SLICE,
+        };
+        unsafe {
+            (*context_decoder.as_mut_ptr()).thread_count = threads as i32;
+            (*context_decoder.as_mut_ptr()).thread_type = thread_type as i32;
+        }
+    }
+    if info.hardware_decode {
+        let hw_device_ctx = shared_hw_device()?;
+        unsafe {
+            // the codec context owns this reference and unrefs it when closed
+            (*context_decoder.as_mut_ptr()).hw_device_ctx = hw_device_ctx;
+            (*context_decoder.as_mut_ptr()).get_format = Some(get_hw_format);
+        }
+    }
+    let decoder = context_decoder.decoder().video()?;
+
+    let Some(stream) = ictx.stream(video_stream_index) else {
+        bail!("Could not find video stream");
+    };
+
+    let fps = if stream.rate() > Rational::new(0, 1) {
+        stream.rate()
+    } else if stream.avg_frame_rate() > Rational::new(0, 1) {
+        stream.avg_frame_rate()
+    } else {
+        bail!("Unable to get fps for {} {}", info.name, info.path)
+    };
+
+    Ok((
+        ictx,
+        decoder,
+        StreamParams {
+            video_stream_index,
+            fps,
+        },
+    ))
+}
+
+struct Producer {
+    info: VidInfo,
+    ring: Arc<FrameRing<Decoded>>,
+    stop: Arc<AtomicBool>,
+    cmds: Receiver<(u64, DecodeCmd)>,
+    consumer: Arc<Mutex<Thread>>,
+    generation: u64,
+    index: Arc<SeekIndex>,
+    // pts of the newest frame out of the decoder since the last flush
+    last_pts: Option<i64>,
+    // frames before this are not pushed after a seek
+    preroll: Option<i64>,
+    // the last frame skipped during preroll, shown if we never reach the target
+    held: Option<Video>,
+    // an error was pushed, the input isn't worth pooling
+    failed: bool,
+}
+
+impl Producer {
+    fn same_gop(&self, ts: i64, min_pts: i64) -> bool {
+        let Some(last_pts) = self.last_pts else {
+            return false;
+        };
+        if last_pts >= min_pts {
+            return false;
+        }
+        match (
+            self.index.keyframe_before(last_pts),
+            self.index.keyframe_before(ts),
+        ) {
+            (Some(current), Some(target)) => current == target,
+            _ => false,
+        }
+    }
+
+    fn push(&mut self, item: DecodeItem) {
+        if let DecodeItem::Error(_) = item {
+            self.failed = true;
+        }
+        let mut decoded = Decoded {
+            generation: self.generation,
+            item,
+        };
+        while !self.stop.load(Ordering::Acquire) {
+            match self.ring.push(decoded) {
+                Ok(()) => {
+                    // never hold up decoding for the wake up, the consumer
+                    // wakes on its own after IDLE_PARK anyway
+                    if let Ok(consumer) = self.consumer.try_lock() {
+                        consumer.unpark();
+                    }
+                    return;
+                }
+                Err(d) => decoded = d,
+            }
+            thread::park_timeout(IDLE_PARK);
+        }
+    }
+
+    /// Decode until stopped, then give the input back unless it failed
+    fn run(
+        &mut self,
+        mut ictx: Input,
+        mut decoder: decoder::Video,
+        video_stream_index: usize,
+    ) -> Option<(Input, decoder::Video)> {
+        let duration: Rational = self.info.duration_tbu_q.into();
+        let mut done = false;
+        let mut error_counter = 0;
+        while !self.stop.load(Ordering::Acquire) {
+            while let Ok((generation, cmd)) = self.cmds.try_recv() {
+                match cmd {
+                    DecodeCmd::Seek { ts, min_pts } => {
+                        self.generation = generation;
+                        let was_done = done;
+                        done = false;
+                        error_counter = 0;
+                        self.preroll = Some(min_pts);
+                        self.held = None;
+                        // still short of the target in the same GOP, decoding on
+                        // gets there sooner than going back to the key frame
+                        if !was_done && self.same_gop(ts, min_pts) {
+                            continue;
+                        }
+                        self.last_pts = None;
+                        if let Err(e) = ictx.seek_stream(video_stream_index as i32, ts, 0..ts) {
+                            done = true;
+                            self.push(DecodeItem::Error(format!(
+                                "Error seeking {}:{}: {e}",
+                                file!(),
+                                line!()
+                            )));
+                        }
+                        decoder.flush();
+                    }
+                }
+            }
+
+            if done || self.ring.is_full() {
+                thread::park_timeout(IDLE_PARK);
+                continue;
+            }
+
+            let mut next_decoded = Video::empty();
+            match decoder.receive_frame(&mut next_decoded) {
+                Ok(()) => {
+                    error_counter = 0;
+                    let pts = next_decoded.pts();
+                    if pts.is_some() {
+                        self.last_pts = pts;
+                    }
+                    if let (Some(min_pts), Some(pts)) = (self.preroll, pts) {
+                        if pts < min_pts {
+                            self.held = Some(next_decoded);
+                            continue;
+                        }
+                    }
+                    self.preroll = None;
+                    self.held = None;
+                    self.push(DecodeItem::Frame(next_decoded));
+                    continue;
+                }
+                Err(ffmpeg_next::Error::Other {
+                    errno: ffmpeg_next::ffi::EAGAIN,
+                }) => (), //needs more input
+                Err(ffmpeg_next::Error::Eof) => {
+                    // drained after end of file, rewind if we can
+                    if !self.info.repeat || duration <= Rational::new(0, 1) {
+                        done = true;
+                        self.preroll = None;
+                        if let Some(held) = self.held.take() {
+                            self.push(DecodeItem::Frame(held));
+                        }
+                        self.push(DecodeItem::Eof);
+                        continue;
+                    }
+                    // the target was past the last frame, show from the top
+                    self.preroll = None;
+                    self.held = None;
+                    self.last_pts = None;
+                    if let Err(e) = ictx.seek(0, ..) {
+                        done = true;
+                        self.push(DecodeItem::Error(format!(
+                            "error seeking {}:{}: {e}",
+                            file!(),
+                            line!()
+                        )));
+                        continue;
+                    }
+                    decoder.flush();
+                    continue;
+                }
+                Err(e) => {
+                    eprintln!("Error receiving frame {}:{}: {}", file!(), line!(), e);
+                    error_counter += 1;
+                    if error_counter > 2 {
+                        done = true;
+                        self.push(DecodeItem::Error(e.to_string()));
+                        continue;
+                    }
+                }
+            }
+
+            let mut packet = Packet::empty();
+            match packet.read(&mut ictx) {
+                Ok(()) => {
+                    if packet.stream() != video_stream_index {
+                        continue;
+                    }
+                    if let Err(e) = decoder.send_packet(&packet) {
+                        done = true;
+                        self.push(DecodeItem::Error(format!(
+                            "error sending packet {}:{}: {e}",
+                            file!(),
+                            line!()
+                        )));
+                    }
+                }
+                Err(ffmpeg_next::Error::Eof) => {
+                    // let the decoder hand out what it has buffered
+                    decoder.send_eof().ok();
+                }
+                Err(e) => {
+                    done = true;
+                    self.push(DecodeItem::Error(format!(
+                        "error reading packet {}:{}: {e}",
+                        file!(),
+                        line!()
+                    )));
+                }
+            }
+        }
+        if self.failed {
+            return None;
+        }
+        Some((ictx, decoder))
+    }
+}
@@ -0,0 +1,739 @@
+use std::collections::HashMap;
+
+use anyhow::{bail, Result};
+
+use crate::{
+    gfxinfo::{
+        AssetEvent, AssetState, FrameEvent, GfxEvent, GpuMemoryEvent, KeyCode, KeyEvent, LogEvent,
+        MidiEvent, StorageEvent,
+    },
+    renderspec::{
+        CopyEx, HudText, Mix, MixInput, RenderSpec, Reset, SeekVid, SendCmd, SendMidi, SendValue,
+    },
+};
+
+/// Binary transport for the per frame traffic between the host and the wasm
+/// guest, replacing the JSON round trip for `GfxEvent`s and `RenderSpec`s.
+///
+/// Everything is little endian. A buffer is a version byte, the sender's u32
+/// epoch, a u32 record count and the records. Mix, video and uniform names
+/// are interned: the first time a name crosses it is written inline with
+/// `NEW_NAME` set on its id, after that only the id is sent. Both ends keep
+/// their table until the sender resets, which starts a new epoch, so a steady
+/// state frame carries no strings besides HUD text and log messages.
+///
+/// A buffer that fails to decode leaves the receiver without a table until
+/// the next epoch. The host resets its encoder whenever an exchange with the
+/// guest fails, and the guest resets its own when it sees the host's epoch
+/// change, so both directions start over together. A reload gets a fresh
+/// instance and fresh tables on both ends.
+pub const WIRE_VERSION: u8 = 2;
+
+const NEW_NAME: u32 = 0x8000_0000;
+
+const SPEC_NONE: u8 = 0;
+const SPEC_SEND_CMD: u8 = 1;
+const SPEC_HUD_TEXT: u8 = 2;
+const SPEC_MIX: u8 = 3;
+const SPEC_SEEK_VID: u8 = 4;
+const SPEC_RESET: u8 = 5;
+const SPEC_SEND_MIDI: u8 = 6;
+
+const VALUE_FLOAT: u8 = 0;
+const VALUE_INTEGER: u8 = 1;
+const VALUE_UNSIGNED: u8 = 2;
+const VALUE_VECTOR: u8 = 3;
+const VALUE_IVECTOR: u8 = 4;
+const VALUE_UVECTOR: u8 = 5;
+
+const INPUT_VIDEO: u8 = 0;
+const INPUT_MIXED: u8 = 1;
+
+const EVENT_KEY: u8 = 0;
+const EVENT_MIDI: u8 = 1;
+const EVENT_FRAME: u8 = 2;
+const EVENT_RELOAD: u8 = 3;
+const EVENT_LOG: u8 = 4;
+const EVENT_ASSET: u8 = 5;
+const EVENT_STORAGE: u8 = 6;
+const EVENT_GPU_MEMORY: u8 = 7;
+
+const KEY_SHIFT: u8 = 1;
+const KEY_ALT: u8 = 2;
+const KEY_CTL: u8 = 4;
+const KEY_DOWN: u8 = 8;
+const KEY_REPEAT: u8 = 16;
+
+/// Sending half of a connection, owns the interning table for its direction
+#[derive(Default)]
+pub struct WireEncoder {
+    names: HashMap<String, u32>,
+    epoch: u32,
+}
+
+impl WireEncoder {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Forget every name sent, the next buffer starts a new epoch and sends
+    /// its names inline again
+    pub fn reset(&mut self) {
+        self.names.clear();
+        self.epoch = self.epoch.wrapping_add(1);
+    }
+
+    /// Replaces the contents of `out`, the buffer can be reused every frame
+    pub fn encode_specs(&mut self, specs: &[RenderSpec], out: &mut Vec<u8>) {
+        out.clear();
+        out.push(WIRE_VERSION);
+        put_u32(out, self.epoch);
+        put_u32(out, specs.len() as u32);
+        for spec in specs {
+            self.spec(spec, out);
+        }
+    }
+
+    /// Replaces the contents of `out`, the buffer can be reused every frame
+    pub fn encode_events(&mut self, events: &[GfxEvent], out: &mut Vec<u8>) {
+        out.clear();
+        out.push(WIRE_VERSION);
+        put_u32(out, self.epoch);
+        put_u32(out, events.len() as u32);
+        for event in events {
+            self.event(event, out);
+        }
+    }
+
+    fn name(&mut self, name: &str, out: &mut Vec<u8>) {
+        if let Some(id) = self.names.get(name) {
+            put_u32(out, *id);
+            return;
+        }
+        let id = self.names.len() as u32;
+        self.names.insert(name.to_string(), id);
+        put_u32(out, id | NEW_NAME);
+        put_str(out, name);
+    }
+
+    fn opt_name(&mut self, name: Option<&String>, out: &mut Vec<u8>) {
+        match name {
+            Some(name) => {
+                out.push(1);
+                self.name(name, out);
+            }
+            None => out.push(0),
+        }
+    }
+
+    fn spec(&mut self, spec: &RenderSpec, out: &mut Vec<u8>) {
+        match spec {
+            RenderSpec::None => out.push(SPEC_NONE),
+            RenderSpec::SendCmd(cmd) => {
+                out.push(SPEC_SEND_CMD);
+                self.name(&cmd.mix, out);
+                self.name(&cmd.name, out);
+                put_value(out, &cmd.value);
+            }
+            RenderSpec::HudText(hud) => {
+                out.push(SPEC_HUD_TEXT);
+                put_str(out, &hud.text);
+            }
+            RenderSpec::Mix(mix) => {
+                out.push(SPEC_MIX);
+                self.name(&mix.name, out);
+                put_u32(out, mix.inputs.len() as u32);
+                for input in mix.inputs.iter() {
+                    match input {
+                        MixInput::Video(name) => {
+                            out.push(INPUT_VIDEO);
+                            self.name(name, out);
+                        }
+                        MixInput::Mixed(name) => {
+                            out.push(INPUT_MIXED);
+                            self.name(name, out);
+                        }
+                    }
+                }
+                self.opt_name(mix.seek_target_hint.as_ref(), out);
+                match mix.target.as_ref() {
+                    Some(target) => {
+                        out.push(1);
+                        self.copy_ex(target, out);
+                    }
+                    None => out.push(0),
+                }
+                self.opt_name(mix.lut.as_ref(), out);
+                out.push(mix.no_display as u8);
+            }
+            RenderSpec::SeekVid(seek) => {
+                out.push(SPEC_SEEK_VID);
+                self.name(&seek.target, out);
+                out.extend_from_slice(&seek.sec.to_le_bytes());
+                out.push(seek.exact as u8);
+            }
+            RenderSpec::Reset(reset) => {
+                out.push(SPEC_RESET);
+                self.name(&reset.target, out);
+            }
+            RenderSpec::SendMidi(midi) => {
+                out.push(SPEC_SEND_MIDI);
+                self.midi(&midi.event, out);
+            }
+        }
+    }
+
+    fn copy_ex(&mut self, copy: &CopyEx, out: &mut Vec<u8>) {
+        self.name(&copy.name, out);
+        put_u64(out, copy.idx as u64);
+        for rect in [copy.src, copy.dst] {
+            match rect {
+                Some((x, y, w, h)) => {
+                    out.push(1);
+                    put_i32(out, x);
+                    put_i32(out, y);
+                    put_u32(out, w);
+                    put_u32(out, h);
+                }
+                None => out.push(0),
+            }
+        }
+        match copy.center {
+            Some((x, y)) => {
+                out.push(1);
+                put_i32(out, x);
+                put_i32(out, y);
+            }
+            None => out.push(0),
+        }
+        out.push(copy.flip_h as u8);
+        out.push(copy.flip_v as u8);
+        match copy.color_mod {
+            Some((r, g, b, a)) => out.extend_from_slice(&[1, r, g, b, a]),
+            None => out.push(0),
+        }
+    }
+
+    fn midi(&mut self, midi: &MidiEvent, out: &mut Vec<u8>) {
+        self.name(&midi.device, out);
+        out.extend_from_slice(&[midi.channel, midi.kind, midi.key, midi.velocity]);
+        put_i64(out, midi.timestamp);
+    }
+
+    fn event(&mut self, event: &GfxEvent, out: &mut Vec<u8>) {
+        match event {
+            GfxEvent::KeyEvent(key) => {
+                out.push(EVENT_KEY);
+                put_u32(out, key.key.clone() as u32);
+                let mut flags = 0;
+                for (set, bit) in [
+                    (key.shift, KEY_SHIFT),
+                    (key.alt, KEY_ALT),
+                    (key.ctl, KEY_CTL),
+                    (key.down, KEY_DOWN),
+                    (key.repeat, KEY_REPEAT),
+                ] {
+                    if set {
+                        flags |= bit;
+                    }
+                }
+                out.push(flags);
+                put_i64(out, key.timestamp);
+            }
+            GfxEvent::MidiEvent(midi) => {
+                out.push(EVENT_MIDI);
+                self.midi(midi, out);
+            }
+            GfxEvent::FrameEvent(frame) => {
+                out.push(EVENT_FRAME);
+                self.name(&frame.stream, out);
+                put_i32(out, frame.real_ts.0);
+                put_i32(out, frame.real_ts.1);
+                put_i32(out, frame.continuous_ts.0);
+                put_i32(out, frame.continuous_ts.1);
+            }
+            GfxEvent::ReloadEvent() => out.push(EVENT_RELOAD),
+            GfxEvent::LogEvent(log) => {
+                out.push(EVENT_LOG);
+                put_str(out, &log.message);
+            }
+            GfxEvent::AssetEvent(asset) => {
+                out.push(EVENT_ASSET);
+                self.name(&asset.name, out);
+                match &asset.state {
+                    AssetState::Ready => out.push(0),
+                    AssetState::Failed(msg) => {
+                        out.push(1);
+                        put_str(out, msg);
+                    }
+                }
+            }
+            GfxEvent::StorageEvent(storage) => {
+                out.push(EVENT_STORAGE);
+                self.name(&storage.mixer, out);
+                self.name(&storage.name, out);
+                put_i64(out, storage.frame);
+                put_u32(out, storage.values.len() as u32);
+                for v in &storage.values {
+                    put_u32(out, *v);
+                }
+            }
+            GfxEvent::GpuMemoryEvent(memory) => {
+                out.push(EVENT_GPU_MEMORY);
+                put_u64(out, memory.budget_bytes);
+                put_u64(out, memory.mixer_bytes);
+                put_u64(out, memory.idle_bytes);
+                put_u64(out, memory.video_bytes);
+                put_u32(out, memory.resident_mixers);
+                put_u64(out, memory.evicted_mixers);
+            }
+        }
+    }
+}
+
+/// Receiving half of a connection, mirrors the sender's interning table
+#[derive(Default)]
+pub struct WireDecoder {
+    names: Vec<String>,
+    // None until the first buffer and after one failed to decode
+    epoch: Option<u32>,
+    new_epoch: bool,
+}
+
+impl WireDecoder {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Forget the sender's table, the next buffer's epoch is taken as is
+    pub fn reset(&mut self) {
+        self.names.clear();
+        self.epoch = None;
+    }
+
+    /// Whether a buffer started a new epoch since the last call
+    pub fn take_new_epoch(&mut self) -> bool {
+        std::mem::take(&mut self.new_epoch)
+    }
+
+    /// Appends the decoded specs to `specs`
+    pub fn decode_specs(&mut self, bytes: &[u8], specs: &mut Vec<RenderSpec>) -> Result<()> {
+        let mut r = Reader::new(bytes);
+        let result = self.header(&mut r).and_then(|count| {
+            specs.reserve(count.min(r.remaining()));
+            for _ in 0..count {
+                let spec = self.spec(&mut r)?;
+                specs.push(spec);
+            }
+            r.finish()
+        });
+        if result.is_err() {
+            self.reset();
+        }
+        result
+    }
+
+    /// Appends the decoded events to `events`
+    pub fn decode_events(&mut self, bytes: &[u8], events: &mut Vec<GfxEvent>) -> Result<()> {
+        let mut r = Reader::new(bytes);
+        let result = self.header(&mut r).and_then(|count| {
+            events.reserve(count.min(r.remaining()));
+            for _ in 0..count {
+                let event = self.event(&mut r)?;
+                events.push(event);
+            }
+            r.finish()
+        });
+        if result.is_err() {
+            self.reset();
+        }
+        result
+    }
+
+    // The record count, with the table started over if the sender's epoch
+    // moved on
+    fn header(&mut self, r: &mut Reader) -> Result<usize> {
+        let (epoch, count) = r.header()?;
+        if self.epoch != Some(epoch) {
+            self.names.clear();
+            self.epoch = Some(epoch);
+            self.new_epoch = true;
+        }
+        Ok(count)
+    }
+
+    fn name(&mut self, r: &mut Reader) -> Result<String> {
+        let id = r.u32()?;
+        if id & NEW_NAME != 0 {
+            let id = (id & !NEW_NAME) as usize;
+            if id != self.names.len() {
+                bail!(
+                    "Wire name table out of sync, got id {} expected {}",
+                    id,
+                    self.names.len()
+                );
+            }
+            self.names.push(r.str()?.to_string());
+        }
+        // a copy of the table's, the one allocation a name costs per use
+        match self.names.get((id & !NEW_NAME) as usize) {
+            Some(name) => Ok(name.clone()),
+            None => bail!("Unknown wire name id {}", id),
+        }
+    }
+
+    fn opt_name(&mut self, r: &mut Reader) -> Result<Option<String>> {
+        if r.bool()? {
+            Ok(Some(self.name(r)?))
+        } else {
+            Ok(None)
+        }
+    }
+
+    fn spec(&mut self, r: &mut Reader) -> Result<RenderSpec> {
+        let spec = match r.u8()? {
+            SPEC_NONE => RenderSpec::None,
+            SPEC_SEND_CMD => RenderSpec::SendCmd(SendCmd {
+                mix: self.name(r)?,
+                name: self.name(r)?,
+                value: r.value()?,
+            }),
+            SPEC_HUD_TEXT => RenderSpec::HudText(HudText {
+                text: r.str()?.to_string(),
+            }),
+            SPEC_MIX => {
+                let name = self.name(r)?;
+                let count = r.u32()? as usize;
+                let mut inputs = Vec::with_capacity(count.min(r.remaining()));
+                for _ in 0..count {
+                    inputs.push(match r.u8()? {
+                        INPUT_VIDEO => MixInput::Video(self.name(r)?),
+                        INPUT_MIXED => MixInput::Mixed(self.name(r)?),
+                        kind => bail!("Unknown wire mix input kind {}", kind),
+                    });
+                }
+                let seek_target_hint = self.opt_name(r)?;
+                let target = if r.bool()? {
+                    Some(self.copy_ex(r)?)
+                } else {
+                    None
+                };
+                RenderSpec::Mix(Mix {
+                    name,
+                    inputs,
+                    seek_target_hint,
+                    target,
+                    lut: self.opt_name(r)?,
+                    no_display: r.bool()?,
+                })
+            }
+            SPEC_SEEK_VID => RenderSpec::SeekVid(SeekVid {
+                target: self.name(r)?,
+                sec: r.f64()?,
+                exact: r.bool()?,
+            }),
+            SPEC_RESET => RenderSpec::Reset(Reset {
+                target: self.name(r)?,
+            }),
+            SPEC_SEND_MIDI => RenderSpec::SendMidi(SendMidi {
+                event: self.midi(r)?,
+            }),
+            tag => bail!("Unknown wire spec tag {}", tag),
+        };
+        Ok(spec)
+    }
+
+    fn copy_ex(&mut self, r: &mut Reader) -> Result<CopyEx> {
+        let name = self.name(r)?;
+        let idx = r.u64()? as usize;
+        let mut rects = [None, None];
+        for rect in rects.iter_mut() {
+            if r.bool()? {
+                *rect = Some((r.i32()?, r.i32()?, r.u32()?, r.u32()?));
+            }
+        }
+        let center = if r.bool()? {
+            Some((r.i32()?, r.i32()?))
+        } else {
+            None
+        };
+        let flip_h = r.bool()?;
+        let flip_v = r.bool()?;
+        let color_mod = if r.bool()? {
+            Some((r.u8()?, r.u8()?, r.u8()?, r.u8()?))
+        } else {
+            None
+        };
+        let [src, dst] = rects;
+        Ok(CopyEx {
+            name,
+            idx,
+            src,
+            dst,
+            center,
+            flip_h,
+            flip_v,
+            color_mod,
+        })
+    }
+
+    fn midi(&mut self, r: &mut Reader) -> Result<MidiEvent> {
+        Ok(MidiEvent {
+            device: self.name(r)?,
+            channel: r.u8()?,
+            kind: r.u8()?,
+            key: r.u8()?,
+            velocity: r.u8()?,
+            timestamp: r.i64()?,
+        })
+    }
+
+    fn event(&mut self, r: &mut Reader) -> Result<GfxEvent> {
+        let event = match r.u8()? {
+            EVENT_KEY => {
+                let key = KeyCode::from(r.u32()?);
+                let flags = r.u8()?;
+                GfxEvent::KeyEvent(KeyEvent {
+                    key,
+                    shift: flags & KEY_SHIFT != 0,
+                    alt: flags & KEY_ALT != 0,
+                    ctl: flags & KEY_CTL != 0,
+                    down: flags & KEY_DOWN != 0,
+                    repeat: flags & KEY_REPEAT != 0,
+                    timestamp: r.i64()?,
+                })
+            }
+            EVENT_MIDI => GfxEvent::MidiEvent(self.midi(r)?),
+            EVENT_FRAME => GfxEvent::FrameEvent(FrameEvent {
+                stream: self.name(r)?,
+                real_ts: (r.i32()?, r.i32()?),
+                continuous_ts: (r.i32()?, r.i32()?),
+            }),
+            EVENT_RELOAD => GfxEvent::ReloadEvent(),
+            EVENT_LOG => GfxEvent::LogEvent(LogEvent {
+                message: r.str()?.to_string(),
+            }),
+            EVENT_ASSET => {
+                let name = self.name(r)?;
+                let state = match r.u8()? {
+                    0 => AssetState::Ready,
+                    1 => AssetState::Failed(r.str()?.to_string()),
+                    state => bail!("Unknown wire asset state {}", state),
+                };
+                GfxEvent::AssetEvent(AssetEvent { name, state })
+            }
+            EVENT_STORAGE => {
+                let mixer = self.name(r)?;
+                let name = self.name(r)?;
+                let frame = r.i64()?;
+                let len = r.u32()? as usize;
+                let mut values = Vec::with_capacity(len.min(r.remaining() / 4));
+                for _ in 0..len {
+                    values.push(r.u32()?);
+                }
+                GfxEvent::StorageEvent(StorageEvent {
+                    mixer,
+                    name,
+                    frame,
+                    values,
+                })
+            }
+            EVENT_GPU_MEMORY => GfxEvent::GpuMemoryEvent(GpuMemoryEvent {
+                budget_bytes: r.u64()?,
+                mixer_bytes: r.u64()?,
+                idle_bytes: r.u64()?,
+                video_bytes: r.u64()?,
+                resident_mixers: r.u32()?,
+                evicted_mixers: r.u64()?,
+            }),
+            tag => bail!("Unknown wire event tag {}", tag),
+        };
+        Ok(event)
+    }
+}
+
+fn put_u32(out: &mut Vec<u8>, v: u32) {
+    out.extend_from_slice(&v.to_le_bytes());
+}
+
+fn put_i32(out: &mut Vec<u8>, v: i32) {
+    out.extend_from_slice(&v.to_le_bytes());
+}
+
+fn put_u64(out: &mut Vec<u8>, v: u64) {
+    out.extend_from_slice(&v.to_le_bytes());
+}
+
+fn put_i64(out: &mut Vec<u8>, v: i64) {
+    out.extend_from_slice(&v.to_le_bytes());
+}
+
+fn put_str(out: &mut Vec<u8>, s: &str) {
+    put_u32(out, s.len() as u32);
+    out.extend_from_slice(s.as_bytes());
+}
+
+fn put_value(out: &mut Vec<u8>, value: &SendValue) {
+    match value {
+        SendValue::Float(v) => {
+            out.push(VALUE_FLOAT);
+            out.extend_from_slice(&v.to_le_bytes());
+        }
+        SendValue::Integer(v) => {
+            out.push(VALUE_INTEGER);
+            put_i32(out, *v);
+        }
+        SendValue::Unsigned(v) => {
+            out.push(VALUE_UNSIGNED);
+            put_u32(out, *v);
+        }
+        SendValue::Vector(v) => {
+            out.push(VALUE_VECTOR);
+            put_u32(out, v.len() as u32);
+            v.iter()
+                .for_each(|f| out.extend_from_slice(&f.to_le_bytes()));
+        }
+        SendValue::IVector(v) => {
+            out.push(VALUE_IVECTOR);
+            put_u32(out, v.len() as u32);
+            v.iter().for_each(|i| put_i32(out, *i));
+        }
+        SendValue::UVector(v) => {
+            out.push(VALUE_UVECTOR);
+            put_u32(out, v.len() as u32);
+            v.iter().for_each(|u| put_u32(out, *u));
+        }
+    }
+}
+
+/// Bounds checked cursor over a borrowed buffer, on the host this reads
+/// straight out of the guest's linear memory
+struct Reader<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn new(buf: &'a [u8]) -> Self {
+        Self { buf, pos: 0 }
+    }
+
+    fn remaining(&self) -> usize {
+        self.buf.len() - self.pos
+    }
+
+    fn take(&mut self, len: usize) -> Result<&'a [u8]> {
+        if len > self.remaining() {
+            bail!(
+                "Wire buffer truncated, wanted {} bytes at {} of {}",
+                len,
+                self.pos,
+                self.buf.len()
+            );
+        }
+        let bytes = &self.buf[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(bytes)
+    }
+
+    fn array<const N: usize>(&mut self) -> Result<[u8; N]> {
+        let mut a = [0u8; N];
+        a.copy_from_slice(self.take(N)?);
+        Ok(a)
+    }
+
+    // The sender's epoch and the record count
+    fn header(&mut self) -> Result<(u32, usize)> {
+        let version = self.u8()?;
+        if version != WIRE_VERSION {
+            bail!(
+                "Wire version mismatch, got {} expected {}",
+                version,
+                WIRE_VERSION
+            );
+        }
+        let epoch = self.u32()?;
+        Ok((epoch, self.u32()? as usize))
+    }
+
+    fn finish(&self) -> Result<()> {
+        if self.remaining() != 0 {
+            bail!("{} trailing bytes in wire buffer", self.remaining());
+        }
+        Ok(())
+    }
+
+    fn u8(&mut self) -> Result<u8> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn bool(&mut self) -> Result<bool> {
+        Ok(self.u8()? != 0)
+    }
+
+    fn u32(&mut self) -> Result<u32> {
+        Ok(u32::from_le_bytes(self.array()?))
+    }
+
+    fn i32(&mut self) -> Result<i32> {
+        Ok(i32::from_le_bytes(self.array()?))
+    }
+
+    fn u64(&mut self) -> Result<u64> {
+        Ok(u64::from_le_bytes(self.array()?))
+    }
+
+    fn i64(&mut self) -> Result<i64> {
+        Ok(i64::from_le_bytes(self.array()?))
+    }
+
+    fn f32(&mut self) -> Result<f32> {
+        Ok(f32::from_le_bytes(self.array()?))
+    }
+
+    fn f64(&mut self) -> Result<f64> {
+        Ok(f64::from_le_bytes(self.array()?))
+    }
+
+    fn str(&mut self) -> Result<&'a str> {
+        let len = self.u32()? as usize;
+        match std::str::from_utf8(self.take(len)?) {
+            Ok(s) => Ok(s),
+            Err(e) => bail!("Bad utf8 in wire string: {}", e),
+        }
+    }
+
+    fn value(&mut self) -> Result<SendValue> {
+        let value = match self.u8()? {
+            VALUE_FLOAT => SendValue::Float(self.f32()?),
+            VALUE_INTEGER => SendValue::Integer(self.i32()?),
+            VALUE_UNSIGNED => SendValue::Unsigned(self.u32()?),
+            VALUE_VECTOR => {
+                let len = self.u32()? as usize;
+                let mut v = Vec::with_capacity(len.min(self.remaining() / 4));
+                for _ in 0..len {
+                    v.push(self.f32()?);
+                }
+                SendValue::Vector(v)
+            }
+            VALUE_IVECTOR => {
+                let len = self.u32()? as usize;
+                let mut v = Vec::with_capacity(len.min(self.remaining() / 4));
+                for _ in 0..len {
+                    v.push(self.i32()?);
+                }
+                SendValue::IVector(v)
+            }
+            VALUE_UVECTOR => {
+                let len = self.u32()? as usize;
+                let mut v = Vec::with_capacity(len.min(self.remaining() / 4));
+                for _ in 0..len {
+                    v.push(self.u32()?);
+                }
+                SendValue::UVector(v)
+            }
+            tag => bail!("Unknown wire value tag {}", tag),
+        };
+        Ok(value)
+    }
+}